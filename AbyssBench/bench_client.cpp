@@ -0,0 +1,145 @@
+#include "bench_client.hpp"
+#include <cstring>
+
+namespace AbyssBench {
+
+	/// <summary>
+	/// The same values with TcpCommandType of TcpInstance.
+	/// </summary>
+	constexpr const uint8_t FRAME_DATA = 0u;
+	constexpr const uint8_t FRAME_CONNECT = 1u;
+	/// <summary>
+	/// Frames from proxy carry GNS messages, which can be much longer than what TcpInstance accept.
+	/// Use the GNS message limit (512 KB) plus flags. Frames longer than it mean the stream is broken.
+	/// </summary>
+	constexpr const uint32_t MAX_FRAME_BODY = 512u * 1024u + 2u;
+
+	BenchClient::BenchClient(asio::io_context& ctx, size_t id, DataHandler_t handler) :
+		mId(id), mHandler(std::move(handler)),
+		mSocket(ctx), mStrand(asio::make_strand(ctx)),
+		mWriteQueue(), mIsWriting(false), mIsClosing(false), mReadSize(0u), mReadBuffer(),
+		mIsConnected(false), mIsFailed(false), mPendingWrites(0u)
+	{}
+
+	BenchClient::~BenchClient() {}
+
+	void BenchClient::Start(const asio::ip::tcp::endpoint& proxy, const std::string& url) {
+		// connect command: flag + url size + url
+		std::string frame;
+		uint32_t body_size = static_cast<uint32_t>(sizeof(uint8_t) + sizeof(uint32_t) + url.size());
+		uint32_t url_size = static_cast<uint32_t>(url.size());
+		frame.append(reinterpret_cast<const char*>(&body_size), sizeof(uint32_t));
+		frame.push_back(static_cast<char>(FRAME_CONNECT));
+		frame.append(reinterpret_cast<const char*>(&url_size), sizeof(uint32_t));
+		frame.append(url);
+
+		auto self = shared_from_this();
+		mSocket.async_connect(proxy, asio::bind_executor(mStrand, [self, frame = std::move(frame)](const asio::error_code& ec) mutable -> void {
+			if (ec) {
+				self->Fail();
+				return;
+			}
+			asio::error_code opt_ec;
+			self->mSocket.set_option(asio::ip::tcp::no_delay(true), opt_ec);
+			self->mIsConnected.store(true);
+
+			// connect command must be the first frame
+			self->mWriteQueue.emplace_front(std::move(frame));
+			self->mPendingWrites.fetch_add(1u, std::memory_order_relaxed);
+			self->WriteNext();
+			self->ReadHeader();
+		}));
+	}
+
+	void BenchClient::SendData(const void* payload, uint32_t len, bool is_reliable) {
+		std::string frame;
+		uint32_t body_size = static_cast<uint32_t>(sizeof(uint8_t) + sizeof(uint8_t) + len);
+		frame.reserve(sizeof(uint32_t) + body_size);
+		frame.append(reinterpret_cast<const char*>(&body_size), sizeof(uint32_t));
+		frame.push_back(static_cast<char>(FRAME_DATA));
+		frame.push_back(static_cast<char>(is_reliable ? 1u : 0u));
+		frame.append(static_cast<const char*>(payload), len);
+		QueueFrame(std::move(frame));
+	}
+
+	void BenchClient::Close(bool is_abortive) {
+		auto self = shared_from_this();
+		asio::post(mStrand, [self, is_abortive]() -> void {
+			self->mIsClosing = true;
+			asio::error_code ec;
+			if (is_abortive) {
+				self->mSocket.set_option(asio::socket_base::linger(true, 0), ec);
+			} else {
+				self->mSocket.shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+			}
+			self->mSocket.close(ec);
+			self->mIsConnected.store(false);
+		});
+	}
+
+	void BenchClient::QueueFrame(std::string&& frame) {
+		mPendingWrites.fetch_add(1u, std::memory_order_relaxed);
+		auto self = shared_from_this();
+		asio::post(mStrand, [self, frame = std::move(frame)]() mutable -> void {
+			// frames queued before connected are written after connect command.
+			self->mWriteQueue.emplace_back(std::move(frame));
+			if (self->mIsConnected.load(std::memory_order_relaxed)) self->WriteNext();
+		});
+	}
+
+	void BenchClient::WriteNext() {
+		if (mIsWriting || mWriteQueue.empty() || !mSocket.is_open()) return;
+		mIsWriting = true;
+
+		auto self = shared_from_this();
+		asio::async_write(mSocket, asio::buffer(mWriteQueue.front()), asio::bind_executor(mStrand, [self](const asio::error_code& ec, size_t) -> void {
+			self->mIsWriting = false;
+			if (ec) {
+				self->Fail();
+				return;
+			}
+			self->mWriteQueue.pop_front();
+			self->mPendingWrites.fetch_sub(1u, std::memory_order_relaxed);
+			self->WriteNext();
+		}));
+	}
+
+	void BenchClient::ReadHeader() {
+		auto self = shared_from_this();
+		asio::async_read(mSocket, asio::buffer(&mReadSize, sizeof(uint32_t)), asio::bind_executor(mStrand, [self](const asio::error_code& ec, size_t) -> void {
+			if (ec || self->mReadSize == 0u || self->mReadSize > MAX_FRAME_BODY) {
+				self->Fail();
+				return;
+			}
+			self->ReadBody();
+		}));
+	}
+
+	void BenchClient::ReadBody() {
+		mReadBuffer.resize(mReadSize);
+		auto self = shared_from_this();
+		asio::async_read(mSocket, asio::buffer(mReadBuffer.data(), mReadSize), asio::bind_executor(mStrand, [self](const asio::error_code& ec, size_t) -> void {
+			if (ec) {
+				self->Fail();
+				return;
+			}
+
+			// only data frames are reported. commands like resume token are ignored.
+			const uint8_t* body = reinterpret_cast<const uint8_t*>(self->mReadBuffer.data());
+			if (body[0] == FRAME_DATA && self->mReadSize >= sizeof(uint8_t) + sizeof(uint8_t)) {
+				if (self->mHandler) self->mHandler(self.get(), body + 2, self->mReadSize - 2u, body[1] != 0u);
+			}
+			self->ReadHeader();
+		}));
+	}
+
+	void BenchClient::Fail() {
+		// closing by ourselves also cancel pending operations. it is not a failure.
+		if (mIsClosing) return;
+		mIsFailed.store(true);
+		mIsConnected.store(false);
+		asio::error_code ec;
+		mSocket.close(ec);
+	}
+
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#ifdef _WIN32
+#include <sdkddkver.h>	// need by asio
+#endif // _WIN32
+#include "asio.hpp"
+#include "others_helper.hpp"
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace AbyssBench {
+
+	using namespace WhispersAbyss;
+
+	/*
+	BenchClient is a synthetic endpoint speaking the framing of TcpInstance:
+	every frame is a uint32 body size followed by body, and body start with a uint8 TcpCommandType.
+	Data body is followed by a uint8 reliability flag and payload.
+
+	All clients share a few io_context threads. Every operation of a client runs in its own strand,
+	so SendData() can be called from any thread.
+	*/
+
+	class BenchClient : public std::enable_shared_from_this<BenchClient> {
+	public:
+		using DataHandler_t = std::function<void(BenchClient* client, const uint8_t* payload, uint32_t len, bool is_reliable)>;
+
+		BenchClient(asio::io_context& ctx, size_t id, DataHandler_t handler);
+		BenchClient(const BenchClient& rhs) = delete;
+		BenchClient(BenchClient&& rhs) = delete;
+		~BenchClient();
+
+		/// <summary>
+		/// Connect to proxy and order it to connect given server url.
+		/// </summary>
+		void Start(const asio::ip::tcp::endpoint& proxy, const std::string& url);
+		void SendData(const void* payload, uint32_t len, bool is_reliable);
+		/// <summary>
+		/// Close socket. Pending frames are dropped.
+		/// </summary>
+		/// <param name="is_abortive">Reset connection instead of closing gracefully, so no port is left in TIME_WAIT.</param>
+		void Close(bool is_abortive = false);
+
+		size_t GetId() const { return mId; }
+		bool IsConnected() const { return mIsConnected.load(std::memory_order_relaxed); }
+		/// <summary>
+		/// Set when socket failed or closed by proxy. Never reset.
+		/// </summary>
+		bool IsFailed() const { return mIsFailed.load(std::memory_order_relaxed); }
+		/// <summary>
+		/// The count of frames queued but not written yet. Show how far client is behind.
+		/// </summary>
+		size_t GetPendingWrites() const { return mPendingWrites.load(std::memory_order_relaxed); }
+	private:
+		void QueueFrame(std::string&& frame);
+		void WriteNext();
+		void ReadHeader();
+		void ReadBody();
+		void Fail();
+
+		size_t mId;
+		DataHandler_t mHandler;
+		asio::ip::tcp::socket mSocket;
+		asio::strand<asio::io_context::executor_type> mStrand;
+
+		/// <summary>
+		/// Only accessed in strand.
+		/// </summary>
+		std::deque<std::string> mWriteQueue;
+		bool mIsWriting, mIsClosing;
+		uint32_t mReadSize;
+		std::string mReadBuffer;
+
+		std::atomic_bool mIsConnected, mIsFailed;
+		std::atomic_size_t mPendingWrites;
+	};
+
+}
@@ -0,0 +1,515 @@
+#include "bench_common.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <Psapi.h>
+#include <TlHelp32.h>
+#else
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif // _WIN32
+
+namespace AbyssBench {
+
+#pragma region BenchArgs
+
+	BenchArgs::BenchArgs() :
+		mValues()
+	{}
+
+	BenchArgs::~BenchArgs() {}
+
+	bool BenchArgs::Parse(int argc, char* argv[], int start, std::string& error) {
+		for (int i = start; i < argc; ++i) {
+			const char* key = argv[i];
+			if (strncmp(key, "--", 2u) != 0) {
+				error = "Unexpected argument: ";
+				error += key;
+				return false;
+			}
+			if (i + 1 >= argc) {
+				error = "Missing value for option: ";
+				error += key;
+				return false;
+			}
+			mValues[key + 2] = argv[++i];
+		}
+		return true;
+	}
+
+	bool BenchArgs::LoadFile(const char* path, std::string& error) {
+		FILE* fs = fopen(path, "r");
+		if (fs == nullptr) {
+			error = "Fail to open file: ";
+			error += path;
+			return false;
+		}
+
+		auto trim = [](std::string& str) -> void {
+			const char* blanks = " \t\r\n";
+			size_t start = str.find_first_not_of(blanks);
+			if (start == std::string::npos) {
+				str.clear();
+				return;
+			}
+			str = str.substr(start, str.find_last_not_of(blanks) - start + 1u);
+		};
+
+		char line[512];
+		size_t line_number = 0u;
+		bool is_success = true;
+		while (fgets(line, sizeof(line), fs) != nullptr) {
+			++line_number;
+			std::string text(line);
+			trim(text);
+			if (text.empty() || text[0] == '#') continue;
+
+			size_t sep = text.find('=');
+			if (sep == std::string::npos) {
+				error.clear();
+				CommonOpers::AppendStrF(error, "Invalid line %zu in %s: %s", line_number, path, text.c_str());
+				is_success = false;
+				break;
+			}
+			std::string key(text.substr(0u, sep)), value(text.substr(sep + 1u));
+			trim(key);
+			trim(value);
+			// try_emplace keep the values from command line
+			mValues.try_emplace(key, value);
+		}
+
+		fclose(fs);
+		return is_success;
+	}
+
+	bool BenchArgs::Has(const char* key) const {
+		return mValues.contains(key);
+	}
+
+	std::string BenchArgs::GetString(const char* key, const char* default_value) const {
+		auto it = mValues.find(key);
+		return it == mValues.end() ? std::string(default_value) : it->second;
+	}
+
+	uint64_t BenchArgs::GetUnsigned(const char* key, uint64_t default_value) const {
+		auto it = mValues.find(key);
+		if (it == mValues.end()) return default_value;
+		return strtoull(it->second.c_str(), nullptr, 10);
+	}
+
+	double BenchArgs::GetDouble(const char* key, double default_value) const {
+		auto it = mValues.find(key);
+		if (it == mValues.end()) return default_value;
+		return strtod(it->second.c_str(), nullptr);
+	}
+
+	std::vector<uint64_t> BenchArgs::GetUnsignedList(const char* key, const char* default_value) const {
+		std::string text(GetString(key, default_value));
+		std::vector<uint64_t> result;
+		const char* p = text.c_str();
+		while (*p != '\0') {
+			char* end = nullptr;
+			uint64_t value = strtoull(p, &end, 10);
+			if (end == p) break;
+			result.emplace_back(value);
+			p = end;
+			if (*p == ',') ++p;
+		}
+		return result;
+	}
+
+#pragma endregion
+
+#pragma region JsonWriter
+
+	JsonWriter::JsonWriter() :
+		mText(), mHasMember()
+	{}
+
+	JsonWriter::~JsonWriter() {}
+
+	JsonWriter& JsonWriter::BeginObject(const char* key) {
+		AppendKey(key);
+		mText.push_back('{');
+		mHasMember.emplace_back(false);
+		return *this;
+	}
+
+	JsonWriter& JsonWriter::EndObject() {
+		mText.push_back('}');
+		mHasMember.pop_back();
+		return *this;
+	}
+
+	JsonWriter& JsonWriter::BeginArray(const char* key) {
+		AppendKey(key);
+		mText.push_back('[');
+		mHasMember.emplace_back(false);
+		return *this;
+	}
+
+	JsonWriter& JsonWriter::EndArray() {
+		mText.push_back(']');
+		mHasMember.pop_back();
+		return *this;
+	}
+
+	JsonWriter& JsonWriter::Value(const char* key, const char* value) {
+		AppendKey(key);
+		AppendString(value);
+		return *this;
+	}
+
+	JsonWriter& JsonWriter::Value(const char* key, const std::string& value) {
+		return Value(key, value.c_str());
+	}
+
+	JsonWriter& JsonWriter::Value(const char* key, uint64_t value) {
+		AppendKey(key);
+		CommonOpers::AppendStrF(mText, "%" PRIu64, value);
+		return *this;
+	}
+
+	JsonWriter& JsonWriter::Value(const char* key, double value) {
+		AppendKey(key);
+		// JSON has no inf or nan.
+		if (value != value || value > 1e300 || value < -1e300) mText.append("null");
+		else CommonOpers::AppendStrF(mText, "%.3f", value);
+		return *this;
+	}
+
+	JsonWriter& JsonWriter::Value(const char* key, bool value) {
+		AppendKey(key);
+		mText.append(value ? "true" : "false");
+		return *this;
+	}
+
+	void JsonWriter::AppendKey(const char* key) {
+		if (!mHasMember.empty()) {
+			if (mHasMember.back()) mText.push_back(',');
+			mHasMember.back() = true;
+		}
+		if (key != nullptr) {
+			AppendString(key);
+			mText.push_back(':');
+		}
+	}
+
+	void JsonWriter::AppendString(const char* str) {
+		mText.push_back('"');
+		for (const char* p = str; *p != '\0'; ++p) {
+			char c = *p;
+			if (c == '"' || c == '\\') {
+				mText.push_back('\\');
+				mText.push_back(c);
+			} else if (static_cast<unsigned char>(c) < 0x20u) {
+				CommonOpers::AppendStrF(mText, "\\u%04x", static_cast<unsigned int>(c));
+			} else {
+				mText.push_back(c);
+			}
+		}
+		mText.push_back('"');
+	}
+
+#pragma endregion
+
+#pragma region Process usage
+
+	ProcessUsage SampleProcessUsage() {
+		ProcessUsage usage{ 0.0, 0u, 0u };
+#ifdef _WIN32
+		FILETIME creation_time, exit_time, kernel_time, user_time;
+		if (GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time)) {
+			auto to_seconds = [](const FILETIME& ft) -> double {
+				ULARGE_INTEGER value;
+				value.LowPart = ft.dwLowDateTime;
+				value.HighPart = ft.dwHighDateTime;
+				return value.QuadPart / 10000000.0;	// in 100 nanoseconds
+			};
+			usage.mCpuSeconds = to_seconds(kernel_time) + to_seconds(user_time);
+		}
+
+		PROCESS_MEMORY_COUNTERS memory;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &memory, sizeof(memory))) {
+			usage.mRssBytes = static_cast<uint64_t>(memory.WorkingSetSize);
+		}
+
+		HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+		if (snapshot != INVALID_HANDLE_VALUE) {
+			DWORD pid = GetCurrentProcessId();
+			THREADENTRY32 entry;
+			entry.dwSize = sizeof(entry);
+			if (Thread32First(snapshot, &entry)) {
+				do {
+					if (entry.th32OwnerProcessID == pid) ++usage.mThreadCount;
+				} while (Thread32Next(snapshot, &entry));
+			}
+			CloseHandle(snapshot);
+		}
+#else
+		struct rusage ru;
+		if (getrusage(RUSAGE_SELF, &ru) == 0) {
+			usage.mCpuSeconds = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1000000.0 +
+				ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1000000.0;
+		}
+
+		// Threads and VmRSS (in kB) are in /proc/self/status
+		FILE* fs = fopen("/proc/self/status", "r");
+		if (fs != nullptr) {
+			char line[256];
+			unsigned long long value;
+			while (fgets(line, sizeof(line), fs) != nullptr) {
+				if (sscanf(line, "Threads: %llu", &value) == 1) usage.mThreadCount = value;
+				else if (sscanf(line, "VmRSS: %llu", &value) == 1) usage.mRssBytes = value * 1024u;
+			}
+			fclose(fs);
+		}
+#endif // _WIN32
+		return usage;
+	}
+
+	void WriteLatency(JsonWriter& json, const char* key, LatencyHistogram& histogram) {
+		WriteLatency(json, key, histogram.Summarize());
+	}
+
+	void WriteLatency(JsonWriter& json, const char* key, const LatencySummary& summary) {
+		json.BeginObject(key)
+			.Value("count", summary.mCount)
+			.Value("p50_us", summary.mP50 / 1000.0)
+			.Value("p99_us", summary.mP99 / 1000.0)
+			.Value("p999_us", summary.mP999 / 1000.0)
+			.Value("max_us", summary.mMax / 1000.0)
+			.EndObject();
+	}
+
+	void WriteOpcodes(JsonWriter& json, const char* key, OpcodeCounters& counters, OpcodeDirection direction) {
+		json.BeginArray(key);
+		for (const auto& usage : counters.Summarize(direction)) {
+			json.BeginObject()
+				.Value("opcode", OpcodeCounters::GetOpcodeName(usage.mOpcode))
+				.Value("msg", usage.mMsg)
+				.Value("bytes", usage.mBytes)
+				.EndObject();
+		}
+		json.EndArray();
+	}
+
+#pragma endregion
+
+#pragma region BenchProxy
+
+	BenchProxy::BenchProxy(OutputHelper* output) :
+		mSettings(), mOutput(output), mExecutor(nullptr), mFactory(nullptr)
+	{}
+
+	BenchProxy::~BenchProxy() {
+		Stop();
+	}
+
+	bool BenchProxy::Start(uint16_t port) {
+		mSettings.mAcceptPort = port;
+		mExecutor.reset(new LifecycleExecutor(mOutput));
+		mFactory.reset(new BridgeFactory(mOutput, mExecutor.get(), &mSettings));
+
+		// factory may fail to start, so wait any stable state.
+		CountDownTimer waiting(MODULE_WAITING_INTERVAL);
+		while (!mFactory->mStatusReporter.IsInState(StateMachine::Running)) {
+			if (mFactory->mStatusReporter.IsInState(StateMachine::Stopped) || waiting.HasRunOutOfTime()) {
+				return false;
+			}
+			std::this_thread::sleep_for(SPIN_INTERVAL);
+		}
+		return true;
+	}
+
+	void BenchProxy::Stop() {
+		if (mFactory != nullptr) {
+			if (!mFactory->mStatusReporter.IsInState(StateMachine::Stopped)) mFactory->Stop();
+			mFactory->mStatusReporter.SpinUntil(StateMachine::Stopped);
+			mFactory.reset();
+		}
+		mExecutor.reset();
+	}
+
+	BridgeFactoryHealth BenchProxy::ReportHealth() {
+		if (mFactory == nullptr) return BridgeFactoryHealth{};
+		return mFactory->ReportHealth();
+	}
+
+	BridgeFactoryPressure BenchProxy::ReportPressure() {
+		if (mFactory == nullptr) return BridgeFactoryPressure{};
+		return mFactory->ReportPressure();
+	}
+
+#pragma endregion
+
+#pragma region Impairment
+
+	const ImpairmentProfile IMPAIRMENT_PROFILES[] = {
+		{ "none", "No impairment.", { 0, 0.0f, 0.0f, 0, 0.0f, 0 } },
+		{ "lan", "Clean LAN: 1ms.", { 1, 0.0f, 0.0f, 0, 0.0f, 0 } },
+		{ "wan", "Typical WAN: 40ms, 0.5% loss, 1% reordered by 10ms.", { 40, 0.5f, 1.0f, 10, 0.0f, 0 } },
+		{ "mobile", "Lossy mobile: 90ms, 3% loss, 5% reordered by 40ms, 0.5% duplicated.", { 90, 3.0f, 5.0f, 40, 0.5f, 20 } },
+	};
+	const size_t IMPAIRMENT_PROFILE_COUNT = sizeof(IMPAIRMENT_PROFILES) / sizeof(ImpairmentProfile);
+
+	bool LoadImpairment(const BenchArgs& args, AbyssSettings& settings, std::string& name) {
+		name = args.GetString("impairment", "none");
+		for (size_t i = 0; i < IMPAIRMENT_PROFILE_COUNT; ++i) {
+			if (name != IMPAIRMENT_PROFILES[i].mName) continue;
+			settings.mImpairment = IMPAIRMENT_PROFILES[i].mImpairment;
+			return true;
+		}
+
+		fprintf(stderr, "Unknown impairment profile: %s. Available profiles:\n", name.c_str());
+		for (size_t i = 0; i < IMPAIRMENT_PROFILE_COUNT; ++i) {
+			fprintf(stderr, "\t%s\t%s\n", IMPAIRMENT_PROFILES[i].mName, IMPAIRMENT_PROFILES[i].mDescription);
+		}
+		return false;
+	}
+
+#pragma endregion
+
+#pragma region PressureTracker
+
+	PressureTracker::PressureTracker() :
+		mSamples(0u), mMax{}, mLast{}
+	{}
+
+	PressureTracker::~PressureTracker() {}
+
+	const BridgeFactoryPressure& PressureTracker::Sample(BenchProxy& proxy) {
+		mLast = proxy.ReportPressure();
+		++mSamples;
+		mMax.mTcpSendQueue = std::max(mMax.mTcpSendQueue, mLast.mTcpSendQueue);
+		mMax.mTcpRecvQueue = std::max(mMax.mTcpRecvQueue, mLast.mTcpRecvQueue);
+		mMax.mGnsSendQueue = std::max(mMax.mGnsSendQueue, mLast.mGnsSendQueue);
+		mMax.mGnsRecvQueue = std::max(mMax.mGnsRecvQueue, mLast.mGnsRecvQueue);
+		mMax.mGnsPendingBytes = std::max(mMax.mGnsPendingBytes, mLast.mGnsPendingBytes);
+		mMax.mGnsQueueTime = std::max(mMax.mGnsQueueTime, mLast.mGnsQueueTime);
+		mMax.mPingMax = std::max(mMax.mPingMax, mLast.mPingMax);
+		return mLast;
+	}
+
+	void PressureTracker::Write(JsonWriter& json, const char* key) const {
+		json.BeginObject(key)
+			.Value("samples", mSamples)
+			.Value("tcp_send_queue_max", static_cast<uint64_t>(mMax.mTcpSendQueue))
+			.Value("tcp_recv_queue_max", static_cast<uint64_t>(mMax.mTcpRecvQueue))
+			.Value("gns_send_queue_max", static_cast<uint64_t>(mMax.mGnsSendQueue))
+			.Value("gns_recv_queue_max", static_cast<uint64_t>(mMax.mGnsRecvQueue))
+			.Value("gns_pending_bytes_max", static_cast<uint64_t>(mMax.mGnsPendingBytes))
+			.Value("gns_queue_time_us_max", static_cast<uint64_t>(mMax.mGnsQueueTime))
+			.Value("ping_ms_max", static_cast<uint64_t>(mMax.mPingMax));
+		// latency is cumulative since proxy started.
+		WriteLatency(json, "bridge_tcp2gns", mLast.mTcp2GnsLatency);
+		WriteLatency(json, "bridge_gns2tcp", mLast.mGns2TcpLatency);
+		json.EndObject();
+	}
+
+#pragma endregion
+
+#pragma region MappedFile
+
+	MappedFile::MappedFile() :
+		mData(nullptr), mSize(0u),
+#ifdef _WIN32
+		mFile(INVALID_HANDLE_VALUE), mMapping(nullptr)
+#else
+		mFile(-1)
+#endif // _WIN32
+	{}
+
+	MappedFile::~MappedFile() {
+		Close();
+	}
+
+	bool MappedFile::Open(const char* path) {
+		Close();
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+			CloseHandle(file);
+			return false;
+		}
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL) {
+			CloseHandle(file);
+			return false;
+		}
+		void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (view == NULL) {
+			CloseHandle(mapping);
+			CloseHandle(file);
+			return false;
+		}
+		mFile = file;
+		mMapping = mapping;
+		mSize = static_cast<size_t>(size.QuadPart);
+#else
+		int file = open(path, O_RDONLY);
+		if (file < 0) return false;
+		struct stat st;
+		if (fstat(file, &st) != 0 || st.st_size == 0) {
+			close(file);
+			return false;
+		}
+		void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+		if (view == MAP_FAILED) {
+			close(file);
+			return false;
+		}
+		// records are read from head to tail
+		madvise(view, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+		mFile = file;
+		mSize = static_cast<size_t>(st.st_size);
+#endif // _WIN32
+		mData = static_cast<const uint8_t*>(view);
+		return true;
+	}
+
+	void MappedFile::Close() {
+		if (mData == nullptr) return;
+#ifdef _WIN32
+		UnmapViewOfFile(mData);
+		CloseHandle(static_cast<HANDLE>(mMapping));
+		CloseHandle(static_cast<HANDLE>(mFile));
+		mMapping = nullptr;
+		mFile = INVALID_HANDLE_VALUE;
+#else
+		munmap(const_cast<uint8_t*>(mData), mSize);
+		close(mFile);
+		mFile = -1;
+#endif // _WIN32
+		mData = nullptr;
+		mSize = 0u;
+	}
+
+#pragma endregion
+
+	bool WriteResult(const std::string& path, const JsonWriter& json) {
+		if (path.empty()) {
+			puts(json.GetText().c_str());
+			fflush(stdout);
+			return true;
+		}
+
+		FILE* fs = fopen(path.c_str(), "w");
+		if (fs == nullptr) return false;
+		fputs(json.GetText().c_str(), fs);
+		fputc('\n', fs);
+		bool is_success = ferror(fs) == 0;
+		fclose(fs);
+		return is_success;
+	}
+
+}
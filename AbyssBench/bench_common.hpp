@@ -0,0 +1,236 @@
+#pragma once
+
+#include "others_helper.hpp"
+#include "lifecycle_executor.hpp"
+#include "bridge_factory.hpp"
+#include "settings.hpp"
+#include "metrics.hpp"
+#include <cinttypes>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace AbyssBench {
+
+	using namespace WhispersAbyss;
+
+	/// <summary>
+	/// The default port of the WhispersAbyss under test.
+	/// </summary>
+	constexpr const uint16_t BENCH_PROXY_PORT = 26690u;
+	/// <summary>
+	/// The default port of the GNS stand-in server.
+	/// </summary>
+	constexpr const uint16_t BENCH_SERVER_PORT = 26691u;
+	/// <summary>
+	/// The opcode written at the head of synthetic payloads.
+	/// It is not used by BMMO, so opcode statistics count it as unknown.
+	/// </summary>
+	constexpr const uint32_t BENCH_OPCODE = 0xABu;
+	/// <summary>
+	/// How long a step waits all clients getting their first echo before giving up.
+	/// </summary>
+	constexpr const std::chrono::seconds BENCH_WARMUP_TIMEOUT(30);
+
+	/// <summary>
+	/// <para>The command line of benchmark, in the form of --key value.</para>
+	/// <para>Unknown keys are kept and ignored, so every mode only pick what it need.</para>
+	/// </summary>
+	class BenchArgs {
+	public:
+		BenchArgs();
+		BenchArgs(const BenchArgs& rhs) = delete;
+		BenchArgs(BenchArgs&& rhs) = delete;
+		~BenchArgs();
+
+		/// <summary>
+		/// Parse arguments after mode.
+		/// </summary>
+		/// <param name="error">The reason if parsing failed.</param>
+		/// <returns>True if success.</returns>
+		bool Parse(int argc, char* argv[], int start, std::string& error);
+		/// <summary>
+		/// <para>Load options from a file with one "key = value" per line. Lines starting with # are comments.</para>
+		/// <para>Options already given in command line are kept, so command line can override a file.</para>
+		/// </summary>
+		/// <param name="error">The reason if loading failed.</param>
+		/// <returns>True if success.</returns>
+		bool LoadFile(const char* path, std::string& error);
+		bool Has(const char* key) const;
+		std::string GetString(const char* key, const char* default_value) const;
+		uint64_t GetUnsigned(const char* key, uint64_t default_value) const;
+		double GetDouble(const char* key, double default_value) const;
+		/// <summary>
+		/// Get a comma separated list of unsigned numbers, like 1,10,100.
+		/// </summary>
+		std::vector<uint64_t> GetUnsignedList(const char* key, const char* default_value) const;
+	private:
+		std::map<std::string, std::string> mValues;
+	};
+
+	/// <summary>
+	/// <para>A minimal JSON writer producing compact text. Caller is responsible for the pairing of Begin and End.</para>
+	/// <para>Keys and strings are escaped for quotes, backslashes and control characters only.</para>
+	/// </summary>
+	class JsonWriter {
+	public:
+		JsonWriter();
+		JsonWriter(const JsonWriter& rhs) = delete;
+		JsonWriter(JsonWriter&& rhs) = delete;
+		~JsonWriter();
+
+		JsonWriter& BeginObject(const char* key = nullptr);
+		JsonWriter& EndObject();
+		JsonWriter& BeginArray(const char* key = nullptr);
+		JsonWriter& EndArray();
+		JsonWriter& Value(const char* key, const char* value);
+		JsonWriter& Value(const char* key, const std::string& value);
+		JsonWriter& Value(const char* key, uint64_t value);
+		JsonWriter& Value(const char* key, double value);
+		JsonWriter& Value(const char* key, bool value);
+		const std::string& GetText() const { return mText; }
+	private:
+		void AppendKey(const char* key);
+		void AppendString(const char* str);
+
+		std::string mText;
+		/// <summary>
+		/// Whether the current object or array has got any member. One entry per nesting level.
+		/// </summary>
+		std::vector<bool> mHasMember;
+	};
+
+	struct ProcessUsage {
+		double mCpuSeconds;	// user + kernel
+		uint64_t mThreadCount;
+		uint64_t mRssBytes;
+	};
+	/// <summary>
+	/// Sample the resource usage of this process. Fields are 0 if they can not be read.
+	/// </summary>
+	ProcessUsage SampleProcessUsage();
+
+	/// <summary>
+	/// Append the summary of a latency histogram into JSON, in microseconds.
+	/// </summary>
+	void WriteLatency(JsonWriter& json, const char* key, LatencyHistogram& histogram);
+	void WriteLatency(JsonWriter& json, const char* key, const LatencySummary& summary);
+	/// <summary>
+	/// Append the per-opcode counters of given direction into JSON as an array, ordered by bytes.
+	/// </summary>
+	void WriteOpcodes(JsonWriter& json, const char* key, OpcodeCounters& counters, OpcodeDirection direction);
+
+	/// <summary>
+	/// <para>The whole WhispersAbyss running in this process: a LifecycleExecutor and a BridgeFactory.</para>
+	/// <para>Log is written into file so that it does not mix with benchmark output.</para>
+	/// </summary>
+	class BenchProxy {
+	public:
+		BenchProxy(OutputHelper* output);
+		BenchProxy(const BenchProxy& rhs) = delete;
+		BenchProxy(BenchProxy&& rhs) = delete;
+		~BenchProxy();
+
+		/// <summary>
+		/// Create factory and wait it running.
+		/// </summary>
+		/// <returns>True if factory is running.</returns>
+		bool Start(uint16_t port);
+		void Stop();
+		/// <summary>
+		/// Get the health figures of factory. All zero if factory is not started.
+		/// </summary>
+		BridgeFactoryHealth ReportHealth();
+		/// <summary>
+		/// Get the queue pressure of factory. All zero if factory is not started.
+		/// </summary>
+		BridgeFactoryPressure ReportPressure();
+		/// <summary>
+		/// The settings used by factory. Can be changed before Start().
+		/// </summary>
+		AbyssSettings mSettings;
+	private:
+		OutputHelper* mOutput;
+		/// <summary>
+		/// Executor should be destroyed after factory.
+		/// </summary>
+		std::unique_ptr<LifecycleExecutor> mExecutor;
+		std::unique_ptr<BridgeFactory> mFactory;
+	};
+
+	/// <summary>
+	/// A named network condition applied to the GNS side of benchmarks.
+	/// Proxy and stand-in server share GNS in the same process, so each direction is impaired once by these values.
+	/// </summary>
+	struct ImpairmentProfile {
+		const char* mName;
+		const char* mDescription;
+		GnsImpairment mImpairment;
+	};
+	extern const ImpairmentProfile IMPAIRMENT_PROFILES[];
+	extern const size_t IMPAIRMENT_PROFILE_COUNT;
+	/// <summary>
+	/// Apply the profile given by --impairment into settings. Default is none.
+	/// </summary>
+	/// <param name="name">The name of applied profile.</param>
+	/// <returns>False if profile is unknown.</returns>
+	bool LoadImpairment(const BenchArgs& args, AbyssSettings& settings, std::string& name);
+
+	/// <summary>
+	/// <para>Track the most queue pressure of proxy through a run by sampling it periodically.</para>
+	/// <para>Each sample collects profiles of all bridges, so sample no more than a few times per second.</para>
+	/// </summary>
+	class PressureTracker {
+	public:
+		PressureTracker();
+		PressureTracker(const PressureTracker& rhs) = delete;
+		PressureTracker(PressureTracker&& rhs) = delete;
+		~PressureTracker();
+
+		/// <summary>
+		/// Sample proxy and return the sample.
+		/// </summary>
+		const BridgeFactoryPressure& Sample(BenchProxy& proxy);
+		/// <summary>
+		/// Write the maxima of samples and the latency inside bridges of the last sample.
+		/// </summary>
+		void Write(JsonWriter& json, const char* key) const;
+	private:
+		uint64_t mSamples;
+		BridgeFactoryPressure mMax, mLast;
+	};
+
+	/// <summary>
+	/// A read-only memory mapping of a whole file.
+	/// </summary>
+	class MappedFile {
+	public:
+		MappedFile();
+		MappedFile(const MappedFile& rhs) = delete;
+		MappedFile(MappedFile&& rhs) = delete;
+		~MappedFile();
+
+		/// <returns>True if success.</returns>
+		bool Open(const char* path);
+		void Close();
+		const uint8_t* GetData() const { return mData; }
+		size_t GetSize() const { return mSize; }
+	private:
+		const uint8_t* mData;
+		size_t mSize;
+#ifdef _WIN32
+		void* mFile;
+		void* mMapping;
+#else
+		int mFile;
+#endif // _WIN32
+	};
+
+	/// <summary>
+	/// Write benchmark result into given path, or stdout if path is empty.
+	/// </summary>
+	/// <returns>True if success.</returns>
+	bool WriteResult(const std::string& path, const JsonWriter& json);
+
+}
@@ -0,0 +1,262 @@
+#include "benchmarks.hpp"
+#include "bench_client.hpp"
+#include "stand_in_server.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+namespace AbyssBench {
+
+	/// <summary>
+	/// The head of every synthetic payload. The rest of payload is padding.
+	/// </summary>
+	struct EchoPayload {
+		uint32_t mOpcode;	// always BENCH_OPCODE
+		uint32_t mClient;
+		uint64_t mSeq;
+		uint64_t mSendTime;	// CommonOpers::GetMonotonicTime() of sender
+	};
+	/// <summary>
+	/// The largest payload fitting in a TcpInstance frame, which also hold command flag and reliability flag.
+	/// </summary>
+	constexpr const uint64_t ECHO_MAX_PAYLOAD = 2045u;
+	/// <summary>
+	/// How often warming up clients resend their probe.
+	/// A probe may be lost while proxy is still connecting GNS, so a single probe is not enough.
+	/// </summary>
+	constexpr const std::chrono::milliseconds ECHO_WARMUP_INTERVAL(200);
+	/// <summary>
+	/// How long a step keeps receiving after it stop sending, so in-flight messages are not counted as lost.
+	/// </summary>
+	constexpr const std::chrono::milliseconds ECHO_DRAIN_TIME(1000);
+	/// <summary>
+	/// The most ticks sent at once when the pacing loop falls behind.
+	/// More than it are skipped, so an overloaded proxy is not buried by a burst.
+	/// </summary>
+	constexpr const uint64_t ECHO_MAX_CATCHUP_TICKS = 16u;
+	/// <summary>
+	/// How often queue pressure of proxy is sampled while measuring.
+	/// </summary>
+	constexpr const std::chrono::milliseconds ECHO_PRESSURE_INTERVAL(100);
+
+	/// <summary>
+	/// The shared state of a step, written by io threads.
+	/// </summary>
+	struct EchoStep {
+		EchoStep(size_t client_count) :
+			mIsMeasuring(false), mHasEcho(new std::atomic_bool[client_count]),
+			mReceived(0u), mReceivedBytes(0u), mLatency()
+		{
+			for (size_t i = 0; i < client_count; ++i) mHasEcho[i].store(false);
+		}
+
+		std::atomic_bool mIsMeasuring;
+		std::unique_ptr<std::atomic_bool[]> mHasEcho;
+		std::atomic_uint64_t mReceived, mReceivedBytes;
+		LatencyHistogram mLatency;
+	};
+
+	static void OnEchoData(EchoStep* step, BenchClient* client, const uint8_t* payload, uint32_t len) {
+		if (len < sizeof(EchoPayload)) return;
+		EchoPayload head;
+		memcpy(&head, payload, sizeof(EchoPayload));
+		if (head.mOpcode != BENCH_OPCODE) return;
+
+		step->mHasEcho[client->GetId()].store(true, std::memory_order_relaxed);
+		if (!step->mIsMeasuring.load(std::memory_order_relaxed)) return;
+		step->mReceived.fetch_add(1u, std::memory_order_relaxed);
+		step->mReceivedBytes.fetch_add(len, std::memory_order_relaxed);
+		step->mLatency.RecordSince(head.mSendTime);
+	}
+
+	static void SendEcho(BenchClient* client, std::string& buffer, uint64_t seq, bool is_reliable) {
+		EchoPayload head{ BENCH_OPCODE, static_cast<uint32_t>(client->GetId()), seq, CommonOpers::GetMonotonicTime() };
+		memcpy(buffer.data(), &head, sizeof(EchoPayload));
+		client->SendData(buffer.data(), static_cast<uint32_t>(buffer.size()), is_reliable);
+	}
+
+	int RunEcho(const BenchArgs& args) {
+		std::vector<uint64_t> client_steps(args.GetUnsignedList("clients", "1,10,100"));
+		uint64_t duration = args.GetUnsigned("duration", 10u);
+		uint64_t rate = args.GetUnsigned("rate", 60u);
+		uint64_t payload_size = std::clamp(args.GetUnsigned("payload", 64u), static_cast<uint64_t>(sizeof(EchoPayload)), ECHO_MAX_PAYLOAD);
+		bool is_reliable = args.GetUnsigned("reliable", 0u) != 0u;
+		uint64_t fanout = args.GetUnsigned("fanout", 1u);
+		uint64_t io_threads = std::max(args.GetUnsigned("io-threads", 2u), static_cast<uint64_t>(1u));
+		uint16_t proxy_port = static_cast<uint16_t>(args.GetUnsigned("proxy-port", BENCH_PROXY_PORT));
+		uint16_t server_port = static_cast<uint16_t>(args.GetUnsigned("server-port", BENCH_SERVER_PORT));
+		if (client_steps.empty() || duration == 0u || rate == 0u) {
+			fputs("Invalid --clients, --duration or --rate.\n", stderr);
+			return 1;
+		}
+
+		// start the proxy under test and the server behind it
+		OutputHelper output;
+		std::string log_file(args.GetString("log-file", "AbyssBench.log"));
+		if (!output.OpenLogFile(log_file.c_str())) {
+			fprintf(stderr, "Fail to open log file: %s\n", log_file.c_str());
+			return 1;
+		}
+		BenchProxy proxy(&output);
+		std::string impairment;
+		if (!LoadImpairment(args, proxy.mSettings, impairment)) return 1;
+		if (!proxy.Start(proxy_port)) {
+			fputs("Fail to start WhispersAbyss.\n", stderr);
+			return 1;
+		}
+		StandInServer server(&output);
+		if (!server.Start(server_port, static_cast<size_t>(fanout))) {
+			fputs("Fail to start stand-in server.\n", stderr);
+			return 1;
+		}
+
+		asio::io_context ctx;
+		auto work_guard = asio::make_work_guard(ctx);
+		std::vector<std::jthread> td_io;
+		for (uint64_t i = 0; i < io_threads; ++i) {
+			td_io.emplace_back([&ctx]() -> void { ctx.run(); });
+		}
+
+		asio::ip::tcp::endpoint proxy_endpoint(asio::ip::make_address("127.0.0.1"), proxy_port);
+		std::string url("127.0.0.1:" + std::to_string(server_port));
+		std::string buffer(static_cast<size_t>(payload_size), '\0');
+		const std::chrono::nanoseconds tick_interval(1000000000u / rate);
+
+		JsonWriter json;
+		json.BeginObject()
+			.Value("mode", "echo")
+			.BeginObject("config")
+			.Value("duration_s", duration)
+			.Value("rate", rate)
+			.Value("payload", payload_size)
+			.Value("reliable", is_reliable)
+			.Value("fanout", fanout)
+			.Value("impairment", impairment)
+			.EndObject()
+			.BeginArray("steps");
+
+		bool is_success = true;
+		for (uint64_t client_count : client_steps) {
+			fprintf(stderr, "Running %" PRIu64 " clients...\n", client_count);
+			// handlers may still run after clients are closed, so they share the ownership of step.
+			auto step_ptr = std::make_shared<EchoStep>(static_cast<size_t>(client_count));
+			EchoStep& step = *step_ptr;
+			std::vector<std::shared_ptr<BenchClient>> clients;
+			for (uint64_t i = 0; i < client_count; ++i) {
+				auto client = std::make_shared<BenchClient>(ctx, static_cast<size_t>(i),
+					[step_ptr](BenchClient* client, const uint8_t* payload, uint32_t len, bool) -> void {
+						OnEchoData(step_ptr.get(), client, payload, len);
+					});
+				client->Start(proxy_endpoint, url);
+				clients.emplace_back(std::move(client));
+			}
+
+			// warm up until every client got its first echo
+			bool is_warm = false;
+			auto warmup_end = std::chrono::steady_clock::now() + BENCH_WARMUP_TIMEOUT;
+			while (std::chrono::steady_clock::now() < warmup_end) {
+				is_warm = true;
+				for (auto& client : clients) {
+					if (step.mHasEcho[client->GetId()].load()) continue;
+					is_warm = false;
+					if (client->IsConnected()) SendEcho(client.get(), buffer, 0u, true);
+				}
+				if (is_warm) break;
+				std::this_thread::sleep_for(ECHO_WARMUP_INTERVAL);
+			}
+			if (!is_warm) {
+				fprintf(stderr, "Not all clients got echo in warming up. Skip the rest steps.\n");
+				for (auto& client : clients) client->Close();
+				is_success = false;
+				break;
+			}
+
+			// measure
+			ProcessUsage usage_start = SampleProcessUsage();
+			PressureTracker pressure;
+			step.mIsMeasuring.store(true);
+			uint64_t sent = 0u, seq = 1u, skipped_ticks = 0u;
+			auto measure_start = std::chrono::steady_clock::now();
+			auto measure_end = measure_start + std::chrono::seconds(duration);
+			auto next_tick = measure_start, next_pressure = measure_start;
+			while (true) {
+				auto now = std::chrono::steady_clock::now();
+				if (now >= measure_end) break;
+				if (now >= next_pressure) {
+					next_pressure += ECHO_PRESSURE_INTERVAL;
+					pressure.Sample(proxy);
+				}
+				if (now < next_tick) {
+					std::this_thread::sleep_for(std::min({ next_tick - now, next_pressure - now, measure_end - now }));
+					continue;
+				}
+
+				uint64_t due_ticks = static_cast<uint64_t>((now - next_tick) / tick_interval) + 1u;
+				next_tick += tick_interval * due_ticks;
+				if (due_ticks > ECHO_MAX_CATCHUP_TICKS) {
+					skipped_ticks += due_ticks - ECHO_MAX_CATCHUP_TICKS;
+					due_ticks = ECHO_MAX_CATCHUP_TICKS;
+				}
+				for (uint64_t t = 0; t < due_ticks; ++t, ++seq) {
+					for (auto& client : clients) {
+						SendEcho(client.get(), buffer, seq, is_reliable);
+						++sent;
+					}
+				}
+			}
+			std::this_thread::sleep_for(ECHO_DRAIN_TIME);
+			step.mIsMeasuring.store(false);
+			ProcessUsage usage_end = SampleProcessUsage();
+			double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - measure_start).count();
+
+			uint64_t failed_clients = 0u;
+			for (auto& client : clients) {
+				if (client->IsFailed()) ++failed_clients;
+			}
+			uint64_t received = step.mReceived.load();
+			double cpu_seconds = usage_end.mCpuSeconds - usage_start.mCpuSeconds;
+			json.BeginObject()
+				.Value("clients", client_count)
+				.Value("sent", sent)
+				.Value("received", received)
+				.Value("skipped_ticks", skipped_ticks)
+				.Value("failed_clients", failed_clients)
+				.Value("msg_per_s", received / static_cast<double>(duration))
+				.Value("bytes_per_s", step.mReceivedBytes.load() / static_cast<double>(duration));
+			WriteLatency(json, "latency", step.mLatency);
+			pressure.Write(json, "pressure");
+			json.Value("cpu_seconds", cpu_seconds)
+				.Value("cpu_percent", cpu_seconds / elapsed * 100.0)
+				.Value("threads", usage_end.mThreadCount)
+				.Value("rss_bytes", usage_end.mRssBytes)
+				.EndObject();
+			fprintf(stderr, "%" PRIu64 " clients: sent %" PRIu64 ", received %" PRIu64 ", %.1f%% CPU.\n",
+				client_count, sent, received, cpu_seconds / elapsed * 100.0);
+
+			// close clients and wait proxy to dispose them, so the next step starts from clean state.
+			for (auto& client : clients) client->Close();
+			CountDownTimer closing(MODULE_WAITING_INTERVAL);
+			while (server.GetConnectionCount() != 0u && !closing.HasRunOutOfTime()) {
+				std::this_thread::sleep_for(SPIN_INTERVAL);
+			}
+		}
+
+		json.EndArray().EndObject();
+
+		// stop in reverse order.
+		work_guard.reset();
+		ctx.stop();
+		td_io.clear();
+		server.Stop();
+		proxy.Stop();
+		output.Flush();
+
+		if (!WriteResult(args.GetString("output", ""), json)) {
+			fputs("Fail to write result.\n", stderr);
+			return 1;
+		}
+		return is_success ? 0 : 1;
+	}
+
+}
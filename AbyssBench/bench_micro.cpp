@@ -0,0 +1,345 @@
+#include "benchmarks.hpp"
+#include "messages.hpp"
+#include "state_machine.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <latch>
+#include <optional>
+#include <thread>
+
+namespace AbyssBench {
+
+	/// <summary>
+	/// The payload sizes of message cases: a ball state, a typical chat, a full server list and the largest TCP frame.
+	/// </summary>
+	constexpr const uint32_t MICRO_PAYLOAD_SIZES[] = { 44u, 256u, 1200u, 2045u };
+	/// <summary>
+	/// The message counts moved by each MoveDeque call.
+	/// </summary>
+	constexpr const size_t MICRO_BATCH_SIZES[] = { 1u, 16u, 128u, 1024u };
+	/// <summary>
+	/// How many state machines are prepared between 2 pauses of transition cases,
+	/// so pausing timer costs little compared with the transitions.
+	/// </summary>
+	constexpr const size_t MICRO_TRANSITION_POOL = 256u;
+	/// <summary>
+	/// The upper bound of iterations per calibration batch, so a case too cheap to measure still finishes calibrating.
+	/// </summary>
+	constexpr const uint64_t MICRO_MAX_ITERATIONS = UINT64_C(1) << 32;
+
+	/// <summary>
+	/// Consumes the results of benchmarked code, so compiler can not drop it.
+	/// </summary>
+	static std::atomic_uint64_t gMicroSink(0u);
+
+	/// <summary>
+	/// The timer of a thread running a case. Cases call PauseTiming() and ResumeTiming() around their preparations.
+	/// </summary>
+	class MicroState {
+	public:
+		MicroState() : mStart(), mElapsed(0u) {}
+		void ResumeTiming() { mStart = std::chrono::steady_clock::now(); }
+		void PauseTiming() {
+			mElapsed += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - mStart).count());
+		}
+		uint64_t GetElapsed() const { return mElapsed; }
+	private:
+		std::chrono::steady_clock::time_point mStart;
+		uint64_t mElapsed;
+	};
+
+	struct MicroCase {
+		std::string mName;
+		size_t mThreads;
+		/// <summary>
+		/// How many items, like messages, each iteration handles.
+		/// </summary>
+		uint64_t mItemsPerOp;
+		/// <summary>
+		/// Run given iterations on given thread. Every thread runs the same iterations at the same time.
+		/// </summary>
+		std::function<void(MicroState& state, size_t thread, uint64_t iterations)> mBody;
+		/// <summary>
+		/// Optional. Cases record the latency of every operation in it, calibration included.
+		/// </summary>
+		std::shared_ptr<LatencyHistogram> mLatency;
+	};
+
+	/// <summary>
+	/// Run a batch on all threads of case and return the elapsed nanoseconds of the slowest thread.
+	/// </summary>
+	static uint64_t RunMicroBatch(const MicroCase& c, uint64_t iterations) {
+		if (c.mThreads == 1u) {
+			MicroState state;
+			state.ResumeTiming();
+			c.mBody(state, 0u, iterations);
+			state.PauseTiming();
+			return state.GetElapsed();
+		}
+
+		// threads are created outside of timing, and start together.
+		std::vector<MicroState> states(c.mThreads);
+		std::latch start(static_cast<ptrdiff_t>(c.mThreads));
+		{
+			std::vector<std::jthread> threads;
+			for (size_t t = 0; t < c.mThreads; ++t) {
+				threads.emplace_back([&c, &states, &start, t, iterations]() -> void {
+					start.arrive_and_wait();
+					states[t].ResumeTiming();
+					c.mBody(states[t], t, iterations);
+					states[t].PauseTiming();
+				});
+			}
+		}
+		uint64_t elapsed = 0u;
+		for (const auto& state : states) elapsed = std::max(elapsed, state.GetElapsed());
+		return elapsed;
+	}
+
+	/// <summary>
+	/// Find the iterations making a batch run about given time.
+	/// </summary>
+	static uint64_t CalibrateMicroCase(const MicroCase& c, uint64_t min_time) {
+		uint64_t iterations = 1u;
+		while (iterations < MICRO_MAX_ITERATIONS) {
+			uint64_t elapsed = std::max(RunMicroBatch(c, iterations), static_cast<uint64_t>(1u));
+			if (elapsed >= min_time) break;
+			// aim a little higher than needed, and grow at most 100 times per round.
+			double scale = std::min(static_cast<double>(min_time) * 1.2 / elapsed, 100.0);
+			iterations = std::max(static_cast<uint64_t>(iterations * scale), iterations + 1u);
+		}
+		return std::min(iterations, MICRO_MAX_ITERATIONS);
+	}
+
+#pragma region Cases
+
+	static void AddMessageCases(std::vector<MicroCase>& cases) {
+		for (uint32_t size : MICRO_PAYLOAD_SIZES) {
+			auto payload = std::make_shared<std::string>(size, 'x');
+			cases.emplace_back(MicroCase{ "message/construct/" + std::to_string(size), 1u, 1u,
+				[payload](MicroState&, size_t, uint64_t iterations) -> void {
+					uint64_t sink = 0u;
+					for (uint64_t i = 0; i < iterations; ++i) {
+						CommonMessage msg;
+						msg.SetTcpData(payload->data(), true, static_cast<uint32_t>(payload->size()));
+						sink += msg.GetCommonDataLen();
+					}
+					gMicroSink.fetch_add(sink, std::memory_order_relaxed);
+				}, nullptr });
+
+			auto source = std::make_shared<CommonMessage>();
+			source->SetTcpData(payload->data(), true, size);
+			cases.emplace_back(MicroCase{ "message/copy/" + std::to_string(size), 1u, 1u,
+				[source](MicroState&, size_t, uint64_t iterations) -> void {
+					uint64_t sink = 0u;
+					for (uint64_t i = 0; i < iterations; ++i) {
+						CommonMessage msg(*source);
+						sink += msg.GetCommonDataLen();
+					}
+					gMicroSink.fetch_add(sink, std::memory_order_relaxed);
+				}, nullptr });
+
+			// each iteration moves out by constructor and moves back by assignment.
+			cases.emplace_back(MicroCase{ "message/move/" + std::to_string(size), 1u, 2u,
+				[source](MicroState&, size_t, uint64_t iterations) -> void {
+					uint64_t sink = 0u;
+					for (uint64_t i = 0; i < iterations; ++i) {
+						CommonMessage msg(std::move(*source));
+						sink += msg.GetCommonDataLen();
+						*source = std::move(msg);
+					}
+					gMicroSink.fetch_add(sink, std::memory_order_relaxed);
+				}, nullptr });
+		}
+	}
+
+	static void AddMoveDequeCases(std::vector<MicroCase>& cases) {
+		std::string payload(MICRO_PAYLOAD_SIZES[0], 'x');
+		for (size_t batch : MICRO_BATCH_SIZES) {
+			// each iteration moves the whole batch forth and back.
+			auto list = std::make_shared<std::deque<CommonMessage>>(batch);
+			for (auto& msg : *list) msg.SetTcpData(payload.data(), false, static_cast<uint32_t>(payload.size()));
+			auto other = std::make_shared<std::deque<CommonMessage>>();
+			cases.emplace_back(MicroCase{ "move_deque/" + std::to_string(batch), 1u, batch * 2u,
+				[list, other](MicroState&, size_t, uint64_t iterations) -> void {
+					for (uint64_t i = 0; i < iterations; ++i) {
+						CommonOpers::MoveDeque(*list, *other);
+						CommonOpers::MoveDeque(*other, *list);
+					}
+					gMicroSink.fetch_add(list->size(), std::memory_order_relaxed);
+				}, nullptr });
+		}
+	}
+
+	/// <summary>
+	/// A state machine in Running state and its reporter, shared by all threads like the reporter of a module.
+	/// </summary>
+	struct MicroStateMachine {
+		MicroStateMachine() : mCore(StateMachine::Ready), mReporter(mCore) {
+			StateMachine::TransitionInitializing transition(mCore);
+		}
+		StateMachine::StateMachineCore mCore;
+		StateMachine::StateMachineReporter mReporter;
+	};
+
+	static void AddStateMachineCases(std::vector<MicroCase>& cases) {
+		for (size_t threads : { 1u, 4u, 16u }) {
+			auto sm = std::make_shared<MicroStateMachine>();
+			cases.emplace_back(MicroCase{ "is_in_state/" + std::to_string(threads), threads, 1u,
+				[sm](MicroState&, size_t, uint64_t iterations) -> void {
+					uint64_t sink = 0u;
+					for (uint64_t i = 0; i < iterations; ++i) {
+						if (sm->mReporter.IsInState(StateMachine::Running)) ++sink;
+					}
+					gMicroSink.fetch_add(sink, std::memory_order_relaxed);
+				}, nullptr });
+		}
+
+		// state machines can only transition once, so fresh ones are prepared with timer paused.
+		auto pool = std::make_shared<std::vector<std::optional<StateMachine::StateMachineCore>>>(MICRO_TRANSITION_POOL);
+		cases.emplace_back(MicroCase{ "transition/initializing", 1u, 1u,
+			[pool](MicroState& state, size_t, uint64_t iterations) -> void {
+				for (uint64_t done = 0u; done < iterations;) {
+					size_t count = static_cast<size_t>(std::min(iterations - done, static_cast<uint64_t>(MICRO_TRANSITION_POOL)));
+					state.PauseTiming();
+					for (size_t k = 0; k < count; ++k) (*pool)[k].emplace(StateMachine::Ready);
+					state.ResumeTiming();
+					for (size_t k = 0; k < count; ++k) {
+						StateMachine::TransitionInitializing transition(*(*pool)[k]);
+					}
+					done += count;
+				}
+			}, nullptr });
+		cases.emplace_back(MicroCase{ "transition/stopping", 1u, 1u,
+			[pool](MicroState& state, size_t, uint64_t iterations) -> void {
+				for (uint64_t done = 0u; done < iterations;) {
+					size_t count = static_cast<size_t>(std::min(iterations - done, static_cast<uint64_t>(MICRO_TRANSITION_POOL)));
+					state.PauseTiming();
+					for (size_t k = 0; k < count; ++k) {
+						(*pool)[k].emplace(StateMachine::Ready);
+						StateMachine::TransitionInitializing transition(*(*pool)[k]);
+					}
+					state.ResumeTiming();
+					for (size_t k = 0; k < count; ++k) {
+						StateMachine::TransitionStopping transition(*(*pool)[k]);
+					}
+					done += count;
+				}
+			}, nullptr });
+	}
+
+	static void AddIndexDistributorCases(std::vector<MicroCase>& cases) {
+		for (size_t threads : { 1u, 4u }) {
+			auto distributor = std::make_shared<IndexDistributor>();
+			cases.emplace_back(MicroCase{ "index_distributor/" + std::to_string(threads), threads, 1u,
+				[distributor](MicroState&, size_t, uint64_t iterations) -> void {
+					uint64_t sink = 0u;
+					for (uint64_t i = 0; i < iterations; ++i) {
+						IndexDistributor::Index_t index = distributor->Get();
+						sink += index;
+						distributor->Return(index);
+					}
+					gMicroSink.fetch_add(sink, std::memory_order_relaxed);
+				}, nullptr });
+		}
+	}
+
+	static void AddPrintfCases(std::vector<MicroCase>& cases, OutputHelper* output) {
+		for (size_t threads : { 1u, 4u }) {
+			auto latency = std::make_shared<LatencyHistogram>();
+			LatencyHistogram* histogram = latency.get();
+			cases.emplace_back(MicroCase{ "printf/" + std::to_string(threads), threads, 1u,
+				[output, histogram](MicroState&, size_t thread, uint64_t iterations) -> void {
+					for (uint64_t i = 0; i < iterations; ++i) {
+						uint64_t start = CommonOpers::GetMonotonicTime();
+						output->Printf(OutputHelper::Component::BridgeInstance, thread, "Micro benchmark line %" PRIu64 " of %s.", i, "printf");
+						histogram->RecordSince(start);
+					}
+				}, std::move(latency) });
+		}
+	}
+
+#pragma endregion
+
+	int RunMicro(const BenchArgs& args) {
+		uint64_t min_time = args.GetUnsigned("min-time", 200u) * UINT64_C(1000000);
+		uint64_t repetitions = std::max(args.GetUnsigned("repetitions", 5u), static_cast<uint64_t>(1u));
+		std::string filter(args.GetString("filter", ""));
+		if (min_time == 0u) {
+			fputs("Invalid --min-time.\n", stderr);
+			return 1;
+		}
+
+		// Printf cases flood the log, so it always goes into file.
+		OutputHelper output;
+		std::string log_file(args.GetString("log-file", "AbyssBench.log"));
+		if (!output.OpenLogFile(log_file.c_str())) {
+			fprintf(stderr, "Fail to open log file: %s\n", log_file.c_str());
+			return 1;
+		}
+
+		std::vector<MicroCase> cases;
+		AddMessageCases(cases);
+		AddMoveDequeCases(cases);
+		AddStateMachineCases(cases);
+		AddIndexDistributorCases(cases);
+		AddPrintfCases(cases, &output);
+
+		JsonWriter json;
+		json.BeginObject()
+			.Value("mode", "micro")
+			.BeginObject("config")
+			.Value("min_time_ms", min_time / UINT64_C(1000000))
+			.Value("repetitions", repetitions)
+			.Value("hardware_threads", static_cast<uint64_t>(std::thread::hardware_concurrency()))
+			.EndObject()
+			.BeginArray("cases");
+
+		for (const auto& c : cases) {
+			if (!filter.empty() && c.mName.find(filter) == std::string::npos) continue;
+
+			// calibration runs also warm up caches and allocator.
+			// they are recorded into latency too, because histogram can not be reset.
+			uint64_t iterations = CalibrateMicroCase(c, min_time);
+			std::vector<double> ns_per_op;
+			for (uint64_t r = 0; r < repetitions; ++r) {
+				uint64_t elapsed = RunMicroBatch(c, iterations);
+				ns_per_op.emplace_back(static_cast<double>(elapsed) / iterations);
+			}
+			std::sort(ns_per_op.begin(), ns_per_op.end());
+			double median = ns_per_op[ns_per_op.size() / 2u];
+
+			json.BeginObject()
+				.Value("name", c.mName)
+				.Value("threads", static_cast<uint64_t>(c.mThreads))
+				.Value("iterations", iterations)
+				.Value("items_per_op", c.mItemsPerOp)
+				.BeginObject("ns_per_op")
+				.Value("median", median)
+				.Value("min", ns_per_op.front())
+				.Value("max", ns_per_op.back())
+				.EndObject()
+				.Value("ns_per_item", median / c.mItemsPerOp)
+				.Value("ops_per_s", 1e9 / median * c.mThreads);
+			if (c.mLatency != nullptr) WriteLatency(json, "latency", *c.mLatency);
+			json.EndObject();
+			fprintf(stderr, "%-28s %12.2f ns/op (min %.2f, max %.2f) x %zu threads\n",
+				c.mName.c_str(), median, ns_per_op.front(), ns_per_op.back(), c.mThreads);
+		}
+
+		output.Flush();
+		OutputHelperProfile log_profile = output.ReportStatus();
+		json.EndArray()
+			.Value("printf_dropped_lines", log_profile.mDroppedLines)
+			.EndObject();
+
+		if (!WriteResult(args.GetString("output", ""), json)) {
+			fputs("Fail to write result.\n", stderr);
+			return 1;
+		}
+		return 0;
+	}
+
+}
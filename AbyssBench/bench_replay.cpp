@@ -0,0 +1,283 @@
+#include "benchmarks.hpp"
+#include "bench_client.hpp"
+#include "stand_in_server.hpp"
+#include "capture_layout.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <unordered_map>
+
+namespace AbyssBench {
+
+	/// <summary>
+	/// How long replay waits after all bridges are connected,
+	/// so the last bridges have finished their setup before the first record is sent.
+	/// </summary>
+	constexpr const std::chrono::milliseconds REPLAY_SETTLE_TIME(500);
+	/// <summary>
+	/// How long replay keeps receiving after the last record is sent.
+	/// </summary>
+	constexpr const std::chrono::milliseconds REPLAY_DRAIN_TIME(1000);
+	/// <summary>
+	/// Replay sleeps only when the next record is due later than it, and busy sends otherwise.
+	/// </summary>
+	constexpr const std::chrono::microseconds REPLAY_SLEEP_THRESHOLD(200);
+	/// <summary>
+	/// How often queue pressure of proxy is sampled while replaying.
+	/// </summary>
+	constexpr const std::chrono::milliseconds REPLAY_PRESSURE_INTERVAL(100);
+
+	/// <summary>
+	/// A record found in capture file. Payload points into the mapped file.
+	/// </summary>
+	struct ReplayRecord {
+		uint64_t mTimestamp;
+		size_t mBridge;	// the index of bridge in replay, not the index in capture
+		const uint8_t* mPayload;
+		uint32_t mLength;
+		CaptureDirection mDirection;
+		bool mIsReliable;
+	};
+
+	/// <summary>
+	/// Scan all records of file and group bridges in the order they first appeared.
+	/// </summary>
+	/// <returns>False if file is not a capture file.</returns>
+	static bool ScanCapture(const MappedFile& file, std::vector<ReplayRecord>& records, size_t& bridge_count, bool& is_truncated) {
+		const uint8_t* p = file.GetData();
+		size_t remain = file.GetSize();
+		if (remain < sizeof(CaptureFileHeader)) return false;
+		CaptureFileHeader file_header;
+		memcpy(&file_header, p, sizeof(CaptureFileHeader));
+		if (file_header.mMagic != CAPTURE_FILE_MAGIC || file_header.mVersion != CAPTURE_FILE_VERSION) return false;
+		p += sizeof(CaptureFileHeader);
+		remain -= sizeof(CaptureFileHeader);
+
+		std::unordered_map<uint64_t, size_t> bridges;
+		records.clear();
+		is_truncated = false;
+		while (remain != 0u) {
+			CaptureRecordHeader header;
+			if (remain < sizeof(CaptureRecordHeader)) {
+				is_truncated = true;
+				break;
+			}
+			memcpy(&header, p, sizeof(CaptureRecordHeader));
+			if (remain - sizeof(CaptureRecordHeader) < header.mLength) {
+				is_truncated = true;
+				break;
+			}
+
+			auto [it, is_new] = bridges.try_emplace(header.mBridgeIndex, bridges.size());
+			records.emplace_back(ReplayRecord{
+				header.mTimestamp, it->second, p + sizeof(CaptureRecordHeader), header.mLength,
+				static_cast<CaptureDirection>(header.mDirection), header.mIsReliable != 0u
+			});
+			p += sizeof(CaptureRecordHeader) + header.mLength;
+			remain -= sizeof(CaptureRecordHeader) + header.mLength;
+		}
+		bridge_count = bridges.size();
+
+		// bridges append their batch independently, so file order is only roughly the time order.
+		std::stable_sort(records.begin(), records.end(), [](const ReplayRecord& lhs, const ReplayRecord& rhs) -> bool {
+			return lhs.mTimestamp < rhs.mTimestamp;
+		});
+		return true;
+	}
+
+	int RunReplay(const BenchArgs& args) {
+		std::string capture_file(args.GetString("capture", ""));
+		uint64_t speed = args.GetUnsigned("speed", 1u);
+		uint64_t io_threads = std::max(args.GetUnsigned("io-threads", 2u), static_cast<uint64_t>(1u));
+		uint16_t proxy_port = static_cast<uint16_t>(args.GetUnsigned("proxy-port", BENCH_PROXY_PORT));
+		uint16_t server_port = static_cast<uint16_t>(args.GetUnsigned("server-port", BENCH_SERVER_PORT));
+		if (capture_file.empty()) {
+			fputs("Missing --capture.\n", stderr);
+			return 1;
+		}
+
+		// load capture
+		MappedFile file;
+		if (!file.Open(capture_file.c_str())) {
+			fprintf(stderr, "Fail to open capture file: %s\n", capture_file.c_str());
+			return 1;
+		}
+		std::vector<ReplayRecord> records;
+		size_t bridge_count = 0u;
+		bool is_truncated = false;
+		if (!ScanCapture(file, records, bridge_count, is_truncated)) {
+			fprintf(stderr, "Not a capture file or unsupported version: %s\n", capture_file.c_str());
+			return 1;
+		}
+		if (records.empty()) {
+			fputs("Capture file has no record.\n", stderr);
+			return 1;
+		}
+		uint64_t record_count[2]{ 0u, 0u }, record_bytes[2]{ 0u, 0u };
+		for (const auto& record : records) {
+			size_t direction = static_cast<size_t>(record.mDirection) & 1u;
+			++record_count[direction];
+			record_bytes[direction] += record.mLength;
+		}
+		uint64_t captured_duration = records.back().mTimestamp - records.front().mTimestamp;
+		fprintf(stderr, "Loaded %zu records of %zu bridges, %.3fs captured%s.\n",
+			records.size(), bridge_count, captured_duration / 1e9, is_truncated ? ", truncated tail ignored" : "");
+
+		// start the proxy under test and the server behind it
+		OutputHelper output;
+		std::string log_file(args.GetString("log-file", "AbyssBench.log"));
+		if (!output.OpenLogFile(log_file.c_str())) {
+			fprintf(stderr, "Fail to open log file: %s\n", log_file.c_str());
+			return 1;
+		}
+		BenchProxy proxy(&output);
+		std::string impairment;
+		if (!LoadImpairment(args, proxy.mSettings, impairment)) return 1;
+		if (!proxy.Start(proxy_port)) {
+			fputs("Fail to start WhispersAbyss.\n", stderr);
+			return 1;
+		}
+		StandInServer server(&output);
+		if (!server.StartSink(server_port)) {
+			fputs("Fail to start stand-in server.\n", stderr);
+			return 1;
+		}
+
+		asio::io_context ctx;
+		auto work_guard = asio::make_work_guard(ctx);
+		std::vector<std::jthread> td_io;
+		for (uint64_t i = 0; i < io_threads; ++i) {
+			td_io.emplace_back([&ctx]() -> void { ctx.run(); });
+		}
+
+		// connect bridges one by one, so each new server connection belongs to the bridge just started.
+		asio::ip::tcp::endpoint proxy_endpoint(asio::ip::make_address("127.0.0.1"), proxy_port);
+		std::string url("127.0.0.1:" + std::to_string(server_port));
+		std::atomic_uint64_t client_received(0u), client_received_bytes(0u);
+		std::vector<std::shared_ptr<BenchClient>> clients;
+		std::vector<HSteamNetConnection> server_conns;
+		bool is_success = true;
+		for (size_t i = 0; i < bridge_count; ++i) {
+			auto client = std::make_shared<BenchClient>(ctx, i,
+				[&client_received, &client_received_bytes](BenchClient*, const uint8_t*, uint32_t len, bool) -> void {
+					client_received.fetch_add(1u, std::memory_order_relaxed);
+					client_received_bytes.fetch_add(len, std::memory_order_relaxed);
+				});
+			client->Start(proxy_endpoint, url);
+			clients.emplace_back(std::move(client));
+
+			auto warmup_end = std::chrono::steady_clock::now() + BENCH_WARMUP_TIMEOUT;
+			while (server.GetConnectionCount() <= i && std::chrono::steady_clock::now() < warmup_end) {
+				std::this_thread::sleep_for(SPIN_INTERVAL);
+			}
+			auto conns = server.GetConnections();
+			if (conns.size() <= i) {
+				fprintf(stderr, "Bridge %zu did not connect to stand-in server.\n", i);
+				is_success = false;
+				break;
+			}
+			server_conns.emplace_back(conns[i]);
+		}
+
+		JsonWriter json;
+		json.BeginObject()
+			.Value("mode", "replay")
+			.BeginObject("config")
+			.Value("capture", capture_file)
+			.Value("speed", speed)
+			.Value("bridges", static_cast<uint64_t>(bridge_count))
+			.Value("truncated", is_truncated)
+			.Value("impairment", impairment)
+			.EndObject();
+
+		if (is_success) {
+			std::this_thread::sleep_for(REPLAY_SETTLE_TIME);
+
+			// replay in time order from a single thread.
+			// lateness is how far each record is sent behind its schedule.
+			fprintf(stderr, "Replaying at %s...\n", speed == 0u ? "maximum speed" : (std::to_string(speed) + "x").c_str());
+			LatencyHistogram lateness;
+			PressureTracker pressure;
+			ProcessUsage usage_start = SampleProcessUsage();
+			auto replay_start = std::chrono::steady_clock::now();
+			auto next_pressure = replay_start + REPLAY_PRESSURE_INTERVAL;
+			uint64_t first_timestamp = records.front().mTimestamp;
+			for (const auto& record : records) {
+				if (speed != 0u) {
+					auto due = replay_start + std::chrono::nanoseconds((record.mTimestamp - first_timestamp) / speed);
+					auto now = std::chrono::steady_clock::now();
+					if (due - now > REPLAY_SLEEP_THRESHOLD) std::this_thread::sleep_until(due);
+					now = std::chrono::steady_clock::now();
+					lateness.Record(now > due ? static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - due).count()) : 0u);
+				}
+				if (std::chrono::steady_clock::now() >= next_pressure) {
+					next_pressure += REPLAY_PRESSURE_INTERVAL;
+					pressure.Sample(proxy);
+				}
+
+				if (record.mDirection == CaptureDirection::Tcp2Gns) {
+					clients[record.mBridge]->SendData(record.mPayload, record.mLength, record.mIsReliable);
+				} else {
+					server.Send(server_conns[record.mBridge], record.mPayload, record.mLength, record.mIsReliable);
+				}
+			}
+			double replay_duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - replay_start).count();
+			std::this_thread::sleep_for(REPLAY_DRAIN_TIME);
+			// the last sample has the latency inside bridges of every replayed message.
+			pressure.Sample(proxy);
+			ProcessUsage usage_end = SampleProcessUsage();
+			double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - replay_start).count();
+
+			uint64_t failed_clients = 0u;
+			for (auto& client : clients) {
+				if (client->IsFailed()) ++failed_clients;
+			}
+			double cpu_seconds = usage_end.mCpuSeconds - usage_start.mCpuSeconds;
+			json.BeginObject("records")
+				.Value("tcp2gns", record_count[0])
+				.Value("tcp2gns_bytes", record_bytes[0])
+				.Value("gns2tcp", record_count[1])
+				.Value("gns2tcp_bytes", record_bytes[1])
+				.EndObject()
+				.Value("captured_duration_s", captured_duration / 1e9)
+				.Value("replay_duration_s", replay_duration)
+				.Value("msg_per_s", records.size() / replay_duration);
+			// lateness is the scheduling slip of replayer itself, not the latency of proxy, which is in pressure.
+			if (speed != 0u) WriteLatency(json, "lateness", lateness);
+			pressure.Write(json, "pressure");
+			json.Value("server_received", server.GetRecvCount())
+				.Value("server_sent", server.GetSendCount())
+				.Value("client_received", client_received.load())
+				.Value("client_received_bytes", client_received_bytes.load())
+				.Value("failed_clients", failed_clients)
+				.Value("cpu_seconds", cpu_seconds)
+				.Value("cpu_percent", cpu_seconds / elapsed * 100.0)
+				.Value("threads", usage_end.mThreadCount)
+				.Value("rss_bytes", usage_end.mRssBytes);
+			fprintf(stderr, "Replayed %zu records in %.3fs: server received %" PRIu64 ", clients received %" PRIu64 ", %.1f%% CPU.\n",
+				records.size(), replay_duration, server.GetRecvCount(), client_received.load(), cpu_seconds / elapsed * 100.0);
+		}
+		json.EndObject();
+
+		// stop in reverse order.
+		for (auto& client : clients) client->Close();
+		CountDownTimer closing(MODULE_WAITING_INTERVAL);
+		while (server.GetConnectionCount() != 0u && !closing.HasRunOutOfTime()) {
+			std::this_thread::sleep_for(SPIN_INTERVAL);
+		}
+		work_guard.reset();
+		ctx.stop();
+		td_io.clear();
+		server.Stop();
+		proxy.Stop();
+		output.Flush();
+
+		if (!WriteResult(args.GetString("output", ""), json)) {
+			fputs("Fail to write result.\n", stderr);
+			return 1;
+		}
+		return is_success ? 0 : 1;
+	}
+
+}
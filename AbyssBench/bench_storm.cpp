@@ -0,0 +1,334 @@
+#include "benchmarks.hpp"
+#include "bench_client.hpp"
+#include "stand_in_server.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <random>
+#include <thread>
+
+namespace AbyssBench {
+
+	/// <summary>
+	/// The payload sent by every session once, echoed by stand-in server.
+	/// </summary>
+	struct StormProbe {
+		uint32_t mOpcode;	// always BENCH_OPCODE
+		uint32_t mReserved;
+		uint64_t mOpenTime;	// CommonOpers::GetMonotonicTime() when session opened
+	};
+	/// <summary>
+	/// How often the storm loop opens and closes due sessions.
+	/// </summary>
+	constexpr const std::chrono::milliseconds STORM_TICK(10);
+	/// <summary>
+	/// Growth is checked on the mean of this many equal windows of samples.
+	/// </summary>
+	constexpr const size_t STORM_GROWTH_WINDOWS = 4u;
+	/// <summary>
+	/// The least samples per window for growth check. Shorter runs skip it.
+	/// </summary>
+	constexpr const size_t STORM_GROWTH_MIN_SAMPLES = 2u;
+	/// <summary>
+	/// Growth smaller than these is treated as noise, whatever the tolerance is.
+	/// </summary>
+	constexpr const double STORM_GROWTH_MIN_RSS = 4.0 * 1024.0 * 1024.0;
+	constexpr const double STORM_GROWTH_MIN_COUNT = 8.0;
+
+	/// <summary>
+	/// Written by io threads.
+	/// </summary>
+	struct StormCounters {
+		StormCounters() : mEchoed(0u), mOpenToEcho() {}
+
+		std::atomic_uint64_t mEchoed;
+		LatencyHistogram mOpenToEcho;
+	};
+
+	struct StormSample {
+		double mTime;	// seconds since storm started
+		uint64_t mThreads, mRssBytes, mBridges, mDisposals;
+	};
+
+	/// <summary>
+	/// Check whether given figure keep growing through the run.
+	/// Samples are split into STORM_GROWTH_WINDOWS windows, and a figure is growing
+	/// if the mean of every window is higher than the previous one and the total rise is over tolerance and min_delta.
+	/// </summary>
+	/// <returns>Empty if not growing, otherwise the description of growth.</returns>
+	static std::string CheckGrowth(const char* name, const std::vector<StormSample>& samples, uint64_t StormSample::* field, double tolerance, double min_delta) {
+		size_t window_size = samples.size() / STORM_GROWTH_WINDOWS;
+		double means[STORM_GROWTH_WINDOWS];
+		for (size_t w = 0; w < STORM_GROWTH_WINDOWS; ++w) {
+			double sum = 0.0;
+			for (size_t i = w * window_size; i < (w + 1u) * window_size; ++i) sum += static_cast<double>(samples[i].*field);
+			means[w] = sum / window_size;
+		}
+
+		for (size_t w = 1; w < STORM_GROWTH_WINDOWS; ++w) {
+			if (means[w] <= means[w - 1u]) return std::string();
+		}
+		double delta = means[STORM_GROWTH_WINDOWS - 1u] - means[0];
+		if (delta < min_delta || delta < means[0] * tolerance) return std::string();
+
+		std::string desc;
+		CommonOpers::AppendStrF(desc, "%s keeps growing: window means", name);
+		for (size_t w = 0; w < STORM_GROWTH_WINDOWS; ++w) CommonOpers::AppendStrF(desc, " %.0f", means[w]);
+		return desc;
+	}
+
+	int RunStorm(const BenchArgs& args) {
+		uint64_t rate = args.GetUnsigned("rate", 1000u);
+		uint64_t lifetime_min = args.GetUnsigned("lifetime-min", 500u);
+		uint64_t lifetime_max = std::max(args.GetUnsigned("lifetime-max", 2000u), lifetime_min);
+		uint64_t duration = args.GetUnsigned("duration", 60u);
+		uint64_t max_sessions = args.GetUnsigned("max-sessions", 10000u);
+		uint64_t sample_interval = std::max(args.GetUnsigned("sample-interval", 5u), static_cast<uint64_t>(1u));
+		bool is_abortive = args.GetUnsigned("abortive-close", 1u) != 0u;
+		double growth_tolerance = args.GetUnsigned("growth-tolerance", 10u) / 100.0;
+		uint64_t drain_timeout = args.GetUnsigned("drain-timeout", 30u);
+		uint64_t seed = args.GetUnsigned("seed", 1u);
+		uint64_t io_threads = std::max(args.GetUnsigned("io-threads", 2u), static_cast<uint64_t>(1u));
+		uint16_t proxy_port = static_cast<uint16_t>(args.GetUnsigned("proxy-port", BENCH_PROXY_PORT));
+		uint16_t server_port = static_cast<uint16_t>(args.GetUnsigned("server-port", BENCH_SERVER_PORT));
+		if (rate == 0u || duration == 0u || max_sessions == 0u) {
+			fputs("Invalid --rate, --duration or --max-sessions.\n", stderr);
+			return 1;
+		}
+
+		// start the proxy under test and the server behind it
+		OutputHelper output;
+		std::string log_file(args.GetString("log-file", "AbyssBench.log"));
+		if (!output.OpenLogFile(log_file.c_str())) {
+			fprintf(stderr, "Fail to open log file: %s\n", log_file.c_str());
+			return 1;
+		}
+		BenchProxy proxy(&output);
+		std::string impairment;
+		if (!LoadImpairment(args, proxy.mSettings, impairment)) return 1;
+		if (!proxy.Start(proxy_port)) {
+			fputs("Fail to start WhispersAbyss.\n", stderr);
+			return 1;
+		}
+		StandInServer server(&output);
+		if (!server.Start(server_port, 1u)) {
+			fputs("Fail to start stand-in server.\n", stderr);
+			return 1;
+		}
+
+		asio::io_context ctx;
+		auto work_guard = asio::make_work_guard(ctx);
+		std::vector<std::jthread> td_io;
+		for (uint64_t i = 0; i < io_threads; ++i) {
+			td_io.emplace_back([&ctx]() -> void { ctx.run(); });
+		}
+
+		asio::ip::tcp::endpoint proxy_endpoint(asio::ip::make_address("127.0.0.1"), proxy_port);
+		std::string url("127.0.0.1:" + std::to_string(server_port));
+		std::mt19937_64 random(seed);
+		std::uniform_int_distribution<uint64_t> lifetime_dist(lifetime_min, lifetime_max);
+		auto counters = std::make_shared<StormCounters>();
+
+		JsonWriter json;
+		json.BeginObject()
+			.Value("mode", "storm")
+			.BeginObject("config")
+			.Value("rate", rate)
+			.Value("lifetime_min_ms", lifetime_min)
+			.Value("lifetime_max_ms", lifetime_max)
+			.Value("duration_s", duration)
+			.Value("max_sessions", max_sessions)
+			.Value("abortive_close", is_abortive)
+			.Value("impairment", impairment)
+			.EndObject()
+			.BeginArray("timeline");
+
+		// the baseline is taken after everything except sessions has started.
+		ProcessUsage baseline = SampleProcessUsage();
+		std::vector<StormSample> samples;
+		uint64_t opened = 0u, closed = 0u, failed = 0u, skipped = 0u;
+		uint64_t peak_threads = baseline.mThreadCount, peak_rss = baseline.mRssBytes, peak_bridges = 0u, peak_disposals = 0u;
+		std::multimap<std::chrono::steady_clock::time_point, std::shared_ptr<BenchClient>> sessions;
+		auto close_session = [&sessions, &closed, &failed, is_abortive](decltype(sessions)::iterator it) -> decltype(sessions)::iterator {
+			if (it->second->IsFailed()) ++failed;
+			it->second->Close(is_abortive);
+			++closed;
+			return sessions.erase(it);
+		};
+
+		fprintf(stderr, "Opening %" PRIu64 " sessions per second for %" PRIu64 "s...\n", rate, duration);
+		ProcessUsage usage_last = baseline;
+		auto storm_start = std::chrono::steady_clock::now();
+		auto storm_end = storm_start + std::chrono::seconds(duration);
+		auto next_sample = storm_start + std::chrono::seconds(sample_interval);
+		while (true) {
+			auto now = std::chrono::steady_clock::now();
+			if (now >= storm_end) break;
+
+			// close expired sessions, then open due ones
+			for (auto it = sessions.begin(); it != sessions.end() && it->first <= now;) {
+				it = close_session(it);
+			}
+			uint64_t due = static_cast<uint64_t>(std::chrono::duration<double>(now - storm_start).count() * rate);
+			for (; opened + skipped < due; ) {
+				if (sessions.size() >= max_sessions) {
+					++skipped;
+					continue;
+				}
+				auto client = std::make_shared<BenchClient>(ctx, static_cast<size_t>(opened),
+					[counters](BenchClient*, const uint8_t* payload, uint32_t len, bool) -> void {
+						if (len < sizeof(StormProbe)) return;
+						StormProbe probe;
+						memcpy(&probe, payload, sizeof(StormProbe));
+						if (probe.mOpcode != BENCH_OPCODE) return;
+						counters->mEchoed.fetch_add(1u, std::memory_order_relaxed);
+						counters->mOpenToEcho.RecordSince(probe.mOpenTime);
+					});
+				client->Start(proxy_endpoint, url);
+				// queued until connected, so it also tells whether the whole chain worked.
+				StormProbe probe{ BENCH_OPCODE, 0u, CommonOpers::GetMonotonicTime() };
+				client->SendData(&probe, sizeof(StormProbe), true);
+				sessions.emplace(now + std::chrono::milliseconds(lifetime_dist(random)), std::move(client));
+				++opened;
+			}
+
+			// sample
+			if (now >= next_sample) {
+				next_sample += std::chrono::seconds(sample_interval);
+				ProcessUsage usage = SampleProcessUsage();
+				BridgeFactoryHealth health = proxy.ReportHealth();
+				uint64_t disposals = health.mBridgeDisposals + health.mTcpDisposals + health.mGnsDisposals;
+				double elapsed = std::chrono::duration<double>(now - storm_start).count();
+				double cpu_percent = (usage.mCpuSeconds - usage_last.mCpuSeconds) / sample_interval * 100.0;
+				usage_last = usage;
+				samples.emplace_back(StormSample{ elapsed, usage.mThreadCount, usage.mRssBytes, health.mBridges, disposals });
+				peak_threads = std::max(peak_threads, usage.mThreadCount);
+				peak_rss = std::max(peak_rss, usage.mRssBytes);
+				peak_bridges = std::max(peak_bridges, static_cast<uint64_t>(health.mBridges));
+				peak_disposals = std::max(peak_disposals, disposals);
+
+				json.BeginObject()
+					.Value("t", elapsed)
+					.Value("opened", opened)
+					.Value("closed", closed)
+					.Value("sessions", static_cast<uint64_t>(sessions.size()))
+					.Value("failed", failed)
+					.Value("echoed", counters->mEchoed.load())
+					.Value("bridges", static_cast<uint64_t>(health.mBridges))
+					.Value("bridge_disposals", static_cast<uint64_t>(health.mBridgeDisposals))
+					.Value("tcp_disposals", static_cast<uint64_t>(health.mTcpDisposals))
+					.Value("gns_disposals", static_cast<uint64_t>(health.mGnsDisposals))
+					.Value("server_connections", static_cast<uint64_t>(server.GetConnectionCount()))
+					.Value("cpu_percent", cpu_percent)
+					.Value("threads", usage.mThreadCount)
+					.Value("rss_bytes", usage.mRssBytes)
+					.EndObject();
+				fprintf(stderr, "%8.0fs: %" PRIu64 " opened, %zu alive, %zu bridges, %" PRIu64 " waiting disposal, %" PRIu64 " threads, %.1f MB, %.1f%% CPU\n",
+					elapsed, opened, sessions.size(), health.mBridges, disposals, usage.mThreadCount, usage.mRssBytes / 1048576.0, cpu_percent);
+			}
+
+			std::this_thread::sleep_for(STORM_TICK);
+		}
+		json.EndArray();
+
+		// close all and wait proxy to dispose everything
+		fputs("Closing all sessions and waiting for disposal...\n", stderr);
+		for (auto it = sessions.begin(); it != sessions.end();) {
+			it = close_session(it);
+		}
+		auto drain_start = std::chrono::steady_clock::now();
+		auto drain_end = drain_start + std::chrono::seconds(drain_timeout);
+		BridgeFactoryHealth health;
+		while (true) {
+			health = proxy.ReportHealth();
+			bool is_drained = health.mBridges == 0u && health.mBridgeDisposals == 0u && health.mTcpDisposals == 0u &&
+				health.mGnsDisposals == 0u && server.GetConnectionCount() == 0u;
+			if (is_drained || std::chrono::steady_clock::now() >= drain_end) break;
+			std::this_thread::sleep_for(SPIN_INTERVAL);
+		}
+		double drain_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - drain_start).count();
+		ProcessUsage usage_end = SampleProcessUsage();
+
+		// judge
+		std::vector<std::string> failures;
+		size_t server_connections = server.GetConnectionCount();
+		if (health.mBridges != 0u || server_connections != 0u) {
+			std::string desc;
+			CommonOpers::AppendStrF(desc, "%zu bridges and %zu server connections still alive after all sessions closed",
+				health.mBridges, server_connections);
+			failures.emplace_back(std::move(desc));
+		}
+		if (health.mBridgeDisposals != 0u || health.mTcpDisposals != 0u || health.mGnsDisposals != 0u) {
+			std::string desc;
+			CommonOpers::AppendStrF(desc, "instances still waiting disposal after all sessions closed: %zu bridges, %zu TCP, %zu GNS",
+				health.mBridgeDisposals, health.mTcpDisposals, health.mGnsDisposals);
+			failures.emplace_back(std::move(desc));
+		}
+		if (usage_end.mThreadCount > baseline.mThreadCount) {
+			std::string desc;
+			CommonOpers::AppendStrF(desc, "thread count grew from %" PRIu64 " to %" PRIu64 " after all sessions closed",
+				baseline.mThreadCount, usage_end.mThreadCount);
+			failures.emplace_back(std::move(desc));
+		}
+		// the first quarter is ramping up, so only the rest is checked.
+		std::vector<StormSample> steady(samples.begin() + samples.size() / 4u, samples.end());
+		bool is_growth_checked = steady.size() >= STORM_GROWTH_WINDOWS * STORM_GROWTH_MIN_SAMPLES;
+		if (is_growth_checked) {
+			for (auto desc : {
+				CheckGrowth("RSS", steady, &StormSample::mRssBytes, growth_tolerance, STORM_GROWTH_MIN_RSS),
+				CheckGrowth("thread count", steady, &StormSample::mThreads, growth_tolerance, STORM_GROWTH_MIN_COUNT),
+				CheckGrowth("bridge count", steady, &StormSample::mBridges, growth_tolerance, STORM_GROWTH_MIN_COUNT),
+				CheckGrowth("disposal backlog", steady, &StormSample::mDisposals, growth_tolerance, STORM_GROWTH_MIN_COUNT) }) {
+				if (!desc.empty()) failures.emplace_back(std::move(desc));
+			}
+		}
+
+		json.Value("opened", opened)
+			.Value("closed", closed)
+			.Value("skipped", skipped)
+			.Value("failed", failed)
+			.Value("echoed", counters->mEchoed.load())
+			.Value("open_rate", opened / static_cast<double>(duration));
+		WriteLatency(json, "accept_to_running", health.mSetupTotal);
+		WriteLatency(json, "open_to_echo", counters->mOpenToEcho);
+		json.BeginObject("peak")
+			.Value("threads", peak_threads)
+			.Value("rss_bytes", peak_rss)
+			.Value("bridges", peak_bridges)
+			.Value("disposals", peak_disposals)
+			.EndObject()
+			.BeginObject("after_drain")
+			.Value("drain_s", drain_time)
+			.Value("threads", usage_end.mThreadCount)
+			.Value("baseline_threads", baseline.mThreadCount)
+			.Value("rss_bytes", usage_end.mRssBytes)
+			.Value("baseline_rss_bytes", baseline.mRssBytes)
+			.EndObject()
+			.Value("growth_checked", is_growth_checked)
+			.BeginArray("failures");
+		for (const auto& desc : failures) {
+			json.BeginObject().Value("reason", desc).EndObject();
+			fprintf(stderr, "FAIL: %s\n", desc.c_str());
+		}
+		json.EndArray().EndObject();
+		fprintf(stderr, "%" PRIu64 " sessions opened, %" PRIu64 " echoed, %" PRIu64 " failed, %" PRIu64 " skipped. %s\n",
+			opened, counters->mEchoed.load(), failed, skipped, failures.empty() ? "PASS" : "FAIL");
+		if (!is_growth_checked) fputs("Too few samples to check growth. Run longer or lower --sample-interval.\n", stderr);
+
+		// stop in reverse order.
+		work_guard.reset();
+		ctx.stop();
+		td_io.clear();
+		server.Stop();
+		proxy.Stop();
+		output.Flush();
+
+		if (!WriteResult(args.GetString("output", ""), json)) {
+			fputs("Fail to write result.\n", stderr);
+			return 1;
+		}
+		return failures.empty() ? 0 : 1;
+	}
+
+}
@@ -0,0 +1,361 @@
+#include "benchmarks.hpp"
+#include "bench_client.hpp"
+#include "bmmo_synth.hpp"
+#include "stand_in_server.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <thread>
+
+namespace AbyssBench {
+
+	/// <summary>
+	/// How long a player waits login_accepted_v3_msg before sending login again.
+	/// </summary>
+	constexpr const std::chrono::milliseconds SWARM_LOGIN_RETRY(1000);
+	/// <summary>
+	/// The interval of timeline samples.
+	/// </summary>
+	constexpr const std::chrono::milliseconds SWARM_SAMPLE_INTERVAL(1000);
+	/// <summary>
+	/// The most ticks sent at once when the driving loop falls behind. Same as echo mode.
+	/// </summary>
+	constexpr const uint64_t SWARM_MAX_CATCHUP_TICKS = 16u;
+	/// <summary>
+	/// The count of sectors a player walks through.
+	/// </summary>
+	constexpr const uint32_t SWARM_SECTOR_COUNT = 8u;
+
+	/// <summary>
+	/// Counters shared by all players, written by io threads.
+	/// </summary>
+	struct SwarmStats {
+		SwarmStats() :
+			mOpcodes(), mLoginLatency(), mStateAge(),
+			mSentMsg(0u), mRecvMsg(0u), mOnline(0u)
+		{}
+
+		OpcodeCounters mOpcodes;
+		LatencyHistogram mLoginLatency;
+		/// <summary>
+		/// The age of the first ball state in each owned_compressed_ball_state_msg received.
+		/// Only the first one is taken, so a large lobby does not spend its CPU on histogram.
+		/// </summary>
+		LatencyHistogram mStateAge;
+		std::atomic_uint64_t mSentMsg, mRecvMsg;
+		/// <summary>
+		/// Players whose login has been accepted and who are still connected.
+		/// </summary>
+		std::atomic_uint64_t mOnline;
+	};
+
+	/// <summary>
+	/// A connection of a player, from join to leave. Shared with the data handler of its client.
+	/// </summary>
+	struct SwarmSession {
+		SwarmSession(SwarmStats* stats) :
+			mStats(stats), mLoginStart(0u), mIsAccepted(false)
+		{}
+
+		SwarmStats* mStats;
+		/// <summary>
+		/// When the first login was sent. Written by driver, read by the io thread of client.
+		/// </summary>
+		std::atomic_uint64_t mLoginStart;
+		std::atomic_bool mIsAccepted;
+	};
+
+	struct SwarmPlayer {
+		std::shared_ptr<BenchClient> mClient;
+		std::shared_ptr<SwarmSession> mSession;
+		uint64_t mSeed;
+		std::chrono::steady_clock::time_point mLeaveTime, mNextLogin;
+		uint64_t mTick, mChatCount;
+		uint32_t mSector;
+	};
+
+	static void OnSwarmData(SwarmSession* session, const uint8_t* payload, uint32_t len) {
+		SwarmStats* stats = session->mStats;
+		stats->mRecvMsg.fetch_add(1u, std::memory_order_relaxed);
+		stats->mOpcodes.Record(OpcodeDirection::Gns2Tcp, payload, len);
+
+		uint32_t opcode;
+		if (!Bmmo::PeekOpcode(payload, len, opcode)) return;
+		switch (static_cast<Bmmo::Opcode>(opcode)) {
+			case Bmmo::Opcode::LoginAcceptedV3Msg:
+			{
+				if (!session->mIsAccepted.exchange(true)) {
+					stats->mLoginLatency.RecordSince(session->mLoginStart.load());
+					stats->mOnline.fetch_add(1u);
+				}
+				break;
+			}
+			case Bmmo::Opcode::OwnedCompressedBallStateMsg:
+			{
+				uint32_t count;
+				const uint8_t* entries;
+				if (!Bmmo::ParseOwnedBallStates(payload, len, count, entries) || count == 0u) break;
+				Bmmo::OwnedBallState state;
+				memcpy(&state, entries, Bmmo::OWNED_BALL_STATE_SIZE);
+				stats->mStateAge.RecordSince(state.mState.mTimestamp);
+				break;
+			}
+			default:
+				break;
+		}
+	}
+
+	int RunSwarm(const BenchArgs& args) {
+		uint64_t player_count = args.GetUnsigned("players", 100u);
+		double ramp_up = args.GetDouble("ramp-up", 50.0);
+		uint64_t duration = args.GetUnsigned("duration", 60u);
+		uint64_t tick_rate = args.GetUnsigned("tick-rate", 30u);
+		double chat_per_minute = args.GetDouble("chat-per-minute", 2.0);
+		double sector_per_minute = args.GetDouble("sector-per-minute", 1.0);
+		double session_seconds = args.GetDouble("session", 0.0);
+		uint64_t server_tick_rate = args.GetUnsigned("server-tick-rate", 30u);
+		uint64_t seed = args.GetUnsigned("seed", 1u);
+		uint64_t io_threads = std::max(args.GetUnsigned("io-threads", 2u), static_cast<uint64_t>(1u));
+		uint16_t proxy_port = static_cast<uint16_t>(args.GetUnsigned("proxy-port", BENCH_PROXY_PORT));
+		uint16_t server_port = static_cast<uint16_t>(args.GetUnsigned("server-port", BENCH_SERVER_PORT));
+		if (player_count == 0u || ramp_up <= 0.0 || duration == 0u || tick_rate == 0u || server_tick_rate == 0u) {
+			fputs("Invalid --players, --ramp-up, --duration, --tick-rate or --server-tick-rate.\n", stderr);
+			return 1;
+		}
+
+		// start the proxy under test and the lobby behind it
+		OutputHelper output;
+		std::string log_file(args.GetString("log-file", "AbyssBench.log"));
+		if (!output.OpenLogFile(log_file.c_str())) {
+			fprintf(stderr, "Fail to open log file: %s\n", log_file.c_str());
+			return 1;
+		}
+		BenchProxy proxy(&output);
+		std::string impairment;
+		if (!LoadImpairment(args, proxy.mSettings, impairment)) return 1;
+		// record what players sent, so a swarm run can be replayed later.
+		proxy.mSettings.mCaptureFile = args.GetString("capture-file", "");
+		if (!proxy.Start(proxy_port)) {
+			fputs("Fail to start WhispersAbyss.\n", stderr);
+			return 1;
+		}
+		StandInServer server(&output);
+		if (!server.StartLobby(server_port, static_cast<uint32_t>(server_tick_rate))) {
+			fputs("Fail to start stand-in lobby.\n", stderr);
+			return 1;
+		}
+
+		asio::io_context ctx;
+		auto work_guard = asio::make_work_guard(ctx);
+		std::vector<std::jthread> td_io;
+		for (uint64_t i = 0; i < io_threads; ++i) {
+			td_io.emplace_back([&ctx]() -> void { ctx.run(); });
+		}
+
+		asio::ip::tcp::endpoint proxy_endpoint(asio::ip::make_address("127.0.0.1"), proxy_port);
+		std::string url("127.0.0.1:" + std::to_string(server_port));
+		const std::chrono::nanoseconds tick_interval(1000000000u / tick_rate);
+		// the chance of sending chat or current sector in a tick
+		const double chat_chance = chat_per_minute / 60.0 / static_cast<double>(tick_rate);
+		const double sector_chance = sector_per_minute / 60.0 / static_cast<double>(tick_rate);
+
+		std::mt19937_64 random(seed);
+		std::uniform_real_distribution<double> chance(0.0, 1.0);
+		std::exponential_distribution<double> session_length(session_seconds > 0.0 ? 1.0 / session_seconds : 1.0);
+		auto stats = std::make_shared<SwarmStats>();
+		std::vector<SwarmPlayer> players(static_cast<size_t>(player_count));
+		std::string buffer;
+		uint64_t next_seed = 0u, joined = 0u, churned = 0u, failed = 0u, peak_online = 0u;
+
+		auto send = [&](SwarmPlayer& player, bool is_reliable) -> void {
+			player.mClient->SendData(buffer.data(), static_cast<uint32_t>(buffer.size()), is_reliable);
+			stats->mOpcodes.Record(OpcodeDirection::Tcp2Gns, buffer.data(), static_cast<uint32_t>(buffer.size()));
+			stats->mSentMsg.fetch_add(1u, std::memory_order_relaxed);
+		};
+		auto join = [&](SwarmPlayer& player, std::chrono::steady_clock::time_point now) -> void {
+			player.mSeed = next_seed++;
+			player.mSession = std::make_shared<SwarmSession>(stats.get());
+			auto session = player.mSession;
+			player.mClient = std::make_shared<BenchClient>(ctx, static_cast<size_t>(player.mSeed),
+				[session](BenchClient*, const uint8_t* payload, uint32_t len, bool) -> void {
+					OnSwarmData(session.get(), payload, len);
+				});
+			player.mLeaveTime = session_seconds > 0.0 ?
+				now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(session_length(random))) :
+				std::chrono::steady_clock::time_point::max();
+			player.mTick = player.mChatCount = 0u;
+			player.mSector = 0u;
+
+			// login is queued behind connect command.
+			// set start time before client starts, so its io thread never sees it unset.
+			// retries keep it, so login latency counts from the first attempt.
+			player.mSession->mLoginStart.store(CommonOpers::GetMonotonicTime());
+			player.mClient->Start(proxy_endpoint, url);
+			player.mNextLogin = now + SWARM_LOGIN_RETRY;
+			Bmmo::BuildLoginRequest(buffer, player.mSeed);
+			send(player, true);
+			++joined;
+		};
+		auto leave = [&](SwarmPlayer& player) -> void {
+			// mark it accepted, so a late login_accepted_v3_msg does not count it online again.
+			if (player.mSession->mIsAccepted.exchange(true)) stats->mOnline.fetch_sub(1u);
+			player.mClient->Close();
+			player.mClient.reset();
+			player.mSession.reset();
+		};
+
+		JsonWriter json;
+		json.BeginObject()
+			.Value("mode", "swarm")
+			.BeginObject("config")
+			.Value("players", player_count)
+			.Value("ramp_up", ramp_up)
+			.Value("duration_s", duration)
+			.Value("tick_rate", tick_rate)
+			.Value("chat_per_minute", chat_per_minute)
+			.Value("sector_per_minute", sector_per_minute)
+			.Value("session_s", session_seconds)
+			.Value("server_tick_rate", server_tick_rate)
+			.Value("seed", seed)
+			.Value("impairment", impairment)
+			.Value("capture_file", proxy.mSettings.mCaptureFile)
+			.EndObject()
+			.BeginArray("timeline");
+
+		fprintf(stderr, "Running %" PRIu64 " players for %" PRIu64 " seconds...\n", player_count, duration);
+		auto start = std::chrono::steady_clock::now();
+		auto end = start + std::chrono::seconds(duration);
+		auto next_tick = start, next_sample = start + SWARM_SAMPLE_INTERVAL;
+		ProcessUsage last_usage = SampleProcessUsage();
+		PressureTracker pressure;
+		uint64_t last_sent = 0u, last_recv = 0u;
+		while (true) {
+			auto now = std::chrono::steady_clock::now();
+			if (now >= end) break;
+
+			// timeline sample
+			if (now >= next_sample) {
+				next_sample += SWARM_SAMPLE_INTERVAL;
+				ProcessUsage usage = SampleProcessUsage();
+				const BridgeFactoryPressure& bridge_pressure = pressure.Sample(proxy);
+				uint64_t sent = stats->mSentMsg.load(), recv = stats->mRecvMsg.load(), online = stats->mOnline.load();
+				double interval = std::chrono::duration<double>(SWARM_SAMPLE_INTERVAL).count();
+				peak_online = std::max(peak_online, online);
+				json.BeginObject()
+					.Value("t_s", std::chrono::duration<double>(now - start).count())
+					.Value("online", online)
+					.Value("sent_per_s", (sent - last_sent) / interval)
+					.Value("recv_per_s", (recv - last_recv) / interval)
+					.Value("cpu_percent", (usage.mCpuSeconds - last_usage.mCpuSeconds) / interval * 100.0)
+					.Value("threads", usage.mThreadCount)
+					.Value("rss_bytes", usage.mRssBytes)
+					.Value("gns_send_queue_max", static_cast<uint64_t>(bridge_pressure.mGnsSendQueue))
+					.Value("tcp_send_queue_max", static_cast<uint64_t>(bridge_pressure.mTcpSendQueue))
+					.Value("gns_pending_bytes_max", static_cast<uint64_t>(bridge_pressure.mGnsPendingBytes))
+					.EndObject();
+				fprintf(stderr, "%.0fs: %" PRIu64 " online, %.0f msg/s out, %.0f msg/s in.\n",
+					std::chrono::duration<double>(now - start).count(), online, (sent - last_sent) / interval, (recv - last_recv) / interval);
+				last_usage = usage;
+				last_sent = sent;
+				last_recv = recv;
+			}
+
+			if (now < next_tick) {
+				std::this_thread::sleep_for(std::min(next_tick - now, next_sample - now));
+				continue;
+			}
+			uint64_t due_ticks = static_cast<uint64_t>((now - next_tick) / tick_interval) + 1u;
+			next_tick += tick_interval * due_ticks;
+			due_ticks = std::min(due_ticks, SWARM_MAX_CATCHUP_TICKS);
+
+			// joins allowed by ramp-up rate so far. rejoins of churned players also take it.
+			uint64_t allowed_joins = static_cast<uint64_t>(std::chrono::duration<double>(now - start).count() * ramp_up) + 1u;
+			for (auto& player : players) {
+				// leave
+				if (player.mClient != nullptr) {
+					if (player.mClient->IsFailed()) {
+						++failed;
+						leave(player);
+					} else if (now >= player.mLeaveTime) {
+						++churned;
+						leave(player);
+					}
+				}
+				// join
+				if (player.mClient == nullptr) {
+					if (joined >= allowed_joins) continue;
+					join(player, now);
+					continue;
+				}
+
+				// wait login accepted
+				if (!player.mSession->mIsAccepted.load(std::memory_order_relaxed)) {
+					if (now >= player.mNextLogin) {
+						player.mNextLogin = now + SWARM_LOGIN_RETRY;
+						Bmmo::BuildLoginRequest(buffer, player.mSeed);
+						send(player, true);
+					}
+					continue;
+				}
+
+				// play
+				for (uint64_t t = 0; t < due_ticks; ++t) {
+					Bmmo::BuildTimedBallState(buffer, player.mSeed, player.mTick++, CommonOpers::GetMonotonicTime());
+					send(player, false);
+					if (chance(random) < chat_chance) {
+						Bmmo::BuildChat(buffer, player.mSeed, player.mChatCount++);
+						send(player, true);
+					}
+					if (chance(random) < sector_chance) {
+						player.mSector = (player.mSector + 1u) % SWARM_SECTOR_COUNT;
+						Bmmo::BuildCurrentSector(buffer, player.mSector);
+						send(player, true);
+					}
+				}
+			}
+		}
+
+		json.EndArray();
+		for (auto& player : players) {
+			if (player.mClient != nullptr) leave(player);
+		}
+		CountDownTimer closing(MODULE_WAITING_INTERVAL);
+		while (server.GetConnectionCount() != 0u && !closing.HasRunOutOfTime()) {
+			std::this_thread::sleep_for(SPIN_INTERVAL);
+		}
+
+		json.BeginObject("summary")
+			.Value("sessions", joined)
+			.Value("churned", churned)
+			.Value("failed", failed)
+			.Value("peak_online", peak_online);
+		WriteLatency(json, "login_latency", stats->mLoginLatency);
+		WriteLatency(json, "state_age", stats->mStateAge);
+		pressure.Write(json, "pressure");
+		json.Value("sent_msg", stats->mSentMsg.load())
+			.Value("recv_msg", stats->mRecvMsg.load())
+			.Value("server_recv_msg", server.GetRecvCount())
+			.Value("server_send_msg", server.GetSendCount());
+		WriteOpcodes(json, "sent_opcodes", stats->mOpcodes, OpcodeDirection::Tcp2Gns);
+		WriteOpcodes(json, "recv_opcodes", stats->mOpcodes, OpcodeDirection::Gns2Tcp);
+		json.EndObject().EndObject();
+		fprintf(stderr, "%" PRIu64 " sessions, %" PRIu64 " churned, %" PRIu64 " failed, peak %" PRIu64 " online.\n",
+			joined, churned, failed, peak_online);
+
+		// stop in reverse order.
+		work_guard.reset();
+		ctx.stop();
+		td_io.clear();
+		server.Stop();
+		proxy.Stop();
+		output.Flush();
+
+		if (!WriteResult(args.GetString("output", ""), json)) {
+			fputs("Fail to write result.\n", stderr);
+			return 1;
+		}
+		return 0;
+	}
+
+}
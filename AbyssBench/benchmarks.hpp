@@ -0,0 +1,34 @@
+#pragma once
+
+#include "bench_common.hpp"
+
+namespace AbyssBench {
+
+	/*
+	Every mode takes the parsed command line and return the exit code of program.
+	Modes write their result as JSON into --output, or stdout if it is not given.
+	Progress is printed into stderr and the log of WhispersAbyss is written into --log-file.
+	*/
+
+	/// <summary>
+	/// Loopback echo benchmark: synthetic TCP clients -> WhispersAbyss -> GNS stand-in server -> back.
+	/// </summary>
+	int RunEcho(const BenchArgs& args);
+	/// <summary>
+	/// BMMO player swarm: synthetic players login and play through WhispersAbyss in a stand-in lobby.
+	/// </summary>
+	int RunSwarm(const BenchArgs& args);
+	/// <summary>
+	/// Replay a capture file written by WhispersAbyss through WhispersAbyss and a GNS stand-in sink.
+	/// </summary>
+	int RunReplay(const BenchArgs& args);
+	/// <summary>
+	/// Microbenchmarks of the primitives every message touches. WhispersAbyss is not started.
+	/// </summary>
+	int RunMicro(const BenchArgs& args);
+	/// <summary>
+	/// Connection storm and soak: open and close short sessions at a high rate, and fail on leaks or growth.
+	/// </summary>
+	int RunStorm(const BenchArgs& args);
+
+}
@@ -0,0 +1,151 @@
+#include "bmmo_synth.hpp"
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+namespace AbyssBench::Bmmo {
+
+	/// <summary>
+	/// The BMMO version claimed by synthetic players: major, minor, subminor, stage and build.
+	/// </summary>
+	static constexpr const uint8_t CLIENT_VERSION[5] = { 3u, 4u, 5u, 2u, 1u };
+	/// <summary>
+	/// Chat contents picked by players in turn. Their length spread like normal chats.
+	/// </summary>
+	static constexpr const char* CHAT_CONTENTS[] = {
+		"gg",
+		"wait for me",
+		"anyone on level 13?",
+		"lag spike again, did anyone else notice it?",
+		"the rope bridge in this map always get me, i need a better route",
+	};
+	static constexpr const size_t CHAT_CONTENT_COUNT = sizeof(CHAT_CONTENTS) / sizeof(const char*);
+
+	template<typename T>
+	static void AppendPod(std::string& out, const T& value) {
+		out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	static void AppendOpcode(std::string& out, Opcode opcode) {
+		AppendPod(out, static_cast<uint32_t>(opcode));
+	}
+
+	static void AppendString(std::string& out, const char* str, size_t len) {
+		AppendPod(out, static_cast<uint32_t>(len));
+		out.append(str, len);
+	}
+
+	bool PeekOpcode(const void* payload, size_t len, uint32_t& opcode) {
+		if (len < sizeof(uint32_t)) return false;
+		memcpy(&opcode, payload, sizeof(uint32_t));
+		return true;
+	}
+
+	void BuildLoginRequest(std::string& out, uint64_t player_seed) {
+		char nickname[32];
+		int nickname_len = snprintf(nickname, sizeof(nickname), "Swarm%06" PRIu64, player_seed);
+
+		out.clear();
+		AppendOpcode(out, Opcode::LoginRequestV3Msg);
+		out.append(reinterpret_cast<const char*>(CLIENT_VERSION), sizeof(CLIENT_VERSION));
+		AppendString(out, nickname, static_cast<size_t>(nickname_len));
+		out.push_back('\0');	// cheated
+		// uuid
+		AppendPod(out, player_seed);
+		AppendPod(out, ~player_seed);
+	}
+
+	void BuildTimedBallState(std::string& out, uint64_t player_seed, uint64_t tick, uint64_t timestamp) {
+		TimedBallState state;
+		float t = static_cast<float>(tick) * 0.01f;
+		state.mType = static_cast<uint32_t>(player_seed % 3u);
+		state.mPosition[0] = static_cast<float>(player_seed % 100u) + t;
+		state.mPosition[1] = 10.0f;
+		state.mPosition[2] = -t;
+		state.mRotation[0] = 0.0f;
+		state.mRotation[1] = 0.0f;
+		state.mRotation[2] = 0.0f;
+		state.mRotation[3] = 1.0f;
+		state.mTimestamp = timestamp;
+
+		out.clear();
+		AppendOpcode(out, Opcode::TimedBallStateMsg);
+		AppendPod(out, state);
+	}
+
+	void BuildChat(std::string& out, uint64_t player_seed, uint64_t count) {
+		const char* content = CHAT_CONTENTS[(player_seed + count) % CHAT_CONTENT_COUNT];
+		out.clear();
+		AppendOpcode(out, Opcode::ChatMsg);
+		AppendString(out, content, strlen(content));
+	}
+
+	void BuildCurrentSector(std::string& out, uint32_t sector) {
+		out.clear();
+		AppendOpcode(out, Opcode::CurrentSectorMsg);
+		AppendPod(out, sector);
+	}
+
+	void BuildLoginAccepted(std::string& out, size_t online_players) {
+		out.clear();
+		AppendOpcode(out, Opcode::LoginAcceptedV3Msg);
+		size_t count_offset = out.size();
+		AppendPod(out, static_cast<uint32_t>(0u));
+
+		// each entry: id, nickname and cheated
+		uint32_t count = 0u;
+		char nickname[32];
+		for (size_t i = 0u; i < online_players; ++i) {
+			int nickname_len = snprintf(nickname, sizeof(nickname), "Swarm%06zu", i);
+			size_t entry_size = sizeof(uint64_t) + sizeof(uint32_t) + static_cast<size_t>(nickname_len) + sizeof(uint8_t);
+			if (out.size() + entry_size > SERVER_MSG_LIMIT) break;
+
+			AppendPod(out, static_cast<uint64_t>(i));
+			AppendString(out, nickname, static_cast<size_t>(nickname_len));
+			out.push_back('\0');
+			++count;
+		}
+		memcpy(out.data() + count_offset, &count, sizeof(uint32_t));
+	}
+
+	bool BuildOwnedChat(std::string& out, uint64_t player_id, const void* player_chat, size_t len) {
+		if (len < sizeof(uint32_t) + sizeof(uint32_t)) return false;
+		const char* content = static_cast<const char*>(player_chat) + sizeof(uint32_t);
+		size_t content_len = len - sizeof(uint32_t);
+		if (sizeof(uint32_t) + sizeof(uint64_t) + content_len > SERVER_MSG_LIMIT) return false;
+
+		out.clear();
+		AppendOpcode(out, Opcode::ChatMsg);
+		AppendPod(out, player_id);
+		out.append(content, content_len);
+		return true;
+	}
+
+	void BeginOwnedBallStates(std::string& out) {
+		out.clear();
+		AppendOpcode(out, Opcode::OwnedCompressedBallStateMsg);
+		AppendPod(out, static_cast<uint32_t>(0u));
+	}
+
+	bool AppendOwnedBallState(std::string& out, const OwnedBallState& state) {
+		if (out.size() + OWNED_BALL_STATE_SIZE > SERVER_MSG_LIMIT) return false;
+
+		AppendPod(out, state.mPlayerId);
+		AppendPod(out, state.mState);
+		uint32_t count;
+		memcpy(&count, out.data() + sizeof(uint32_t), sizeof(uint32_t));
+		++count;
+		memcpy(out.data() + sizeof(uint32_t), &count, sizeof(uint32_t));
+		return true;
+	}
+
+	bool ParseOwnedBallStates(const void* payload, size_t len, uint32_t& count, const uint8_t*& entries) {
+		if (len < sizeof(uint32_t) + sizeof(uint32_t)) return false;
+		const uint8_t* p = static_cast<const uint8_t*>(payload);
+		memcpy(&count, p + sizeof(uint32_t), sizeof(uint32_t));
+		if (len - sizeof(uint32_t) - sizeof(uint32_t) < static_cast<size_t>(count) * OWNED_BALL_STATE_SIZE) return false;
+		entries = p + sizeof(uint32_t) + sizeof(uint32_t);
+		return true;
+	}
+
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+namespace AbyssBench::Bmmo {
+
+	/*
+	Synthetic BMMO messages used by swarm mode.
+	Opcodes are the same as the BallanceMMO server and sizes are close to real messages,
+	but fields are filled with synthetic values and nothing here is meant to be read by a real BMMO server.
+	*/
+
+	enum class Opcode : uint32_t {
+		ChatMsg = 10,
+		LoginRequestV3Msg = 22,
+		TimedBallStateMsg = 32,
+		CurrentSectorMsg = 40,
+		LoginAcceptedV3Msg = 41,
+		OwnedCompressedBallStateMsg = 45
+	};
+
+	/// <summary>
+	/// The body of timed_ball_state_msg after opcode.
+	/// </summary>
+	struct TimedBallState {
+		uint32_t mType;
+		float mPosition[3];
+		float mRotation[4];
+		/// <summary>
+		/// CommonOpers::GetMonotonicTime() of sender, so receivers in the same process can get its age.
+		/// </summary>
+		uint64_t mTimestamp;
+	};
+	/// <summary>
+	/// An entry of owned_compressed_ball_state_msg: the owner and its latest state.
+	/// </summary>
+	struct OwnedBallState {
+		uint64_t mPlayerId;
+		TimedBallState mState;
+	};
+	/// <summary>
+	/// The bytes of each entry of owned_compressed_ball_state_msg.
+	/// </summary>
+	constexpr const size_t OWNED_BALL_STATE_SIZE = sizeof(uint64_t) + sizeof(TimedBallState);
+	/// <summary>
+	/// The most bytes of a message sent by stand-in server.
+	/// Longer lists are split into multiple messages, so each fits in a TcpInstance frame.
+	/// </summary>
+	constexpr const size_t SERVER_MSG_LIMIT = 1200u;
+
+	/// <summary>
+	/// Get opcode of payload. Return false if payload is too short.
+	/// </summary>
+	bool PeekOpcode(const void* payload, size_t len, uint32_t& opcode);
+
+	void BuildLoginRequest(std::string& out, uint64_t player_seed);
+	void BuildTimedBallState(std::string& out, uint64_t player_seed, uint64_t tick, uint64_t timestamp);
+	void BuildChat(std::string& out, uint64_t player_seed, uint64_t count);
+	void BuildCurrentSector(std::string& out, uint32_t sector);
+
+	/// <summary>
+	/// Build login_accepted_v3_msg listing at most as many online players as fit in SERVER_MSG_LIMIT.
+	/// </summary>
+	void BuildLoginAccepted(std::string& out, size_t online_players);
+	/// <summary>
+	/// Build chat_msg relayed by server: the sender id followed by the content of the chat of player.
+	/// </summary>
+	/// <param name="player_chat">The whole chat_msg sent by player, opcode included.</param>
+	/// <returns>False if player chat is malformed.</returns>
+	bool BuildOwnedChat(std::string& out, uint64_t player_id, const void* player_chat, size_t len);
+	/// <summary>
+	/// Start a owned_compressed_ball_state_msg. Append entries by AppendOwnedBallState() until it is full.
+	/// </summary>
+	void BeginOwnedBallStates(std::string& out);
+	/// <summary>
+	/// Append a entry if message still has room for it.
+	/// </summary>
+	/// <returns>False if message is full and the entry is not appended.</returns>
+	bool AppendOwnedBallState(std::string& out, const OwnedBallState& state);
+	/// <summary>
+	/// Get the count of entries and the first entry of a owned_compressed_ball_state_msg.
+	/// Entries are not aligned so they should be copied out.
+	/// </summary>
+	/// <returns>False if payload is malformed.</returns>
+	bool ParseOwnedBallStates(const void* payload, size_t len, uint32_t& count, const uint8_t*& entries);
+
+}
@@ -0,0 +1,306 @@
+import argparse, json, os, statistics, subprocess, sys, time
+
+# The metric kinds compared against baseline.
+# True mean higher is better, so only a drop is a regression.
+METRIC_KINDS: dict[str, bool] = {
+    "throughput": True,
+    "p99_latency": False,
+    "rss": False,
+    "threads": False,
+}
+
+class Tolerance:
+    mPercent: float
+    mAbsolute: float
+    def __init__(self, percent: float, absolute: float):
+        self.mPercent = percent
+        self.mAbsolute = absolute
+
+    def GetBand(self, baseline: float) -> float:
+        """
+        The change allowed from baseline.
+        Absolute part keeps small values, like thread count or latency of an idle run, from failing on noise.
+        """
+        return max(abs(baseline) * self.mPercent / 100.0, self.mAbsolute)
+
+class Scenario:
+    mName: str
+    mMode: str
+    mArgs: dict[str, str]
+    mRecord: dict | None
+    mMetrics: dict[str, str]
+    mTolerances: dict[str, Tolerance]
+    def __init__(self, name: str, mode: str, args: dict[str, str], record: dict | None, metrics: dict[str, str], tolerances: dict[str, Tolerance]):
+        self.mName = name
+        self.mMode = mode
+        self.mArgs = args
+        self.mRecord = record
+        self.mMetrics = metrics
+        self.mTolerances = tolerances
+
+class MetricResult:
+    mKind: str
+    mBaseline: float | None
+    mCurrent: float | None
+    mBand: float
+    mVerdict: str   # pass, improved, regressed, missing or new
+    def __init__(self, kind: str, baseline: float | None, current: float | None, band: float, verdict: str):
+        self.mKind = kind
+        self.mBaseline = baseline
+        self.mCurrent = current
+        self.mBand = band
+        self.mVerdict = verdict
+
+    def GetDelta(self) -> float | None:
+        if self.mBaseline is None or self.mCurrent is None: return None
+        return self.mCurrent - self.mBaseline
+
+    def GetDeltaPercent(self) -> float | None:
+        if self.mBaseline is None or self.mCurrent is None or self.mBaseline == 0: return None
+        return (self.mCurrent - self.mBaseline) / abs(self.mBaseline) * 100.0
+
+# ============= Suite =============
+
+def LoadTolerances(data: dict, fallback: dict[str, Tolerance]) -> dict[str, Tolerance]:
+    tolerances = dict(fallback)
+    for kind, value in data.items():
+        if kind not in METRIC_KINDS: raise Exception(f"Unknown metric kind in tolerances: {kind}")
+        tolerances[kind] = Tolerance(float(value.get("percent", 0)), float(value.get("absolute", 0)))
+    return tolerances
+
+def LoadSuite(path: str) -> tuple[int, list[Scenario]]:
+    with open(path, 'r', encoding='utf-8') as f:
+        data = json.load(f)
+    default_tolerances = LoadTolerances(data.get("tolerances", {}), dict((kind, Tolerance(0, 0)) for kind in METRIC_KINDS))
+    scenarios: list[Scenario] = []
+    for item in data["scenarios"]:
+        for kind in item["metrics"]:
+            if kind not in METRIC_KINDS: raise Exception(f"Unknown metric kind in scenario {item['name']}: {kind}")
+        scenarios.append(Scenario(
+            item["name"], item["mode"],
+            dict((key, str(value)) for key, value in item.get("args", {}).items()),
+            item.get("record", None),
+            item["metrics"],
+            LoadTolerances(item.get("tolerances", {}), default_tolerances)
+        ))
+    return (int(data.get("repeat", 1)), scenarios)
+
+def ResolvePath(suite_dir: str, value: str) -> str:
+    return value if os.path.isabs(value) else os.path.join(suite_dir, value)
+
+def ExtractMetric(result: dict, path: str) -> float | None:
+    """
+    Walk a dotted path like "steps.0.latency.p99_us" in a result.
+    """
+    node = result
+    for part in path.split('.'):
+        if isinstance(node, list):
+            if not part.isdigit() or int(part) >= len(node): return None
+            node = node[int(part)]
+        elif isinstance(node, dict):
+            if part not in node: return None
+            node = node[part]
+        else:
+            return None
+    if isinstance(node, bool) or not isinstance(node, (int, float)): return None
+    return float(node)
+
+# ============= Run =============
+
+def RunBench(bench: str, mode: str, args: dict[str, str], output_file: str, log_file: str) -> tuple[int, float]:
+    cmd = [bench, mode, "--output", output_file, "--log-file", log_file]
+    for key, value in args.items():
+        cmd += [f"--{key}", value]
+    print(f"[AbyssGate] {' '.join(cmd)}", flush=True)
+    start = time.monotonic()
+    # progress of AbyssBench goes into stderr, let it show.
+    ret = subprocess.run(cmd, stdout=subprocess.DEVNULL).returncode
+    return (ret, time.monotonic() - start)
+
+def ResolveArgs(suite_dir: str, args: dict[str, str]) -> dict[str, str]:
+    resolved = dict(args)
+    for key in ("capture", "capture-file", "scenario"):
+        if key in resolved: resolved[key] = ResolvePath(suite_dir, resolved[key])
+    return resolved
+
+def PrepareCapture(bench: str, suite_dir: str, results_dir: str, scenario: Scenario) -> bool:
+    """
+    Record the capture replayed by scenario if it is not stored yet.
+    """
+    if scenario.mRecord is None or "capture" not in scenario.mArgs: return True
+    capture_file = ResolvePath(suite_dir, scenario.mArgs["capture"])
+    if os.path.isfile(capture_file): return True
+
+    print(f"[AbyssGate] Capture of {scenario.mName} is not stored, recording {capture_file}.", flush=True)
+    os.makedirs(os.path.dirname(capture_file) or '.', exist_ok=True)
+    record_args = ResolveArgs(suite_dir, dict((key, str(value)) for key, value in scenario.mRecord.get("args", {}).items()))
+    record_args["capture-file"] = capture_file
+    ret, _ = RunBench(bench, scenario.mRecord["mode"], record_args,
+        os.path.join(results_dir, f"{scenario.mName}.record.json"), os.path.join(results_dir, f"{scenario.mName}.record.log"))
+    return ret == 0 and os.path.isfile(capture_file)
+
+def RunScenario(bench: str, suite_dir: str, results_dir: str, scenario: Scenario, repeat: int) -> dict:
+    """
+    Run scenario repeat times and keep the median of each metric.
+    A run which exits with error, like a storm listing failures, fails the scenario whatever its numbers are.
+    """
+    summary = {"name": scenario.mName, "mode": scenario.mMode, "runs": [], "metrics": {}, "errors": []}
+    if not PrepareCapture(bench, suite_dir, results_dir, scenario):
+        summary["errors"].append("fail to record capture")
+        return summary
+
+    args = ResolveArgs(suite_dir, scenario.mArgs)
+    values: dict[str, list[float]] = dict((kind, []) for kind in scenario.mMetrics)
+    for i in range(repeat):
+        output_file = os.path.join(results_dir, f"{scenario.mName}.{i}.json")
+        if os.path.isfile(output_file): os.remove(output_file)
+        ret, elapsed = RunBench(bench, scenario.mMode, args, output_file, os.path.join(results_dir, f"{scenario.mName}.{i}.log"))
+        summary["runs"].append({"output": output_file, "exit_code": ret, "elapsed_s": elapsed})
+        if not os.path.isfile(output_file):
+            summary["errors"].append(f"run {i} exited with {ret} and wrote no result")
+            continue
+        with open(output_file, 'r', encoding='utf-8') as f:
+            result = json.load(f)
+        if ret != 0:
+            reasons = [item.get("reason", "") for item in result.get("failures", [])]
+            summary["errors"].append(f"run {i} exited with {ret}" + (f": {'; '.join(reasons)}" if len(reasons) != 0 else ""))
+        for kind, path in scenario.mMetrics.items():
+            value = ExtractMetric(result, path)
+            if value is None: summary["errors"].append(f"run {i} has no {path}")
+            else: values[kind].append(value)
+
+    for kind, samples in values.items():
+        if len(samples) != 0: summary["metrics"][kind] = statistics.median(samples)
+    return summary
+
+# ============= Compare =============
+
+def CompareMetric(kind: str, baseline: float | None, current: float | None, tolerance: Tolerance) -> MetricResult:
+    if current is None: return MetricResult(kind, baseline, current, 0, "missing")
+    if baseline is None: return MetricResult(kind, baseline, current, 0, "new")
+    band = tolerance.GetBand(baseline)
+    # flip the sign of higher-is-better metrics, so a positive change is always worse.
+    worse = (baseline - current) if METRIC_KINDS[kind] else (current - baseline)
+    if worse > band: verdict = "regressed"
+    elif -worse > band: verdict = "improved"
+    else: verdict = "pass"
+    return MetricResult(kind, baseline, current, band, verdict)
+
+def CompareScenario(scenario: Scenario, summary: dict, baseline: dict | None) -> list[MetricResult]:
+    baseline_metrics = {} if baseline is None else baseline.get("metrics", {})
+    return [CompareMetric(kind, baseline_metrics.get(kind, None), summary["metrics"].get(kind, None), scenario.mTolerances[kind]) for kind in scenario.mMetrics]
+
+def FormatNumber(value: float | None) -> str:
+    if value is None: return "-"
+    if abs(value) >= 1e6: return f"{value / 1e6:.2f}M"
+    if abs(value) >= 1e4: return f"{value / 1e3:.1f}k"
+    return f"{value:.1f}" if value != int(value) else str(int(value))
+
+def FormatDelta(item: MetricResult) -> str:
+    delta = item.GetDelta()
+    if delta is None: return "-"
+    percent = item.GetDeltaPercent()
+    strl = ('+' if delta >= 0 else '-') + FormatNumber(abs(delta))
+    if percent is not None: strl += f" ({percent:+.1f}%)"
+    return strl
+
+def PrintReport(rows: list[tuple[str, MetricResult]], errors: list[tuple[str, str]], is_pass: bool):
+    header = ("scenario", "metric", "baseline", "current", "delta", "band", "verdict")
+    cells = [header] + [(
+        name, item.mKind, FormatNumber(item.mBaseline), FormatNumber(item.mCurrent),
+        FormatDelta(item), "-" if item.mBaseline is None else "±" + FormatNumber(item.mBand), item.mVerdict.upper()
+    ) for name, item in rows]
+    widths = [max(len(row[i]) for row in cells) for i in range(len(header))]
+    print("")
+    for idx, row in enumerate(cells):
+        print("  ".join(cell.ljust(widths[i]) for i, cell in enumerate(row)))
+        if idx == 0: print("  ".join('-' * width for width in widths))
+    for name, error in errors:
+        print(f"{name}: {error}")
+    print("")
+    print("PASS" if is_pass else "FAIL")
+
+# ============= Main =============
+
+parser = argparse.ArgumentParser(description='Run AbyssBench scenarios and compare them with a stored baseline.')
+parser.add_argument('-b', '--bench', required=True, action='store', dest='bench', metavar='AbyssBench.exe')
+parser.add_argument('-s', '--suite', action='store', dest='suite', default=os.path.join(os.path.dirname(os.path.abspath(__file__)), 'suite.json'))
+parser.add_argument('-B', '--baseline', action='store', dest='baseline', default=None, help='Default is baseline.json beside suite.')
+parser.add_argument('-r', '--results', action='store', dest='results', default=None, help='Default is results beside suite.')
+parser.add_argument('-n', '--repeat', type=int, action='store', dest='repeat', default=None, help='Override repeat of suite.')
+parser.add_argument('-o', '--only', action='append', dest='only', default=None, metavar='clients_100', help='Only run given scenario. Can be repeated.')
+parser.add_argument('-u', '--update-baseline', action='store_true', dest='update_baseline', help='Write results as new baseline instead of comparing.')
+parser.add_argument('--allow-missing-baseline', action='store_true', dest='allow_missing_baseline', help='Pass when baseline or some of its metrics are not stored yet.')
+args = parser.parse_args()
+
+suite_dir = os.path.dirname(os.path.abspath(args.suite))
+baseline_file = args.baseline if args.baseline is not None else os.path.join(suite_dir, 'baseline.json')
+results_dir = args.results if args.results is not None else os.path.join(suite_dir, 'results')
+os.makedirs(results_dir, exist_ok=True)
+
+repeat, scenarios = LoadSuite(args.suite)
+if args.repeat is not None: repeat = args.repeat
+repeat = max(repeat, 1)
+if args.only is not None:
+    unknown = set(args.only) - set(scenario.mName for scenario in scenarios)
+    if len(unknown) != 0:
+        print(f"[AbyssGate] Unknown scenario: {', '.join(sorted(unknown))}")
+        sys.exit(2)
+    scenarios = [scenario for scenario in scenarios if scenario.mName in args.only]
+
+baseline: dict = {}
+if os.path.isfile(baseline_file):
+    with open(baseline_file, 'r', encoding='utf-8') as f:
+        baseline = json.load(f)
+elif not args.update_baseline:
+    print(f"[AbyssGate] No baseline at {baseline_file}. Run with --update-baseline on the reference machine and commit it.")
+    if not args.allow_missing_baseline: sys.exit(2)
+
+summaries = [RunScenario(args.bench, suite_dir, results_dir, scenario, repeat) for scenario in scenarios]
+
+if args.update_baseline:
+    broken = [summary["name"] for summary in summaries if len(summary["errors"]) != 0]
+    if len(broken) != 0:
+        for summary in summaries:
+            for error in summary["errors"]: print(f"{summary['name']}: {error}")
+        print(f"[AbyssGate] Baseline is not updated because these scenarios failed: {', '.join(broken)}")
+        sys.exit(1)
+    # keep entries of scenarios not run this time.
+    stored = baseline.get("scenarios", {})
+    for summary in summaries:
+        stored[summary["name"]] = {"metrics": summary["metrics"]}
+    with open(baseline_file, 'w', encoding='utf-8') as f:
+        json.dump({"repeat": repeat, "scenarios": stored}, f, indent=4, sort_keys=True)
+        f.write('\n')
+    print(f"[AbyssGate] Baseline written into {baseline_file}.")
+    sys.exit(0)
+
+rows: list[tuple[str, MetricResult]] = []
+errors: list[tuple[str, str]] = []
+report = {"baseline": baseline_file, "repeat": repeat, "scenarios": []}
+for scenario, summary in zip(scenarios, summaries):
+    items = CompareScenario(scenario, summary, baseline.get("scenarios", {}).get(scenario.mName, None))
+    rows += [(scenario.mName, item) for item in items]
+    errors += [(scenario.mName, error) for error in summary["errors"]]
+    report["scenarios"].append({
+        "name": scenario.mName,
+        "runs": summary["runs"],
+        "errors": summary["errors"],
+        "metrics": [{
+            "kind": item.mKind, "baseline": item.mBaseline, "current": item.mCurrent,
+            "delta": item.GetDelta(), "delta_percent": item.GetDeltaPercent(), "band": item.mBand, "verdict": item.mVerdict
+        } for item in items],
+    })
+
+# a metric without baseline gates nothing, so it fails unless allowed explicitly.
+failed_verdicts = ("regressed", "missing") if args.allow_missing_baseline else ("regressed", "missing", "new")
+is_pass = len(errors) == 0 and all(item.mVerdict not in failed_verdicts for _, item in rows)
+report["pass"] = is_pass
+with open(os.path.join(results_dir, 'report.json'), 'w', encoding='utf-8') as f:
+    json.dump(report, f, indent=4)
+    f.write('\n')
+
+PrintReport(rows, errors, is_pass)
+if not args.allow_missing_baseline and any(item.mVerdict == "new" for _, item in rows):
+    print("[AbyssGate] NEW metrics have no baseline. Update baseline, or pass --allow-missing-baseline.")
+sys.exit(0 if is_pass else 1)
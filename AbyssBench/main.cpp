@@ -0,0 +1,62 @@
+#include "benchmarks.hpp"
+#include <cstdio>
+#include <cstring>
+
+/*
+AbyssBench - drive WhispersAbyss with synthetic clients and report the result as JSON.
+
+WhispersAbyss and a GNS stand-in server run inside this process,
+so a benchmark needs nothing but a free loopback port pair.
+*/
+
+struct BenchMode {
+	const char* mName;
+	const char* mDescription;
+	int(*mEntry)(const AbyssBench::BenchArgs& args);
+};
+
+static const BenchMode BENCH_MODES[] = {
+	{ "echo", "Loopback echo through WhispersAbyss and a GNS stand-in server.", &AbyssBench::RunEcho },
+	{ "swarm", "Synthetic BMMO players in a stand-in lobby, driven by a scenario.", &AbyssBench::RunSwarm },
+	{ "replay", "Replay a capture file of WhispersAbyss at 1x, Nx or maximum speed.", &AbyssBench::RunReplay },
+	{ "micro", "Microbenchmarks of messages, state machines, index distributor and logger.", &AbyssBench::RunMicro },
+	{ "storm", "Open and close sessions at a high rate for a long time, and check leaks.", &AbyssBench::RunStorm },
+};
+
+static void PrintSyntax() {
+	puts("Syntax: AbyssBench <mode> [--key value]...");
+	puts("Modes:");
+	for (const auto& mode : BENCH_MODES) {
+		printf("\t%s\t%s\n", mode.mName, mode.mDescription);
+	}
+	puts("See README.md for the options of every mode.");
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		PrintSyntax();
+		return 1;
+	}
+
+	for (const auto& mode : BENCH_MODES) {
+		if (strcmp(argv[1], mode.mName) != 0) continue;
+
+		AbyssBench::BenchArgs args;
+		std::string error;
+		if (!args.Parse(argc, argv, 2, error)) {
+			puts(error.c_str());
+			PrintSyntax();
+			return 1;
+		}
+		// scenario file fills the options not given in command line
+		if (args.Has("scenario") && !args.LoadFile(args.GetString("scenario", "").c_str(), error)) {
+			puts(error.c_str());
+			return 1;
+		}
+		return mode.mEntry(args);
+	}
+
+	printf("Unknown mode: %s\n", argv[1]);
+	PrintSyntax();
+	return 1;
+}
@@ -0,0 +1,338 @@
+#include "stand_in_server.hpp"
+#include "bmmo_synth.hpp"
+#include <steam/steamnetworkingsockets.h>
+#include <steam/isteamnetworkingutils.h>
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+namespace AbyssBench {
+
+	std::atomic<StandInServer*> StandInServer::sInstance(nullptr);
+
+	StandInServer::StandInServer(OutputHelper* output) :
+		mOutput(output), mGnsSockets(nullptr),
+		mListenSocket(k_HSteamListenSocket_Invalid), mPollGroup(k_HSteamNetPollGroup_Invalid),
+		mMode(Mode::Echo), mFanout(1u), mTickRate(1u),
+		mConnectionsMutex(), mConnections(), mRecvCount(0u), mSendCount(0u),
+		mTdWorker()
+	{}
+
+	StandInServer::~StandInServer() {
+		Stop();
+	}
+
+	bool StandInServer::Start(uint16_t port, size_t fanout) {
+		mFanout = std::max(fanout, static_cast<size_t>(1u));
+		if (!Listen(port, Mode::Echo)) return false;
+		mOutput->Printf("Stand-in server is listening on port %" PRIu16 " with fanout %zu.", port, mFanout);
+		return true;
+	}
+
+	bool StandInServer::StartLobby(uint16_t port, uint32_t tick_rate) {
+		mTickRate = std::max(tick_rate, 1u);
+		if (!Listen(port, Mode::Lobby)) return false;
+		mOutput->Printf("Stand-in lobby is listening on port %" PRIu16 " with tick rate %" PRIu32 ".", port, mTickRate);
+		return true;
+	}
+
+	bool StandInServer::StartSink(uint16_t port) {
+		if (!Listen(port, Mode::Sink)) return false;
+		mOutput->Printf("Stand-in sink is listening on port %" PRIu16 ".", port);
+		return true;
+	}
+
+	bool StandInServer::Listen(uint16_t port, Mode mode) {
+		StandInServer* expected = nullptr;
+		if (!sInstance.compare_exchange_strong(expected, this)) {
+			mOutput->Printf("Only one stand-in server can be started.");
+			return false;
+		}
+
+		mGnsSockets = SteamNetworkingSockets();
+		mMode = mode;
+
+		// listen on loopback with our own callback
+		SteamNetworkingIPAddr address;
+		address.Clear();
+		address.SetIPv4(0x7F000001u, port);
+		SteamNetworkingConfigValue_t opt;
+		opt.SetPtr(k_ESteamNetworkingConfig_Callback_ConnectionStatusChanged, reinterpret_cast<void*>(&StandInServer::ProcConnectionStatusChanged));
+		mListenSocket = mGnsSockets->CreateListenSocketIP(address, 1, &opt);
+		if (mListenSocket == k_HSteamListenSocket_Invalid) {
+			mOutput->Printf("Fail to listen stand-in server on port %" PRIu16 ".", port);
+			sInstance.store(nullptr);
+			return false;
+		}
+		mPollGroup = mGnsSockets->CreatePollGroup();
+
+		switch (mode) {
+			case Mode::Echo:
+				mTdWorker = std::jthread(std::bind(&StandInServer::EchoWorker, this, std::placeholders::_1));
+				break;
+			case Mode::Lobby:
+				mTdWorker = std::jthread(std::bind(&StandInServer::LobbyWorker, this, std::placeholders::_1));
+				break;
+			case Mode::Sink:
+				mTdWorker = std::jthread(std::bind(&StandInServer::SinkWorker, this, std::placeholders::_1));
+				break;
+		}
+		return true;
+	}
+
+	void StandInServer::Stop() {
+		if (mTdWorker.joinable()) {
+			mTdWorker.request_stop();
+			mTdWorker.join();
+		}
+		if (mListenSocket == k_HSteamListenSocket_Invalid) return;
+
+		// close listen socket first, so no more connections will be added.
+		mGnsSockets->CloseListenSocket(mListenSocket);
+		mListenSocket = k_HSteamListenSocket_Invalid;
+		{
+			std::lock_guard locker(mConnectionsMutex);
+			for (auto conn : mConnections) {
+				mGnsSockets->CloseConnection(conn, 0, "Stand-in server stopped", false);
+			}
+			mConnections.clear();
+		}
+		mGnsSockets->DestroyPollGroup(mPollGroup);
+		mPollGroup = k_HSteamNetPollGroup_Invalid;
+
+		sInstance.store(nullptr);
+	}
+
+	size_t StandInServer::GetConnectionCount() {
+		std::lock_guard locker(mConnectionsMutex);
+		return mConnections.size();
+	}
+
+	std::vector<HSteamNetConnection> StandInServer::GetConnections() {
+		std::lock_guard locker(mConnectionsMutex);
+		return mConnections;
+	}
+
+	void StandInServer::Send(HSteamNetConnection conn, const void* data, uint32_t len, bool is_reliable) {
+		mGnsSockets->SendMessageToConnection(conn, data, static_cast<uint32>(len),
+			is_reliable ? k_nSteamNetworkingSend_Reliable : k_nSteamNetworkingSend_UnreliableNoNagle, nullptr);
+		mSendCount.fetch_add(1u, std::memory_order_relaxed);
+	}
+
+	void StandInServer::ProcConnectionStatusChanged(SteamNetConnectionStatusChangedCallback_t* pInfo) {
+		StandInServer* instance = sInstance.load();
+		if (instance != nullptr) instance->HandleConnectionStatusChanged(pInfo);
+	}
+
+	void StandInServer::HandleConnectionStatusChanged(SteamNetConnectionStatusChangedCallback_t* pInfo) {
+		switch (pInfo->m_info.m_eState) {
+			case k_ESteamNetworkingConnectionState_Connecting:
+			{
+				if (mGnsSockets->AcceptConnection(pInfo->m_hConn) != k_EResultOK) {
+					mGnsSockets->CloseConnection(pInfo->m_hConn, 0, nullptr, false);
+					break;
+				}
+				mGnsSockets->SetConnectionPollGroup(pInfo->m_hConn, mPollGroup);
+				std::lock_guard locker(mConnectionsMutex);
+				mConnections.emplace_back(pInfo->m_hConn);
+				break;
+			}
+			case k_ESteamNetworkingConnectionState_ClosedByPeer:
+			case k_ESteamNetworkingConnectionState_ProblemDetectedLocally:
+			{
+				mGnsSockets->CloseConnection(pInfo->m_hConn, 0, nullptr, false);
+				std::lock_guard locker(mConnectionsMutex);
+				auto it = std::find(mConnections.begin(), mConnections.end(), pInfo->m_hConn);
+				if (it != mConnections.end()) mConnections.erase(it);
+				break;
+			}
+			default:
+				break;
+		}
+	}
+
+	uint64_t StandInServer::Broadcast(const std::vector<HSteamNetConnection>& targets, const std::string& msg, int send_flags) {
+		for (auto target : targets) {
+			mGnsSockets->SendMessageToConnection(target, msg.data(), static_cast<uint32>(msg.size()), send_flags, nullptr);
+		}
+		return static_cast<uint64_t>(targets.size());
+	}
+
+	void StandInServer::EchoWorker(std::stop_token st) {
+		std::vector<SteamNetworkingMessage_t*> messages(STEAM_MSG_CAPACITY, nullptr);
+		std::vector<HSteamNetConnection> connections;
+		size_t next_target = 0u;
+
+		while (!st.stop_requested()) {
+			int count = mGnsSockets->ReceiveMessagesOnPollGroup(mPollGroup, messages.data(), static_cast<int>(messages.size()));
+			if (count <= 0) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				continue;
+			}
+			mRecvCount.fetch_add(static_cast<uint64_t>(count), std::memory_order_relaxed);
+
+			// copy connections once per batch. fanout to a closing connection only fail silently.
+			if (mFanout > 1u) {
+				std::lock_guard locker(mConnectionsMutex);
+				connections = mConnections;
+			}
+
+			uint64_t sent = 0u;
+			for (int i = 0; i < count; ++i) {
+				SteamNetworkingMessage_t* msg = messages[i];
+				// keep the reliability of sender
+				mGnsSockets->SendMessageToConnection(msg->m_conn, msg->m_pData, static_cast<uint32>(msg->m_cbSize), msg->m_nFlags, nullptr);
+				++sent;
+
+				for (size_t j = 1u; j < mFanout && j < connections.size(); ++j) {
+					HSteamNetConnection target = connections[next_target++ % connections.size()];
+					if (target == msg->m_conn) target = connections[next_target++ % connections.size()];
+					if (target == msg->m_conn) continue;
+					mGnsSockets->SendMessageToConnection(target, msg->m_pData, static_cast<uint32>(msg->m_cbSize), msg->m_nFlags, nullptr);
+					++sent;
+				}
+
+				msg->Release();
+			}
+			mSendCount.fetch_add(sent, std::memory_order_relaxed);
+		}
+	}
+
+	/// <summary>
+	/// What lobby knows about a player. Only accessed by lobby worker.
+	/// </summary>
+	struct LobbyPlayer {
+		bool mIsLoggedIn;
+		/// <summary>
+		/// Set when a new ball state arrived after the last broadcast.
+		/// </summary>
+		bool mIsDirty;
+		Bmmo::TimedBallState mState;
+	};
+
+	void StandInServer::LobbyWorker(std::stop_token st) {
+		std::vector<SteamNetworkingMessage_t*> messages(STEAM_MSG_CAPACITY, nullptr);
+		std::unordered_map<HSteamNetConnection, LobbyPlayer> players;
+		std::vector<HSteamNetConnection> connections, logged_in;
+		std::string buffer;
+		const std::chrono::nanoseconds tick_interval(1000000000u / mTickRate);
+		auto next_tick = std::chrono::steady_clock::now() + tick_interval;
+
+		auto refresh_logged_in = [&]() -> void {
+			logged_in.clear();
+			for (const auto& [conn, player] : players) {
+				if (player.mIsLoggedIn) logged_in.emplace_back(conn);
+			}
+		};
+
+		while (!st.stop_requested()) {
+			int count = mGnsSockets->ReceiveMessagesOnPollGroup(mPollGroup, messages.data(), static_cast<int>(messages.size()));
+			uint64_t sent = 0u;
+			if (count > 0) mRecvCount.fetch_add(static_cast<uint64_t>(count), std::memory_order_relaxed);
+
+			for (int i = 0; i < count; ++i) {
+				SteamNetworkingMessage_t* msg = messages[i];
+				uint32_t opcode;
+				if (!Bmmo::PeekOpcode(msg->m_pData, static_cast<size_t>(msg->m_cbSize), opcode)) {
+					msg->Release();
+					continue;
+				}
+
+				LobbyPlayer& player = players.try_emplace(msg->m_conn, LobbyPlayer{ false, false, {} }).first->second;
+				switch (static_cast<Bmmo::Opcode>(opcode)) {
+					case Bmmo::Opcode::LoginRequestV3Msg:
+					{
+						// players resend login until accepted, so only the first one change the list.
+						if (!player.mIsLoggedIn) {
+							player.mIsLoggedIn = true;
+							refresh_logged_in();
+						}
+						Bmmo::BuildLoginAccepted(buffer, logged_in.size());
+						mGnsSockets->SendMessageToConnection(msg->m_conn, buffer.data(), static_cast<uint32>(buffer.size()), k_nSteamNetworkingSend_Reliable, nullptr);
+						++sent;
+						break;
+					}
+					case Bmmo::Opcode::TimedBallStateMsg:
+					{
+						if (static_cast<size_t>(msg->m_cbSize) < sizeof(uint32_t) + sizeof(Bmmo::TimedBallState)) break;
+						memcpy(&player.mState, static_cast<const uint8_t*>(msg->m_pData) + sizeof(uint32_t), sizeof(Bmmo::TimedBallState));
+						player.mIsDirty = true;
+						break;
+					}
+					case Bmmo::Opcode::ChatMsg:
+					{
+						if (!player.mIsLoggedIn) break;
+						if (Bmmo::BuildOwnedChat(buffer, static_cast<uint64_t>(msg->m_conn), msg->m_pData, static_cast<size_t>(msg->m_cbSize))) {
+							sent += Broadcast(logged_in, buffer, k_nSteamNetworkingSend_Reliable);
+						}
+						break;
+					}
+					default:
+						// current sector and others are only received.
+						break;
+				}
+				msg->Release();
+			}
+
+			// broadcast ball states in tick
+			auto now = std::chrono::steady_clock::now();
+			if (now >= next_tick) {
+				next_tick += tick_interval;
+				// do not try to catch up missing ticks. a real server also drop them.
+				if (next_tick < now) next_tick = now + tick_interval;
+
+				// remove disconnected players
+				{
+					std::lock_guard locker(mConnectionsMutex);
+					connections = mConnections;
+				}
+				std::sort(connections.begin(), connections.end());
+				bool is_removed = false;
+				for (auto it = players.begin(); it != players.end();) {
+					if (std::binary_search(connections.begin(), connections.end(), it->first)) ++it;
+					else {
+						it = players.erase(it);
+						is_removed = true;
+					}
+				}
+				if (is_removed) refresh_logged_in();
+
+				// split dirty states into messages, and send each of them to every player.
+				Bmmo::BeginOwnedBallStates(buffer);
+				size_t entries = 0u;
+				for (auto& [conn, player] : players) {
+					if (!player.mIsDirty) continue;
+					player.mIsDirty = false;
+
+					Bmmo::OwnedBallState state{ static_cast<uint64_t>(conn), player.mState };
+					if (!Bmmo::AppendOwnedBallState(buffer, state)) {
+						sent += Broadcast(logged_in, buffer, k_nSteamNetworkingSend_UnreliableNoNagle);
+						Bmmo::BeginOwnedBallStates(buffer);
+						Bmmo::AppendOwnedBallState(buffer, state);
+						entries = 0u;
+					}
+					++entries;
+				}
+				if (entries != 0u) sent += Broadcast(logged_in, buffer, k_nSteamNetworkingSend_UnreliableNoNagle);
+			}
+
+			if (sent != 0u) mSendCount.fetch_add(sent, std::memory_order_relaxed);
+			if (count <= 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+	void StandInServer::SinkWorker(std::stop_token st) {
+		std::vector<SteamNetworkingMessage_t*> messages(STEAM_MSG_CAPACITY, nullptr);
+
+		while (!st.stop_requested()) {
+			int count = mGnsSockets->ReceiveMessagesOnPollGroup(mPollGroup, messages.data(), static_cast<int>(messages.size()));
+			if (count <= 0) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				continue;
+			}
+			mRecvCount.fetch_add(static_cast<uint64_t>(count), std::memory_order_relaxed);
+			for (int i = 0; i < count; ++i) messages[i]->Release();
+		}
+	}
+
+}
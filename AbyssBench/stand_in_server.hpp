@@ -0,0 +1,108 @@
+#pragma once
+
+#include "others_helper.hpp"
+#include <steam/steamnetworkingtypes.h>
+#include <steam/isteamnetworkingsockets.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace AbyssBench {
+
+	using namespace WhispersAbyss;
+
+	/*
+	StandInServer is a GNS server standing in for the real BMMO server.
+	It runs in the same process with the WhispersAbyss under test and use the GNS library initialized by its GnsFactory,
+	so it must be started after BridgeFactory is running and stopped before BridgeFactory is stopped.
+
+	GnsFactory owns the global connection status callback, so this server set its own callback on its listen socket.
+	Accepted connections inherit it, and their callbacks are still run by the polling thread of GnsFactory.
+
+	Server works in one of 3 modes:
+	Echo mode send every message back to its sender and some other connections.
+	Lobby mode act like a BMMO server: it accept login, relay chat, and broadcast the latest ball states of players
+	in owned_compressed_ball_state_msg at a fixed tick rate.
+	Sink mode only receive messages. Caller send messages by itself through Send(), like replay mode does.
+	*/
+
+	class StandInServer {
+	public:
+		StandInServer(OutputHelper* output);
+		StandInServer(const StandInServer& rhs) = delete;
+		StandInServer(StandInServer&& rhs) = delete;
+		~StandInServer();
+
+		/// <summary>
+		/// Listen on loopback and start serving.
+		/// </summary>
+		/// <param name="fanout">How many connections receive each message. 1 mean echo to sender only.
+		/// Others are picked in turn from the rest connections.</param>
+		/// <returns>True if success.</returns>
+		bool Start(uint16_t port, size_t fanout);
+		/// <summary>
+		/// Listen on loopback and serve as a BMMO lobby.
+		/// </summary>
+		/// <param name="tick_rate">How many times per second ball states are broadcast.</param>
+		/// <returns>True if success.</returns>
+		bool StartLobby(uint16_t port, uint32_t tick_rate);
+		/// <summary>
+		/// Listen on loopback and drop all received messages.
+		/// </summary>
+		/// <returns>True if success.</returns>
+		bool StartSink(uint16_t port);
+		void Stop();
+
+		/// <summary>
+		/// Send a message to given connection. Can be called from any thread.
+		/// </summary>
+		void Send(HSteamNetConnection conn, const void* data, uint32_t len, bool is_reliable);
+		/// <summary>
+		/// Get accepted connections, in the order they were accepted.
+		/// </summary>
+		std::vector<HSteamNetConnection> GetConnections();
+
+		size_t GetConnectionCount();
+		uint64_t GetRecvCount() { return mRecvCount.load(std::memory_order_relaxed); }
+		uint64_t GetSendCount() { return mSendCount.load(std::memory_order_relaxed); }
+	private:
+		enum class Mode {
+			Echo, Lobby, Sink
+		};
+		bool Listen(uint16_t port, Mode mode);
+		static void ProcConnectionStatusChanged(SteamNetConnectionStatusChangedCallback_t* pInfo);
+		void HandleConnectionStatusChanged(SteamNetConnectionStatusChangedCallback_t* pInfo);
+		void EchoWorker(std::stop_token st);
+		void LobbyWorker(std::stop_token st);
+		void SinkWorker(std::stop_token st);
+		/// <summary>
+		/// Send the same message to given connections and return the count of sent messages.
+		/// </summary>
+		uint64_t Broadcast(const std::vector<HSteamNetConnection>& targets, const std::string& msg, int send_flags);
+
+		/// <summary>
+		/// The running server receiving callbacks. Only one server can be started at the same time.
+		/// </summary>
+		static std::atomic<StandInServer*> sInstance;
+
+		OutputHelper* mOutput;
+		ISteamNetworkingSockets* mGnsSockets;
+		HSteamListenSocket mListenSocket;
+		HSteamNetPollGroup mPollGroup;
+		Mode mMode;
+		size_t mFanout;
+		uint32_t mTickRate;
+
+		/// <summary>
+		/// Written by callback, read by worker.
+		/// </summary>
+		std::mutex mConnectionsMutex;
+		std::vector<HSteamNetConnection> mConnections;
+		std::atomic_uint64_t mRecvCount, mSendCount;
+
+		std::jthread mTdWorker;
+	};
+
+}
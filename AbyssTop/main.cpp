@@ -0,0 +1,287 @@
+#include "stats_layout.hpp"
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <conio.h>
+#else
+#include <sys/mman.h>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#endif // _WIN32
+
+/*
+AbyssTop - watch the statistics page published by WhispersAbyss.
+
+It only maps the page read-only and never talks to WhispersAbyss,
+so it can refresh at any rate without affecting the proxy.
+*/
+
+using namespace WhispersAbyss;
+
+/// <summary>
+/// Give up reading a section in this round if it keeps changing.
+/// </summary>
+constexpr const int READ_RETRY_COUNT = 64;
+
+struct SlotSnapshot {
+	uint32_t mFlags;
+	uint64_t mIndex;
+	StatsCountersValue mCounters;
+};
+
+static bool ReadSlot(const StatsBridgeSlot& slot, SlotSnapshot& snapshot) {
+	for (int i = 0; i < READ_RETRY_COUNT; ++i) {
+		if (slot.mLock.TryRead([&]() -> void {
+			snapshot.mFlags = slot.mFlags.load(std::memory_order_relaxed);
+			snapshot.mIndex = slot.mIndex.load(std::memory_order_relaxed);
+			snapshot.mCounters.LoadFrom(slot.mCounters);
+		})) return true;
+	}
+	return false;
+}
+
+struct GlobalSnapshot {
+	uint32_t mBridgeCount, mUnpublishedBridgeCount;
+	int64_t mUpdateTime;
+	StatsCountersValue mTotal;
+};
+
+static bool ReadGlobal(const StatsGlobalSection& global, GlobalSnapshot& snapshot) {
+	for (int i = 0; i < READ_RETRY_COUNT; ++i) {
+		if (global.mLock.TryRead([&]() -> void {
+			snapshot.mBridgeCount = global.mBridgeCount.load(std::memory_order_relaxed);
+			snapshot.mUnpublishedBridgeCount = global.mUnpublishedBridgeCount.load(std::memory_order_relaxed);
+			snapshot.mUpdateTime = global.mUpdateTime.load(std::memory_order_relaxed);
+			snapshot.mTotal.LoadFrom(global.mTotal);
+		})) return true;
+	}
+	return false;
+}
+
+static std::string FormatBytes(double bytes) {
+	constexpr const char* units[] = { "B", "KB", "MB", "GB", "TB" };
+	size_t unit = 0u;
+	while (bytes >= 1024.0 && unit < 4u) {
+		bytes /= 1024.0;
+		++unit;
+	}
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.1f%s", bytes, units[unit]);
+	return buf;
+}
+
+static const StatsPageLayout* OpenPage(const char* name) {
+#ifdef _WIN32
+	HANDLE mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+	if (mapping == nullptr) return nullptr;
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, sizeof(StatsPageLayout));
+	// view keeps mapping alive.
+	CloseHandle(mapping);
+	if (view == nullptr) return nullptr;
+#else
+	std::string shm_name("/");
+	shm_name += name;
+	int fd = shm_open(shm_name.c_str(), O_RDONLY, 0);
+	if (fd < 0) return nullptr;
+	void* view = mmap(nullptr, sizeof(StatsPageLayout), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (view == MAP_FAILED) return nullptr;
+#endif // _WIN32
+	return static_cast<const StatsPageLayout*>(view);
+}
+
+static void ClosePage(const StatsPageLayout* page) {
+#ifdef _WIN32
+	UnmapViewOfFile(page);
+#else
+	munmap(const_cast<StatsPageLayout*>(page), sizeof(StatsPageLayout));
+#endif // _WIN32
+}
+
+#ifndef _WIN32
+static termios s_OldTermios;
+static bool s_IsTermiosChanged = false;
+static volatile sig_atomic_t s_QuitSignal = 0;
+
+static void OnQuitSignal(int) {
+	s_QuitSignal = 1;
+}
+#endif // _WIN32
+
+/// <summary>
+/// Let keys be read one by one without echo, and make Ctrl+C quit like q, so terminal is restored.
+/// Windows console does not need it.
+/// </summary>
+static void BeginKeyInput() {
+#ifndef _WIN32
+	signal(SIGINT, &OnQuitSignal);
+	signal(SIGTERM, &OnQuitSignal);
+	if (tcgetattr(STDIN_FILENO, &s_OldTermios) != 0) return;
+	termios new_attr = s_OldTermios;
+	new_attr.c_lflag &= ~(ICANON | ECHO);
+	s_IsTermiosChanged = tcsetattr(STDIN_FILENO, TCSANOW, &new_attr) == 0;
+#endif // _WIN32
+}
+
+static void EndKeyInput() {
+#ifndef _WIN32
+	if (s_IsTermiosChanged) tcsetattr(STDIN_FILENO, TCSANOW, &s_OldTermios);
+	s_IsTermiosChanged = false;
+#endif // _WIN32
+}
+
+static bool IsQuitPressed() {
+#ifdef _WIN32
+	while (_kbhit()) {
+		if (_getch() == 'q') return true;
+	}
+#else
+	if (s_QuitSignal) return true;
+	pollfd pfd{ STDIN_FILENO, POLLIN, 0 };
+	char c;
+	while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN)) {
+		if (read(STDIN_FILENO, &c, 1) != 1) break;
+		if (c == 'q') return true;
+	}
+#endif // _WIN32
+	return false;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		puts("Syntax: AbyssTop [name] <interval>");
+		puts("\tname\tThe statistics page name given to WhispersAbyss by --stats-name.");
+		puts("\tinterval\tRefresh interval in milliseconds. Default is 1000.");
+		return 0;
+	}
+	const char* name = argv[1];
+	long interval = argc >= 3 ? strtol(argv[2], nullptr, 10) : 1000;
+	if (interval <= 0) interval = 1000;
+
+#ifdef _WIN32
+	// enable ANSI escape for redrawing
+	HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+	DWORD mode = 0;
+	if (GetConsoleMode(console, &mode)) SetConsoleMode(console, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+#endif // _WIN32
+
+	const StatsPageLayout* page = OpenPage(name);
+	if (page == nullptr) {
+		printf("Fail to open statistics page %s. Is WhispersAbyss running with --stats-name?\n", name);
+		return 1;
+	}
+	if (page->mHeader.mMagic.load(std::memory_order_acquire) != STATS_PAGE_MAGIC ||
+		page->mHeader.mVersion != STATS_PAGE_VERSION ||
+		page->mHeader.mPageSize != sizeof(StatsPageLayout)) {
+		printf("Statistics page %s is not ready or its version is not matched. Expect version %" PRIu32 ".\n", name, STATS_PAGE_VERSION);
+		ClosePage(page);
+		return 1;
+	}
+
+	// the last counters of each bridge, keyed by slot and bridge index,
+	// so that a slot reused by another bridge do not produce a negative rate.
+	std::map<std::pair<uint32_t, uint64_t>, StatsCountersValue> last_counters, current_counters;
+	// total has its own time, because reading global may fail in some rounds.
+	StatsCountersValue last_total{ 0u, 0u, 0u, 0u, 0u, 0u, 0u, 0u };
+	bool has_last_total = false;
+	auto last_time = std::chrono::steady_clock::now(), last_total_time = last_time;
+	std::vector<std::pair<uint32_t, SlotSnapshot>> rows;
+	SlotSnapshot slot_snapshot;
+	GlobalSnapshot global_snapshot{};
+
+	BeginKeyInput();
+	while (true) {
+		if (IsQuitPressed()) break;
+		if (page->mHeader.mMagic.load(std::memory_order_acquire) != STATS_PAGE_MAGIC) {
+			puts("WhispersAbyss has exited.");
+			break;
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		double elapsed = std::chrono::duration<double>(now - last_time).count();
+		last_time = now;
+
+		// collect
+		rows.clear();
+		current_counters.clear();
+		for (uint32_t i = 0u; i < STATS_SLOT_COUNT; ++i) {
+			if (!ReadSlot(page->mSlots[i], slot_snapshot)) continue;
+			if (!(slot_snapshot.mFlags & StatsSlotFlags::InUse)) continue;
+			rows.emplace_back(i, slot_snapshot);
+			current_counters.emplace(std::make_pair(i, slot_snapshot.mIndex), slot_snapshot.mCounters);
+		}
+		bool has_global = ReadGlobal(page->mGlobal, global_snapshot);
+
+		// draw
+		printf("\x1b[2J\x1b[H");
+		printf("AbyssTop - %s (pid %" PRIu64 ")    refresh %ld ms, q to quit\n\n", name, page->mHeader.mProcessId, interval);
+		if (has_global) {
+			// a counter going back means it is not the same source anymore, so restart its rate.
+			double total_elapsed = std::chrono::duration<double>(now - last_total_time).count();
+			bool has_total_rate = has_last_total && total_elapsed > 0.0 &&
+				global_snapshot.mTotal.mSendGnsBytes >= last_total.mSendGnsBytes &&
+				global_snapshot.mTotal.mSendTcpBytes >= last_total.mSendTcpBytes;
+			printf("Bridges: %" PRIu32 " (unpublished: %" PRIu32 ")\n", global_snapshot.mBridgeCount, global_snapshot.mUnpublishedBridgeCount);
+			printf("Total Tcp->Gns: %" PRIu64 " msg, %s", global_snapshot.mTotal.mSendGns, FormatBytes(static_cast<double>(global_snapshot.mTotal.mSendGnsBytes)).c_str());
+			if (has_total_rate) {
+				printf(" (%s/s)", FormatBytes((global_snapshot.mTotal.mSendGnsBytes - last_total.mSendGnsBytes) / total_elapsed).c_str());
+			}
+			printf("\nTotal Gns->Tcp: %" PRIu64 " msg, %s", global_snapshot.mTotal.mSendTcp, FormatBytes(static_cast<double>(global_snapshot.mTotal.mSendTcpBytes)).c_str());
+			if (has_total_rate) {
+				printf(" (%s/s)", FormatBytes((global_snapshot.mTotal.mSendTcpBytes - last_total.mSendTcpBytes) / total_elapsed).c_str());
+			}
+			printf("\n\n");
+			last_total = global_snapshot.mTotal;
+			last_total_time = now;
+			has_last_total = true;
+		}
+
+		printf("%-6s %-10s %-10s %12s %12s %12s %12s\n", "Index", "State", "Flags", "T->G msg/s", "T->G B/s", "G->T msg/s", "G->T B/s");
+		for (auto& row : rows) {
+			const SlotSnapshot& snapshot = row.second;
+			char flags[16];
+			snprintf(flags, sizeof(flags), "%s%s",
+				(snapshot.mFlags & StatsSlotFlags::Detached) ? "D" : "-",
+				(snapshot.mFlags & StatsSlotFlags::Switching) ? "S" : "-");
+
+			// no rate for a new bridge, or counters going back, like a slot reused by a bridge of the same index.
+			auto it = last_counters.find(std::make_pair(row.first, snapshot.mIndex));
+			bool has_rate = it != last_counters.end() && elapsed > 0.0 &&
+				snapshot.mCounters.mSendGns >= it->second.mSendGns && snapshot.mCounters.mSendGnsBytes >= it->second.mSendGnsBytes &&
+				snapshot.mCounters.mSendTcp >= it->second.mSendTcp && snapshot.mCounters.mSendTcpBytes >= it->second.mSendTcpBytes;
+			if (!has_rate) {
+				printf("%-6" PRIu64 " %-10s %-10s %12s %12s %12s %12s\n", snapshot.mIndex,
+					(snapshot.mFlags & StatsSlotFlags::Running) ? "Running" : "Ready", flags, "-", "-", "-", "-");
+				continue;
+			}
+			const StatsCountersValue& prev = it->second;
+			printf("%-6" PRIu64 " %-10s %-10s %12.1f %12s %12.1f %12s\n", snapshot.mIndex,
+				(snapshot.mFlags & StatsSlotFlags::Running) ? "Running" : "Ready", flags,
+				(snapshot.mCounters.mSendGns - prev.mSendGns) / elapsed,
+				FormatBytes((snapshot.mCounters.mSendGnsBytes - prev.mSendGnsBytes) / elapsed).c_str(),
+				(snapshot.mCounters.mSendTcp - prev.mSendTcp) / elapsed,
+				FormatBytes((snapshot.mCounters.mSendTcpBytes - prev.mSendTcpBytes) / elapsed).c_str());
+		}
+		fflush(stdout);
+		std::swap(last_counters, current_counters);
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+	}
+	EndKeyInput();
+
+	ClosePage(page);
+	return 0;
+}
@@ -0,0 +1,205 @@
+#include "alloc_profiler.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+
+namespace WhispersAbyss {
+
+	/// <summary>
+	/// The counters of a thread. Only written by its thread, so it uses relaxed load and store instead of read-modify-write.
+	/// </summary>
+	struct AllocThreadCounters {
+		std::atomic_uint64_t mCount[ALLOC_CATEGORY_COUNT];
+		std::atomic_uint64_t mBytes[ALLOC_CATEGORY_COUNT];
+		std::atomic_bool mIsAlive;
+	};
+
+	struct AllocRegistry {
+		std::mutex mMutex;
+		std::deque<std::unique_ptr<AllocThreadCounters>> mThreads;
+		uint64_t mRetiredCount[ALLOC_CATEGORY_COUNT];
+		uint64_t mRetiredBytes[ALLOC_CATEGORY_COUNT];
+	};
+
+	thread_local AllocThreadCounters* tCounters = nullptr;
+	thread_local AllocCategory tCategory = AllocCategory::Other;
+	/// <summary>
+	/// True when allocations of this thread should not be counted:
+	/// while profiler itself is allocating, or after this thread started exiting.
+	/// </summary>
+	thread_local bool tIsBypassed = false;
+
+	/// <summary>
+	/// Mark counters of this thread as retired when thread exits.
+	/// It is constructed when thread registers, so threads never allocating do not register an exit hook.
+	/// </summary>
+	struct AllocThreadExit {
+		~AllocThreadExit() {
+			tIsBypassed = true;
+			if (tCounters != nullptr) {
+				tCounters->mIsAlive.store(false, std::memory_order_release);
+				tCounters = nullptr;
+			}
+		}
+	};
+	thread_local AllocThreadExit tExit;
+
+	class AllocBypassGuard {
+	public:
+		AllocBypassGuard() : mPrevious(tIsBypassed) { tIsBypassed = true; }
+		~AllocBypassGuard() { tIsBypassed = mPrevious; }
+	private:
+		bool mPrevious;
+	};
+
+	/// <summary>
+	/// The registry is never destroyed, because detached threads may still exit after static destruction.
+	/// Caller must hold AllocBypassGuard, because creating it allocates.
+	/// </summary>
+	static AllocRegistry& GetRegistry() {
+		static AllocRegistry* registry = new AllocRegistry{};
+		return *registry;
+	}
+
+	/// <summary>
+	/// Fold counters of exited threads into retired totals. Caller must lock registry.
+	/// </summary>
+	static void FoldRetired(AllocRegistry& registry) {
+		for (auto it = registry.mThreads.begin(); it != registry.mThreads.end();) {
+			AllocThreadCounters& counters = **it;
+			if (counters.mIsAlive.load(std::memory_order_acquire)) {
+				++it;
+				continue;
+			}
+			for (size_t i = 0; i < ALLOC_CATEGORY_COUNT; ++i) {
+				registry.mRetiredCount[i] += counters.mCount[i].load(std::memory_order_relaxed);
+				registry.mRetiredBytes[i] += counters.mBytes[i].load(std::memory_order_relaxed);
+			}
+			it = registry.mThreads.erase(it);
+		}
+	}
+
+	static AllocThreadCounters* RegisterThread() {
+		AllocBypassGuard bypass;
+		AllocRegistry& registry = GetRegistry();
+
+		auto counters = std::make_unique<AllocThreadCounters>();
+		for (size_t i = 0; i < ALLOC_CATEGORY_COUNT; ++i) {
+			counters->mCount[i].store(0u, std::memory_order_relaxed);
+			counters->mBytes[i].store(0u, std::memory_order_relaxed);
+		}
+		counters->mIsAlive.store(true, std::memory_order_relaxed);
+		// touch exit hook, so it is constructed and destroyed with this thread.
+		(void)&tExit;
+		tCounters = counters.get();
+
+		std::lock_guard locker(registry.mMutex);
+		FoldRetired(registry);
+		registry.mThreads.emplace_back(std::move(counters));
+		return tCounters;
+	}
+
+	uint64_t AllocProfile::GetTotalCount() const {
+		uint64_t total = 0u;
+		for (size_t i = 0; i < ALLOC_CATEGORY_COUNT; ++i) total += mCount[i];
+		return total;
+	}
+
+	uint64_t AllocProfile::GetTotalBytes() const {
+		uint64_t total = 0u;
+		for (size_t i = 0; i < ALLOC_CATEGORY_COUNT; ++i) total += mBytes[i];
+		return total;
+	}
+
+	AllocCategory AllocProfiler::EnterCategory(AllocCategory category) {
+		AllocCategory previous = tCategory;
+		if (previous == AllocCategory::Other) tCategory = category;
+		return previous;
+	}
+
+	void AllocProfiler::LeaveCategory(AllocCategory previous) {
+		tCategory = previous;
+	}
+
+	void AllocProfiler::Record(size_t bytes) {
+		if (tIsBypassed) return;
+		AllocThreadCounters* counters = tCounters;
+		if (counters == nullptr) counters = RegisterThread();
+
+		size_t category = static_cast<size_t>(tCategory);
+		counters->mCount[category].store(counters->mCount[category].load(std::memory_order_relaxed) + 1u, std::memory_order_relaxed);
+		counters->mBytes[category].store(counters->mBytes[category].load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+	}
+
+	AllocProfile AllocProfiler::Report() {
+		AllocBypassGuard bypass;
+		AllocRegistry& registry = GetRegistry();
+		AllocProfile profile{};
+
+		std::lock_guard locker(registry.mMutex);
+		FoldRetired(registry);
+		for (size_t i = 0; i < ALLOC_CATEGORY_COUNT; ++i) {
+			profile.mCount[i] = registry.mRetiredCount[i];
+			profile.mBytes[i] = registry.mRetiredBytes[i];
+		}
+		for (auto& counters : registry.mThreads) {
+			uint64_t thread_count = 0u;
+			for (size_t i = 0; i < ALLOC_CATEGORY_COUNT; ++i) {
+				uint64_t count = counters->mCount[i].load(std::memory_order_relaxed);
+				profile.mCount[i] += count;
+				profile.mBytes[i] += counters->mBytes[i].load(std::memory_order_relaxed);
+				thread_count += count;
+			}
+			profile.mBusiestThreadCount = std::max(profile.mBusiestThreadCount, thread_count);
+		}
+		profile.mThreads = registry.mThreads.size();
+		return profile;
+	}
+
+	const char* AllocProfiler::Category2String(AllocCategory category) {
+		switch (category) {
+			case AllocCategory::Other: return "other";
+			case AllocCategory::MessagePayload: return "payload";
+			case AllocCategory::DequeNode: return "deque";
+			case AllocCategory::RecvBuffer: return "recv buffer";
+			case AllocCategory::Disposal: return "disposal";
+			default: return "unknown";
+		}
+	}
+
+}
+
+#ifdef WHISPERS_ABYSS_ALLOC_PROFILE
+
+// Replace global allocator of the whole program. malloc and free do the real work.
+
+static void* CountedAlloc(size_t size) {
+	WhispersAbyss::AllocProfiler::Record(size);
+	return std::malloc(size == 0u ? 1u : size);
+}
+
+void* operator new(size_t size) {
+	void* ptr = CountedAlloc(size);
+	if (ptr == nullptr) throw std::bad_alloc();
+	return ptr;
+}
+void* operator new[](size_t size) {
+	void* ptr = CountedAlloc(size);
+	if (ptr == nullptr) throw std::bad_alloc();
+	return ptr;
+}
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return CountedAlloc(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return CountedAlloc(size); }
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { std::free(ptr); }
+
+#endif
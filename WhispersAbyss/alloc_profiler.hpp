@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+
+namespace WhispersAbyss {
+
+	/*
+	Allocation profiler counts heap allocations made through global operator new, per thread and per call site category.
+
+	The counting operator new and delete are only compiled when WHISPERS_ABYSS_ALLOC_PROFILE is defined,
+	because they replace the allocator of the whole program. Otherwise ABYSS_ALLOC_SCOPE expands to nothing
+	and AllocProfiler::Report() returns zeros.
+
+	Call sites are tagged by ABYSS_ALLOC_SCOPE(category): every allocation of current thread is counted into that category
+	until the end of enclosing block. The outermost scope wins, so helpers like CommonOpers::MoveDeque
+	called inside DisposalHelper are still counted as Disposal. Allocations out of any scope are counted as Other.
+	Over-aligned new and delete are not replaced, so they are not counted.
+
+	Counters belong to threads, written by their own thread only, so counting takes no lock.
+	Counters of exited threads are folded into retired totals when next thread registers or when reporting.
+	*/
+
+	enum class AllocCategory : uint8_t {
+		Other,
+		MessagePayload,	// the buffer of CommonMessage
+		DequeNode,	// the blocks of message lists, growing when messages are pushed or moved
+		RecvBuffer,	// the body buffer of TcpInstance::RecvWorker
+		Disposal,	// std::function and item list of DisposalHelper
+		Count
+	};
+	constexpr const size_t ALLOC_CATEGORY_COUNT = static_cast<size_t>(AllocCategory::Count);
+
+	struct AllocProfile {
+		uint64_t mCount[ALLOC_CATEGORY_COUNT];
+		uint64_t mBytes[ALLOC_CATEGORY_COUNT];
+		size_t mThreads;	// alive threads which have allocated
+		uint64_t mBusiestThreadCount;	// the most allocations made by one alive thread
+
+		uint64_t GetTotalCount() const;
+		uint64_t GetTotalBytes() const;
+	};
+
+	class AllocProfiler {
+	public:
+		static constexpr bool IsCompiled() {
+#ifdef WHISPERS_ABYSS_ALLOC_PROFILE
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		/// <summary>
+		/// Tag following allocations of current thread, if no outer scope has tagged them.
+		/// </summary>
+		/// <returns>The category before entering, which should be given to LeaveCategory().</returns>
+		static AllocCategory EnterCategory(AllocCategory category);
+		static void LeaveCategory(AllocCategory previous);
+		/// <summary>
+		/// Count an allocation of current thread. Called by operator new.
+		/// </summary>
+		static void Record(size_t bytes);
+		/// <summary>
+		/// Sum the counters of all threads, including exited ones. Can be called from any thread.
+		/// </summary>
+		static AllocProfile Report();
+		static const char* Category2String(AllocCategory category);
+	};
+
+	class AllocScope {
+	public:
+		AllocScope(AllocCategory category) : mPrevious(AllocProfiler::EnterCategory(category)) {}
+		AllocScope(const AllocScope& rhs) = delete;
+		AllocScope(AllocScope&& rhs) = delete;
+		~AllocScope() { AllocProfiler::LeaveCategory(mPrevious); }
+	private:
+		AllocCategory mPrevious;
+	};
+
+}
+
+#ifdef WHISPERS_ABYSS_ALLOC_PROFILE
+
+#define ABYSS_ALLOC_CONCAT_IMPL(a, b) a##b
+#define ABYSS_ALLOC_CONCAT(a, b) ABYSS_ALLOC_CONCAT_IMPL(a, b)
+#define ABYSS_ALLOC_SCOPE(category) ::WhispersAbyss::AllocScope ABYSS_ALLOC_CONCAT(abyss_alloc_scope_, __LINE__)(::WhispersAbyss::AllocCategory::category)
+
+#else
+
+#define ABYSS_ALLOC_SCOPE(category) ((void)0)
+
+#endif
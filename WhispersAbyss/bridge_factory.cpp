@@ -1,59 +1,19 @@
 #include "bridge_factory.hpp"
+#include <algorithm>
 
 namespace WhispersAbyss {
 
-	BridgeFactory::BridgeFactory(OutputHelper* output, uint16_t tcp_port) :
-		mOutput(output), mModuleStatus(StateMachine::Ready), mStatusReporter(mModuleStatus), mIndexDistributor(),
-		mTcpFactory(output, tcp_port), mGnsFactory(output),
-		mInstances(), mInstancesMutex(),
-		mTdCtx(),
+	BridgeFactory::BridgeFactory(OutputHelper* output, LifecycleExecutor* executor, const AbyssSettings* settings) :
+		mOutput(output), mExecutor(executor), mStrand(executor->MakeStrand()),
+		mModuleStatus(StateMachine::Ready), mStatusReporter(mModuleStatus), mIndexDistributor(), mSettings(settings),
+		mTcp2GnsLatency(), mGns2TcpLatency(), mOpcodes(settings->mOpcodeStats ? new OpcodeCounters() : nullptr), mSetupDurations(), mStatsPage(output), mCapture(output),
+		mTcpFactory(output, executor, settings->mAcceptPort, &mSetupDurations), mGnsFactory(output, executor, settings->mImpairment),
+		mInstances(), mInstancesMutex("bridge_instances"), mSamplers(), mTotalSampler(), mRetiredSample{ 0u, 0u, 0u, 0u }, mRetiredCounters{ 0u, 0u, 0u, 0u, 0u, 0u, 0u, 0u }, mRetiredSwitches{ 0u, 0u, 0u, 0u }, mSessions(),
+		mLastAlloc{}, mLastAllocMessages(0u),
+		mTdCtx(), mMetricsServer(settings->mMetricsPort != 0u ? new MetricsServer(output, settings->mMetricsPort) : nullptr),
 		mDisposal()
 	{
-		std::thread([this]() -> void {
-			// start transition
-			StateMachine::TransitionInitializing transition(mModuleStatus);
-			if (!transition.CanTransition()) return;
-
-			// wait them
-			CountDownTimer waiting(MODULE_WAITING_INTERVAL);
-			while (true) {
-				if (mTcpFactory.mStatusReporter.IsInState(StateMachine::Stopped) ||
-					mGnsFactory.mStatusReporter.IsInState(StateMachine::Stopped)) {
-					mOutput->Printf(OutputHelper::Component::BridgeFactory, NO_INDEX, "Unexpected crash of TcpFactory or GnsFactory.");
-					this->InternalStop();
-					transition.SetTransitionError(true);
-					return;
-				}
-
-				if (mTcpFactory.mStatusReporter.IsInState(StateMachine::Running) &&
-					mGnsFactory.mStatusReporter.IsInState(StateMachine::Running)) {
-					break;	// all factory are running
-				}
-
-				// otherwise check time and sleep
-				if (waiting.HasRunOutOfTime()) {
-					mOutput->Printf(OutputHelper::Component::BridgeFactory, NO_INDEX, "Run out of time of waiting factory running.");
-					this->InternalStop();
-					transition.SetTransitionError(true);
-					return;
-				}
-				std::this_thread::sleep_for(SPIN_INTERVAL);
-			}
-
-			// Start context
-			this->mTdCtx = std::jthread(std::bind(&BridgeFactory::CtxWorker, this, std::placeholders::_1));
-
-			// start disposal
-			this->mDisposal.Start([this](BridgeInstance* instance) -> void {
-				if (!instance->mStatusReporter.IsInState(StateMachine::Stopped)) instance->Stop();
-				instance->mStatusReporter.SpinUntil(StateMachine::Stopped);
-				this->mIndexDistributor.Return(instance->mIndex);
-				delete instance;
-			});
-
-			// end transition
-			transition.SetTransitionError(false);
-		}).detach();
+		mExecutor->Spawn(mStrand, InitializingTask(), "BridgeFactory::Initializing", NO_INDEX);
 
 		mOutput->Printf(OutputHelper::Component::BridgeFactory, NO_INDEX, "Factory created.");
 	}
@@ -64,11 +24,74 @@ namespace WhispersAbyss {
 		mOutput->Printf(OutputHelper::Component::BridgeFactory, NO_INDEX, "Factory disposed.");
 	}
 
-	void BridgeFactory::InternalStop() {
+	LifecycleExecutor::Task_t BridgeFactory::InitializingTask() {
+		// start transition
+		StateMachine::TransitionInitializing transition(mModuleStatus, std::defer_lock);
+		co_await LifecycleExecutor::EnterTransition(transition);
+		if (!transition.CanTransition()) co_return;
+
+		// wait them
+		CountDownTimer waiting(MODULE_WAITING_INTERVAL);
+		while (true) {
+			if (mTcpFactory.mStatusReporter.IsInState(StateMachine::Stopped) ||
+				mGnsFactory.mStatusReporter.IsInState(StateMachine::Stopped)) {
+				mOutput->Printf(OutputHelper::Component::BridgeFactory, NO_INDEX, "Unexpected crash of TcpFactory or GnsFactory.");
+				co_await this->InternalStop();
+				transition.SetTransitionError(true);
+				co_return;
+			}
+
+			if (mTcpFactory.mStatusReporter.IsInState(StateMachine::Running) &&
+				mGnsFactory.mStatusReporter.IsInState(StateMachine::Running)) {
+				break;	// all factory are running
+			}
+
+			// otherwise check time and sleep
+			if (waiting.HasRunOutOfTime()) {
+				mOutput->Printf(OutputHelper::Component::BridgeFactory, NO_INDEX, "Run out of time of waiting factory running.");
+				co_await this->InternalStop();
+				transition.SetTransitionError(true);
+				co_return;
+			}
+			co_await LifecycleExecutor::Delay(SPIN_INTERVAL);
+		}
+
+		// start metrics endpoint. it is optional so failure is not fatal.
+		if (mMetricsServer != nullptr && !mMetricsServer->Start()) {
+			mMetricsServer.reset();
+		}
+		// open statistics page. also optional.
+		if (!mSettings->mStatsName.empty()) {
+			mStatsPage.Open(mSettings->mStatsName);
+		}
+		// open capture file. also optional.
+		if (!mSettings->mCaptureFile.empty()) {
+			mCapture.Open(mSettings->mCaptureFile);
+		}
+
+		// Start context
+		this->mTdCtx.Start(std::bind(&BridgeFactory::CtxWorker, this, std::placeholders::_1));
+
+		// start disposal
+		this->mDisposal.Start([this](BridgeInstance* instance) -> void {
+			if (!instance->mStatusReporter.IsInState(StateMachine::Stopped)) instance->Stop();
+			instance->mStatusReporter.SpinUntil(StateMachine::Stopped);
+			this->mIndexDistributor.Return(instance->mIndex);
+			this->mStatsPage.ReleaseSlot(instance->GetStatsSlot());
+			delete instance;
+		}, "disposal-bridge");
+
+		// end transition
+		transition.SetTransitionError(false);
+	}
+
+	LifecycleExecutor::Task_t BridgeFactory::InternalStop() {
 		// stop context first
-		if (mTdCtx.joinable()) {
-			mTdCtx.request_stop();
-			mTdCtx.join();
+		co_await mTdCtx.Stop();
+
+		// stop metrics endpoint
+		if (mMetricsServer != nullptr) {
+			mMetricsServer->Stop();
 		}
 
 		// move all bridge instance to disposal and wait disposal exit
@@ -76,51 +99,101 @@ namespace WhispersAbyss {
 			std::lock_guard locker(mInstancesMutex);
 			this->mDisposal.Move(mInstances);
 		}
-		this->mDisposal.Stop();
+		co_await LifecycleExecutor::StopDisposal(this->mDisposal);
+
+		// no bridge write statistics page or capture file now
+		mStatsPage.Close();
+		mCapture.Close();
 
 		// stop 2 factory
 		mTcpFactory.Stop();
-		mTcpFactory.mStatusReporter.SpinUntil(StateMachine::Stopped);
+		co_await LifecycleExecutor::WaitState(mTcpFactory.mStatusReporter, StateMachine::Stopped);
 		mGnsFactory.Stop();
-		mGnsFactory.mStatusReporter.SpinUntil(StateMachine::Stopped);
+		co_await LifecycleExecutor::WaitState(mGnsFactory.mStatusReporter, StateMachine::Stopped);
 
 	}
 	void BridgeFactory::Stop() {
-		std::thread([this]() -> void {
-			// start transition
-			StateMachine::TransitionStopping transition(mModuleStatus);
-			if (!transition.CanTransition()) return;
-
-			// run internal one
-			this->InternalStop();
-		}).detach();
+		mExecutor->Spawn(mStrand, StoppingTask(), "BridgeFactory::Stopping", NO_INDEX);
 	}
 
-	void BridgeFactory::ReportStatus() {
-		std::deque<BridgeInstanceProfile> profiles;
-		{
-			std::lock_guard locker(mInstancesMutex);
-			for (auto& instance : mInstances) {
-				profiles.emplace_back(instance->ReportStatus());
+	LifecycleExecutor::Task_t BridgeFactory::StoppingTask() {
+		// start transition
+		StateMachine::TransitionStopping transition(mModuleStatus, std::defer_lock);
+		co_await LifecycleExecutor::EnterTransition(transition);
+		if (!transition.CanTransition()) co_return;
+
+		// run internal one
+		co_await this->InternalStop();
+	}
+
+	/// <summary>
+	/// Format bytes into human readable string, like 12.3KB.
+	/// </summary>
+	static std::string FormatBytes(double bytes) {
+		constexpr const char* units[] = { "B", "KB", "MB", "GB", "TB" };
+		size_t unit = 0u;
+		while (bytes >= 1024.0 && unit < 4u) {
+			bytes /= 1024.0;
+			++unit;
+		}
+
+		std::string result;
+		CommonOpers::AppendStrF(result, "%.1f%s", bytes, units[unit]);
+		return result;
+	}
+
+	void BridgeFactory::CollectProfiles(std::deque<BridgeInstanceProfile>& profiles, ThroughputRate& total_rate, ThroughputSample& total_sample,
+		SwitchSample& total_switches, std::deque<std::pair<LatencyBuckets, LatencyBuckets>>* buckets) {
+		total_sample = ThroughputSample{ 0u, 0u, 0u, 0u };
+		total_switches = SwitchSample{ 0u, 0u, 0u, 0u };
+
+		std::lock_guard locker(mInstancesMutex);
+		for (auto& instance : mInstances) {
+			auto& profile = profiles.emplace_back(instance->ReportStatus());
+
+			auto it = mSamplers.find(instance);
+			if (it != mSamplers.end()) profile.mRate = it->second.GetRate();
+			else profile.mRate = ThroughputRate{ 0.0, 0.0, 0.0, 0.0 };
+			total_sample += instance->SampleThroughput();
+			total_switches += instance->SampleSwitches();
+
+			if (buckets != nullptr) {
+				auto& pair = buckets->emplace_back();
+				instance->ReportLatencyBuckets(pair.first, pair.second);
 			}
 		}
+		total_rate = mTotalSampler.GetRate();
+		total_sample += mRetiredSample;
+		total_switches += mRetiredSwitches;
+	}
+
+	void BridgeFactory::ReportStatus() {
+		std::deque<BridgeInstanceProfile> profiles;
+		ThroughputRate total_rate;
+		ThroughputSample total_sample;
+		SwitchSample total_switches;
+		CollectProfiles(profiles, total_rate, total_sample, total_switches, nullptr);
 
 		// show profiles
 		// reserve string first
-		// (profiles.size() * 5 + 1) is the total used lines. every profile will use 5 lines in average.
+		// (profiles.size() * 7 + 1) is the total used lines. every profile will use 7 lines in average.
 		// (3 * 20 + 1) is the character used by one line. every line have 3 column and each use 20 chars in average.
 		// 128 is padding. just to make sure no extra allocation.
 		std::string buf;
-		buf.reserve((profiles.size() * 5 + 1) * (3 * 20 + 1) + 128);
+		buf.reserve((profiles.size() * 7 + 1) * (3 * 20 + 1) + 128);
 		constexpr const char cInTrans[] = "(Trans)";
 		constexpr const char cNotInTrans[] = "";
 		for (auto& profile : profiles) {
 			buf.append("+--------------+--------------+--------------+\n");
 			CommonOpers::AppendStrF(buf, "|%12" PRIu64 "->|  Tcp to Gns  |->%-12" PRIu64 "|\n",
 				profile.mRecvTcp, profile.mSendGns);
+			CommonOpers::AppendStrF(buf, "|%12s->|%8.1f msg/s|->%10s/s|\n",
+				FormatBytes(profile.mRecvTcpBytes).c_str(), profile.mRate.mTcp2GnsMsg, FormatBytes(profile.mRate.mTcp2GnsBytes).c_str());
 			
 			if (profile.mTcpStatus.mIsExisted) {
 				CommonOpers::AppendStrF(buf, "|Tcp#%-10" PRIu64, profile.mTcpStatus.mIndex);
+			} else if (profile.mIsDetached) {
+				buf.append("|DETACHED     ");
 			} else buf.append("|NO TCP       ");
 			if (profile.mSelfStatus.mIsExisted) {
 				CommonOpers::AppendStrF(buf, "|Bridge#%-7" PRIu64, profile.mSelfStatus.mIndex);
@@ -144,22 +217,423 @@ namespace WhispersAbyss {
 			} else buf.append("|             ");
 			buf.append("|\n");
 
+			CommonOpers::AppendStrF(buf, "|%10s/s<-|%8.1f msg/s|<-%-12s|\n",
+				FormatBytes(profile.mRate.mGns2TcpBytes).c_str(), profile.mRate.mGns2TcpMsg, FormatBytes(profile.mRecvGnsBytes).c_str());
 			CommonOpers::AppendStrF(buf, "|%12" PRIu64 "<-|  Gns to Tcp  |<-%-12" PRIu64 "|\n",
 				profile.mSendTcp, profile.mRecvGns);
 		}
 		if (!profiles.empty()) {
 			buf.append("+--------------+--------------+--------------+\n");
 		} else {
-			buf = "No available profile.";
+			buf = "No available profile.\n";
+		}
+
+		// show latency of each bridge and the aggregate
+		// all values are shown in microseconds.
+		auto append_latency = [&buf](const char* label, const LatencySummary& summary) -> void {
+			CommonOpers::AppendStrF(buf, "%-20s%12" PRIu64 "%10.1f%10.1f%10.1f%10.1f\n",
+				label, summary.mCount,
+				summary.mP50 / 1000.0, summary.mP99 / 1000.0, summary.mP999 / 1000.0, summary.mMax / 1000.0
+			);
+		};
+		char label[48];
+		CommonOpers::AppendStrF(buf, "%-20s%12s%10s%10s%10s%10s\n", "Latency (us)", "count", "p50", "p99", "p99.9", "max");
+		for (auto& profile : profiles) {
+			snprintf(label, sizeof(label), "Bridge#%" PRIu64 " Tcp>Gns", profile.mSelfStatus.mIndex);
+			append_latency(label, profile.mTcp2GnsLatency);
+			snprintf(label, sizeof(label), "Bridge#%" PRIu64 " Gns>Tcp", profile.mSelfStatus.mIndex);
+			append_latency(label, profile.mGns2TcpLatency);
+		}
+		append_latency("All Tcp>Gns", mTcp2GnsLatency.Summarize());
+		append_latency("All Gns>Tcp", mGns2TcpLatency.Summarize());
+
+		// show setup phase durations of all bridges
+		// each phase is measured from its previous one. see SetupTimeline::GetPreviousPhase().
+		CommonOpers::AppendStrF(buf, "%-20s%12s%10s%10s%10s%10s\n", "Setup (ms)", "count", "p50", "p99", "p99.9", "max");
+		auto append_setup = [&buf](const char* label, const LatencySummary& summary) -> void {
+			CommonOpers::AppendStrF(buf, "%-20s%12" PRIu64 "%10.2f%10.2f%10.2f%10.2f\n",
+				label, summary.mCount,
+				summary.mP50 / 1000000.0, summary.mP99 / 1000000.0, summary.mP999 / 1000000.0, summary.mMax / 1000000.0
+			);
+		};
+		for (size_t i = static_cast<size_t>(SetupPhase::TcpStarted); i < SETUP_PHASE_COUNT; ++i) {
+			SetupPhase phase = static_cast<SetupPhase>(i);
+			append_setup(SetupTimeline::GetPhaseName(phase), mSetupDurations.Summarize(phase));
+		}
+		append_setup("total (connected)", mSetupDurations.SummarizeTotal());
+
+		// show top opcodes of all bridges and each bridge, if enabled
+		if (mOpcodes != nullptr) {
+			auto append_opcodes = [&buf](const char* label, const std::vector<OpcodeUsage>& usages) -> void {
+				uint64_t total_bytes = 0u;
+				for (auto& usage : usages) total_bytes += usage.mBytes;
+				CommonOpers::AppendStrF(buf, "%-40s%12s%10s%8s\n", label, "msg", "bytes", "share");
+				size_t count = std::min(usages.size(), OPCODE_TOP_COUNT);
+				for (size_t i = 0u; i < count; ++i) {
+					const OpcodeUsage& usage = usages[i];
+					if (usage.mOpcode == OpcodeCounters::UNKNOWN_OPCODE) buf.append("     -");
+					else CommonOpers::AppendStrF(buf, "%6" PRIu32, usage.mOpcode);
+					CommonOpers::AppendStrF(buf, " %-33s%12" PRIu64 "%10s%7.1f%%\n",
+						OpcodeCounters::GetOpcodeName(usage.mOpcode), usage.mMsg, FormatBytes(static_cast<double>(usage.mBytes)).c_str(),
+						total_bytes == 0u ? 0.0 : usage.mBytes * 100.0 / total_bytes
+					);
+				}
+				if (usages.size() > count) {
+					CommonOpers::AppendStrF(buf, "       (%zu more opcodes)\n", usages.size() - count);
+				}
+			};
+			append_opcodes("Opcodes (all Tcp>Gns)", mOpcodes->Summarize(OpcodeDirection::Tcp2Gns));
+			append_opcodes("Opcodes (all Gns>Tcp)", mOpcodes->Summarize(OpcodeDirection::Gns2Tcp));
+			for (auto& profile : profiles) {
+				snprintf(label, sizeof(label), "Opcodes (Bridge#%" PRIu64 " Tcp>Gns)", profile.mSelfStatus.mIndex);
+				append_opcodes(label, profile.mTcp2GnsOpcodes);
+				snprintf(label, sizeof(label), "Opcodes (Bridge#%" PRIu64 " Gns>Tcp)", profile.mSelfStatus.mIndex);
+				append_opcodes(label, profile.mGns2TcpOpcodes);
+			}
+		}
+
+		// show gns connection quality of each bridge
+		// quality is shown in percentage. pending and unacked are in bytes.
+		CommonOpers::AppendStrF(buf, "%-16s%6s%8s%8s%10s%10s%10s%10s%10s%10s%10s\n",
+			"GNS (per bridge)", "ping", "q.local", "q.remote", "out/s", "in/s", "rate/s", "pend.rel", "pend.unr", "unacked", "queue(us)");
+		for (auto& profile : profiles) {
+			CommonOpers::AppendStrF(buf, "Bridge#%-9" PRIu64, profile.mSelfStatus.mIndex);
+			const GnsConnectionQuality& quality = profile.mGnsQuality;
+			if (!quality.mIsValid) {
+				buf.append("    NO CONNECTION\n");
+				continue;
+			}
+			CommonOpers::AppendStrF(buf, "%6d%7.1f%%%7.1f%%%10s%10s%10s%10d%10d%10d%10" PRId64 "\n",
+				quality.mPing, quality.mQualityLocal * 100.0f, quality.mQualityRemote * 100.0f,
+				FormatBytes(quality.mOutBytesPerSec).c_str(), FormatBytes(quality.mInBytesPerSec).c_str(), FormatBytes(quality.mSendRate).c_str(),
+				quality.mPendingReliable, quality.mPendingUnreliable, quality.mSentUnackedReliable, quality.mQueueTime
+			);
+		}
+
+		// show process-wide throughput
+		CommonOpers::AppendStrF(buf, "Throughput: Tcp to Gns %.1f msg/s %s/s (%" PRIu64 " msg %s total), Gns to Tcp %.1f msg/s %s/s (%" PRIu64 " msg %s total)\n",
+			total_rate.mTcp2GnsMsg, FormatBytes(total_rate.mTcp2GnsBytes).c_str(), total_sample.mTcp2GnsMsg, FormatBytes(total_sample.mTcp2GnsBytes).c_str(),
+			total_rate.mGns2TcpMsg, FormatBytes(total_rate.mGns2TcpBytes).c_str(), total_sample.mGns2TcpMsg, FormatBytes(total_sample.mGns2TcpBytes).c_str()
+		);
+
+		// show server switching profile of all bridges, including disposed ones
+		size_t switching_count = 0u;
+		for (auto& profile : profiles) {
+			if (profile.mIsSwitching) ++switching_count;
+		}
+		CommonOpers::AppendStrF(buf, "Server switching: %zu in progress, %" PRIu64 " switched, %" PRIu64 " failed, switch avg %.2fms max %.2fms\n",
+			switching_count, total_switches.mSwitchCount, total_switches.mSwitchFailCount,
+			total_switches.mSwitchCount == 0u ? 0.0 : total_switches.mSwitchTimeTotal / 1000.0 / total_switches.mSwitchCount,
+			total_switches.mSwitchTimeMax / 1000.0
+		);
+
+		// show shared resolver profile
+		// merged lookup also saves a real lookup, so count it as hit.
+		GnsResolverProfile resolver = mGnsFactory.ReportResolverStatus();
+		uint64_t lookups = resolver.mHitCount + resolver.mMergedCount + resolver.mMissCount;
+		CommonOpers::AppendStrF(buf, "DNS cache: %zu entries, %" PRIu64 " hit, %" PRIu64 " merged, %" PRIu64 " miss (%" PRIu64 " failed), hit rate %.1f%%, resolve avg %.2fms max %.2fms",
+			resolver.mCachedEntries, resolver.mHitCount, resolver.mMergedCount, resolver.mMissCount, resolver.mFailCount,
+			lookups == 0u ? 0.0 : (resolver.mHitCount + resolver.mMergedCount) * 100.0 / lookups,
+			resolver.mMissCount == 0u ? 0.0 : resolver.mResolveTimeTotal / 1000.0 / resolver.mMissCount,
+			resolver.mResolveTimeMax / 1000.0
+		);
+
+		// show instances waiting for disposal
+		// they should drop back to 0 soon after connections closed. a growing count mean disposal can not keep up.
+		BridgeFactoryHealth health = ReportHealth();
+		CommonOpers::AppendStrF(buf, "\nDisposal: %zu bridges alive, waiting %zu bridges, %zu TCP, %zu GNS",
+			health.mBridges, health.mBridgeDisposals, health.mTcpDisposals, health.mGnsDisposals
+		);
+
+		// show CPU and wakeups per thread role since last profile, the busiest role first
+		ThreadInventoryProfile threads = ThreadInventory::Sample();
+		CommonOpers::AppendStrF(buf, "\nThreads: %zu named, %zu unnamed, in last %.1fs",
+			threads.mNamedThreads, threads.mUnnamedThreads, threads.mInterval
+		);
+		buf.append("\n  role               threads     cpu %  cpu max %   wakeups/s");
+		for (auto& role : threads.mRoles) {
+			CommonOpers::AppendStrF(buf, "\n  %-18s%8zu%10.1f%11.1f%12.1f",
+				role.mRole.c_str(), role.mThreads, role.mCpuPercent, role.mCpuPercentMax, role.mWakeupsPerSec
+			);
+		}
+		CommonOpers::AppendStrF(buf, "\n  %-18s%8zu%10.1f", "(unnamed)", threads.mUnnamedThreads, threads.mUnnamedCpuPercent);
+		buf.append("\nBusiest threads:");
+		for (auto& thread : threads.mBusiest) {
+			CommonOpers::AppendStrF(buf, " %s %.1f%% (%.1f wakeups/s)", thread.mName.c_str(), thread.mCpuPercent, thread.mWakeupsPerSec);
+		}
+
+		// show logger profile
+		OutputHelperProfile logger = mOutput->ReportStatus();
+		CommonOpers::AppendStrF(buf, "\nLogger: %" PRIu64 " lines, %" PRIu64 " dropped, call avg %.2fus max %.2fus",
+			logger.mLoggedLines, logger.mDroppedLines,
+			logger.mLoggedLines == 0u ? 0.0 : logger.mCallTimeTotal / 1000.0 / logger.mLoggedLines,
+			logger.mCallTimeMax / 1000.0
+		);
+
+		// show allocations per forwarded message since last profile.
+		// the first profile also counts setup of every module, so read the following ones for steady state.
+		if (AllocProfiler::IsCompiled()) {
+			AllocProfile alloc = AllocProfiler::Report();
+			uint64_t messages = total_sample.mTcp2GnsMsg + total_sample.mGns2TcpMsg;
+			uint64_t delta_messages = messages - mLastAllocMessages;
+			double per_message = delta_messages == 0u ? 0.0 : 1.0 / delta_messages;
+			CommonOpers::AppendStrF(buf, "\nAllocations: %.2f (%s) per message in %" PRIu64 " messages since last profile,",
+				(alloc.GetTotalCount() - mLastAlloc.GetTotalCount()) * per_message,
+				FormatBytes((alloc.GetTotalBytes() - mLastAlloc.GetTotalBytes()) * per_message).c_str(),
+				delta_messages
+			);
+			for (size_t i = 0; i < ALLOC_CATEGORY_COUNT; ++i) {
+				CommonOpers::AppendStrF(buf, " %s %.2f", AllocProfiler::Category2String(static_cast<AllocCategory>(i)),
+					(alloc.mCount[i] - mLastAlloc.mCount[i]) * per_message);
+			}
+			CommonOpers::AppendStrF(buf, "; %" PRIu64 " total in %zu alive threads, busiest thread %" PRIu64,
+				alloc.GetTotalCount(), alloc.mThreads, alloc.mBusiestThreadCount
+			);
+			mLastAlloc = alloc;
+			mLastAllocMessages = messages;
+		}
+
+		// show lock contention since start, the lock waited longest in total first.
+		if (LockProfiler::IsCompiled()) {
+			buf.append("\nLocks:                  acquired   contended    wait total    wait max    hold max");
+			for (auto& lock : LockProfiler::Report()) {
+				CommonOpers::AppendStrF(buf, "\n  %-18s%12" PRIu64 "%12" PRIu64 "%12.2fms%10.1fus%10.1fus",
+					lock.mName.c_str(), lock.mAcquisitions, lock.mContended,
+					lock.mWaitTotal / 1000000.0, lock.mWaitMax / 1000.0, lock.mHoldMax / 1000.0
+				);
+				if (lock.mAcquisitions != 0u) CommonOpers::AppendStrF(buf, " (%.2f%% contended)", lock.mContended * 100.0 / lock.mAcquisitions);
+			}
+		}
+
+		// show capture profile
+		if (mCapture.IsOpened()) {
+			TrafficCaptureProfile capture = mCapture.ReportStatus();
+			CommonOpers::AppendStrF(buf, "\nCapture: %" PRIu64 " records, %s, %" PRIu64 " dropped, %" PRIu64 " failed (%s), write total %.2fms max %.2fms",
+				capture.mRecords, FormatBytes(static_cast<double>(capture.mBytes)).c_str(), capture.mDroppedRecords,
+				capture.mFailedRecords, FormatBytes(static_cast<double>(capture.mFailedBytes)).c_str(),
+				capture.mWriteTimeTotal / 1000000.0, capture.mWriteTimeMax / 1000000.0
+			);
 		}
 
 		// print profile
-		mOutput->RawPrintf(buf.c_str());
+		mOutput->RawPrintf("%s", buf.c_str());
+	}
+
+	BridgeFactoryHealth BridgeFactory::ReportHealth() {
+		BridgeFactoryHealth health;
+		{
+			std::lock_guard locker(mInstancesMutex);
+			health.mBridges = mInstances.size();
+		}
+		health.mBridgeDisposals = mDisposal.GetPendingCount();
+		health.mTcpDisposals = mTcpFactory.ReportDisposalBacklog();
+		health.mGnsDisposals = mGnsFactory.ReportDisposalBacklog();
+		health.mSetupTotal = mSetupDurations.SummarizeTotal();
+		return health;
+	}
+
+	BridgeFactoryPressure BridgeFactory::ReportPressure() {
+		std::deque<BridgeInstanceProfile> profiles;
+		ThroughputRate total_rate;
+		ThroughputSample total_sample;
+		SwitchSample total_switches;
+		CollectProfiles(profiles, total_rate, total_sample, total_switches, nullptr);
+
+		BridgeFactoryPressure pressure{};
+		for (auto& profile : profiles) {
+			pressure.mTcpSendQueue = std::max(pressure.mTcpSendQueue, profile.mTcpSendQueue);
+			pressure.mTcpRecvQueue = std::max(pressure.mTcpRecvQueue, profile.mTcpRecvQueue);
+			pressure.mGnsSendQueue = std::max(pressure.mGnsSendQueue, profile.mGnsSendQueue);
+			pressure.mGnsRecvQueue = std::max(pressure.mGnsRecvQueue, profile.mGnsRecvQueue);
+			const GnsConnectionQuality& quality = profile.mGnsQuality;
+			if (!quality.mIsValid) continue;
+			pressure.mGnsPendingBytes = std::max(pressure.mGnsPendingBytes, quality.mPendingReliable + quality.mPendingUnreliable);
+			pressure.mGnsQueueTime = std::max(pressure.mGnsQueueTime, quality.mQueueTime);
+			pressure.mPingMax = std::max(pressure.mPingMax, quality.mPing);
+		}
+		pressure.mTcp2GnsLatency = mTcp2GnsLatency.Summarize();
+		pressure.mGns2TcpLatency = mGns2TcpLatency.Summarize();
+		return pressure;
+	}
+
+	void BridgeFactory::ReportGnsDetailedStatus() {
+		std::string buf;
+		{
+			std::lock_guard locker(mInstancesMutex);
+			for (auto& instance : mInstances) {
+				std::string detailed(instance->ReportGnsDetailedStatus());
+				CommonOpers::AppendStrF(buf, "========== Bridge#%" PRIu64 " ==========\n", instance->mIndex);
+				if (detailed.empty()) buf.append("No GNS connection.\n");
+				else buf.append(detailed);
+			}
+		}
+		if (buf.empty()) buf = "No available bridge.";
+
+		mOutput->RawPrintf("%s", buf.c_str());
+	}
+
+	std::string BridgeFactory::BuildMetrics() {
+		std::deque<BridgeInstanceProfile> profiles;
+		std::deque<std::pair<LatencyBuckets, LatencyBuckets>> buckets;
+		ThroughputRate total_rate;
+		ThroughputSample total_sample;
+		SwitchSample total_switches;
+		CollectProfiles(profiles, total_rate, total_sample, total_switches, &buckets);
+
+		std::string buf;
+		buf.reserve(profiles.size() * 4096u + 4096u);
+		auto append_header = [&buf](const char* name, const char* type, const char* help) -> void {
+			CommonOpers::AppendStrF(buf, "# HELP whispers_abyss_%s %s\n# TYPE whispers_abyss_%s %s\n", name, help, name, type);
+		};
+		constexpr const char* directions[] = { "tcp2gns", "gns2tcp" };
+
+		// ========== bridge states ==========
+		size_t state_count[3] = { 0u, 0u, 0u }, detached_count = 0u, switching_count = 0u;
+		for (auto& profile : profiles) {
+			if (profile.mSelfStatus.mState == StateMachine::Ready) ++state_count[0];
+			else if (profile.mSelfStatus.mState == StateMachine::Running) ++state_count[1];
+			else ++state_count[2];
+			if (profile.mIsDetached) ++detached_count;
+			if (profile.mIsSwitching) ++switching_count;
+		}
+		// states are exclusive, so they sum up to bridge count. detached and switching overlap them.
+		append_header("bridges", "gauge", "Bridges by lifecycle state.");
+		CommonOpers::AppendStrF(buf, "whispers_abyss_bridges{state=\"ready\"} %zu\n", state_count[0]);
+		CommonOpers::AppendStrF(buf, "whispers_abyss_bridges{state=\"running\"} %zu\n", state_count[1]);
+		CommonOpers::AppendStrF(buf, "whispers_abyss_bridges{state=\"stopped\"} %zu\n", state_count[2]);
+		append_header("bridges_detached", "gauge", "Bridges waiting for client to resume.");
+		CommonOpers::AppendStrF(buf, "whispers_abyss_bridges_detached %zu\n", detached_count);
+		append_header("bridges_switching", "gauge", "Bridges switching to another GNS server.");
+		CommonOpers::AppendStrF(buf, "whispers_abyss_bridges_switching %zu\n", switching_count);
+		append_header("switches_total", "counter", "GNS server switches of all bridges by result, including disposed ones.");
+		CommonOpers::AppendStrF(buf, "whispers_abyss_switches_total{result=\"succeeded\"} %" PRIu64 "\n", total_switches.mSwitchCount);
+		CommonOpers::AppendStrF(buf, "whispers_abyss_switches_total{result=\"failed\"} %" PRIu64 "\n", total_switches.mSwitchFailCount);
+		append_header("switch_seconds_total", "counter", "Time spent in successful GNS server switches of all bridges, including disposed ones.");
+		CommonOpers::AppendStrF(buf, "whispers_abyss_switch_seconds_total %.6f\n", total_switches.mSwitchTimeTotal / 1e6);
+
+		// ========== throughput ==========
+		append_header("messages_total", "counter", "Messages forwarded by each bridge.");
+		for (auto& profile : profiles) {
+			CommonOpers::AppendStrF(buf, "whispers_abyss_messages_total{bridge=\"%" PRIu64 "\",direction=\"tcp2gns\"} %" PRIu64 "\n", profile.mSelfStatus.mIndex, profile.mSendGns);
+			CommonOpers::AppendStrF(buf, "whispers_abyss_messages_total{bridge=\"%" PRIu64 "\",direction=\"gns2tcp\"} %" PRIu64 "\n", profile.mSelfStatus.mIndex, profile.mSendTcp);
+		}
+		append_header("bytes_total", "counter", "Bytes forwarded by each bridge.");
+		for (auto& profile : profiles) {
+			CommonOpers::AppendStrF(buf, "whispers_abyss_bytes_total{bridge=\"%" PRIu64 "\",direction=\"tcp2gns\"} %" PRIu64 "\n", profile.mSelfStatus.mIndex, profile.mSendGnsBytes);
+			CommonOpers::AppendStrF(buf, "whispers_abyss_bytes_total{bridge=\"%" PRIu64 "\",direction=\"gns2tcp\"} %" PRIu64 "\n", profile.mSelfStatus.mIndex, profile.mSendTcpBytes);
+		}
+		append_header("messages_per_second", "gauge", "Messages forwarded per second by each bridge in sliding window.");
+		for (auto& profile : profiles) {
+			CommonOpers::AppendStrF(buf, "whispers_abyss_messages_per_second{bridge=\"%" PRIu64 "\",direction=\"tcp2gns\"} %.3f\n", profile.mSelfStatus.mIndex, profile.mRate.mTcp2GnsMsg);
+			CommonOpers::AppendStrF(buf, "whispers_abyss_messages_per_second{bridge=\"%" PRIu64 "\",direction=\"gns2tcp\"} %.3f\n", profile.mSelfStatus.mIndex, profile.mRate.mGns2TcpMsg);
+		}
+		append_header("bytes_per_second", "gauge", "Bytes forwarded per second by each bridge in sliding window.");
+		for (auto& profile : profiles) {
+			CommonOpers::AppendStrF(buf, "whispers_abyss_bytes_per_second{bridge=\"%" PRIu64 "\",direction=\"tcp2gns\"} %.3f\n", profile.mSelfStatus.mIndex, profile.mRate.mTcp2GnsBytes);
+			CommonOpers::AppendStrF(buf, "whispers_abyss_bytes_per_second{bridge=\"%" PRIu64 "\",direction=\"gns2tcp\"} %.3f\n", profile.mSelfStatus.mIndex, profile.mRate.mGns2TcpBytes);
+		}
+		append_header("all_messages_total", "counter", "Messages forwarded by all bridges, including disposed ones.");
+		CommonOpers::AppendStrF(buf, "whispers_abyss_all_messages_total{direction=\"tcp2gns\"} %" PRIu64 "\n", total_sample.mTcp2GnsMsg);
+		CommonOpers::AppendStrF(buf, "whispers_abyss_all_messages_total{direction=\"gns2tcp\"} %" PRIu64 "\n", total_sample.mGns2TcpMsg);
+		append_header("all_bytes_total", "counter", "Bytes forwarded by all bridges, including disposed ones.");
+		CommonOpers::AppendStrF(buf, "whispers_abyss_all_bytes_total{direction=\"tcp2gns\"} %" PRIu64 "\n", total_sample.mTcp2GnsBytes);
+		CommonOpers::AppendStrF(buf, "whispers_abyss_all_bytes_total{direction=\"gns2tcp\"} %" PRIu64 "\n", total_sample.mGns2TcpBytes);
+		append_header("all_bytes_per_second", "gauge", "Bytes forwarded per second by all bridges in sliding window.");
+		CommonOpers::AppendStrF(buf, "whispers_abyss_all_bytes_per_second{direction=\"tcp2gns\"} %.3f\n", total_rate.mTcp2GnsBytes);
+		CommonOpers::AppendStrF(buf, "whispers_abyss_all_bytes_per_second{direction=\"gns2tcp\"} %.3f\n", total_rate.mGns2TcpBytes);
+
+		// ========== queue depth ==========
+		append_header("queue_depth", "gauge", "Messages waiting in the queues of Tcp and Gns instances.");
+		for (auto& profile : profiles) {
+			CommonOpers::AppendStrF(buf, "whispers_abyss_queue_depth{bridge=\"%" PRIu64 "\",queue=\"tcp_send\"} %zu\n", profile.mSelfStatus.mIndex, profile.mTcpSendQueue);
+			CommonOpers::AppendStrF(buf, "whispers_abyss_queue_depth{bridge=\"%" PRIu64 "\",queue=\"tcp_recv\"} %zu\n", profile.mSelfStatus.mIndex, profile.mTcpRecvQueue);
+			CommonOpers::AppendStrF(buf, "whispers_abyss_queue_depth{bridge=\"%" PRIu64 "\",queue=\"gns_send\"} %zu\n", profile.mSelfStatus.mIndex, profile.mGnsSendQueue);
+			CommonOpers::AppendStrF(buf, "whispers_abyss_queue_depth{bridge=\"%" PRIu64 "\",queue=\"gns_recv\"} %zu\n", profile.mSelfStatus.mIndex, profile.mGnsRecvQueue);
+		}
+
+		// ========== latency ==========
+		auto append_buckets = [&buf](const char* name, const char* labels, const LatencyBuckets& bucket) -> void {
+			for (size_t i = 0u; i < LATENCY_EXPORT_BOUND_COUNT; ++i) {
+				CommonOpers::AppendStrF(buf, "whispers_abyss_%s_bucket{%s,le=\"%g\"} %" PRIu64 "\n",
+					name, labels, LATENCY_EXPORT_BOUNDS[i] / 1e9, bucket.mCumulative[i]);
+			}
+			CommonOpers::AppendStrF(buf, "whispers_abyss_%s_bucket{%s,le=\"+Inf\"} %" PRIu64 "\n", name, labels, bucket.mCount);
+			CommonOpers::AppendStrF(buf, "whispers_abyss_%s_sum{%s} %.9f\n", name, labels, bucket.mSum / 1e9);
+			CommonOpers::AppendStrF(buf, "whispers_abyss_%s_count{%s} %" PRIu64 "\n", name, labels, bucket.mCount);
+		};
+		char labels[64];
+		append_header("latency_seconds", "histogram", "Time from a message entering this app to being written out on the other side, per bridge.");
+		for (size_t i = 0u; i < profiles.size(); ++i) {
+			snprintf(labels, sizeof(labels), "bridge=\"%" PRIu64 "\",direction=\"%s\"", profiles[i].mSelfStatus.mIndex, directions[0]);
+			append_buckets("latency_seconds", labels, buckets[i].first);
+			snprintf(labels, sizeof(labels), "bridge=\"%" PRIu64 "\",direction=\"%s\"", profiles[i].mSelfStatus.mIndex, directions[1]);
+			append_buckets("latency_seconds", labels, buckets[i].second);
+		}
+		append_header("all_latency_seconds", "histogram", "Time from a message entering this app to being written out on the other side, all bridges.");
+		snprintf(labels, sizeof(labels), "direction=\"%s\"", directions[0]);
+		append_buckets("all_latency_seconds", labels, mTcp2GnsLatency.SummarizeBuckets());
+		snprintf(labels, sizeof(labels), "direction=\"%s\"", directions[1]);
+		append_buckets("all_latency_seconds", labels, mGns2TcpLatency.SummarizeBuckets());
+
+		// ========== gns connection ==========
+		append_header("gns_ping_seconds", "gauge", "GNS ping of each bridge.");
+		for (auto& profile : profiles) {
+			if (!profile.mGnsQuality.mIsValid) continue;
+			CommonOpers::AppendStrF(buf, "whispers_abyss_gns_ping_seconds{bridge=\"%" PRIu64 "\"} %.3f\n", profile.mSelfStatus.mIndex, profile.mGnsQuality.mPing / 1e3);
+		}
+		append_header("gns_quality_ratio", "gauge", "GNS connection quality (0-1) measured by each side.");
+		for (auto& profile : profiles) {
+			if (!profile.mGnsQuality.mIsValid) continue;
+			CommonOpers::AppendStrF(buf, "whispers_abyss_gns_quality_ratio{bridge=\"%" PRIu64 "\",side=\"local\"} %.3f\n", profile.mSelfStatus.mIndex, profile.mGnsQuality.mQualityLocal);
+			CommonOpers::AppendStrF(buf, "whispers_abyss_gns_quality_ratio{bridge=\"%" PRIu64 "\",side=\"remote\"} %.3f\n", profile.mSelfStatus.mIndex, profile.mGnsQuality.mQualityRemote);
+		}
+		append_header("gns_pending_bytes", "gauge", "GNS bytes waiting to be sent or acked.");
+		for (auto& profile : profiles) {
+			if (!profile.mGnsQuality.mIsValid) continue;
+			CommonOpers::AppendStrF(buf, "whispers_abyss_gns_pending_bytes{bridge=\"%" PRIu64 "\",kind=\"reliable\"} %d\n", profile.mSelfStatus.mIndex, profile.mGnsQuality.mPendingReliable);
+			CommonOpers::AppendStrF(buf, "whispers_abyss_gns_pending_bytes{bridge=\"%" PRIu64 "\",kind=\"unreliable\"} %d\n", profile.mSelfStatus.mIndex, profile.mGnsQuality.mPendingUnreliable);
+			CommonOpers::AppendStrF(buf, "whispers_abyss_gns_pending_bytes{bridge=\"%" PRIu64 "\",kind=\"unacked\"} %d\n", profile.mSelfStatus.mIndex, profile.mGnsQuality.mSentUnackedReliable);
+		}
+		append_header("gns_send_rate_bytes_per_second", "gauge", "GNS estimated send rate in bytes per second.");
+		for (auto& profile : profiles) {
+			if (!profile.mGnsQuality.mIsValid) continue;
+			CommonOpers::AppendStrF(buf, "whispers_abyss_gns_send_rate_bytes_per_second{bridge=\"%" PRIu64 "\"} %d\n", profile.mSelfStatus.mIndex, profile.mGnsQuality.mSendRate);
+		}
+		append_header("gns_queue_time_seconds", "gauge", "GNS estimated queue time of a new message.");
+		for (auto& profile : profiles) {
+			if (!profile.mGnsQuality.mIsValid) continue;
+			CommonOpers::AppendStrF(buf, "whispers_abyss_gns_queue_time_seconds{bridge=\"%" PRIu64 "\"} %.6f\n", profile.mSelfStatus.mIndex, profile.mGnsQuality.mQueueTime / 1e6);
+		}
+
+		// ========== threads ==========
+		// threads not created by us, like GNS service thread, are the rest of process thread count.
+		ThreadCountProfile threads = ThreadInventory::Count();
+		append_header("threads", "gauge", "Alive threads by role. Threads not created by this app are counted as unnamed.");
+		for (auto& [role, count] : threads.mRoles) {
+			CommonOpers::AppendStrF(buf, "whispers_abyss_threads{role=\"%s\"} %zu\n", role.c_str(), count);
+		}
+		CommonOpers::AppendStrF(buf, "whispers_abyss_threads{role=\"unnamed\"} %zu\n", threads.mUnnamedThreads);
+
+		// ========== others ==========
+		OutputHelperProfile logger = mOutput->ReportStatus();
+		append_header("log_lines_total", "counter", "Log lines queued.");
+		CommonOpers::AppendStrF(buf, "whispers_abyss_log_lines_total %" PRIu64 "\n", logger.mLoggedLines);
+		append_header("log_dropped_total", "counter", "Log lines dropped because log queue is full.");
+		CommonOpers::AppendStrF(buf, "whispers_abyss_log_dropped_total %" PRIu64 "\n", logger.mDroppedLines);
+		GnsResolverProfile resolver = mGnsFactory.ReportResolverStatus();
+		append_header("dns_lookups_total", "counter", "Server address lookups by result.");
+		CommonOpers::AppendStrF(buf, "whispers_abyss_dns_lookups_total{result=\"hit\"} %" PRIu64 "\n", resolver.mHitCount);
+		CommonOpers::AppendStrF(buf, "whispers_abyss_dns_lookups_total{result=\"merged\"} %" PRIu64 "\n", resolver.mMergedCount);
+		CommonOpers::AppendStrF(buf, "whispers_abyss_dns_lookups_total{result=\"miss\"} %" PRIu64 "\n", resolver.mMissCount);
+
+		return buf;
 	}
 
 	void BridgeFactory::CtxWorker(std::stop_token st) {
 		std::deque<TcpInstance*> new_incoming;
 		std::deque<BridgeInstance*> cache;
+		std::chrono::steady_clock::time_point last_metrics;
+		ThreadInventory::Register("bridge-factory", NO_INDEX);
 
 		while (!st.stop_requested()) {
 			// if not in running. spin
@@ -172,12 +646,21 @@ namespace WhispersAbyss {
 			// get new tcp incoming
 			mTcpFactory.GetConnections(new_incoming);
 			for (auto& ptr : new_incoming) {
+				IndexDistributor::Index_t index = mIndexDistributor.Get();
 				cache.push_back(new BridgeInstance(
 					mOutput,
+					mExecutor,
 					&mTcpFactory,
 					&mGnsFactory,
+					mSettings,
+					&mSessions,
+					&mTcp2GnsLatency,
+					&mGns2TcpLatency,
+					mOpcodes.get(),
+					mCapture.IsOpened() ? &mCapture : nullptr,
+					mStatsPage.AcquireSlot(index),
 					ptr,
-					mIndexDistributor.Get()
+					index
 				));
 			}
 			new_incoming.clear();
@@ -185,18 +668,43 @@ namespace WhispersAbyss {
 			{
 				std::lock_guard locker(mInstancesMutex);
 				// process old bridges
+				// and sample their throughput
+				auto now = std::chrono::steady_clock::now();
+				ThroughputSample total_sample(mRetiredSample);
+				StatsCountersValue total_counters(mRetiredCounters);
 				for (auto& instance : mInstances) {
 					if (instance->mStatusReporter.IsInState(StateMachine::Stopped)) {
+						mRetiredSample += instance->SampleThroughput();
+						total_sample += instance->SampleThroughput();
+						mRetiredCounters += instance->SampleCounters();
+						total_counters += instance->SampleCounters();
+						mRetiredSwitches += instance->SampleSwitches();
+						mSamplers.erase(instance);
 						mDisposal.Move(instance);
 					} else {
+						ThroughputSample sample(instance->SampleThroughput());
+						total_sample += sample;
+						mSamplers[instance].Push(now, sample);
+						if (mStatsPage.IsOpened()) total_counters += instance->SampleCounters();
 						cache.push_back(instance);
 					}
 				}
+				mTotalSampler.Push(now, total_sample);
+				mStatsPage.PublishGlobal(static_cast<uint32_t>(cache.size()), total_counters);
 				// replace instances
 				mInstances.clear();
 				CommonOpers::MoveDeque(cache, mInstances);
 			}
 
+			// publish metrics snapshot
+			if (mMetricsServer != nullptr) {
+				auto now = std::chrono::steady_clock::now();
+				if (now - last_metrics >= METRICS_INTERVAL) {
+					last_metrics = now;
+					mMetricsServer->Publish(BuildMetrics());
+				}
+			}
+
 			// in any case, sleep. sleep like disposal long time.
 			std::this_thread::sleep_for(BRIDGE_INTERVAL);
 		}
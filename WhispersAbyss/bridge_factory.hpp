@@ -5,41 +5,151 @@
 #include "tcp_factory.hpp"
 #include "gns_factory.hpp"
 #include "bridge_instance.hpp"
+#include "lifecycle_executor.hpp"
+#include "settings.hpp"
+#include "metrics.hpp"
+#include "metrics_server.hpp"
+#include "stats_page.hpp"
+#include "traffic_capture.hpp"
+#include "alloc_profiler.hpp"
+#include "lock_profiler.hpp"
 #include <thread>
 #include <deque>
 #include <mutex>
+#include <map>
 
 namespace WhispersAbyss {
 
+	/// <summary>
+	/// The cheap health figures of factory, for watching it over a long time.
+	/// </summary>
+	struct BridgeFactoryHealth {
+		size_t mBridges;
+		/// <summary>
+		/// Instances returned to each DisposalHelper but not destroyed yet.
+		/// </summary>
+		size_t mBridgeDisposals, mTcpDisposals, mGnsDisposals;
+		/// <summary>
+		/// From accepted to GNS connected, of all bridges.
+		/// </summary>
+		LatencySummary mSetupTotal;
+	};
+	/// <summary>
+	/// The queue pressure of all bridges, for watching whether backpressure holds.
+	/// </summary>
+	struct BridgeFactoryPressure {
+		/// <summary>
+		/// The deepest message lists among bridges.
+		/// </summary>
+		size_t mTcpSendQueue, mTcpRecvQueue, mGnsSendQueue, mGnsRecvQueue;
+		/// <summary>
+		/// The most bytes pending in GNS among bridges, reliable and unreliable together.
+		/// </summary>
+		int mGnsPendingBytes;
+		int64_t mGnsQueueTime;	// the longest among bridges, in microseconds
+		int mPingMax;	// in milliseconds
+		/// <summary>
+		/// The aggregate latency of all bridges since factory started.
+		/// </summary>
+		LatencySummary mTcp2GnsLatency, mGns2TcpLatency;
+	};
+
 	class BridgeFactory {
 	private:
 		OutputHelper* mOutput;
+		LifecycleExecutor* mExecutor;
+		LifecycleExecutor::Strand_t mStrand;
 		StateMachine::StateMachineCore mModuleStatus;
 		IndexDistributor mIndexDistributor;
+		const AbyssSettings* mSettings;
+		/// <summary>
+		/// The aggregate latency of all bridges. Declared before factories so they outlive all instances.
+		/// </summary>
+		LatencyHistogram mTcp2GnsLatency, mGns2TcpLatency;
+		/// <summary>
+		/// The traffic per opcode of all bridges. nullptr if opcode statistics is disabled. Also declared before factories.
+		/// </summary>
+		std::unique_ptr<OpcodeCounters> mOpcodes;
+		/// <summary>
+		/// The setup phase durations of all bridges. Also declared before factories.
+		/// </summary>
+		SetupDurations mSetupDurations;
+		/// <summary>
+		/// Declared before instances so that it outlive all bridges writing it.
+		/// </summary>
+		StatsPage mStatsPage;
+		/// <summary>
+		/// Also declared before instances for the same reason.
+		/// </summary>
+		TrafficCapture mCapture;
 
 		TcpFactory mTcpFactory;
 		GnsFactory mGnsFactory;
 
-		std::mutex mInstancesMutex;
+		AbyssMutex mInstancesMutex;
 		std::deque<BridgeInstance*> mInstances;
+		/// <summary>
+		/// Throughput samplers of each bridge and the whole process. Protected by mInstancesMutex.
+		/// mRetiredSample, mRetiredCounters and mRetiredSwitches hold the counters of disposed bridges, so that total counters are monotonic.
+		/// </summary>
+		std::map<BridgeInstance*, RateSampler> mSamplers;
+		RateSampler mTotalSampler;
+		ThroughputSample mRetiredSample;
+		StatsCountersValue mRetiredCounters;
+		SwitchSample mRetiredSwitches;
+		BridgeSessionRegistry mSessions;
+		/// <summary>
+		/// Allocations and forwarded messages when profile was printed last time, so next profile shows the steady state between them.
+		/// Only used by ReportStatus().
+		/// </summary>
+		AllocProfile mLastAlloc;
+		uint64_t mLastAllocMessages;
 
-		std::jthread mTdCtx;
+		LifecycleThread mTdCtx;
+		/// <summary>
+		/// nullptr if metrics endpoint is disabled.
+		/// </summary>
+		std::unique_ptr<MetricsServer> mMetricsServer;
 
 		DisposalHelper<BridgeInstance*> mDisposal;
 	public:
 		StateMachine::StateMachineReporter mStatusReporter;
 
 	public:
-		BridgeFactory(OutputHelper* output, uint16_t tcp_port);
+		BridgeFactory(OutputHelper* output, LifecycleExecutor* executor, const AbyssSettings* settings);
 		BridgeFactory(const BridgeFactory& rhs) = delete;
 		BridgeFactory(BridgeFactory&& rhs) = delete;
 		~BridgeFactory();
 
 		void Stop();
 		void ReportStatus();
+		/// <summary>
+		/// Print the detailed status of GNS connection of each bridge.
+		/// </summary>
+		void ReportGnsDetailedStatus();
+		/// <summary>
+		/// Get health figures without collecting profiles of bridges. Can be called from any thread while factory is running.
+		/// </summary>
+		BridgeFactoryHealth ReportHealth();
+		/// <summary>
+		/// Get queue pressure of all bridges. It collects profiles of bridges, so do not call it too often.
+		/// </summary>
+		BridgeFactoryPressure ReportPressure();
 	private:
-		void InternalStop();
+		LifecycleExecutor::Task_t InitializingTask();
+		LifecycleExecutor::Task_t StoppingTask();
+		LifecycleExecutor::Task_t InternalStop();
 		void CtxWorker(std::stop_token st);
+		/// <summary>
+		/// Collect profiles of all bridges, their throughput rate, and the total counters including disposed bridges.
+		/// </summary>
+		/// <param name="buckets">Collect latency buckets of each bridge if not nullptr. Same order with profiles.</param>
+		void CollectProfiles(std::deque<BridgeInstanceProfile>& profiles, ThroughputRate& total_rate, ThroughputSample& total_sample,
+			SwitchSample& total_switches, std::deque<std::pair<LatencyBuckets, LatencyBuckets>>* buckets);
+		/// <summary>
+		/// Build metrics in Prometheus text format.
+		/// </summary>
+		std::string BuildMetrics();
 	};
 
 }
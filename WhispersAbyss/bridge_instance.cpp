@@ -1,60 +1,110 @@
 #include "bridge_instance.hpp"
 #include "gns_instance.hpp"
 #include "tcp_instance.hpp"
+#include <algorithm>
+#include <random>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <bcrypt.h>
+#else
+#include <cerrno>
+#include <sys/random.h>
+#endif // _WIN32
 
 namespace WhispersAbyss {
 
-	BridgeInstance::BridgeInstance(OutputHelper* output, TcpFactory* tcp_factory, GnsFactory* gns_factory, TcpInstance* tcp_instance, IndexDistributor::Index_t index) :
-		mOutput(output), mModuleStatus(StateMachine::Ready), mStatusReporter(mModuleStatus), mIndexDistributor(), mIndex(index),
-		mTcpFactory(tcp_factory), mGnsFactory(gns_factory), mTcpInstance(tcp_instance), mGnsInstance(nullptr),
-		mRecvTcp(0u), mSendTcp(0u), mRecvGns(0u), mSendGns(0u),
-		mTdCtx()
-	{
-		std::thread([this]() -> void {
-			// start transition
-			StateMachine::TransitionInitializing transition(mModuleStatus);
-			if (!transition.CanTransition()) return;
-
-			// try get status or order from tcp connection
-			std::string url;
-			CountDownTimer waiting(MODULE_WAITING_INTERVAL);
-			while (true) {
-				if (mTcpInstance->mStatusReporter.IsInState(StateMachine::Stopped)) {
-					// crash before getting it.
-					mOutput->Printf(OutputHelper::Component::BridgeInstance, mIndex, "Unexpected Tcp instance crash before ordering URL.");
-					transition.SetTransitionError(true);
-					this->InternalStop();
-					return;
-				} else {
-					// try get ordered url
-					url = mTcpInstance->GetOrderedUrl();
-					if (url.empty()) {
-						std::this_thread::sleep_for(SPIN_INTERVAL);
-
-						if (waiting.HasRunOutOfTime()) {
-							// wait enough times (around 10s). no response. disconnect.
-							mOutput->Printf(OutputHelper::Component::BridgeInstance, mIndex, "Run out of time of waiting instance ordering URL.");
-							transition.SetTransitionError(true);
-							this->InternalStop();
-							return;
-						}
-					} else {
-						// we got it, go to next
-						break;
-					}
-				}
+	SwitchSample& SwitchSample::operator+=(const SwitchSample& rhs) {
+		mSwitchCount += rhs.mSwitchCount;
+		mSwitchFailCount += rhs.mSwitchFailCount;
+		mSwitchTimeTotal += rhs.mSwitchTimeTotal;
+		mSwitchTimeMax = std::max(mSwitchTimeMax, rhs.mSwitchTimeMax);
+		return *this;
+	}
+
+#pragma region BridgeSessionRegistry
+
+	/// <summary>
+	/// Fill given buffer with cryptographically secure random bytes from OS.
+	/// </summary>
+	/// <returns>True if success.</returns>
+	static bool ReadSecureRandom(void* buf, size_t len) {
+#ifdef _WIN32
+		return BCRYPT_SUCCESS(BCryptGenRandom(nullptr, static_cast<PUCHAR>(buf), static_cast<ULONG>(len), BCRYPT_USE_SYSTEM_PREFERRED_RNG));
+#else
+		uint8_t* ptr = static_cast<uint8_t*>(buf);
+		while (len > 0u) {
+			ssize_t got = getrandom(ptr, len, 0);
+			if (got < 0) {
+				if (errno == EINTR) continue;
+				return false;
 			}
+			ptr += got;
+			len -= static_cast<size_t>(got);
+		}
+		return true;
+#endif // _WIN32
+	}
+
+	BridgeSessionRegistry::BridgeSessionRegistry() :
+		mSessionsMutex("bridge_sessions"), mSessions()
+	{}
+
+	BridgeSessionRegistry::~BridgeSessionRegistry() {}
 
-			// ok, we got it.
-			// create gns instance
-			mGnsInstance = mGnsFactory->GetConnections(url);
+	uint64_t BridgeSessionRegistry::Register(BridgeInstance* instance) {
+		std::lock_guard locker(mSessionsMutex);
 
-			// start context workder
-			this->mTdCtx = std::jthread(std::bind(&BridgeInstance::CtxWorker, this, std::placeholders::_1));
+		// token should be unpredictable, non-zero and unique.
+		// a token is a credential of its session, so it is taken from OS CSPRNG instead of a seeded engine.
+		uint64_t token;
+		do {
+			if (!ReadSecureRandom(&token, sizeof(token))) {
+				// fall back to fresh output of random_device, which also come from OS on supported platforms.
+				std::random_device device;
+				token = (static_cast<uint64_t>(device()) << 32) | static_cast<uint64_t>(device());
+			}
+		} while (token == 0u || mSessions.contains(token));
+
+		mSessions.emplace(token, instance);
+		return token;
+	}
 
-			// end transition
-			transition.SetTransitionError(false);
-		}).detach();
+	void BridgeSessionRegistry::Unregister(uint64_t token) {
+		std::lock_guard locker(mSessionsMutex);
+		mSessions.erase(token);
+	}
+
+	bool BridgeSessionRegistry::Reattach(uint64_t token, TcpInstance* tcp_instance) {
+		std::lock_guard locker(mSessionsMutex);
+
+		auto it = mSessions.find(token);
+		if (it == mSessions.end()) return false;
+		return it->second->AcceptReattach(tcp_instance);
+	}
+
+#pragma endregion
+
+#pragma region BridgeInstance
+
+	BridgeInstance::BridgeInstance(OutputHelper* output, LifecycleExecutor* executor, TcpFactory* tcp_factory, GnsFactory* gns_factory, const AbyssSettings* settings, BridgeSessionRegistry* sessions, LatencyHistogram* tcp2gns_total, LatencyHistogram* gns2tcp_total, OpcodeCounters* opcode_total, TrafficCapture* capture, StatsBridgeSlot* stats_slot, TcpInstance* tcp_instance, IndexDistributor::Index_t index) :
+		mOutput(output), mExecutor(executor), mStrand(executor->MakeStrand()),
+		mModuleStatus(StateMachine::Ready), mStatusReporter(mModuleStatus), mIndexDistributor(), mIndex(index),
+		mTcpFactory(tcp_factory), mGnsFactory(gns_factory), mSettings(settings), mSessions(sessions),
+		mPeerMutex("bridge_peer"), mTcpInstance(tcp_instance), mGnsInstance(nullptr), mPendingTcp(nullptr),
+		mResumeToken(0u), mIsDetached(false),
+		mSwitchingGns(nullptr), mSwitchingUrl(), mSwitchStart(), mIsSwitching(false),
+		mSwitchCount(0u), mSwitchFailCount(0u), mSwitchTimeTotal(0u), mSwitchTimeMax(0u),
+		mRecvTcp(0u), mSendTcp(0u), mRecvGns(0u), mSendGns(0u),
+		mRecvTcpBytes(0u), mSendTcpBytes(0u), mRecvGnsBytes(0u), mSendGnsBytes(0u),
+		mTcp2GnsLatency(std::make_shared<LatencyHistogram>(tcp2gns_total)), mGns2TcpLatency(std::make_shared<LatencyHistogram>(gns2tcp_total)),
+		mStatsSlot(stats_slot),
+		mOpcodes(opcode_total != nullptr ? new OpcodeCounters(opcode_total) : nullptr),
+		mCapture(capture),
+		mSetupTimeline(tcp_instance->GetSetupTimeline()),
+		mTdCtx()
+	{
+		mExecutor->Spawn(mStrand, InitializingTask(), "BridgeInstance::Initializing", mIndex);
 
 		mOutput->Printf(OutputHelper::Component::BridgeInstance, mIndex, "Instance created.");
 	}
@@ -66,38 +116,148 @@ namespace WhispersAbyss {
 		mOutput->Printf(OutputHelper::Component::BridgeInstance, mIndex, "Instance disposed.");
 	}
 
-	void BridgeInstance::InternalStop() {
+	LifecycleExecutor::Task_t BridgeInstance::InitializingTask() {
+		// start transition
+		StateMachine::TransitionInitializing transition(mModuleStatus, std::defer_lock);
+		co_await LifecycleExecutor::EnterTransition(transition);
+		if (!transition.CanTransition()) co_return;
+
+		// try get status or order from tcp connection
+		std::string url;
+		uint64_t token = 0u;
+		CountDownTimer waiting(MODULE_WAITING_INTERVAL);
+		while (true) {
+			if (mTcpInstance->mStatusReporter.IsInState(StateMachine::Stopped)) {
+				// crash before getting it.
+				mOutput->Printf(OutputHelper::Component::BridgeInstance, mIndex, "Unexpected Tcp instance crash before ordering URL or resume token.");
+				transition.SetTransitionError(true);
+				co_await this->InternalStop();
+				co_return;
+			}
+
+			// try get ordered url
+			url = mTcpInstance->GetOrderedUrl();
+			if (!url.empty()) {
+				// we got it, go to next
+				break;
+			}
+			// or try get ordered resume token
+			token = mTcpInstance->GetOrderedResumeToken();
+			if (token != 0u) {
+				break;
+			}
+
+			if (waiting.HasRunOutOfTime()) {
+				// wait enough times (around 10s). no response. disconnect.
+				mOutput->Printf(OutputHelper::Component::BridgeInstance, mIndex, "Run out of time of waiting instance ordering URL or resume token.");
+				transition.SetTransitionError(true);
+				co_await this->InternalStop();
+				co_return;
+			}
+
+			// wait tcp instance ordering url or stopping.
+			// if the event has been set but we can not get url,
+			// tcp instance is still in its transition. sleep a while.
+			if (mTcpInstance->mOrderedEvent.IsSet()) {
+				co_await LifecycleExecutor::Delay(SPIN_INTERVAL);
+			} else {
+				co_await mTcpInstance->mOrderedEvent.Wait(std::chrono::milliseconds(static_cast<int64_t>(MODULE_WAITING_INTERVAL)));
+			}
+		}
+
+		// resume existing session.
+		// hand over tcp instance to the bridge owning that session. this bridge has nothing to do then.
+		if (token != 0u) {
+			if (mSessions->Reattach(token, mTcpInstance)) {
+				mOutput->Printf(OutputHelper::Component::BridgeInstance, mIndex, "Tcp instance #%" PRIu64 " is handed over to session %016" PRIx64 ".", mTcpInstance->mIndex, token);
+				std::lock_guard locker(mPeerMutex);
+				mTcpInstance = nullptr;
+			} else {
+				mOutput->Printf(OutputHelper::Component::BridgeInstance, mIndex, "Session %016" PRIx64 " is not existed or busy. Can not resume it.", token);
+			}
+
+			transition.SetTransitionError(true);
+			co_await this->InternalStop();
+			co_return;
+		}
+
+		// ok, we got url.
+		// create gns instance
+		mSetupTimeline->Mark(SetupPhase::BridgePicked);
+		mGnsInstance = mGnsFactory->GetConnections(url, mSetupTimeline);
+		mGnsInstance->SetEgressLatency(mTcp2GnsLatency);
+		mTcpInstance->SetEgressLatency(mGns2TcpLatency);
+
+		// start context workder
+		this->mTdCtx.Start(std::bind(&BridgeInstance::CtxWorker, this, std::placeholders::_1));
+
+		// end transition
+		transition.SetTransitionError(false);
+	}
+
+	LifecycleExecutor::Task_t BridgeInstance::InternalStop() {
 
 		// stop context
-		if (mTdCtx.joinable()) {
-			mTdCtx.request_stop();
-			mTdCtx.join();
+		co_await mTdCtx.Stop();
+
+		// log where the setup time went. skip bridges which never created their Gns instance.
+		if (mSetupTimeline->IsMarked(SetupPhase::BridgePicked)) {
+			mOutput->Printf(OutputHelper::Component::BridgeInstance, mIndex, "Setup timeline since accepted: %s", mSetupTimeline->Format().c_str());
+		}
+
+		// unregister session. no more tcp instance can be handed over after this.
+		if (mResumeToken != 0u) {
+			mSessions->Unregister(mResumeToken);
+			mResumeToken = 0u;
 		}
 
-		// kill 2 instance
+		// kill 2 instance and the pending one
+		TcpInstance* pending_tcp;
+		{
+			std::lock_guard locker(mPeerMutex);
+			pending_tcp = mPendingTcp;
+			mPendingTcp = nullptr;
+		}
+		if (pending_tcp != nullptr) {
+			pending_tcp->Stop();
+			co_await LifecycleExecutor::WaitState(pending_tcp->mStatusReporter, StateMachine::Stopped);
+			mTcpFactory->ReturnConnections(pending_tcp);
+		}
 		if (mTcpInstance != nullptr) {
 			mTcpInstance->Stop();
-			mTcpInstance->mStatusReporter.SpinUntil(StateMachine::Stopped);
+			co_await LifecycleExecutor::WaitState(mTcpInstance->mStatusReporter, StateMachine::Stopped);
 			mTcpFactory->ReturnConnections(mTcpInstance);
+			std::lock_guard locker(mPeerMutex);
 			mTcpInstance = nullptr;
 		}
+		if (mSwitchingGns != nullptr) {
+			mSwitchingGns->Stop();
+			co_await LifecycleExecutor::WaitState(mSwitchingGns->mStatusReporter, StateMachine::Stopped);
+			mGnsFactory->ReturnConnections(mSwitchingGns);
+			mSwitchingGns = nullptr;
+			mIsSwitching.store(false);
+		}
 		if (mGnsInstance != nullptr) {
 			mGnsInstance->Stop();
-			mGnsInstance->mStatusReporter.SpinUntil(StateMachine::Stopped);
+			co_await LifecycleExecutor::WaitState(mGnsInstance->mStatusReporter, StateMachine::Stopped);
 			mGnsFactory->ReturnConnections(mGnsInstance);
+			std::lock_guard locker(mPeerMutex);
 			mGnsInstance = nullptr;
 		}
 
 	}
 	void BridgeInstance::Stop() {
-		std::thread([this]() -> void {
-			// start transition
-			StateMachine::TransitionStopping transition(mModuleStatus);
-			if (!transition.CanTransition()) return;
+		mExecutor->Spawn(mStrand, StoppingTask(), "BridgeInstance::Stopping", mIndex);
+	}
+
+	LifecycleExecutor::Task_t BridgeInstance::StoppingTask() {
+		// start transition
+		StateMachine::TransitionStopping transition(mModuleStatus, std::defer_lock);
+		co_await LifecycleExecutor::EnterTransition(transition);
+		if (!transition.CanTransition()) co_return;
 
-			// call internal stop
-			this->InternalStop();
-		}).detach();
+		// call internal stop
+		co_await this->InternalStop();
 	}
 
 	BridgeInstanceProfile BridgeInstance::ReportStatus() {
@@ -107,29 +267,221 @@ namespace WhispersAbyss {
 		profile.mSendTcp = mSendTcp.load();
 		profile.mRecvGns = mRecvGns.load();
 		profile.mSendGns = mSendGns.load();
+		profile.mRecvTcpBytes = mRecvTcpBytes.load();
+		profile.mSendTcpBytes = mSendTcpBytes.load();
+		profile.mRecvGnsBytes = mRecvGnsBytes.load();
+		profile.mSendGnsBytes = mSendGnsBytes.load();
 
 		profile.mSelfStatus.mIsExisted = true;
 		profile.mSelfStatus.mIndex = mIndex;
 		mStatusReporter.GetStatus(profile.mSelfStatus.mState, profile.mSelfStatus.mIsInTransition);
 
-		profile.mTcpStatus.mIsExisted = mTcpInstance != nullptr;
-		if (profile.mTcpStatus.mIsExisted) {
-			profile.mTcpStatus.mIndex = mTcpInstance->mIndex;
-			mTcpInstance->mStatusReporter.GetStatus(profile.mTcpStatus.mState, profile.mTcpStatus.mIsInTransition);
+		profile.mIsDetached = mIsDetached.load();
+		profile.mIsSwitching = mIsSwitching.load();
+		profile.mSwitchCount = mSwitchCount.load();
+		profile.mSwitchFailCount = mSwitchFailCount.load();
+		profile.mSwitchTimeTotal = mSwitchTimeTotal.load();
+		profile.mSwitchTimeMax = mSwitchTimeMax.load();
+		profile.mTcp2GnsLatency = mTcp2GnsLatency->Summarize();
+		profile.mGns2TcpLatency = mGns2TcpLatency->Summarize();
+		if (mOpcodes != nullptr) {
+			profile.mTcp2GnsOpcodes = mOpcodes->Summarize(OpcodeDirection::Tcp2Gns);
+			profile.mGns2TcpOpcodes = mOpcodes->Summarize(OpcodeDirection::Gns2Tcp);
 		}
+		{
+			std::lock_guard locker(mPeerMutex);
+			profile.mTcpStatus.mIsExisted = mTcpInstance != nullptr;
+			if (profile.mTcpStatus.mIsExisted) {
+				profile.mTcpStatus.mIndex = mTcpInstance->mIndex;
+				mTcpInstance->mStatusReporter.GetStatus(profile.mTcpStatus.mState, profile.mTcpStatus.mIsInTransition);
+				mTcpInstance->ReportQueueDepth(profile.mTcpSendQueue, profile.mTcpRecvQueue);
+			} else {
+				profile.mTcpSendQueue = profile.mTcpRecvQueue = 0u;
+			}
 
-		profile.mGnsStatus.mIsExisted = mGnsInstance != nullptr;
-		if (profile.mGnsStatus.mIsExisted) {
-			profile.mGnsStatus.mIndex = mGnsInstance->mIndex;
-			mGnsInstance->mStatusReporter.GetStatus(profile.mGnsStatus.mState, profile.mGnsStatus.mIsInTransition);
+			profile.mGnsStatus.mIsExisted = mGnsInstance != nullptr;
+			if (profile.mGnsStatus.mIsExisted) {
+				profile.mGnsStatus.mIndex = mGnsInstance->mIndex;
+				mGnsInstance->mStatusReporter.GetStatus(profile.mGnsStatus.mState, profile.mGnsStatus.mIsInTransition);
+				profile.mGnsQuality = mGnsInstance->ReportQuality();
+				mGnsInstance->ReportQueueDepth(profile.mGnsSendQueue, profile.mGnsRecvQueue);
+			} else {
+				profile.mGnsQuality = GnsConnectionQuality();
+				profile.mGnsSendQueue = profile.mGnsRecvQueue = 0u;
+			}
 		}
 
 		return profile;
 	}
 
+	std::string BridgeInstance::ReportGnsDetailedStatus() {
+		std::lock_guard locker(mPeerMutex);
+		if (mGnsInstance == nullptr) return std::string();
+		return mGnsInstance->ReportDetailedStatus();
+	}
+
+	void BridgeInstance::ReportLatencyBuckets(LatencyBuckets& tcp2gns, LatencyBuckets& gns2tcp) {
+		tcp2gns = mTcp2GnsLatency->SummarizeBuckets();
+		gns2tcp = mGns2TcpLatency->SummarizeBuckets();
+	}
+
+	ThroughputSample BridgeInstance::SampleThroughput() {
+		ThroughputSample sample;
+
+		sample.mTcp2GnsMsg = mSendGns.load();
+		sample.mTcp2GnsBytes = mSendGnsBytes.load();
+		sample.mGns2TcpMsg = mSendTcp.load();
+		sample.mGns2TcpBytes = mSendTcpBytes.load();
+
+		return sample;
+	}
+
+	StatsCountersValue BridgeInstance::SampleCounters() {
+		StatsCountersValue counters;
+
+		counters.mRecvTcp = mRecvTcp.load();
+		counters.mSendTcp = mSendTcp.load();
+		counters.mRecvGns = mRecvGns.load();
+		counters.mSendGns = mSendGns.load();
+		counters.mRecvTcpBytes = mRecvTcpBytes.load();
+		counters.mSendTcpBytes = mSendTcpBytes.load();
+		counters.mRecvGnsBytes = mRecvGnsBytes.load();
+		counters.mSendGnsBytes = mSendGnsBytes.load();
+
+		return counters;
+	}
+
+	SwitchSample BridgeInstance::SampleSwitches() {
+		SwitchSample sample;
+
+		sample.mSwitchCount = mSwitchCount.load();
+		sample.mSwitchFailCount = mSwitchFailCount.load();
+		sample.mSwitchTimeTotal = mSwitchTimeTotal.load();
+		sample.mSwitchTimeMax = mSwitchTimeMax.load();
+
+		return sample;
+	}
+
+	bool BridgeInstance::AcceptReattach(TcpInstance* tcp_instance) {
+		std::lock_guard locker(mPeerMutex);
+
+		// only accept one reattaching at the same time.
+		if (mPendingTcp != nullptr) return false;
+		mPendingTcp = tcp_instance;
+		return true;
+	}
+
+	bool BridgeInstance::PickPendingTcp() {
+		TcpInstance* old_tcp;
+		{
+			std::lock_guard locker(mPeerMutex);
+			if (mPendingTcp == nullptr) return false;
+
+			old_tcp = mTcpInstance;
+			mTcpInstance = mPendingTcp;
+			mPendingTcp = nullptr;
+		}
+		mIsDetached.store(false);
+		mTcpInstance->SetEgressLatency(mGns2TcpLatency);
+
+		// endpoint may reconnect before we notice the old connection dropped.
+		// disposal will stop it.
+		if (old_tcp != nullptr) {
+			mTcpFactory->ReturnConnections(old_tcp);
+		}
+
+		mOutput->Printf(OutputHelper::Component::BridgeInstance, mIndex, "Tcp instance #%" PRIu64 " reattached to session %016" PRIx64 ".", mTcpInstance->mIndex, mResumeToken);
+		return true;
+	}
+
+	void BridgeInstance::DetachTcp() {
+		TcpInstance* old_tcp;
+		{
+			std::lock_guard locker(mPeerMutex);
+			old_tcp = mTcpInstance;
+			mTcpInstance = nullptr;
+		}
+		mIsDetached.store(true);
+
+		mTcpFactory->ReturnConnections(old_tcp);
+
+		mOutput->Printf(OutputHelper::Component::BridgeInstance, mIndex, "Tcp instance dropped. Session %016" PRIx64 " is waiting reattaching.", mResumeToken);
+	}
+
+	bool BridgeInstance::ProcessSwitching() {
+		// accept new switching order
+		if (!mIsDetached.load()) {
+			std::string url(mTcpInstance->PopSwitchUrl());
+			if (!url.empty()) {
+				if (mSwitchingGns != nullptr) {
+					// only the latest order is valid.
+					mOutput->Printf(OutputHelper::Component::BridgeInstance, mIndex, "Abandon switching to %s.", mSwitchingUrl.c_str());
+					mGnsFactory->ReturnConnections(mSwitchingGns);
+				}
+
+				mSwitchingUrl = std::move(url);
+				mSwitchStart = std::chrono::steady_clock::now();
+				mSwitchingGns = mGnsFactory->GetConnections(mSwitchingUrl, nullptr);
+				mSwitchingGns->SetEgressLatency(mTcp2GnsLatency);
+				mIsSwitching.store(true);
+				mOutput->Printf(OutputHelper::Component::BridgeInstance, mIndex, "Start switching to %s.", mSwitchingUrl.c_str());
+			}
+		}
+
+		// check switching one
+		if (mSwitchingGns == nullptr) return false;
+		if (mSwitchingGns->mStatusReporter.IsInState(StateMachine::Stopped)) {
+			// fail to connect. keep current server.
+			mOutput->Printf(OutputHelper::Component::BridgeInstance, mIndex, "Fail to switch to %s.", mSwitchingUrl.c_str());
+			mGnsFactory->ReturnConnections(mSwitchingGns);
+			mSwitchingGns = nullptr;
+			mIsSwitching.store(false);
+			mSwitchFailCount.fetch_add(1u);
+
+			if (!mIsDetached.load()) mTcpInstance->SendSwitchResult(false);
+			return false;
+		}
+		if (!mSwitchingGns->mStatusReporter.IsInState(StateMachine::Running)) return false;
+
+		// new server is ready. swap them.
+		GnsInstance* old_gns;
+		{
+			std::lock_guard locker(mPeerMutex);
+			old_gns = mGnsInstance;
+			mGnsInstance = mSwitchingGns;
+		}
+		mSwitchingGns = nullptr;
+		mIsSwitching.store(false);
+		mGnsFactory->ReturnConnections(old_gns);
+
+		// record switch latency
+		uint64_t elapsed = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - mSwitchStart).count());
+		mSwitchCount.fetch_add(1u);
+		mSwitchTimeTotal.fetch_add(elapsed);
+		if (elapsed > mSwitchTimeMax.load()) mSwitchTimeMax.store(elapsed);	// only CtxWorker write it.
+
+		// reply endpoint. all following server messages come from new server.
+		// if detached, endpoint will know it from the messages after reattaching.
+		if (!mIsDetached.load()) mTcpInstance->SendSwitchResult(true);
+		mOutput->Printf(OutputHelper::Component::BridgeInstance, mIndex, "Switched to %s in %.2fms.", mSwitchingUrl.c_str(), elapsed / 1000.0);
+		return true;
+	}
+
+	static uint64_t SumBytes(const std::deque<CommonMessage>& msg_list, size_t from) {
+		uint64_t bytes = 0u;
+		for (size_t i = from; i < msg_list.size(); ++i) {
+			bytes += msg_list[i].GetCommonDataLen();
+		}
+		return bytes;
+	}
+
 	void BridgeInstance::CtxWorker(std::stop_token st) {
 		std::deque<CommonMessage> msgtcp2gns, msggns2tcp;
 		uint64_t count, allcount;
+		uint64_t bytes, bytestcp2gns = 0u, bytesgns2tcp = 0u;	// the bytes of messages waiting in lists.
+		std::chrono::steady_clock::time_point detached_at;
+		StatsSlotFlags::Flags_t stats_flags, last_stats_flags = 0u;
+		ThreadInventory::Register("bridge", mIndex);
 
 		while (!st.stop_requested()) {
 			// if it can not work, wait
@@ -141,37 +493,120 @@ namespace WhispersAbyss {
 			// start working
 			allcount = 0u;
 
-			// check 2 instance status
-			if (mGnsInstance->mStatusReporter.IsInState(StateMachine::Stopped) ||
-				mTcpInstance->mStatusReporter.IsInState(StateMachine::Stopped)) {
+			// check gns instance status
+			// session can not live without it, unless a switching is in progress.
+			if (mGnsInstance->mStatusReporter.IsInState(StateMachine::Stopped) && mSwitchingGns == nullptr) {
 				this->Stop();
 				return;
 			}
 
+			// check tcp instance status
+			// pick reattached one first, then check whether current one dropped.
+			PickPendingTcp();
+			if (!mIsDetached.load() && mTcpInstance->mStatusReporter.IsInState(StateMachine::Stopped)) {
+				if (mResumeToken == 0u) {
+					this->Stop();
+					return;
+				}
+
+				DetachTcp();
+				detached_at = std::chrono::steady_clock::now();
+			}
+			if (mIsDetached.load() && std::chrono::steady_clock::now() - detached_at > mSettings->mResumeWindow) {
+				mOutput->Printf(OutputHelper::Component::BridgeInstance, mIndex, "No Tcp instance reattached in resumption window.");
+				this->Stop();
+				return;
+			}
+
+			// process session resumption request
+			if (!mIsDetached.load() && mTcpInstance->IsResumeRequested()) {
+				if (mSettings->mResumeWindow.count() == 0) {
+					mOutput->Printf(OutputHelper::Component::BridgeInstance, mIndex, "Session resumption is disabled.");
+				} else if (mResumeToken == 0u) {
+					mResumeToken = mSessions->Register(this);
+					mOutput->Printf(OutputHelper::Component::BridgeInstance, mIndex, "Session %016" PRIx64 " is resumable now.", mResumeToken);
+				}
+				mTcpInstance->SendResumeToken(mResumeToken);
+			}
+
+			// process server switching
+			// unsent messages belong to old server. drop them.
+			if (ProcessSwitching()) {
+				msgtcp2gns.clear();
+				bytestcp2gns = 0u;
+			}
+
 			// move msg data
-			// and collect data count
+			// and collect data count.
+			// Send() move all messages or nothing, so the bytes of sent messages is the bytes of whole list.
 			// ==================== Tcp 2 Gns ====================
-			count = msgtcp2gns.size();
-			mTcpInstance->Recv(msgtcp2gns);
-			mRecvTcp.fetch_add(msgtcp2gns.size() - count);
-			allcount += msgtcp2gns.size() - count;
+			if (!mIsDetached.load()) {
+				count = msgtcp2gns.size();
+				mTcpInstance->Recv(msgtcp2gns);
+				bytes = SumBytes(msgtcp2gns, count);
+				if (mOpcodes != nullptr) mOpcodes->Inspect(OpcodeDirection::Tcp2Gns, msgtcp2gns, count);
+				if (mCapture != nullptr) mCapture->Record(mIndex, CaptureDirection::Tcp2Gns, msgtcp2gns, count);
+				bytestcp2gns += bytes;
+				mRecvTcp.fetch_add(msgtcp2gns.size() - count);
+				mRecvTcpBytes.fetch_add(bytes);
+				allcount += msgtcp2gns.size() - count;
+			}
 
 			count = msgtcp2gns.size();
 			mGnsInstance->Send(msgtcp2gns);
+			if (msgtcp2gns.empty()) {
+				mSendGnsBytes.fetch_add(bytestcp2gns);
+				bytestcp2gns = 0u;
+			}
 			mSendGns.fetch_add(count - msgtcp2gns.size());
+			if (count != msgtcp2gns.size()) {
+				Tracer::Instant("bridge", "tcp2gns_handoff", mIndex, count - msgtcp2gns.size());
+				mSetupTimeline->Mark(SetupPhase::FirstTcp2Gns);
+			}
 			allcount += count - msgtcp2gns.size();
 
 			// ==================== Gns 2 Tco ====================
 			count = msggns2tcp.size();
 			mGnsInstance->Recv(msggns2tcp);
+			bytes = SumBytes(msggns2tcp, count);
+			if (mOpcodes != nullptr) mOpcodes->Inspect(OpcodeDirection::Gns2Tcp, msggns2tcp, count);
+			if (mCapture != nullptr) mCapture->Record(mIndex, CaptureDirection::Gns2Tcp, msggns2tcp, count);
+			bytesgns2tcp += bytes;
 			mRecvGns.fetch_add(msggns2tcp.size() - count);
+			mRecvGnsBytes.fetch_add(bytes);
 			allcount += msggns2tcp.size() - count;
 
-			count = msggns2tcp.size();
-			mTcpInstance->Send(msggns2tcp);
-			mSendTcp.fetch_add(count - msggns2tcp.size());
-			allcount += count - msggns2tcp.size();
+			if (!mIsDetached.load()) {
+				count = msggns2tcp.size();
+				mTcpInstance->Send(msggns2tcp);
+				if (msggns2tcp.empty()) {
+					mSendTcpBytes.fetch_add(bytesgns2tcp);
+					bytesgns2tcp = 0u;
+				}
+				mSendTcp.fetch_add(count - msggns2tcp.size());
+				if (count != msggns2tcp.size()) {
+					Tracer::Instant("bridge", "gns2tcp_handoff", mIndex, count - msggns2tcp.size());
+					mSetupTimeline->Mark(SetupPhase::FirstGns2Tcp);
+				}
+				allcount += count - msggns2tcp.size();
+			} else if (msggns2tcp.size() > RESUME_BUFFER_CAPACITY) {
+				// buffer server messages until reattaching.
+				// too much messages. this session can not be recovered.
+				mOutput->Printf(OutputHelper::Component::BridgeInstance, mIndex, "Too much server messages buffered during detaching.");
+				this->Stop();
+				return;
+			}
 
+			// publish into statistics page if anything changed
+			if (mStatsSlot != nullptr) {
+				stats_flags = StatsSlotFlags::Running;
+				if (mIsDetached.load()) stats_flags |= StatsSlotFlags::Detached;
+				if (mIsSwitching.load()) stats_flags |= StatsSlotFlags::Switching;
+				if (allcount != 0u || stats_flags != last_stats_flags) {
+					StatsPage::PublishSlot(mStatsSlot, stats_flags, SampleCounters());
+					last_stats_flags = stats_flags;
+				}
+			}
 
 			// if no data, sleep a while
 			if (allcount == 0u) {
@@ -181,4 +616,6 @@ namespace WhispersAbyss {
 		}
 	}
 
+#pragma endregion
+
 }
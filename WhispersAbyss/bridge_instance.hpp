@@ -4,8 +4,16 @@
 #include "state_machine.hpp"
 #include "tcp_factory.hpp"
 #include "gns_factory.hpp"
+#include "gns_instance.hpp"
+#include "lifecycle_executor.hpp"
+#include "settings.hpp"
+#include "metrics.hpp"
+#include "stats_page.hpp"
+#include "traffic_capture.hpp"
 #include <atomic>
 #include <thread>
+#include <map>
+#include <mutex>
 
 namespace WhispersAbyss {
 
@@ -15,41 +23,184 @@ namespace WhispersAbyss {
 		StateMachine::State_t mState;
 		bool mIsInTransition;
 	};
+	struct SwitchSample {
+		uint64_t mSwitchCount, mSwitchFailCount;
+		uint64_t mSwitchTimeTotal, mSwitchTimeMax;	// in microseconds. only count successful switching.
+
+		/// <summary>
+		/// Sum counters, and keep the larger max.
+		/// </summary>
+		SwitchSample& operator+=(const SwitchSample& rhs);
+	};
 	struct BridgeInstanceProfile {
 		uint64_t mRecvTcp, mSendTcp, mRecvGns, mSendGns;
+		uint64_t mRecvTcpBytes, mSendTcpBytes, mRecvGnsBytes, mSendGnsBytes;
+		/// <summary>
+		/// Filled by BridgeFactory from its sampler, not by BridgeInstance.
+		/// </summary>
+		ThroughputRate mRate;
 		InstanceStatus mSelfStatus, mTcpStatus, mGnsStatus;
+		bool mIsDetached, mIsSwitching;
+		uint64_t mSwitchCount, mSwitchFailCount;
+		uint64_t mSwitchTimeTotal, mSwitchTimeMax;	// in microseconds. only count successful switching.
+		LatencySummary mTcp2GnsLatency, mGns2TcpLatency;
+		/// <summary>
+		/// Ordered by bytes in descending order. Empty if opcode statistics is disabled.
+		/// </summary>
+		std::vector<OpcodeUsage> mTcp2GnsOpcodes, mGns2TcpOpcodes;
+		GnsConnectionQuality mGnsQuality;
+		size_t mTcpSendQueue, mTcpRecvQueue, mGnsSendQueue, mGnsRecvQueue;
+	};
+
+	class BridgeInstance;
+
+	/// <summary>
+	/// <para>The resumable sessions owned by BridgeFactory.</para>
+	/// <para>A bridge register itself when its endpoint request session resumption,
+	/// and unregister itself in its stopping. So the pointer stored in it is always valid under its lock.</para>
+	/// </summary>
+	class BridgeSessionRegistry {
+	public:
+		BridgeSessionRegistry();
+		BridgeSessionRegistry(const BridgeSessionRegistry& rhs) = delete;
+		BridgeSessionRegistry(BridgeSessionRegistry&& rhs) = delete;
+		~BridgeSessionRegistry();
+
+		/// <summary>
+		/// Register a bridge and return its token. Token is never 0.
+		/// </summary>
+		uint64_t Register(BridgeInstance* instance);
+		void Unregister(uint64_t token);
+		/// <summary>
+		/// Hand over a Tcp instance to the bridge owning given token.
+		/// </summary>
+		/// <returns>True if the bridge accept it. The ownership of Tcp instance is moved to that bridge.</returns>
+		bool Reattach(uint64_t token, TcpInstance* tcp_instance);
+	private:
+		AbyssMutex mSessionsMutex;
+		std::map<uint64_t, BridgeInstance*> mSessions;
 	};
 
 	class BridgeInstance {
 	private:
 		OutputHelper* mOutput;
+		LifecycleExecutor* mExecutor;
+		LifecycleExecutor::Strand_t mStrand;
 		StateMachine::StateMachineCore mModuleStatus;
 		IndexDistributor mIndexDistributor;
 
 		TcpFactory* mTcpFactory;
 		GnsFactory* mGnsFactory;
+		const AbyssSettings* mSettings;
+		BridgeSessionRegistry* mSessions;
 
+		/// <summary>
+		/// Protect the swap of mTcpInstance, mPendingTcp and mGnsInstance.
+		/// mTcpInstance and mGnsInstance only can be changed by CtxWorker after initializing.
+		/// </summary>
+		AbyssMutex mPeerMutex;
 		TcpInstance* mTcpInstance;
 		GnsInstance* mGnsInstance;
+		/// <summary>
+		/// The Tcp instance handed over by BridgeSessionRegistry, waiting CtxWorker picking it up.
+		/// </summary>
+		TcpInstance* mPendingTcp;
+		/// <summary>
+		/// The token of this session. 0 mean this session is not resumable.
+		/// </summary>
+		uint64_t mResumeToken;
+		std::atomic_bool mIsDetached;
+		/// <summary>
+		/// The Gns instance connecting to the server ordered by Switch Command.
+		/// It will replace mGnsInstance once it is running. Only accessed by CtxWorker and stopping.
+		/// </summary>
+		GnsInstance* mSwitchingGns;
+		std::string mSwitchingUrl;
+		std::chrono::steady_clock::time_point mSwitchStart;
+		std::atomic_bool mIsSwitching;
+		std::atomic_uint64_t mSwitchCount, mSwitchFailCount, mSwitchTimeTotal, mSwitchTimeMax;
 
 		std::atomic_uint64_t mRecvTcp, mSendTcp, mRecvGns, mSendGns;
+		std::atomic_uint64_t mRecvTcpBytes, mSendTcpBytes, mRecvGnsBytes, mSendGnsBytes;
+		/// <summary>
+		/// The time from message entering this app to being written out on the other side.
+		/// Recorded by the egress instance and aggregated into BridgeFactory.
+		/// </summary>
+		std::shared_ptr<LatencyHistogram> mTcp2GnsLatency, mGns2TcpLatency;
+		/// <summary>
+		/// The slot in statistics page. Only written by context. nullptr if not published.
+		/// </summary>
+		StatsBridgeSlot* mStatsSlot;
+		/// <summary>
+		/// The traffic per opcode counted at ingress. nullptr if opcode statistics is disabled.
+		/// </summary>
+		std::unique_ptr<OpcodeCounters> mOpcodes;
+		/// <summary>
+		/// Owned by factory. nullptr if capture is disabled.
+		/// </summary>
+		TrafficCapture* mCapture;
+		/// <summary>
+		/// The setup timeline of the Tcp instance creating this bridge. Kept after reattaching.
+		/// </summary>
+		std::shared_ptr<SetupTimeline> mSetupTimeline;
 
-		std::jthread mTdCtx;
+		LifecycleThread mTdCtx;
 	public:
 		StateMachine::StateMachineReporter mStatusReporter;
 		IndexDistributor::Index_t mIndex;
 
 	public:
-		BridgeInstance(OutputHelper* output, TcpFactory* tcp_factory, GnsFactory* gns_factory, TcpInstance* tcp_instance, IndexDistributor::Index_t index);
+		BridgeInstance(OutputHelper* output, LifecycleExecutor* executor, TcpFactory* tcp_factory, GnsFactory* gns_factory, const AbyssSettings* settings, BridgeSessionRegistry* sessions, LatencyHistogram* tcp2gns_total, LatencyHistogram* gns2tcp_total, OpcodeCounters* opcode_total, TrafficCapture* capture, StatsBridgeSlot* stats_slot, TcpInstance* tcp_instance, IndexDistributor::Index_t index);
 		BridgeInstance(const BridgeInstance& rhs) = delete;
 		BridgeInstance(BridgeInstance&& rhs) = delete;
 		~BridgeInstance();
 
 		void Stop();
 		BridgeInstanceProfile ReportStatus();
+		/// <summary>
+		/// Get the forwarded (sent) message and byte counters for throughput sampling.
+		/// </summary>
+		ThroughputSample SampleThroughput();
+		/// <summary>
+		/// Get all message and byte counters.
+		/// </summary>
+		StatsCountersValue SampleCounters();
+		/// <summary>
+		/// Get server switching counters.
+		/// </summary>
+		SwitchSample SampleSwitches();
+		/// <summary>
+		/// Get the slot in statistics page. BridgeFactory return it after disposing this bridge.
+		/// </summary>
+		StatsBridgeSlot* GetStatsSlot() { return mStatsSlot; }
+		/// <summary>
+		/// Get the detailed status text of Gns connection. Empty if no connection.
+		/// </summary>
+		std::string ReportGnsDetailedStatus();
+		void ReportLatencyBuckets(LatencyBuckets& tcp2gns, LatencyBuckets& gns2tcp);
+		/// <summary>
+		/// Accept a reattaching Tcp instance. Called by BridgeSessionRegistry with its lock held.
+		/// </summary>
+		bool AcceptReattach(TcpInstance* tcp_instance);
 	private:
-		void InternalStop();
+		LifecycleExecutor::Task_t InitializingTask();
+		LifecycleExecutor::Task_t StoppingTask();
+		LifecycleExecutor::Task_t InternalStop();
 		void CtxWorker(std::stop_token st);
+		/// <summary>
+		/// Pick up pending Tcp instance and replace current one. Only called by CtxWorker.
+		/// </summary>
+		/// <returns>True if reattached.</returns>
+		bool PickPendingTcp();
+		/// <summary>
+		/// Return current Tcp instance and enter detached state. Only called by CtxWorker.
+		/// </summary>
+		void DetachTcp();
+		/// <summary>
+		/// Accept Switch Command and check switching Gns instance. Only called by CtxWorker.
+		/// </summary>
+		/// <returns>True if server has been switched.</returns>
+		bool ProcessSwitching();
 	};
 
 }
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+/*
+The layout of traffic capture file written by WhispersAbyss with --capture-file.
+This header is shared by WhispersAbyss (writer) and AbyssBench replay mode (reader),
+so it only depends on standard library.
+
+The file is append-only. It starts with a CaptureFileHeader,
+followed by records until the end of file. Each record is a CaptureRecordHeader followed by its payload.
+Records are not aligned, so readers should copy headers out before reading them.
+Records of a bridge are in order, but records of different bridges may be slightly out of order,
+because every bridge append its batch when it moves messages.
+A file may end with a truncated record if process was killed. Readers should ignore it.
+
+All numbers are little endian. Increase CAPTURE_FILE_VERSION if any layout changed.
+*/
+
+namespace WhispersAbyss {
+
+	constexpr const uint32_t CAPTURE_FILE_MAGIC = 0x50414357u;	// "WCAP" in little endian
+	constexpr const uint32_t CAPTURE_FILE_VERSION = 1u;
+
+	/// <summary>
+	/// The direction of a record. Same values as OpcodeDirection.
+	/// </summary>
+	enum class CaptureDirection : uint8_t {
+		Tcp2Gns = 0, Gns2Tcp = 1
+	};
+
+	struct CaptureFileHeader {
+		uint32_t mMagic;
+		uint32_t mVersion;
+		/// <summary>
+		/// Wall clock when capture started, in microseconds since Unix epoch. Only for showing.
+		/// </summary>
+		int64_t mStartTime;
+	};
+	static_assert(sizeof(CaptureFileHeader) == 16u, "Unexpected padding in CaptureFileHeader.");
+
+	struct CaptureRecordHeader {
+		/// <summary>
+		/// When the message entered WhispersAbyss, in nanoseconds since capture started.
+		/// </summary>
+		uint64_t mTimestamp;
+		uint64_t mBridgeIndex;
+		/// <summary>
+		/// The bytes of payload following this header.
+		/// </summary>
+		uint32_t mLength;
+		uint8_t mDirection;	// CaptureDirection
+		uint8_t mIsReliable;
+		uint16_t mReserved;
+	};
+	static_assert(sizeof(CaptureRecordHeader) == 24u, "Unexpected padding in CaptureRecordHeader.");
+
+}
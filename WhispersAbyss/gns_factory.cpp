@@ -12,7 +12,7 @@ namespace WhispersAbyss {
 	/// <summary>
 	/// Lock shared when calling function. Lock unique when replacing function ptr.
 	/// </summary>
-	static std::shared_mutex s_GnsFuncPtrsMutex;
+	static AbyssSharedMutex s_GnsFuncPtrsMutex("gns_func_ptrs");
 	static std::function<void(ESteamNetworkingSocketsDebugOutputType, const char*)> s_fpGnsDebug(nullptr);
 	static std::function<void(SteamNetConnectionStatusChangedCallback_t*)> s_fpGnsStatusChanged(nullptr);
 	static void ProcDebugOutput(ESteamNetworkingSocketsDebugOutputType eType, const char* pszMsg) {
@@ -24,72 +24,15 @@ namespace WhispersAbyss {
 		if (s_fpGnsStatusChanged) s_fpGnsStatusChanged(pInfo);
 	}
 
-	GnsFactory::GnsFactory(OutputHelper* output) :
-		mOutput(output), mModuleStatus(StateMachine::Ready), mStatusReporter(mModuleStatus), mIndexDistributor(),
-		mSelfOperator(this), mGnsSockets(nullptr),
-		mRouterMap(), mRouterMutex(),
+	GnsFactory::GnsFactory(OutputHelper* output, LifecycleExecutor* executor, const GnsImpairment& impairment) :
+		mOutput(output), mExecutor(executor), mStrand(executor->MakeStrand()),
+		mModuleStatus(StateMachine::Ready), mStatusReporter(mModuleStatus), mIndexDistributor(),
+		mSelfOperator(this), mGnsSockets(nullptr), mResolver(output), mImpairment(impairment),
+		mRouterMap(), mRouterMutex("gns_router"),
 		mTdPoll(),
 		mDisposal()
 	{
-		std::thread([this]() -> void {
-			// start transition
-			StateMachine::TransitionInitializing transition(mModuleStatus);
-			if (!transition.CanTransition()) return;
-
-			// initialize steam lib
-			SteamDatagramErrMsg err_msg;
-			if (!GameNetworkingSockets_Init(nullptr, err_msg)) {
-				this->mOutput->FatalError(OutputHelper::Component::GnsFactory, NO_INDEX, "GameNetworkingSockets_Init failed. %s", err_msg);
-				transition.SetTransitionError(true);
-				return;
-			}
-
-			// bind to static variables
-			{
-				std::unique_lock locker(s_GnsFuncPtrsMutex);
-				if (s_fpGnsDebug || s_fpGnsStatusChanged) {
-					this->mOutput->FatalError(OutputHelper::Component::GnsFactory, NO_INDEX, "Multiple instance of GnsFactory!");
-					transition.SetTransitionError(true);
-					return;
-				}
-
-				s_fpGnsDebug = std::bind(&GnsFactory::ProcDebugOutput, this, std::placeholders::_1, std::placeholders::_2);
-				s_fpGnsStatusChanged = std::bind(&GnsFactory::ProcConnectionStatusChanged, this, std::placeholders::_1);
-			}
-
-			// bind static functions to gns
-			SteamNetworkingUtils()->SetDebugOutputFunction(
-				k_ESteamNetworkingSocketsDebugOutputType_Msg,
-				&WhispersAbyss::ProcDebugOutput
-			);
-			SteamNetworkingUtils()->SetGlobalCallback_SteamNetConnectionStatusChanged(
-				&WhispersAbyss::ProcConnectionStatusChanged
-			);
-
-			// get sockets
-			this->mGnsSockets = SteamNetworkingSockets();
-
-			// start disposal
-			this->mDisposal.Start([this](GnsInstance* instance) -> void {
-				if (!instance->mStatusReporter.IsInState(StateMachine::Stopped)) instance->Stop();
-				instance->mStatusReporter.SpinUntil(StateMachine::Stopped);
-				this->mIndexDistributor.Return(instance->mIndex);
-				delete instance;
-			});
-
-			// start polling
-			this->mTdPoll = std::jthread([this](std::stop_token st) -> void {
-				while (!st.stop_requested()) {
-					this->mGnsSockets->RunCallbacks();
-					std::this_thread::sleep_for(SPIN_INTERVAL);
-				}
-			});
-
-			this->mOutput->Printf(OutputHelper::Component::GnsFactory, NO_INDEX, "GameNetworkingSockets_Init done.");
-
-			// end transition
-			transition.SetTransitionError(false);
-		}).detach();
+		mExecutor->Spawn(mStrand, InitializingTask(), "GnsFactory::Initializing", NO_INDEX);
 
 		mOutput->Printf(OutputHelper::Component::GnsFactory, NO_INDEX, "Factory created.");
 	}
@@ -100,30 +43,105 @@ namespace WhispersAbyss {
 		mOutput->Printf(OutputHelper::Component::GnsFactory, NO_INDEX, "Factory disposed.");
 	}
 
-	void GnsFactory::Stop() {
-		std::thread([this]() -> void {
-			// start transition
-			StateMachine::TransitionStopping transition(mModuleStatus);
-			if (!transition.CanTransition()) return;
-
-			// stop polling
-			if (this->mTdPoll.joinable()) {
-				this->mTdPoll.request_stop();
-				this->mTdPoll.join();
+	LifecycleExecutor::Task_t GnsFactory::InitializingTask() {
+		// start transition
+		StateMachine::TransitionInitializing transition(mModuleStatus, std::defer_lock);
+		co_await LifecycleExecutor::EnterTransition(transition);
+		if (!transition.CanTransition()) co_return;
+
+		// initialize steam lib
+		SteamDatagramErrMsg err_msg;
+		if (!GameNetworkingSockets_Init(nullptr, err_msg)) {
+			this->mOutput->FatalError(OutputHelper::Component::GnsFactory, NO_INDEX, "GameNetworkingSockets_Init failed. %s", err_msg);
+			transition.SetTransitionError(true);
+			co_return;
+		}
+
+		// bind to static variables
+		{
+			std::unique_lock locker(s_GnsFuncPtrsMutex);
+			if (s_fpGnsDebug || s_fpGnsStatusChanged) {
+				this->mOutput->FatalError(OutputHelper::Component::GnsFactory, NO_INDEX, "Multiple instance of GnsFactory!");
+				transition.SetTransitionError(true);
+				co_return;
 			}
-			// set socket
-			this->mGnsSockets = nullptr;
 
-			// wait disposal worker exit
-			this->mDisposal.Stop();
+			s_fpGnsDebug = std::bind(&GnsFactory::ProcDebugOutput, this, std::placeholders::_1, std::placeholders::_2);
+			s_fpGnsStatusChanged = std::bind(&GnsFactory::ProcConnectionStatusChanged, this, std::placeholders::_1);
+		}
+
+		// bind static functions to gns
+		SteamNetworkingUtils()->SetDebugOutputFunction(
+			k_ESteamNetworkingSocketsDebugOutputType_Msg,
+			&WhispersAbyss::ProcDebugOutput
+		);
+		SteamNetworkingUtils()->SetGlobalCallback_SteamNetConnectionStatusChanged(
+			&WhispersAbyss::ProcConnectionStatusChanged
+		);
+
+		// apply fake network conditions
+		// they are global options of GNS, so they can not be given to each connection.
+		if (mImpairment.IsEnabled()) {
+			ISteamNetworkingUtils* utils = SteamNetworkingUtils();
+			utils->SetGlobalConfigValueInt32(k_ESteamNetworkingConfig_FakePacketLag_Send, mImpairment.mLag);
+			utils->SetGlobalConfigValueFloat(k_ESteamNetworkingConfig_FakePacketLoss_Send, mImpairment.mLoss);
+			utils->SetGlobalConfigValueFloat(k_ESteamNetworkingConfig_FakePacketReorder_Send, mImpairment.mReorder);
+			utils->SetGlobalConfigValueInt32(k_ESteamNetworkingConfig_FakePacketReorder_Time, mImpairment.mReorderTime);
+			utils->SetGlobalConfigValueFloat(k_ESteamNetworkingConfig_FakePacketDup_Send, mImpairment.mDup);
+			utils->SetGlobalConfigValueInt32(k_ESteamNetworkingConfig_FakePacketDup_TimeMax, mImpairment.mDupTimeMax);
+			this->mOutput->Printf(OutputHelper::Component::GnsFactory, NO_INDEX, "Impairment applied: lag %" PRId32 "ms, loss %.2f%%, reorder %.2f%% by %" PRId32 "ms, dup %.2f%% within %" PRId32 "ms.",
+				mImpairment.mLag, mImpairment.mLoss, mImpairment.mReorder, mImpairment.mReorderTime, mImpairment.mDup, mImpairment.mDupTimeMax);
+		}
 
-			// destroy steam work
-			std::this_thread::sleep_for(std::chrono::milliseconds(500));
-			GameNetworkingSockets_Kill();
+		// get sockets
+		this->mGnsSockets = SteamNetworkingSockets();
+
+		// start disposal
+		this->mDisposal.Start([this](GnsInstance* instance) -> void {
+			if (!instance->mStatusReporter.IsInState(StateMachine::Stopped)) instance->Stop();
+			instance->mStatusReporter.SpinUntil(StateMachine::Stopped);
+			this->mIndexDistributor.Return(instance->mIndex);
+			delete instance;
+		}, "disposal-gns");
+
+		// start polling
+		this->mTdPoll.Start([this](std::stop_token st) -> void {
+			ThreadInventory::Register("gns-poll", NO_INDEX);
+			while (!st.stop_requested()) {
+				this->mGnsSockets->RunCallbacks();
+				std::this_thread::sleep_for(SPIN_INTERVAL);
+			}
+		});
 
-			mOutput->Printf(OutputHelper::Component::GnsFactory, NO_INDEX, "GameNetworkingSockets_Kill done.");
+		this->mOutput->Printf(OutputHelper::Component::GnsFactory, NO_INDEX, "GameNetworkingSockets_Init done.");
 
-		}).detach();
+		// end transition
+		transition.SetTransitionError(false);
+	}
+
+	void GnsFactory::Stop() {
+		mExecutor->Spawn(mStrand, StoppingTask(), "GnsFactory::Stopping", NO_INDEX);
+	}
+
+	LifecycleExecutor::Task_t GnsFactory::StoppingTask() {
+		// start transition
+		StateMachine::TransitionStopping transition(mModuleStatus, std::defer_lock);
+		co_await LifecycleExecutor::EnterTransition(transition);
+		if (!transition.CanTransition()) co_return;
+
+		// stop polling
+		co_await this->mTdPoll.Stop();
+		// set socket
+		this->mGnsSockets = nullptr;
+
+		// wait disposal worker exit
+		co_await LifecycleExecutor::StopDisposal(this->mDisposal);
+
+		// destroy steam work
+		co_await LifecycleExecutor::Delay(std::chrono::milliseconds(500));
+		GameNetworkingSockets_Kill();
+
+		mOutput->Printf(OutputHelper::Component::GnsFactory, NO_INDEX, "GameNetworkingSockets_Kill done.");
 	}
 
 #pragma endregion
@@ -156,6 +174,10 @@ namespace WhispersAbyss {
 		return mFactory->mGnsSockets;
 	}
 
+	GnsResolver* GnsFactoryOperator::GetResolver() {
+		return &mFactory->mResolver;
+	}
+
 	void GnsFactoryOperator::RegisterClient(HSteamNetConnection token, GnsInstance* instance) {
 		std::unique_lock locker(mFactory->mRouterMutex);
 		mFactory->mRouterMap.emplace(token, GnsInstanceOperator(instance));
@@ -169,17 +191,19 @@ namespace WhispersAbyss {
 #pragma endregion
 
 
-	GnsInstance* GnsFactory::GetConnections(std::string& server_url) {
+	GnsInstance* GnsFactory::GetConnections(std::string& server_url, std::shared_ptr<SetupTimeline> setup_timeline) {
 		if (!mStatusReporter.IsInState(StateMachine::Running)) {
 			mOutput->FatalError(OutputHelper::Component::GnsFactory, NO_INDEX, "Out of work time calling GnsFactory::GetConnections()!");
 			return nullptr;
 		}
 
 		GnsInstance* instance = new GnsInstance(
-			mOutput, 
+			mOutput,
+			mExecutor,
 			mIndexDistributor.Get(),
 			&mSelfOperator,
-			server_url
+			server_url,
+			std::move(setup_timeline)
 		);
 		return instance;
 	}
@@ -192,5 +216,13 @@ namespace WhispersAbyss {
 
 		mDisposal.Move(conn);
 	}
+
+	GnsResolverProfile GnsFactory::ReportResolverStatus() {
+		return mResolver.ReportStatus();
+	}
+
+	size_t GnsFactory::ReportDisposalBacklog() {
+		return mDisposal.GetPendingCount();
+	}
 	
 }
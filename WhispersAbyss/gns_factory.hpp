@@ -3,12 +3,17 @@
 #include "state_machine.hpp"
 #include "others_helper.hpp"
 #include "messages.hpp"
+#include "lifecycle_executor.hpp"
+#include "gns_resolver.hpp"
+#include "metrics.hpp"
+#include "settings.hpp"
 #include <steam/steamnetworkingtypes.h>
 #include <steam/isteamnetworkingsockets.h>
 #include <map>
 #include <mutex>
 #include <shared_mutex>
 #include <deque>
+#include <memory>
 
 namespace WhispersAbyss {
 
@@ -26,6 +31,7 @@ namespace WhispersAbyss {
 		~GnsFactoryOperator() {}
 
 		ISteamNetworkingSockets* GetGnsSockets();
+		GnsResolver* GetResolver();
 
 		void RegisterClient(HSteamNetConnection token, GnsInstance* instance);
 		void UnregisterClient(HSteamNetConnection token);
@@ -36,35 +42,50 @@ namespace WhispersAbyss {
 		friend class GnsFactoryOperator;
 	private:
 		OutputHelper* mOutput;
+		LifecycleExecutor* mExecutor;
+		LifecycleExecutor::Strand_t mStrand;
 		StateMachine::StateMachineCore mModuleStatus;
 		IndexDistributor mIndexDistributor;
 
-		std::jthread mTdPoll;
+		LifecycleThread mTdPoll;
 
 		GnsFactoryOperator mSelfOperator;
 		ISteamNetworkingSockets* mGnsSockets;
+		GnsResolver mResolver;
+		GnsImpairment mImpairment;
 
 		std::map<HSteamNetConnection, GnsInstanceOperator> mRouterMap;
 		// Lock shared when use router. Lock unique when change router.
-		std::shared_mutex mRouterMutex;
+		AbyssSharedMutex mRouterMutex;
 
 		DisposalHelper<GnsInstance*> mDisposal;
 	public:
 		StateMachine::StateMachineReporter mStatusReporter;
 
 	public:
-		GnsFactory(OutputHelper* output);
+		GnsFactory(OutputHelper* output, LifecycleExecutor* executor, const GnsImpairment& impairment);
 		GnsFactory(const GnsFactory& rhs) = delete;
 		GnsFactory(GnsFactory&& rhs) = delete;
 		~GnsFactory();
 
 		void Stop();
 
-		GnsInstance* GetConnections(std::string& server_url);
+		/// <summary>
+		/// Create an instance connecting to given server.
+		/// </summary>
+		/// <param name="setup_timeline">Mark setup phases of a bridge into it. nullptr if not needed, like switching server.</param>
+		GnsInstance* GetConnections(std::string& server_url, std::shared_ptr<SetupTimeline> setup_timeline);
 		void ReturnConnections(GnsInstance* conn);
+		GnsResolverProfile ReportResolverStatus();
+		/// <summary>
+		/// Get how many returned instances are still waiting for disposal.
+		/// </summary>
+		size_t ReportDisposalBacklog();
 	protected:
 
 	private:
+		LifecycleExecutor::Task_t InitializingTask();
+		LifecycleExecutor::Task_t StoppingTask();
 		void ProcDebugOutput(ESteamNetworkingSocketsDebugOutputType eType, const char* pszMsg);
 		void ProcConnectionStatusChanged(SteamNetConnectionStatusChangedCallback_t* pInfo);
 	};
@@ -1,74 +1,28 @@
+#ifdef _WIN32
 #include <sdkddkver.h>	// need by asio
+#endif // _WIN32
 #include "asio.hpp"
 #include <steam/steamnetworkingsockets.h>
 #include <steam/isteamnetworkingutils.h>
 #include "gns_instance.hpp"
 #include "gns_factory.hpp"
+#include "probes.hpp"
+#include <algorithm>
 
 namespace WhispersAbyss {
 
-	GnsInstance::GnsInstance(OutputHelper* output, IndexDistributor::Index_t index, GnsFactoryOperator* factory_oper, std::string& server) :
-		mOutput(output), mModuleStatus(StateMachine::Ready), mStatusReporter(mModuleStatus),
+	GnsInstance::GnsInstance(OutputHelper* output, LifecycleExecutor* executor, IndexDistributor::Index_t index, GnsFactoryOperator* factory_oper, std::string& server, std::shared_ptr<SetupTimeline> setup_timeline) :
+		mOutput(output), mExecutor(executor), mStrand(executor->MakeStrand()),
+		mModuleStatus(StateMachine::Ready), mStatusReporter(mModuleStatus),
 		mIndex(index), mServerUrl(server), mFactoryOperator(factory_oper),
-		mRecvMsgMutex(), mSendMsgMutex(),
-		mRecvMsg(), mSendMsg(),
+		mRecvMsgMutex("gns_recv_msg"), mSendMsgMutex("gns_send_msg"),
+		mRecvMsg(), mSendMsg(), mEgressLatency(), mSetupTimeline(std::move(setup_timeline)),
+		mQualityMutex("gns_quality"), mQuality(), mDetailedStatus(),
 		mTdCtx(),
-		mGnsConnection(k_HSteamNetConnection_Invalid), mGnsMessages(), mGnsBuffer()
+		mGnsConnection(k_HSteamNetConnection_Invalid), mGnsMessages(), mGnsBuffer(),
+		mRacingMutex("gns_racing"), mGnsAttempts(), mRacingEvent(nullptr)
 	{
-		std::thread([this]() -> void {
-			// start transition
-			StateMachine::TransitionInitializing transition(mModuleStatus);
-			if (!transition.CanTransition()) return;
-
-			// split url
-			std::string address, port;
-			size_t urlpos = mServerUrl.find(":");
-			address = mServerUrl.substr(0, urlpos);
-			port = mServerUrl.substr(urlpos + 1);
-
-			// solve ip
-			mOutput->Printf(OutputHelper::Component::GnsInstance, mIndex, "Resolving server address %s:%s", address.c_str(), port.c_str());
-			asio::io_context ioContext;
-			asio::ip::udp::resolver udpResolver(ioContext);
-			asio::error_code ec;
-			asio::ip::udp::resolver::results_type results = udpResolver.resolve(address, port, ec);
-			bool is_success = false;
-			if (!ec) {
-				for (const auto& i : results) {
-					auto endpoint = i.endpoint();
-					std::string connection_string;
-					connection_string = endpoint.address().to_string() + ":" + std::to_string(endpoint.port());
-					mOutput->Printf(OutputHelper::Component::GnsInstance, mIndex, "Trying %s...", connection_string.c_str());
-					if (ConnectGns(connection_string)) {
-						// success
-						is_success = true;
-						transition.SetTransitionError(false);
-						break;
-					}
-				}
-
-				if (!is_success) {
-					// failed
-					this->InternalStop();
-					transition.SetTransitionError(true);
-					mOutput->Printf(OutputHelper::Component::GnsInstance, mIndex, "Run out of resolved address.");
-				}
-			} else {
-				// failed
-				this->InternalStop();
-				transition.SetTransitionError(true);
-				mOutput->Printf(OutputHelper::Component::GnsInstance, mIndex, "Fail to resolve hostname.");
-			}
-
-			// stop context
-			ioContext.stop();
-
-			// if success, start context worker
-			if (is_success) {
-				this->mTdCtx = std::jthread(std::bind(&GnsInstance::CtxWorker, this, std::placeholders::_1));
-			}
-
-		}).detach();
+		mExecutor->Spawn(mStrand, InitializingTask(), "GnsInstance::Initializing", mIndex);
 
 		mOutput->Printf(OutputHelper::Component::GnsInstance, mIndex, "Instance created.");
 	}
@@ -79,27 +33,69 @@ namespace WhispersAbyss {
 		mOutput->Printf(OutputHelper::Component::GnsInstance, mIndex, "Instance disposed.");
 	}
 
-	void GnsInstance::InternalStop() {
+	LifecycleExecutor::Task_t GnsInstance::InitializingTask() {
+		// start transition
+		StateMachine::TransitionInitializing transition(mModuleStatus, std::defer_lock);
+		co_await LifecycleExecutor::EnterTransition(transition);
+		if (!transition.CanTransition()) co_return;
+
+		// split url
+		std::string address, port;
+		size_t urlpos = mServerUrl.find(":");
+		address = mServerUrl.substr(0, urlpos);
+		port = mServerUrl.substr(urlpos + 1);
+
+		// solve ip
+		// resolver is shared by all instances. it will merge the same request and cache the result.
+		mOutput->Printf(OutputHelper::Component::GnsInstance, mIndex, "Resolving server address %s:%s", address.c_str(), port.c_str());
+		GnsResolver::Endpoints_t endpoints;
+		bool is_resolved = co_await mFactoryOperator->GetResolver()->Resolve(address, port, endpoints);
+		bool is_success = false;
+		if (is_resolved) {
+			if (mSetupTimeline != nullptr) mSetupTimeline->Mark(SetupPhase::Resolved);
+			// race all resolved address. the first connected one win.
+			is_success = co_await RaceGns(endpoints);
+			if (is_success) {
+				transition.SetTransitionError(false);
+			} else {
+				// failed
+				co_await this->InternalStop();
+				transition.SetTransitionError(true);
+			}
+		} else {
+			// failed
+			co_await this->InternalStop();
+			transition.SetTransitionError(true);
+			mOutput->Printf(OutputHelper::Component::GnsInstance, mIndex, "Fail to resolve hostname.");
+		}
+
+		// if success, start context worker
+		if (is_success) {
+			this->mTdCtx.Start(std::bind(&GnsInstance::CtxWorker, this, std::placeholders::_1));
+		}
+	}
+
+	LifecycleExecutor::Task_t GnsInstance::InternalStop() {
 		// stop steam interface
 		mOutput->Printf(OutputHelper::Component::GnsInstance, mIndex, "Closing connection...");
 		DisconnectGns();
 
 		// stop ctx worker
-		if (mTdCtx.joinable()) {
-			mTdCtx.request_stop();
-			mTdCtx.join();
-		}
+		co_await mTdCtx.Stop();
 
 	}
 	void GnsInstance::Stop() {
-		std::thread([this]() -> void {
-			// start transition
-			StateMachine::TransitionStopping transition(mModuleStatus);
-			if (!transition.CanTransition()) return;
-
-			// call internal one
-			this->InternalStop();
-		}).detach();
+		mExecutor->Spawn(mStrand, StoppingTask(), "GnsInstance::Stopping", mIndex);
+	}
+
+	LifecycleExecutor::Task_t GnsInstance::StoppingTask() {
+		// start transition
+		StateMachine::TransitionStopping transition(mModuleStatus, std::defer_lock);
+		co_await LifecycleExecutor::EnterTransition(transition);
+		if (!transition.CanTransition()) co_return;
+
+		// call internal one
+		co_await this->InternalStop();
 	}
 
 	void GnsInstance::Send(std::deque<CommonMessage>& msg_list) {
@@ -127,15 +123,46 @@ namespace WhispersAbyss {
 		const char* side = is_recv ? "Recv" : "Send";
 
 		if (msg_size >= NUKE_CAPACITY) {
+			ABYSS_PROBE4(queue_nuke, "gns", mIndex, msg_size, is_recv);
 			mOutput->Printf(OutputHelper::Component::GnsInstance, mIndex, "%s message list reach nuke level: %zu. Nuke instance!!!", side, msg_size);
 			Stop();
 		} else if (msg_size >= WARNING_CAPACITY) {
+			ABYSS_PROBE4(queue_warning, "gns", mIndex, msg_size, is_recv);
 			mOutput->Printf(OutputHelper::Component::GnsInstance, mIndex, "%s message list reach warning level: %zu", side, msg_size);
 		}
 	}
 
+	void GnsInstance::SetEgressLatency(std::shared_ptr<LatencyHistogram> latency) {
+		std::lock_guard locker(mSendMsgMutex);
+		mEgressLatency = std::move(latency);
+	}
+
+	GnsConnectionQuality GnsInstance::ReportQuality() {
+		std::lock_guard locker(mQualityMutex);
+		return mQuality;
+	}
+
+	void GnsInstance::ReportQueueDepth(size_t& send_depth, size_t& recv_depth) {
+		{
+			std::lock_guard locker(mSendMsgMutex);
+			send_depth = mSendMsg.size();
+		}
+		{
+			std::lock_guard locker(mRecvMsgMutex);
+			recv_depth = mRecvMsg.size();
+		}
+	}
+
+	std::string GnsInstance::ReportDetailedStatus() {
+		std::lock_guard locker(mQualityMutex);
+		return mDetailedStatus;
+	}
+
 	void GnsInstance::CtxWorker(std::stop_token st) {
 		std::deque<CommonMessage> incoming_message, outbound_message;
+		std::shared_ptr<LatencyHistogram> latency;
+		std::chrono::steady_clock::time_point last_sample;
+		ThreadInventory::Register("gns-ctx", mIndex);
 
 		while (!st.stop_requested()) {
 			// if not in work. spin until it can work.
@@ -150,11 +177,17 @@ namespace WhispersAbyss {
 			{
 				std::lock_guard locker(mSendMsgMutex);
 				CommonOpers::MoveDeque(mSendMsg, outbound_message);
+				latency = mEgressLatency;
 			}
 			// process it if has message
 			if (!outbound_message.empty()) {
 				has_data = true;
-				SendGns(outbound_message);
+				// only read clock when tracing. checked once, so a span never pairs with a missing start.
+				bool is_traced = Tracer::IsEnabled();
+				uint64_t send_start = is_traced ? CommonOpers::GetMonotonicTime() : 0u;
+				size_t send_count = outbound_message.size();
+				SendGns(outbound_message, latency.get());
+				if (is_traced) Tracer::Complete("gns", "send", mIndex, send_start, send_count);
 			}
 
 
@@ -167,14 +200,22 @@ namespace WhispersAbyss {
 			}
 			// try push message from internal buffer
 			// and check size
-			size_t msg_list_size;
+			size_t msg_list_size, handoff_count = incoming_message.size();
 			{
 				std::lock_guard locker(mRecvMsgMutex);
 				CommonOpers::MoveDeque(incoming_message, mRecvMsg);
 				msg_list_size = mRecvMsg.size();
 			}
+			if (handoff_count != 0u) Tracer::Instant("gns", "recv_handoff", mIndex, handoff_count);
 			CheckSize(msg_list_size, true);
 
+			// ================= Status Sampler =================
+			auto now = std::chrono::steady_clock::now();
+			if (now - last_sample >= GNS_STATUS_INTERVAL) {
+				last_sample = now;
+				SampleGnsStatus();
+			}
+
 			// if this round no data. sleep more time
 			if (!has_data) {
 				std::this_thread::sleep_for(SPIN_INTERVAL);
@@ -194,6 +235,7 @@ namespace WhispersAbyss {
 			case k_ESteamNetworkingConnectionState_Connected:
 			{
 				mInstance->mOutput->Printf(OutputHelper::Component::GnsInstance,  mInstance->mIndex, "Connected.");
+				mInstance->OnAttemptConnected(pInfo->m_hConn);
 				break;
 			}
 			case k_ESteamNetworkingConnectionState_ClosedByPeer:
@@ -204,8 +246,11 @@ namespace WhispersAbyss {
 					pInfo->m_info.m_eEndReason
 				);
 
-				// actively stop
-				mInstance->Stop();
+				// actively stop if it is the connection in use.
+				// otherwise it is a failed racing attempt.
+				if (mInstance->OnAttemptFailed(pInfo->m_hConn)) {
+					mInstance->Stop();
+				}
 				break;
 			}
 			case k_ESteamNetworkingConnectionState_ProblemDetectedLocally:
@@ -216,8 +261,11 @@ namespace WhispersAbyss {
 					pInfo->m_info.m_eEndReason
 				);
 
-				// actively stop
-				mInstance->Stop();
+				// actively stop if it is the connection in use.
+				// otherwise it is a failed racing attempt.
+				if (mInstance->OnAttemptFailed(pInfo->m_hConn)) {
+					mInstance->Stop();
+				}
 				break;
 			}
 			case k_ESteamNetworkingConnectionState_None:
@@ -240,51 +288,162 @@ namespace WhispersAbyss {
 
 #pragma region steam work
 
-	bool GnsInstance::ConnectGns(std::string& addrs) {
-		if (mGnsConnection != k_HSteamNetConnection_Invalid) return false;	// already connected
+	asio::awaitable<bool> GnsInstance::RaceGns(const GnsResolver::Endpoints_t& endpoints) {
+		CountDownTimer waiting(MODULE_WAITING_INTERVAL);
+		size_t next_endpoint = 0u;
 
+		while (true) {
+			// fetch racing status and renew event
+			HSteamNetConnection winner;
+			size_t pending;
+			std::shared_ptr<LifecycleEvent> racing_event(std::make_shared<LifecycleEvent>());
+			{
+				std::lock_guard locker(mRacingMutex);
+				winner = mGnsConnection;
+				pending = std::count_if(mGnsAttempts.begin(), mGnsAttempts.end(), [](const GnsAttempt& attempt) -> bool {
+					return !attempt.mIsFailed;
+				});
+				mRacingEvent = racing_event;
+			}
+
+			// someone win. close others.
+			if (winner != k_HSteamNetConnection_Invalid) {
+				CloseLosingAttempts();
+				co_return true;
+			}
+
+			if (waiting.HasRunOutOfTime()) {
+				mOutput->Printf(OutputHelper::Component::GnsInstance, mIndex, "Run out of time of connecting server.");
+				co_return false;
+			}
+
+			// start next attempt if we still have address and free slot
+			if (next_endpoint < endpoints.size() && pending < GNS_RACING_COUNT) {
+				const auto& endpoint = endpoints[next_endpoint++];
+				std::string connection_string;
+				connection_string = endpoint.address().to_string() + ":" + std::to_string(endpoint.port());
+				mOutput->Printf(OutputHelper::Component::GnsInstance, mIndex, "Trying %s...", connection_string.c_str());
+
+				// if we can not start it, try next address at once.
+				if (ConnectGns(connection_string) == k_HSteamNetConnection_Invalid) continue;
+			} else if (pending == 0u) {
+				// no address can be tried and all attempts failed.
+				mOutput->Printf(OutputHelper::Component::GnsInstance, mIndex, "Run out of resolved address.");
+				co_return false;
+			}
+
+			// give attempts a while before starting next one.
+			// wake up early if any attempt connected or failed.
+			co_await racing_event->Wait(GNS_RACING_DELAY);
+		}
+	}
+
+	HSteamNetConnection GnsInstance::ConnectGns(const std::string& addrs) {
 		// parse addrs
 		SteamNetworkingIPAddr server_address{};
 		if (!server_address.ParseString(addrs.c_str())) {
-			return false;
+			return k_HSteamNetConnection_Invalid;
 		}
 
 		// set empty opt
+		// fake lag and loss are global options applied by GnsFactory, not options of connection.
 		SteamNetworkingConfigValue_t opt{};
 
 		// connect
-		mGnsConnection = mFactoryOperator->GetGnsSockets()->ConnectByIPAddress(server_address, 0, &opt);
-		if (mGnsConnection == k_HSteamNetConnection_Invalid) {
+		HSteamNetConnection conn = mFactoryOperator->GetGnsSockets()->ConnectByIPAddress(server_address, 0, &opt);
+		if (conn == k_HSteamNetConnection_Invalid) {
 			// failed. return.
-			return false;
+			return k_HSteamNetConnection_Invalid;
+		}
+
+		// register client and racing attempt
+		{
+			std::lock_guard locker(mRacingMutex);
+			mGnsAttempts.emplace_back(GnsAttempt{ conn, addrs, false });
 		}
+		mFactoryOperator->RegisterClient(conn, this);
+		if (mSetupTimeline != nullptr) mSetupTimeline->Mark(SetupPhase::ConnectIssued);
 
-		// register client
-		mFactoryOperator->RegisterClient(mGnsConnection, this);
+		return conn;
+	}
 
-		return true;
+	void GnsInstance::OnAttemptConnected(HSteamNetConnection conn) {
+		std::lock_guard locker(mRacingMutex);
+
+		// only the first connected one can win.
+		if (mGnsConnection != k_HSteamNetConnection_Invalid) return;
+		auto it = std::find_if(mGnsAttempts.begin(), mGnsAttempts.end(), [conn](const GnsAttempt& attempt) -> bool {
+			return attempt.mConnection == conn;
+		});
+		if (it == mGnsAttempts.end() || it->mIsFailed) return;
+
+		mGnsConnection = conn;
+		Tracer::Instant("gns", "connected", mIndex);
+		if (mSetupTimeline != nullptr) mSetupTimeline->Mark(SetupPhase::GnsConnected);
+		mOutput->Printf(OutputHelper::Component::GnsInstance, mIndex, "Won connection racing with %s.", it->mAddress.c_str());
+		if (mRacingEvent != nullptr) mRacingEvent->Set();
+	}
+
+	bool GnsInstance::OnAttemptFailed(HSteamNetConnection conn) {
+		std::lock_guard locker(mRacingMutex);
+
+		if (mGnsConnection != k_HSteamNetConnection_Invalid && mGnsConnection == conn) return true;
+		for (auto& attempt : mGnsAttempts) {
+			if (attempt.mConnection == conn) {
+				attempt.mIsFailed = true;
+			}
+		}
+		if (mRacingEvent != nullptr) mRacingEvent->Set();
+		return false;
+	}
+
+	void GnsInstance::CloseLosingAttempts() {
+		// pick losers first.
+		// do not close them with holding racing mutex because GNS callback hold router mutex then take racing mutex.
+		std::deque<HSteamNetConnection> losers;
+		{
+			std::lock_guard locker(mRacingMutex);
+			for (auto it = mGnsAttempts.begin(); it != mGnsAttempts.end();) {
+				if (it->mConnection != mGnsConnection) {
+					losers.emplace_back(it->mConnection);
+					it = mGnsAttempts.erase(it);
+				} else {
+					++it;
+				}
+			}
+		}
+
+		for (auto& conn : losers) {
+			mFactoryOperator->GetGnsSockets()->CloseConnection(conn, 0, "Lost connection racing", false);
+			mFactoryOperator->UnregisterClient(conn);
+		}
 	}
 
 	void GnsInstance::RecvGns(std::deque<CommonMessage>& msg_list) {
 		if (mGnsConnection == k_HSteamNetConnection_Invalid) return;
 
 		int msg_count = mFactoryOperator->GetGnsSockets()->ReceiveMessagesOnConnection(mGnsConnection, mGnsMessages, STEAM_MSG_CAPACITY);
+		if (msg_count > 0) ABYSS_PROBE3(gns_recv, mIndex, msg_count, msg_list.size());
 		// process message
 		for (int i = 0; i < msg_count; ++i) {
 			// parse data
 			// and add into list
 			CommonMessage msg;
 			msg.SetGnsData(mGnsMessages[i]->m_pData, mGnsMessages[i]->m_nFlags, mGnsMessages[i]->m_cbSize);
-			msg_list.emplace_back(std::move(msg));
+			{
+				ABYSS_ALLOC_SCOPE(DequeNode);
+				msg_list.emplace_back(std::move(msg));
+			}
 
 			// release steam msg data
 			mGnsMessages[i]->Release();
 		}
 	}
 
-	void GnsInstance::SendGns(std::deque<CommonMessage>& msg_list) {
+	void GnsInstance::SendGns(std::deque<CommonMessage>& msg_list, LatencyHistogram* latency) {
 		if (mGnsConnection == k_HSteamNetConnection_Invalid) return;
 
+		[[maybe_unused]] uint64_t start_time = ABYSS_PROBE_ENABLED(gns_send) ? CommonOpers::GetMonotonicTime() : 0u;
 		for (auto& msg : msg_list) {
 			mFactoryOperator->GetGnsSockets()->SendMessageToConnection(
 				mGnsConnection,
@@ -293,16 +452,59 @@ namespace WhispersAbyss {
 				msg.GetGnsSendFlag(),
 				nullptr
 			);
+
+			// record forwarding latency
+			if (latency != nullptr) latency->RecordSince(msg.GetIngressTime());
 		}
+		ABYSS_PROBE4(gns_send, mIndex, msg_list.size(), start_time, CommonOpers::GetMonotonicTime());
 		msg_list.clear();
 	}
 
-	void GnsInstance::DisconnectGns() {
+	void GnsInstance::SampleGnsStatus() {
+		GnsConnectionQuality quality;
+		std::string detailed;
+		quality.mIsValid = false;
+
 		if (mGnsConnection != k_HSteamNetConnection_Invalid) {
-			mFactoryOperator->GetGnsSockets()->CloseConnection(mGnsConnection, 0, "Goodbye from WhispersAbyss", false);
-			mFactoryOperator->UnregisterClient(mGnsConnection);
+			SteamNetConnectionRealTimeStatus_t status;
+			if (mFactoryOperator->GetGnsSockets()->GetConnectionRealTimeStatus(mGnsConnection, &status, 0, nullptr) == k_EResultOK) {
+				quality.mIsValid = true;
+				quality.mPing = status.m_nPing;
+				quality.mQualityLocal = status.m_flConnectionQualityLocal;
+				quality.mQualityRemote = status.m_flConnectionQualityRemote;
+				quality.mOutBytesPerSec = status.m_flOutBytesPerSec;
+				quality.mInBytesPerSec = status.m_flInBytesPerSec;
+				quality.mSendRate = status.m_nSendRateBytesPerSecond;
+				quality.mPendingUnreliable = status.m_cbPendingUnreliable;
+				quality.mPendingReliable = status.m_cbPendingReliable;
+				quality.mSentUnackedReliable = status.m_cbSentUnackedReliable;
+				quality.mQueueTime = status.m_usecQueueTime;
+			}
+
+			// return value > 0 mean buffer is too small and it is the required size.
+			detailed.resize(GNS_DETAILED_STATUS_CAPACITY);
+			int ret = mFactoryOperator->GetGnsSockets()->GetDetailedConnectionStatus(mGnsConnection, detailed.data(), static_cast<int>(detailed.size()));
+			if (ret == 0) detailed.resize(strlen(detailed.c_str()));
+			else detailed.clear();
+		}
+
+		std::lock_guard locker(mQualityMutex);
+		mQuality = quality;
+		mDetailedStatus = std::move(detailed);
+	}
+
+	void GnsInstance::DisconnectGns() {
+		// close connection in use and all racing attempts.
+		std::deque<GnsAttempt> attempts;
+		{
+			std::lock_guard locker(mRacingMutex);
+			CommonOpers::MoveDeque(mGnsAttempts, attempts);
 			mGnsConnection = k_HSteamNetConnection_Invalid;
+		}
 
+		for (auto& attempt : attempts) {
+			mFactoryOperator->GetGnsSockets()->CloseConnection(attempt.mConnection, 0, "Goodbye from WhispersAbyss", false);
+			mFactoryOperator->UnregisterClient(attempt.mConnection);
 		}
 	}
 
@@ -3,14 +3,31 @@
 #include "state_machine.hpp"
 #include "others_helper.hpp"
 #include "messages.hpp"
+#include "lifecycle_executor.hpp"
+#include "gns_resolver.hpp"
+#include "metrics.hpp"
 #include <steam/steamnetworkingtypes.h>
 #include <steam/isteamnetworkingsockets.h>
 #include <deque>
 #include <mutex>
 #include <string>
+#include <memory>
 
 namespace WhispersAbyss {
 
+	struct GnsConnectionQuality {
+		/// <summary>
+		/// False if no connection in use or it has not been sampled yet.
+		/// </summary>
+		bool mIsValid;
+		int mPing;	// in milliseconds
+		float mQualityLocal, mQualityRemote;	// 0 - 1. -1 mean unknown
+		float mOutBytesPerSec, mInBytesPerSec;
+		int mSendRate;	// the estimated bytes per second can be sent
+		int mPendingUnreliable, mPendingReliable, mSentUnackedReliable;	// in bytes
+		int64_t mQueueTime;	// in microseconds. the time a new message will wait before being sent.
+	};
+
 	class GnsInstance;
 	class GnsFactory;
 	class GnsFactoryOperator;
@@ -30,24 +47,61 @@ namespace WhispersAbyss {
 		friend class GnsInstanceOperator;
 	private:
 		OutputHelper* mOutput;
+		LifecycleExecutor* mExecutor;
+		LifecycleExecutor::Strand_t mStrand;
 		StateMachine::StateMachineCore mModuleStatus;
 		GnsFactoryOperator* mFactoryOperator;
 
-		std::mutex mRecvMsgMutex, mSendMsgMutex;
+		AbyssMutex mRecvMsgMutex, mSendMsgMutex;
 		std::deque<CommonMessage> mRecvMsg, mSendMsg;
+		/// <summary>
+		/// Record the latency of messages sent to server. Protected by mSendMsgMutex.
+		/// It is shared because this instance may be disposed later than its bridge.
+		/// </summary>
+		std::shared_ptr<LatencyHistogram> mEgressLatency;
+		/// <summary>
+		/// The setup timeline of the bridge. nullptr if this instance is not the first one of its bridge.
+		/// </summary>
+		std::shared_ptr<SetupTimeline> mSetupTimeline;
+
+		/// <summary>
+		/// Protect mQuality and mDetailedStatus. They are sampled by CtxWorker periodically.
+		/// </summary>
+		AbyssMutex mQualityMutex;
+		GnsConnectionQuality mQuality;
+		std::string mDetailedStatus;
 		std::string mServerUrl;
-		std::jthread mTdCtx;
+		LifecycleThread mTdCtx;
 
 		HSteamNetConnection mGnsConnection;
 		ISteamNetworkingMessage* mGnsMessages[STEAM_MSG_CAPACITY];
 		std::string mGnsBuffer;
 
+		struct GnsAttempt {
+			HSteamNetConnection mConnection;
+			std::string mAddress;
+			bool mIsFailed;
+		};
+		/// <summary>
+		/// <para>Protect mGnsAttempts, mRacingEvent and the assignment of mGnsConnection.</para>
+		/// <para>They are changed by both Initializing transition and GNS callback.</para>
+		/// </summary>
+		AbyssMutex mRacingMutex;
+		/// <summary>
+		/// All connections started by racing. The winner will be kept in it until disconnecting.
+		/// </summary>
+		std::deque<GnsAttempt> mGnsAttempts;
+		/// <summary>
+		/// Set when any attempt connected or failed. Renewed by every racing round.
+		/// </summary>
+		std::shared_ptr<LifecycleEvent> mRacingEvent;
+
 	public:
 		StateMachine::StateMachineReporter mStatusReporter;
 		IndexDistributor::Index_t mIndex;
 
 	public:
-		GnsInstance(OutputHelper* output, IndexDistributor::Index_t index, GnsFactoryOperator* factory_oper, std::string& server);
+		GnsInstance(OutputHelper* output, LifecycleExecutor* executor, IndexDistributor::Index_t index, GnsFactoryOperator* factory_oper, std::string& server, std::shared_ptr<SetupTimeline> setup_timeline);
 		GnsInstance(const GnsInstance& rhs) = delete;
 		GnsInstance(GnsInstance&& rhs) = delete;
 		~GnsInstance();
@@ -57,14 +111,25 @@ namespace WhispersAbyss {
 		void Send(std::deque<CommonMessage>& msg_list);
 		void Recv(std::deque<CommonMessage>& msg_list);
 		void CheckSize(size_t msg_size, bool is_recv);
+		void SetEgressLatency(std::shared_ptr<LatencyHistogram> latency);
+		GnsConnectionQuality ReportQuality();
+		void ReportQueueDepth(size_t& send_depth, size_t& recv_depth);
+		std::string ReportDetailedStatus();	// return empty string if no connection in use.
 	private:
-		void InternalStop();
+		LifecycleExecutor::Task_t InitializingTask();
+		LifecycleExecutor::Task_t StoppingTask();
+		LifecycleExecutor::Task_t InternalStop();
 		void CtxWorker(std::stop_token st);
 
-		bool ConnectGns(std::string& addrs);
+		asio::awaitable<bool> RaceGns(const GnsResolver::Endpoints_t& endpoints);
+		HSteamNetConnection ConnectGns(const std::string& addrs);
+		void OnAttemptConnected(HSteamNetConnection conn);
+		bool OnAttemptFailed(HSteamNetConnection conn);
+		void CloseLosingAttempts();
 		void RecvGns(std::deque<CommonMessage>& msg_list);
-		void SendGns(std::deque<CommonMessage>& msg_list);
+		void SendGns(std::deque<CommonMessage>& msg_list, LatencyHistogram* latency);
 		void DisconnectGns();
+		void SampleGnsStatus();
 	};
 }
 
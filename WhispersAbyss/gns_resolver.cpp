@@ -0,0 +1,129 @@
+#include "gns_resolver.hpp"
+
+namespace WhispersAbyss {
+
+	GnsResolver::GnsResolver(OutputHelper* output) :
+		mOutput(output), mCacheMutex("gns_resolver_cache"), mCache(),
+		mHitCount(0u), mMissCount(0u), mMergedCount(0u), mFailCount(0u),
+		mResolveTimeTotal(0u), mResolveTimeMax(0u)
+	{}
+
+	GnsResolver::~GnsResolver() {}
+
+	asio::awaitable<bool> GnsResolver::Resolve(const std::string& host, const std::string& port, Endpoints_t& result) {
+		std::string key(host + ":" + port);
+		std::shared_ptr<LifecycleEvent> resolved_event;
+		bool is_owner = false;
+
+		// check cache first
+		{
+			std::lock_guard locker(mCacheMutex);
+			auto now = std::chrono::steady_clock::now();
+			PruneCache(now);
+
+			auto it = mCache.find(key);
+			if (it != mCache.end()) {
+				if (!it->second.mIsResolving) {
+					// cache hit
+					mHitCount.fetch_add(1u);
+					result = it->second.mEndpoints;
+					co_return true;
+				}
+
+				// someone is resolving it. merge into it.
+				mMergedCount.fetch_add(1u);
+				resolved_event = it->second.mResolvedEvent;
+			} else {
+				// cache miss. we do the lookup.
+				mMissCount.fetch_add(1u);
+				is_owner = true;
+				resolved_event = std::make_shared<LifecycleEvent>();
+				mCache.emplace(key, CacheEntry{ Endpoints_t(), now, true, false, resolved_event });
+			}
+		}
+
+		// merged request only need to wait owner
+		if (!is_owner) {
+			co_await resolved_event->Wait(std::chrono::milliseconds(static_cast<int64_t>(MODULE_WAITING_INTERVAL)));
+
+			std::lock_guard locker(mCacheMutex);
+			auto it = mCache.find(key);
+			if (it == mCache.end() || it->second.mIsResolving || !it->second.mIsSuccess) co_return false;
+			result = it->second.mEndpoints;
+			co_return true;
+		}
+
+		// do real lookup
+		auto time_start = std::chrono::steady_clock::now();
+		uint64_t trace_start = CommonOpers::GetMonotonicTime();
+		asio::ip::udp::resolver resolver(co_await asio::this_coro::executor);
+		asio::error_code ec;
+		asio::ip::udp::resolver::results_type results = co_await resolver.async_resolve(
+			host, port, asio::redirect_error(asio::use_awaitable, ec)
+		);
+		auto time_end = std::chrono::steady_clock::now();
+		Tracer::Complete("gns", "resolve", NO_INDEX, trace_start);
+
+		// record resolve time
+		uint64_t elapsed = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(time_end - time_start).count());
+		mResolveTimeTotal.fetch_add(elapsed);
+		uint64_t prev_max = mResolveTimeMax.load();
+		while (elapsed > prev_max && !mResolveTimeMax.compare_exchange_weak(prev_max, elapsed)) {}
+
+		// fill cache and wake merged requests
+		bool is_success = !ec && !results.empty();
+		{
+			std::lock_guard locker(mCacheMutex);
+			auto& entry = mCache[key];
+			entry.mIsResolving = false;
+			entry.mIsSuccess = is_success;
+			entry.mEndpoints.clear();
+			if (is_success) {
+				for (const auto& i : results) {
+					entry.mEndpoints.emplace_back(i.endpoint());
+				}
+				entry.mExpireAt = time_end + RESOLVE_CACHE_TTL;
+				result = entry.mEndpoints;
+			} else {
+				// do not cache failure. let it expire at once.
+				entry.mExpireAt = time_end;
+				mFailCount.fetch_add(1u);
+			}
+		}
+		resolved_event->Set();
+
+		if (!is_success) {
+			mOutput->Printf(OutputHelper::Component::GnsFactory, NO_INDEX, "Fail to resolve %s: %s", key.c_str(), ec.message().c_str());
+		}
+		co_return is_success;
+	}
+
+	GnsResolverProfile GnsResolver::ReportStatus() {
+		GnsResolverProfile profile;
+
+		profile.mHitCount = mHitCount.load();
+		profile.mMissCount = mMissCount.load();
+		profile.mMergedCount = mMergedCount.load();
+		profile.mFailCount = mFailCount.load();
+		profile.mResolveTimeTotal = mResolveTimeTotal.load();
+		profile.mResolveTimeMax = mResolveTimeMax.load();
+		{
+			std::lock_guard locker(mCacheMutex);
+			profile.mCachedEntries = mCache.size();
+		}
+
+		return profile;
+	}
+
+	void GnsResolver::PruneCache(std::chrono::steady_clock::time_point now) {
+		for (auto it = mCache.begin(); it != mCache.end();) {
+			// resolving entry will be updated by its owner. keep it.
+			if (!it->second.mIsResolving && it->second.mExpireAt <= now) {
+				it = mCache.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#ifdef _WIN32
+#include <sdkddkver.h>	// need by asio
+#endif // _WIN32
+#include "asio.hpp"
+#include "others_helper.hpp"
+#include "lifecycle_executor.hpp"
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace WhispersAbyss {
+
+	struct GnsResolverProfile {
+		uint64_t mHitCount, mMissCount, mMergedCount, mFailCount;
+		uint64_t mResolveTimeTotal, mResolveTimeMax;	// in microseconds. only count real lookups.
+		size_t mCachedEntries;
+	};
+
+	/// <summary>
+	/// <para>The shared asynchronous resolver owned by GnsFactory.</para>
+	/// <para>Resolved endpoints are cached by host:port with a TTL.
+	/// Concurrent requests of the same name will be merged into one lookup.</para>
+	/// <para>Resolve() should only be awaited in a coroutine spawned on a strand, like other LifecycleExecutor awaitables.</para>
+	/// </summary>
+	class GnsResolver {
+	public:
+		using Endpoints_t = std::vector<asio::ip::udp::endpoint>;
+
+		GnsResolver(OutputHelper* output);
+		GnsResolver(const GnsResolver& rhs) = delete;
+		GnsResolver(GnsResolver&& rhs) = delete;
+		~GnsResolver();
+
+		/// <summary>
+		/// Resolve given host and port.
+		/// </summary>
+		/// <param name="result">The resolved endpoints. Only valid when returning true.</param>
+		/// <returns>True if success.</returns>
+		asio::awaitable<bool> Resolve(const std::string& host, const std::string& port, Endpoints_t& result);
+		GnsResolverProfile ReportStatus();
+	private:
+		struct CacheEntry {
+			Endpoints_t mEndpoints;
+			std::chrono::steady_clock::time_point mExpireAt;
+			bool mIsResolving;
+			bool mIsSuccess;
+			/// <summary>
+			/// Set when the lookup of this entry finished. Merged requests wait this.
+			/// </summary>
+			std::shared_ptr<LifecycleEvent> mResolvedEvent;
+		};
+
+		OutputHelper* mOutput;
+		AbyssMutex mCacheMutex;
+		std::map<std::string, CacheEntry> mCache;
+
+		std::atomic_uint64_t mHitCount, mMissCount, mMergedCount, mFailCount;
+		std::atomic_uint64_t mResolveTimeTotal, mResolveTimeMax;
+
+		/// <summary>
+		/// Remove expired entries. Caller should hold mCacheMutex.
+		/// </summary>
+		void PruneCache(std::chrono::steady_clock::time_point now);
+	};
+
+}
@@ -0,0 +1,119 @@
+#include "lifecycle_executor.hpp"
+#include <algorithm>
+
+namespace WhispersAbyss {
+
+#pragma region LifecycleExecutor
+
+	LifecycleExecutor::LifecycleExecutor(OutputHelper* output, size_t thread_count) :
+		mOutput(output), mPool(thread_count) {
+		mOutput->Printf(OutputHelper::Component::Core, NO_INDEX, "Lifecycle executor started with %zu threads.", thread_count);
+	}
+
+	LifecycleExecutor::~LifecycleExecutor() {
+		Stop();
+	}
+
+	void LifecycleExecutor::Stop() {
+		mPool.join();
+	}
+
+	LifecycleExecutor::Strand_t LifecycleExecutor::MakeStrand() {
+		return asio::make_strand(mPool.get_executor());
+	}
+
+	void LifecycleExecutor::Spawn(Strand_t& strand, Task_t&& task, const char* trace_name, IndexDistributor::Index_t index) {
+		asio::co_spawn(strand, TracedTask(std::move(task), trace_name, index), asio::detached);
+	}
+
+	LifecycleExecutor::Task_t LifecycleExecutor::TracedTask(Task_t task, const char* trace_name, IndexDistributor::Index_t index) {
+		// all transitions run in pool threads, which are not created by us, so name them here.
+		ThreadInventory::Register("lifecycle", NO_INDEX);
+		uint64_t start_time = CommonOpers::GetMonotonicTime();
+		co_await std::move(task);
+		Tracer::Complete("lifecycle", trace_name, index, start_time);
+	}
+
+	LifecycleExecutor::Task_t LifecycleExecutor::Delay(std::chrono::milliseconds duration) {
+		asio::steady_timer timer(co_await asio::this_coro::executor, duration);
+		asio::error_code ec;
+		co_await timer.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+	}
+
+	LifecycleExecutor::Task_t LifecycleExecutor::WaitState(StateMachine::StateMachineReporter& reporter, StateMachine::State_t state) {
+		while (!reporter.IsInState(state)) {
+			co_await Delay(SPIN_INTERVAL);
+		}
+	}
+
+#pragma endregion
+
+#pragma region LifecycleEvent
+
+	void LifecycleEvent::Set() {
+		std::lock_guard locker(mMutex);
+		mIsSet = true;
+
+		// post cancel into the strand of waiter.
+		// timer is shared so it is still alive even if waiter has been woken by timeout.
+		for (auto& waiter : mWaiters) {
+			asio::post(waiter->get_executor(), [waiter]() -> void {
+				waiter->cancel();
+			});
+		}
+		mWaiters.clear();
+	}
+
+	bool LifecycleEvent::IsSet() {
+		std::lock_guard locker(mMutex);
+		return mIsSet;
+	}
+
+	asio::awaitable<bool> LifecycleEvent::Wait(std::chrono::milliseconds timeout) {
+		auto timer = std::make_shared<asio::steady_timer>(co_await asio::this_coro::executor, timeout);
+
+		// register waiter
+		{
+			std::lock_guard locker(mMutex);
+			if (mIsSet) co_return true;
+			mWaiters.emplace_back(timer);
+		}
+
+		// the cancel posted by Set() always run after this wait registered,
+		// because we are running in the same strand.
+		asio::error_code ec;
+		co_await timer->async_wait(asio::redirect_error(asio::use_awaitable, ec));
+
+		// unregister waiter if we are woken by timeout
+		std::lock_guard locker(mMutex);
+		auto it = std::find(mWaiters.begin(), mWaiters.end(), timer);
+		if (it != mWaiters.end()) mWaiters.erase(it);
+		co_return mIsSet;
+	}
+
+#pragma endregion
+
+#pragma region LifecycleThread
+
+	void LifecycleThread::Start(Worker_t&& worker) {
+		mIsExited.store(false);
+		mThread = std::jthread([this, worker = std::move(worker)](std::stop_token st) -> void {
+			worker(st);
+			mIsExited.store(true, std::memory_order_release);
+		});
+	}
+
+	LifecycleExecutor::Task_t LifecycleThread::Stop() {
+		if (!mThread.joinable()) co_return;
+
+		mThread.request_stop();
+		while (!mIsExited.load(std::memory_order_acquire)) {
+			co_await LifecycleExecutor::Delay(SPIN_INTERVAL);
+		}
+		// worker has returned, so this only wait thread teardown.
+		mThread.join();
+	}
+
+#pragma endregion
+
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#ifdef _WIN32
+#include <sdkddkver.h>	// need by asio
+#endif // _WIN32
+#include "asio.hpp"
+#include "others_helper.hpp"
+#include "state_machine.hpp"
+#include "tracer.hpp"
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace WhispersAbyss {
+
+	/*
+	LifecycleExecutor is a fixed size thread pool which run all Initializing and Stopping transitions
+	of Instance and Factory as C++20 coroutines (asio awaitable).
+
+	Every Instance and Factory own a strand created by LifecycleExecutor.
+	All of its transitions are spawned on this strand.
+	A transition can be suspended when waiting something, such as waiting other module stopped,
+	or waiting a LifecycleEvent (URL received, connected and etc).
+	Suspended transition do not occupy any thread.
+
+	So a transition running in LifecycleExecutor should not block its thread for a long time.
+	Use LifecycleExecutor::EnterTransition(), LifecycleExecutor::WaitState() and LifecycleEvent::Wait()
+	instead of the spinning functions of StateMachine.
+	Likewise, stop worker threads with LifecycleThread::Stop() and LifecycleExecutor::StopDisposal()
+	instead of joining them.
+	*/
+
+	class LifecycleExecutor {
+	public:
+		using Strand_t = asio::strand<asio::thread_pool::executor_type>;
+		using Task_t = asio::awaitable<void>;
+
+		LifecycleExecutor(OutputHelper* output, size_t thread_count = LIFECYCLE_THREAD_COUNT);
+		LifecycleExecutor(const LifecycleExecutor& rhs) = delete;
+		LifecycleExecutor(LifecycleExecutor&& rhs) = delete;
+		~LifecycleExecutor();
+
+		/// <summary>
+		/// Wait all pending tasks finished and stop the threads.
+		/// All modules using this executor should be stopped before calling this.
+		/// </summary>
+		void Stop();
+
+		/// <summary>
+		/// Create a new strand. Every module should own a strand for its transitions.
+		/// </summary>
+		Strand_t MakeStrand();
+		/// <summary>
+		/// Run a transition on given strand. The task is detached.
+		/// </summary>
+		/// <param name="trace_name">The name of this transition shown in trace. Should be a string literal.</param>
+		/// <param name="index">The index of the module owning this transition.</param>
+		void Spawn(Strand_t& strand, Task_t&& task, const char* trace_name, IndexDistributor::Index_t index);
+
+		/// <summary>
+		/// Suspend current transition for a while. Do not occupy thread.
+		/// </summary>
+		static Task_t Delay(std::chrono::milliseconds duration);
+		/// <summary>
+		/// <para>Suspend current transition until the state machine matched.</para>
+		/// <para>The awaitable version of StateMachineReporter::SpinUntil().</para>
+		/// </summary>
+		static Task_t WaitState(StateMachine::StateMachineReporter& reporter, StateMachine::State_t state);
+		/// <summary>
+		/// <para>Suspend current transition until given deferred transition can be decided.</para>
+		/// <para>Check CanTransition() after this.</para>
+		/// </summary>
+		template<class _TTransition>
+		static Task_t EnterTransition(_TTransition& transition) {
+			while (!transition.TryEnter()) {
+				co_await Delay(SPIN_INTERVAL);
+			}
+		}
+		/// <summary>
+		/// <para>Suspend current transition until given disposal worker destroyed all items and exited.</para>
+		/// <para>The awaitable version of DisposalHelper::Stop().</para>
+		/// </summary>
+		template<class _Ty>
+		static Task_t StopDisposal(DisposalHelper<_Ty>& disposal) {
+			disposal.RequestStop();
+			while (!disposal.IsExited()) {
+				co_await Delay(SPIN_INTERVAL);
+			}
+			// worker has returned, so this only wait thread teardown.
+			disposal.Stop();
+		}
+
+	private:
+		/// <summary>
+		/// Wrap a transition, name the pool thread running it, and record its whole duration into trace.
+		/// </summary>
+		static Task_t TracedTask(Task_t task, const char* trace_name, IndexDistributor::Index_t index);
+
+		OutputHelper* mOutput;
+		asio::thread_pool mPool;
+	};
+
+	/// <summary>
+	/// <para>A manual reset event which can be awaited by the transitions running in LifecycleExecutor.</para>
+	/// <para>Once it is set, it will keep set state forever.</para>
+	/// <para>Set() is thread safe and can be called in any thread.
+	/// Wait() should only be awaited in a coroutine spawned on a strand.</para>
+	/// </summary>
+	class LifecycleEvent {
+	public:
+		LifecycleEvent() : mMutex(), mIsSet(false), mWaiters() {}
+		LifecycleEvent(const LifecycleEvent& rhs) = delete;
+		LifecycleEvent(LifecycleEvent&& rhs) = delete;
+		~LifecycleEvent() {}
+
+		/// <summary>
+		/// Set event and wake up all waiters.
+		/// </summary>
+		void Set();
+		bool IsSet();
+		/// <summary>
+		/// Wait until event set or run out of time.
+		/// </summary>
+		/// <returns>True if event has been set.</returns>
+		asio::awaitable<bool> Wait(std::chrono::milliseconds timeout);
+
+	private:
+		std::mutex mMutex;
+		bool mIsSet;
+		/// <summary>
+		/// The timers of waiting coroutines. Cancel them to wake waiters.
+		/// Each timer is bound to the strand of its waiter so cancelling it from strand is safe.
+		/// </summary>
+		std::deque<std::shared_ptr<asio::steady_timer>> mWaiters;
+	};
+
+	/// <summary>
+	/// <para>A worker thread which can be stopped by the transitions running in LifecycleExecutor.</para>
+	/// <para>It marks itself exited when worker returns, so Stop() can wait it without blocking pool thread in join().</para>
+	/// <para>Start() and Stop() should be called in the strand of owner.</para>
+	/// </summary>
+	class LifecycleThread {
+	public:
+		using Worker_t = std::function<void(std::stop_token)>;
+
+		LifecycleThread() : mIsExited(true), mThread() {}
+		LifecycleThread(const LifecycleThread& rhs) = delete;
+		LifecycleThread(LifecycleThread&& rhs) = delete;
+		~LifecycleThread() {}
+
+		void Start(Worker_t&& worker);
+		/// <summary>
+		/// Request worker to stop, and suspend until it returns. Do nothing if not started.
+		/// </summary>
+		LifecycleExecutor::Task_t Stop();
+
+	private:
+		// flag is declared first, so it outlives the thread joined in destructor.
+		std::atomic_bool mIsExited;
+		std::jthread mThread;
+	};
+
+}
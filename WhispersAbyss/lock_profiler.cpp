@@ -0,0 +1,62 @@
+#include "lock_profiler.hpp"
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <memory>
+
+namespace WhispersAbyss {
+
+	struct LockRegistry {
+		std::mutex mMutex;
+		std::deque<std::unique_ptr<LockStats>> mLocks;
+	};
+
+	/// <summary>
+	/// The registry is never destroyed, because static mutexes may register before it and outlive it.
+	/// </summary>
+	static LockRegistry& GetRegistry() {
+		static LockRegistry* registry = new LockRegistry();
+		return *registry;
+	}
+
+	LockStats* LockProfiler::Register(const char* name) {
+		LockRegistry& registry = GetRegistry();
+		std::lock_guard locker(registry.mMutex);
+		for (auto& stats : registry.mLocks) {
+			if (strcmp(stats->mName, name) == 0) return stats.get();
+		}
+
+		auto& stats = registry.mLocks.emplace_back(std::make_unique<LockStats>());
+		stats->mName = name;
+		stats->mAcquisitions.store(0u, std::memory_order_relaxed);
+		stats->mContended.store(0u, std::memory_order_relaxed);
+		stats->mWaitTotal.store(0u, std::memory_order_relaxed);
+		stats->mWaitMax.store(0u, std::memory_order_relaxed);
+		stats->mHoldMax.store(0u, std::memory_order_relaxed);
+		return stats.get();
+	}
+
+	std::vector<LockProfile> LockProfiler::Report() {
+		std::vector<LockProfile> profiles;
+		{
+			LockRegistry& registry = GetRegistry();
+			std::lock_guard locker(registry.mMutex);
+			for (auto& stats : registry.mLocks) {
+				profiles.emplace_back(LockProfile{
+					stats->mName,
+					stats->mAcquisitions.load(std::memory_order_relaxed),
+					stats->mContended.load(std::memory_order_relaxed),
+					stats->mWaitTotal.load(std::memory_order_relaxed),
+					stats->mWaitMax.load(std::memory_order_relaxed),
+					stats->mHoldMax.load(std::memory_order_relaxed)
+				});
+			}
+		}
+
+		std::sort(profiles.begin(), profiles.end(), [](const LockProfile& lhs, const LockProfile& rhs) -> bool {
+			return lhs.mWaitTotal > rhs.mWaitTotal;
+		});
+		return profiles;
+	}
+
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+namespace WhispersAbyss {
+
+	/*
+	Lock profiler records how internal mutexes are acquired, per lock name.
+	All mutexes of the same name, like the receiving list mutex of every TcpInstance, share one record.
+
+	AbyssMutex and AbyssSharedMutex are only instrumented when WHISPERS_ABYSS_LOCK_PROFILE is defined.
+	Otherwise they are std::mutex and std::shared_mutex taking an unused name, and LockProfiler::Report() returns nothing.
+
+	An acquisition is contended when try_lock fails first; only then the waiting time is measured.
+	Hold time is measured for exclusive locks only, because shared holders overlap.
+	Times are in nanoseconds.
+	*/
+
+	struct LockStats {
+		const char* mName;
+		std::atomic_uint64_t mAcquisitions, mContended, mWaitTotal, mWaitMax, mHoldMax;
+
+		void RecordAcquire(bool is_contended, uint64_t wait) {
+			mAcquisitions.fetch_add(1u, std::memory_order_relaxed);
+			if (!is_contended) return;
+			mContended.fetch_add(1u, std::memory_order_relaxed);
+			mWaitTotal.fetch_add(wait, std::memory_order_relaxed);
+			uint64_t prev_max = mWaitMax.load(std::memory_order_relaxed);
+			while (wait > prev_max && !mWaitMax.compare_exchange_weak(prev_max, wait, std::memory_order_relaxed)) {}
+		}
+		void RecordHold(uint64_t hold) {
+			uint64_t prev_max = mHoldMax.load(std::memory_order_relaxed);
+			while (hold > prev_max && !mHoldMax.compare_exchange_weak(prev_max, hold, std::memory_order_relaxed)) {}
+		}
+	};
+
+	struct LockProfile {
+		std::string mName;
+		uint64_t mAcquisitions, mContended, mWaitTotal, mWaitMax, mHoldMax;
+	};
+
+	class LockProfiler {
+	public:
+		static constexpr bool IsCompiled() {
+#ifdef WHISPERS_ABYSS_LOCK_PROFILE
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		/// <summary>
+		/// Get the record of given name, creating it if not existed. Records are never freed.
+		/// </summary>
+		/// <param name="name">Must be a string literal or other static string.</param>
+		static LockStats* Register(const char* name);
+		/// <summary>
+		/// Copy all records, the one waited longest in total first. Can be called from any thread.
+		/// </summary>
+		static std::vector<LockProfile> Report();
+	};
+
+#ifdef WHISPERS_ABYSS_LOCK_PROFILE
+
+	template<class _TMutex>
+	class InstrumentedMutex {
+	public:
+		InstrumentedMutex(const char* name) :
+			mMutex(), mStats(LockProfiler::Register(name)), mLockTime(0u) {}
+		InstrumentedMutex(const InstrumentedMutex& rhs) = delete;
+		InstrumentedMutex(InstrumentedMutex&& rhs) = delete;
+		~InstrumentedMutex() {}
+
+		void lock() {
+			if (mMutex.try_lock()) {
+				mStats->RecordAcquire(false, 0u);
+				mLockTime = GetTime();
+				return;
+			}
+			uint64_t start = GetTime();
+			mMutex.lock();
+			mLockTime = GetTime();
+			mStats->RecordAcquire(true, mLockTime - start);
+		}
+		bool try_lock() {
+			if (!mMutex.try_lock()) return false;
+			mStats->RecordAcquire(false, 0u);
+			mLockTime = GetTime();
+			return true;
+		}
+		void unlock() {
+			uint64_t hold = GetTime() - mLockTime;
+			mMutex.unlock();
+			mStats->RecordHold(hold);
+		}
+
+		void lock_shared() {
+			if (mMutex.try_lock_shared()) {
+				mStats->RecordAcquire(false, 0u);
+				return;
+			}
+			uint64_t start = GetTime();
+			mMutex.lock_shared();
+			mStats->RecordAcquire(true, GetTime() - start);
+		}
+		bool try_lock_shared() {
+			if (!mMutex.try_lock_shared()) return false;
+			mStats->RecordAcquire(false, 0u);
+			return true;
+		}
+		void unlock_shared() {
+			mMutex.unlock_shared();
+		}
+	private:
+		static uint64_t GetTime() {
+			return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count());
+		}
+
+		_TMutex mMutex;
+		LockStats* mStats;
+		/// <summary>
+		/// When current exclusive owner got the lock. Only touched by owner.
+		/// </summary>
+		uint64_t mLockTime;
+	};
+
+#else
+
+	template<class _TMutex>
+	class InstrumentedMutex : public _TMutex {
+	public:
+		InstrumentedMutex(const char*) : _TMutex() {}
+	};
+
+#endif
+
+	using AbyssMutex = InstrumentedMutex<std::mutex>;
+	using AbyssSharedMutex = InstrumentedMutex<std::shared_mutex>;
+
+}
@@ -1,15 +1,80 @@
 ﻿#include "bridge_factory.hpp"
+#include "settings.hpp"
+#include "tracer.hpp"
+#include "thread_inventory.hpp"
 #include <atomic>
+
+#ifdef _WIN32
 #include <conio.h>
+#else
+#include <csignal>
+#include <termios.h>
+#include <unistd.h>
+#endif // _WIN32
+
+#ifndef _WIN32
+static volatile sig_atomic_t s_QuitSignal = 0;
+
+static void OnQuitSignal(int) {
+	s_QuitSignal = 1;
+}
+#endif // _WIN32
+
+/// <summary>
+/// Wait for one key without echoing it, like _getch() on Windows.
+/// On POSIX, SIGINT and SIGTERM are also reported as q, and if stdin is closed, it waits for them.
+/// </summary>
+static char GetKey() {
+#ifdef _WIN32
+	return static_cast<char>(_getch());
+#else
+	static bool is_signal_set = false;
+	if (!is_signal_set) {
+		// no SA_RESTART, so that read() is interrupted.
+		struct sigaction action {};
+		action.sa_handler = &OnQuitSignal;
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGINT, &action, nullptr);
+		sigaction(SIGTERM, &action, nullptr);
+		is_signal_set = true;
+	}
+
+	termios old_attr;
+	bool is_tty = tcgetattr(STDIN_FILENO, &old_attr) == 0;
+	if (is_tty) {
+		termios new_attr = old_attr;
+		new_attr.c_lflag &= ~(ICANON | ECHO);
+		tcsetattr(STDIN_FILENO, TCSANOW, &new_attr);
+	}
+
+	char c = '\0';
+	while (true) {
+		if (s_QuitSignal) {
+			c = 'q';
+			break;
+		}
+		ssize_t rc = read(STDIN_FILENO, &c, 1);
+		if (rc == 1) break;
+		if (rc == 0) pause();	// stdin is closed, e.g. running as a service
+	}
+
+	if (is_tty) tcsetattr(STDIN_FILENO, TCSANOW, &old_attr);
+	return c;
+#endif // _WIN32
+}
 
 void MainWorker(
-	uint16_t tcp_port,
+	const WhispersAbyss::AbyssSettings& settings,
 	std::atomic_bool& signalStop,
 	std::atomic_bool& signalProfile,
+	std::atomic_bool& signalGnsStatus,
 	WhispersAbyss::OutputHelper& output) {
+	WhispersAbyss::ThreadInventory::Register("main-worker", WhispersAbyss::NO_INDEX);
 
-	// init factory
-	WhispersAbyss::BridgeFactory factory(&output, tcp_port);
+	// init lifecycle executor and factory
+	// executor should be destroyed after factory.
+	WhispersAbyss::LifecycleExecutor executor(&output);
+	WhispersAbyss::BridgeFactory factory(&output, &executor, &settings);
 
 	// core processor
 	std::deque<WhispersAbyss::TcpInstance*> conns;
@@ -27,6 +92,10 @@ void MainWorker(
 			output.Printf("Start collecting profile...");
 			factory.ReportStatus();
 		}
+		if (signalGnsStatus.exchange(false)) {
+			output.Printf("Start collecting GNS detailed status...");
+			factory.ReportGnsDetailedStatus();
+		}
 
 	}
 
@@ -49,37 +118,46 @@ int main(int argc, char* argv[]) {
 	output.RawPrintf("");
 
 	// ========== Check Parameter ==========
-	if (argc != 2) {
-		puts("Wrong arguments.");
-		puts("Syntax: WhispersAbyss [tcp_port]");
+	WhispersAbyss::AbyssSettings settings;
+	std::string error;
+	if (!settings.Parse(argc, argv, error)) {
+		puts(error.c_str());
+		WhispersAbyss::AbyssSettings::PrintSyntax();
 		puts("Program will exit. See README.md for more detail about commandline arguments.");
 		return 0;
 	}
-	long int argsAcceptPort = strtoul(argv[1], NULL, 10);
-	if (argsAcceptPort == LONG_MAX || argsAcceptPort == LONG_MIN || argsAcceptPort > 65535u) {
-		puts("Wrong arguments. Port value is illegal.");
-		puts("Syntax: WhispersAbyss [accept_port] [server_address]");
-		puts("Program will exit. Please specific a correct port number.");
-		return 0;
+	if (!settings.mLogFile.empty()) {
+		if (!output.OpenLogFile(settings.mLogFile.c_str())) {
+			output.RawPrintf("Fail to open log file: %s", settings.mLogFile.c_str());
+			output.RawPrintf("Program will exit.");
+			return 0;
+		}
+		puts("Log is redirected to file. Press q to exit. Press p to write profile into log.");
+	}
+
+	if (!settings.mTraceFile.empty()) {
+		WhispersAbyss::Tracer::Enable();
 	}
+	WhispersAbyss::ThreadInventory::Register("main", WhispersAbyss::NO_INDEX);
 
 	// ==========Real Work ==========
 	// allocate signal for worker
-	std::atomic_bool signalStop(false), signalProfile(false);
+	std::atomic_bool signalStop(false), signalProfile(false), signalGnsStatus(false);
 
 	// start worker
 	std::thread tdMainWorker(
 		&MainWorker,
-		static_cast<uint16_t>(argsAcceptPort),
+		std::cref(settings),
 		std::ref(signalStop),
 		std::ref(signalProfile),
+		std::ref(signalGnsStatus),
 		std::ref(output)
 	);
 
 	// accept input
 	char inc;
 	while (true) {
-		inc = _getch();
+		inc = GetKey();
 
 		switch (inc) {
 			case 'q':
@@ -92,6 +170,22 @@ int main(int argc, char* argv[]) {
 				signalProfile.store(true);
 				break;
 			}
+			case 'g':
+			{
+				signalGnsStatus.store(true);
+				break;
+			}
+			case 't':
+			{
+				if (settings.mTraceFile.empty()) {
+					output.RawPrintf("Tracing is not enabled. Use --trace-file to enable it.");
+				} else if (WhispersAbyss::Tracer::Dump(settings.mTraceFile.c_str())) {
+					output.RawPrintf("Trace is written into %s", settings.mTraceFile.c_str());
+				} else {
+					output.RawPrintf("Fail to write trace into %s", settings.mTraceFile.c_str());
+				}
+				break;
+			}
 			default:
 			{
 				output.RawPrintf("Invalid command!");
@@ -106,6 +200,15 @@ exit_program:
 	if (tdMainWorker.joinable())
 		tdMainWorker.join();
 
+	// dump trace after all workers stopped, so that the whole shutdown is recorded.
+	if (!settings.mTraceFile.empty()) {
+		if (WhispersAbyss::Tracer::Dump(settings.mTraceFile.c_str())) {
+			output.RawPrintf("Trace is written into %s", settings.mTraceFile.c_str());
+		} else {
+			output.RawPrintf("Fail to write trace into %s", settings.mTraceFile.c_str());
+		}
+	}
+
 	output.RawPrintf("======");
 	output.RawPrintf("See ya~");
 
@@ -1,4 +1,6 @@
 #include "messages.hpp"
+#include "others_helper.hpp"
+#include "alloc_profiler.hpp"
 #include <steam/steamnetworkingtypes.h>
 
 namespace WhispersAbyss {
@@ -6,19 +8,23 @@ namespace WhispersAbyss {
 	void CommonMessage::SetGnsData(const void* ss, int send_flag, int len) {
 		this->Clear();
 
+		ABYSS_ALLOC_SCOPE(MessagePayload);
 		this->mBuf = new char[len];
 		memcpy(this->mBuf, ss, len);
 		this->mBufLen = len;
 		this->mIsReliable = (send_flag & k_nSteamNetworkingSend_Reliable) != 0;
+		this->mIngressTime = CommonOpers::GetMonotonicTime();
 	}
 
 	void CommonMessage::SetTcpData(const void* ss, bool is_reliable, uint32_t len) {
 		this->Clear();
 
+		ABYSS_ALLOC_SCOPE(MessagePayload);
 		this->mBuf = new char[len];
 		memcpy(this->mBuf, ss, len);
 		this->mBufLen = len;
 		this->mIsReliable = is_reliable;
+		this->mIngressTime = CommonOpers::GetMonotonicTime();
 	}
 
 	int CommonMessage::GetGnsSendFlag() const {
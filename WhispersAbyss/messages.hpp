@@ -1,6 +1,8 @@
 #pragma once
 
+#include "alloc_profiler.hpp"
 #include <cinttypes>
+#include <cstring>
 #include <stdexcept>
 #include <string>
 
@@ -9,16 +11,17 @@ namespace WhispersAbyss {
 	class CommonMessage {
 	public:
 		CommonMessage() :
-			mBuf(nullptr), mBufLen(0u), mIsReliable(true) {}
+			mBuf(nullptr), mBufLen(0u), mIsReliable(true), mIngressTime(0u) {}
 		CommonMessage(const CommonMessage& rhs) :
-			mBuf(nullptr), mBufLen(rhs.mBufLen), mIsReliable(rhs.mIsReliable) {
+			mBuf(nullptr), mBufLen(rhs.mBufLen), mIsReliable(rhs.mIsReliable), mIngressTime(rhs.mIngressTime) {
 			if (rhs.mBuf != nullptr) {
+				ABYSS_ALLOC_SCOPE(MessagePayload);
 				mBuf = new char[mBufLen];
 				memcpy(mBuf, rhs.mBuf, mBufLen);
 			}
 		}
 		CommonMessage(CommonMessage&& rhs) noexcept :
-			mBuf(rhs.mBuf), mBufLen(rhs.mBufLen), mIsReliable(rhs.mIsReliable) {
+			mBuf(rhs.mBuf), mBufLen(rhs.mBufLen), mIsReliable(rhs.mIsReliable), mIngressTime(rhs.mIngressTime) {
 			if (rhs.mBuf != nullptr) {
 				rhs.mBuf = nullptr;
 				rhs.mBufLen = 0u;
@@ -28,8 +31,10 @@ namespace WhispersAbyss {
 			this->Clear();
 
 			this->mIsReliable = rhs.mIsReliable;
+			this->mIngressTime = rhs.mIngressTime;
 			this->mBufLen = rhs.mBufLen;
 			if (rhs.mBuf != nullptr) {
+				ABYSS_ALLOC_SCOPE(MessagePayload);
 				mBuf = new char[mBufLen];
 				memcpy(mBuf, rhs.mBuf, mBufLen);
 			}
@@ -40,6 +45,7 @@ namespace WhispersAbyss {
 			this->Clear();
 
 			this->mIsReliable = rhs.mIsReliable;
+			this->mIngressTime = rhs.mIngressTime;
 			this->mBufLen = rhs.mBufLen;
 			this->mBuf = rhs.mBuf;
 			if (rhs.mBuf != nullptr) {
@@ -56,6 +62,10 @@ namespace WhispersAbyss {
 		const void* GetCommonData() const { return mBuf; }
 		uint32_t GetCommonDataLen() const { return mBufLen; }
 		uint8_t GetTcpIsReliable() const { return mIsReliable ? 1u : 0u; }
+		/// <summary>
+		/// The time when this message entered this app. See CommonOpers::GetMonotonicTime().
+		/// </summary>
+		uint64_t GetIngressTime() const { return mIngressTime; }
 
 		void SetGnsData(const void* ss, int send_flag, int len);
 		void SetTcpData(const void* ss, bool is_reliable, uint32_t len);
@@ -73,6 +83,7 @@ namespace WhispersAbyss {
 		char* mBuf;
 		uint32_t mBufLen;
 		bool mIsReliable;
+		uint64_t mIngressTime;
 	};
 
 }
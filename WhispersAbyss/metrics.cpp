@@ -0,0 +1,345 @@
+#include "metrics.hpp"
+#include <algorithm>
+#include <bit>
+
+namespace WhispersAbyss {
+
+	ThroughputSample& ThroughputSample::operator+=(const ThroughputSample& rhs) {
+		mTcp2GnsMsg += rhs.mTcp2GnsMsg;
+		mTcp2GnsBytes += rhs.mTcp2GnsBytes;
+		mGns2TcpMsg += rhs.mGns2TcpMsg;
+		mGns2TcpBytes += rhs.mGns2TcpBytes;
+		return *this;
+	}
+
+#pragma region LatencyHistogram
+
+	LatencyHistogram::LatencyHistogram(LatencyHistogram* parent) :
+		mParent(parent), mBuckets(new std::atomic_uint64_t[LATENCY_BUCKETS]),
+		mCount(0u), mMax(0u), mSum(0u)
+	{
+		for (size_t i = 0u; i < LATENCY_BUCKETS; ++i) {
+			mBuckets[i].store(0u, std::memory_order_relaxed);
+		}
+	}
+
+	LatencyHistogram::~LatencyHistogram() {}
+
+	void LatencyHistogram::Record(uint64_t value) {
+		mBuckets[GetBucketIndex(value)].fetch_add(1u, std::memory_order_relaxed);
+		mCount.fetch_add(1u, std::memory_order_relaxed);
+		mSum.fetch_add(value, std::memory_order_relaxed);
+		uint64_t prev_max = mMax.load(std::memory_order_relaxed);
+		while (value > prev_max && !mMax.compare_exchange_weak(prev_max, value, std::memory_order_relaxed)) {}
+
+		if (mParent != nullptr) mParent->Record(value);
+	}
+
+	void LatencyHistogram::RecordSince(uint64_t ingress_time) {
+		uint64_t now = CommonOpers::GetMonotonicTime();
+		Record(now > ingress_time ? now - ingress_time : 0u);
+	}
+
+	LatencySummary LatencyHistogram::Summarize() {
+		LatencySummary summary;
+
+		// take a snapshot first. recording may happen at the same time,
+		// so use the sum of snapshot as count to keep percentiles consistent.
+		std::unique_ptr<uint64_t[]> buckets(new uint64_t[LATENCY_BUCKETS]);
+		uint64_t count = 0u;
+		for (size_t i = 0u; i < LATENCY_BUCKETS; ++i) {
+			buckets[i] = mBuckets[i].load(std::memory_order_relaxed);
+			count += buckets[i];
+		}
+		summary.mCount = count;
+		summary.mMax = mMax.load(std::memory_order_relaxed);
+
+		// walk buckets for each percentile
+		const double percentiles[] = { 0.5, 0.99, 0.999 };
+		uint64_t* results[] = { &summary.mP50, &summary.mP99, &summary.mP999 };
+		uint64_t cumulative = 0u;
+		size_t index = 0u;
+		for (size_t p = 0u; p < 3u; ++p) {
+			*results[p] = 0u;
+			if (count == 0u) continue;
+
+			// the rank of this percentile. at least 1.
+			uint64_t rank = std::max<uint64_t>(1u, static_cast<uint64_t>(percentiles[p] * count + 0.5));
+			while (index < LATENCY_BUCKETS && cumulative + buckets[index] < rank) {
+				cumulative += buckets[index];
+				++index;
+			}
+			*results[p] = std::min(GetBucketUpperBound(index), summary.mMax);
+		}
+
+		return summary;
+	}
+
+	LatencyBuckets LatencyHistogram::SummarizeBuckets() {
+		LatencyBuckets buckets;
+
+		// a internal bucket is counted into a bound if its upper bound is not greater than it.
+		uint64_t cumulative = 0u;
+		size_t index = 0u;
+		for (size_t b = 0u; b < LATENCY_EXPORT_BOUND_COUNT; ++b) {
+			while (index < LATENCY_BUCKETS && GetBucketUpperBound(index) <= LATENCY_EXPORT_BOUNDS[b]) {
+				cumulative += mBuckets[index].load(std::memory_order_relaxed);
+				++index;
+			}
+			buckets.mCumulative[b] = cumulative;
+		}
+		for (; index < LATENCY_BUCKETS; ++index) {
+			cumulative += mBuckets[index].load(std::memory_order_relaxed);
+		}
+
+		// use the sum of snapshot as count, so +Inf bucket is never less than other buckets.
+		buckets.mCount = cumulative;
+		buckets.mSum = mSum.load(std::memory_order_relaxed);
+		return buckets;
+	}
+
+	size_t LatencyHistogram::GetBucketIndex(uint64_t value) {
+		// small values have their own bucket
+		if (value < LATENCY_SUB_BUCKETS) return static_cast<size_t>(value);
+
+		// the highest bit decide magnitude, the following LATENCY_SUB_BITS bits decide sub bucket.
+		size_t exponent = 63u - static_cast<size_t>(std::countl_zero(value));
+		size_t sub = static_cast<size_t>(value >> (exponent - LATENCY_SUB_BITS)) - LATENCY_SUB_BUCKETS;
+		return (exponent - LATENCY_SUB_BITS + 1u) * LATENCY_SUB_BUCKETS + sub;
+	}
+
+	uint64_t LatencyHistogram::GetBucketUpperBound(size_t index) {
+		if (index < LATENCY_SUB_BUCKETS) return static_cast<uint64_t>(index);
+		if (index >= LATENCY_BUCKETS) return UINT64_MAX;
+
+		size_t exponent = index / LATENCY_SUB_BUCKETS + LATENCY_SUB_BITS - 1u;
+		size_t sub = index % LATENCY_SUB_BUCKETS;
+		uint64_t width = UINT64_C(1) << (exponent - LATENCY_SUB_BITS);
+		uint64_t lower = static_cast<uint64_t>(LATENCY_SUB_BUCKETS + sub) << (exponent - LATENCY_SUB_BITS);
+		return lower + (width - 1u);
+	}
+
+#pragma endregion
+
+#pragma region OpcodeCounters
+
+	/// <summary>
+	/// BMMO opcode names, indexed by opcode. Same as the opcodes used by BallanceMMO server.
+	/// </summary>
+	static constexpr const char* OPCODE_NAMES[] = {
+		"none_msg", "login_request_msg", "login_accepted_msg", "simple_action_msg",
+		"player_disconnected_msg", "player_connected_msg", "ping_msg", "ball_state_msg",
+		"owned_ball_state_msg", "keyboard_input_msg", "chat_msg", "level_finish_msg",
+		"login_request_v2_msg", "login_accepted_v2_msg", "player_connected_v2_msg", "cheat_state_msg",
+		"owned_cheat_state_msg", "cheat_toggle_msg", "owned_cheat_toggle_msg", "kick_request_msg",
+		"player_kicked_msg", "owned_ball_state_v2_msg", "login_request_v3_msg", "level_finish_v2_msg",
+		"action_denied_msg", "op_state_msg", "countdown_msg", "did_not_finish_msg",
+		"map_names_msg", "plain_text_msg", "current_map_msg", "hash_data_msg",
+		"timed_ball_state_msg", "owned_timed_ball_state_msg", "timestamp_msg", "private_chat_msg",
+		"player_ready_msg", "important_notification_msg", "mod_list_msg", "popup_box_msg",
+		"current_sector_msg", "login_accepted_v3_msg", "permanent_notification_msg", "sound_data_msg",
+		"public_notification_msg", "owned_compressed_ball_state_msg"
+	};
+	static constexpr const uint32_t OPCODE_NAME_COUNT = static_cast<uint32_t>(sizeof(OPCODE_NAMES) / sizeof(const char*));
+	static_assert(OPCODE_NAME_COUNT <= OpcodeCounters::UNKNOWN_OPCODE, "OPCODE_SLOT_COUNT is too small to hold all opcodes.");
+
+	OpcodeCounters::OpcodeCounters(OpcodeCounters* parent) :
+		mParent(parent)
+	{
+		for (size_t dir = 0u; dir < 2u; ++dir) {
+			for (uint32_t i = 0u; i < OPCODE_SLOT_COUNT; ++i) {
+				mMsg[dir][i].store(0u, std::memory_order_relaxed);
+				mBytes[dir][i].store(0u, std::memory_order_relaxed);
+			}
+		}
+	}
+
+	OpcodeCounters::~OpcodeCounters() {}
+
+	void OpcodeCounters::Record(OpcodeDirection direction, const void* payload, uint32_t len) {
+		uint32_t opcode = UNKNOWN_OPCODE;
+		if (payload != nullptr && len >= sizeof(uint32_t)) {
+			// little endian uint32. read bytes one by one to avoid unaligned access.
+			const uint8_t* bytes = static_cast<const uint8_t*>(payload);
+			uint32_t value = static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8) |
+				(static_cast<uint32_t>(bytes[2]) << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+			if (value < UNKNOWN_OPCODE) opcode = value;
+		}
+
+		size_t dir = static_cast<size_t>(direction);
+		mMsg[dir][opcode].fetch_add(1u, std::memory_order_relaxed);
+		mBytes[dir][opcode].fetch_add(len, std::memory_order_relaxed);
+		if (mParent != nullptr) mParent->Record(direction, payload, len);
+	}
+
+	void OpcodeCounters::Inspect(OpcodeDirection direction, const std::deque<CommonMessage>& msg_list, size_t from) {
+		for (size_t i = from; i < msg_list.size(); ++i) {
+			Record(direction, msg_list[i].GetCommonData(), msg_list[i].GetCommonDataLen());
+		}
+	}
+
+	std::vector<OpcodeUsage> OpcodeCounters::Summarize(OpcodeDirection direction) {
+		std::vector<OpcodeUsage> usages;
+		size_t dir = static_cast<size_t>(direction);
+		for (uint32_t i = 0u; i < OPCODE_SLOT_COUNT; ++i) {
+			uint64_t msg = mMsg[dir][i].load(std::memory_order_relaxed);
+			if (msg == 0u) continue;
+			usages.emplace_back(OpcodeUsage{ i, msg, mBytes[dir][i].load(std::memory_order_relaxed) });
+		}
+
+		std::sort(usages.begin(), usages.end(), [](const OpcodeUsage& lhs, const OpcodeUsage& rhs) -> bool {
+			return lhs.mBytes > rhs.mBytes;
+		});
+		return usages;
+	}
+
+	const char* OpcodeCounters::GetOpcodeName(uint32_t opcode) {
+		if (opcode < OPCODE_NAME_COUNT) return OPCODE_NAMES[opcode];
+		else return "unknown";
+	}
+
+#pragma endregion
+
+#pragma region SetupDurations
+
+	SetupDurations::SetupDurations() :
+		mPhases(), mTotal()
+	{}
+
+	SetupDurations::~SetupDurations() {}
+
+	void SetupDurations::Record(SetupPhase phase, uint64_t duration) {
+		mPhases[static_cast<size_t>(phase)].Record(duration);
+	}
+
+	void SetupDurations::RecordTotal(uint64_t duration) {
+		mTotal.Record(duration);
+	}
+
+	LatencySummary SetupDurations::Summarize(SetupPhase phase) {
+		return mPhases[static_cast<size_t>(phase)].Summarize();
+	}
+
+	LatencySummary SetupDurations::SummarizeTotal() {
+		return mTotal.Summarize();
+	}
+
+#pragma endregion
+
+#pragma region SetupTimeline
+
+	static constexpr const char* SETUP_PHASE_NAMES[SETUP_PHASE_COUNT] = {
+		"accepted", "tcp_started", "ordered", "bridge_picked", "resolved",
+		"connect_issued", "gns_connected", "first_tcp2gns", "first_gns2tcp"
+	};
+
+	SetupTimeline::SetupTimeline(SetupDurations* parent) :
+		mParent(parent), mTimes()
+	{
+		for (auto& time : mTimes) {
+			time.store(0u, std::memory_order_relaxed);
+		}
+	}
+
+	SetupTimeline::~SetupTimeline() {}
+
+	void SetupTimeline::Mark(SetupPhase phase) {
+		// only the first mark count.
+		// check it without writing first, because some phases are marked in every loop of context.
+		std::atomic_uint64_t& time = mTimes[static_cast<size_t>(phase)];
+		if (time.load(std::memory_order_relaxed) != 0u) return;
+		uint64_t now = CommonOpers::GetMonotonicTime(), expected = 0u;
+		if (!time.compare_exchange_strong(expected, now, std::memory_order_relaxed)) return;
+		if (mParent == nullptr) return;
+
+		// record the duration from previous phase.
+		// skip it if previous phase is not reached, like a bridge resumed its session.
+		SetupPhase previous = GetPreviousPhase(phase);
+		if (previous == SetupPhase::Count) return;
+		uint64_t previous_time = mTimes[static_cast<size_t>(previous)].load(std::memory_order_relaxed);
+		if (previous_time != 0u && now >= previous_time) {
+			mParent->Record(phase, now - previous_time);
+		}
+
+		if (phase == SetupPhase::GnsConnected) {
+			uint64_t accepted_time = mTimes[static_cast<size_t>(SetupPhase::Accepted)].load(std::memory_order_relaxed);
+			if (accepted_time != 0u && now >= accepted_time) {
+				mParent->RecordTotal(now - accepted_time);
+			}
+		}
+	}
+
+	bool SetupTimeline::IsMarked(SetupPhase phase) const {
+		return mTimes[static_cast<size_t>(phase)].load(std::memory_order_relaxed) != 0u;
+	}
+
+	std::string SetupTimeline::Format() const {
+		std::string result;
+		uint64_t accepted_time = mTimes[static_cast<size_t>(SetupPhase::Accepted)].load(std::memory_order_relaxed);
+		for (size_t i = static_cast<size_t>(SetupPhase::TcpStarted); i < SETUP_PHASE_COUNT; ++i) {
+			if (!result.empty()) result.append(", ");
+			uint64_t time = mTimes[i].load(std::memory_order_relaxed);
+			if (time == 0u || accepted_time == 0u || time < accepted_time) {
+				CommonOpers::AppendStrF(result, "%s -", SETUP_PHASE_NAMES[i]);
+			} else {
+				CommonOpers::AppendStrF(result, "%s %.2fms", SETUP_PHASE_NAMES[i], (time - accepted_time) / 1000000.0);
+			}
+		}
+		return result;
+	}
+
+	const char* SetupTimeline::GetPhaseName(SetupPhase phase) {
+		if (phase < SetupPhase::Count) return SETUP_PHASE_NAMES[static_cast<size_t>(phase)];
+		else return "unknown";
+	}
+
+	SetupPhase SetupTimeline::GetPreviousPhase(SetupPhase phase) {
+		switch (phase) {
+			case SetupPhase::Accepted:
+				return SetupPhase::Count;
+			case SetupPhase::FirstTcp2Gns:
+			case SetupPhase::FirstGns2Tcp:
+				return SetupPhase::GnsConnected;
+			default:
+				return static_cast<SetupPhase>(static_cast<size_t>(phase) - 1u);
+		}
+	}
+
+#pragma endregion
+
+#pragma region RateSampler
+
+	RateSampler::RateSampler(std::chrono::milliseconds window) :
+		mWindow(window), mSamples()
+	{}
+
+	RateSampler::~RateSampler() {}
+
+	void RateSampler::Push(std::chrono::steady_clock::time_point now, const ThroughputSample& sample) {
+		mSamples.emplace_back(now, sample);
+
+		// drop the samples out of window, but keep at least 2 samples for computing rate.
+		while (mSamples.size() > 2u && now - mSamples[1].first >= mWindow) {
+			mSamples.pop_front();
+		}
+	}
+
+	ThroughputRate RateSampler::GetRate() const {
+		ThroughputRate rate{ 0.0, 0.0, 0.0, 0.0 };
+		if (mSamples.size() < 2u) return rate;
+
+		const auto& oldest = mSamples.front();
+		const auto& newest = mSamples.back();
+		double seconds = std::chrono::duration<double>(newest.first - oldest.first).count();
+		if (seconds <= 0.0) return rate;
+
+		rate.mTcp2GnsMsg = (newest.second.mTcp2GnsMsg - oldest.second.mTcp2GnsMsg) / seconds;
+		rate.mTcp2GnsBytes = (newest.second.mTcp2GnsBytes - oldest.second.mTcp2GnsBytes) / seconds;
+		rate.mGns2TcpMsg = (newest.second.mGns2TcpMsg - oldest.second.mGns2TcpMsg) / seconds;
+		rate.mGns2TcpBytes = (newest.second.mGns2TcpBytes - oldest.second.mGns2TcpBytes) / seconds;
+		return rate;
+	}
+
+#pragma endregion
+
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include "others_helper.hpp"
+#include "messages.hpp"
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace WhispersAbyss {
+
+	struct LatencySummary {
+		uint64_t mCount;
+		uint64_t mP50, mP99, mP999, mMax;	// in nanoseconds
+	};
+
+	/// <summary>
+	/// The fixed bucket bounds used when exporting histogram to Prometheus. In nanoseconds.
+	/// </summary>
+	constexpr const uint64_t LATENCY_EXPORT_BOUNDS[] = {
+		50000u, 100000u, 250000u, 500000u,
+		1000000u, 2500000u, 5000000u, 10000000u, 25000000u, 50000000u,
+		100000000u, 250000000u, 500000000u, 1000000000u
+	};
+	constexpr const size_t LATENCY_EXPORT_BOUND_COUNT = sizeof(LATENCY_EXPORT_BOUNDS) / sizeof(uint64_t);
+	struct LatencyBuckets {
+		uint64_t mCumulative[LATENCY_EXPORT_BOUND_COUNT];	// the count of values <= each bound. approximated by internal buckets.
+		uint64_t mCount;
+		uint64_t mSum;	// in nanoseconds
+	};
+
+	struct ThroughputSample {
+		uint64_t mTcp2GnsMsg, mTcp2GnsBytes, mGns2TcpMsg, mGns2TcpBytes;
+
+		ThroughputSample& operator+=(const ThroughputSample& rhs);
+	};
+	struct ThroughputRate {
+		double mTcp2GnsMsg, mTcp2GnsBytes, mGns2TcpMsg, mGns2TcpBytes;	// per second
+	};
+
+	struct OpcodeUsage {
+		uint32_t mOpcode;
+		uint64_t mMsg, mBytes;
+	};
+	enum class OpcodeDirection : size_t {
+		Tcp2Gns = 0, Gns2Tcp = 1
+	};
+
+	/// <summary>
+	/// The phases of setting up a bridge, in the order they normally happen.
+	/// </summary>
+	enum class SetupPhase : size_t {
+		Accepted = 0,	// TcpInstance created by acceptor
+		TcpStarted,	// TcpInstance started its workers
+		Ordered,	// Connect command or resume token received
+		BridgePicked,	// BridgeInstance picked up the order and created GnsInstance
+		Resolved,	// server address resolved
+		ConnectIssued,	// the first ConnectByIPAddress called
+		GnsConnected,	// the first GNS connection won racing
+		FirstTcp2Gns,	// the first message handed from Tcp to Gns
+		FirstGns2Tcp,	// the first message handed from Gns to Tcp
+		Count
+	};
+	constexpr const size_t SETUP_PHASE_COUNT = static_cast<size_t>(SetupPhase::Count);
+
+	/// <summary>
+	/// <para>A HDR-style (log-linear) latency histogram. Values are in nanoseconds.</para>
+	/// <para>Each power of 2 is split into LATENCY_SUB_BUCKETS buckets, so the relative error is below 1 / LATENCY_SUB_BUCKETS.</para>
+	/// <para>Record() is lock-free and can be called by any thread.
+	/// If parent is provided, every value will also be recorded into parent, so parent become the aggregate of its children.</para>
+	/// </summary>
+	class LatencyHistogram {
+	public:
+		LatencyHistogram(LatencyHistogram* parent = nullptr);
+		LatencyHistogram(const LatencyHistogram& rhs) = delete;
+		LatencyHistogram(LatencyHistogram&& rhs) = delete;
+		~LatencyHistogram();
+
+		void Record(uint64_t value);
+		/// <summary>
+		/// Record the time elapsed from given ingress time. See CommonOpers::GetMonotonicTime().
+		/// </summary>
+		void RecordSince(uint64_t ingress_time);
+		LatencySummary Summarize();
+		LatencyBuckets SummarizeBuckets();
+	private:
+		static constexpr const size_t LATENCY_SUB_BITS = 4u;
+		static constexpr const size_t LATENCY_SUB_BUCKETS = 1u << LATENCY_SUB_BITS;
+		static constexpr const size_t LATENCY_BUCKETS = (64u - LATENCY_SUB_BITS + 1u) * LATENCY_SUB_BUCKETS;
+
+		static size_t GetBucketIndex(uint64_t value);
+		static uint64_t GetBucketUpperBound(size_t index);
+
+		LatencyHistogram* mParent;
+		std::unique_ptr<std::atomic_uint64_t[]> mBuckets;
+		std::atomic_uint64_t mCount, mMax, mSum;
+	};
+
+	/// <summary>
+	/// <para>Per-opcode message and byte counters of BMMO payloads in both directions.</para>
+	/// <para>Every BMMO payload starts with its opcode in little endian uint32.
+	/// Payloads which are too short or whose opcode is out of range are counted as UNKNOWN_OPCODE.</para>
+	/// <para>Record() is lock-free and can be called by any thread.
+	/// Like LatencyHistogram, if parent is provided, every payload will also be counted into parent.</para>
+	/// </summary>
+	class OpcodeCounters {
+	public:
+		static constexpr const uint32_t UNKNOWN_OPCODE = OPCODE_SLOT_COUNT - 1u;
+
+		OpcodeCounters(OpcodeCounters* parent = nullptr);
+		OpcodeCounters(const OpcodeCounters& rhs) = delete;
+		OpcodeCounters(OpcodeCounters&& rhs) = delete;
+		~OpcodeCounters();
+
+		void Record(OpcodeDirection direction, const void* payload, uint32_t len);
+		/// <summary>
+		/// Record messages in given list starting from given position.
+		/// </summary>
+		void Inspect(OpcodeDirection direction, const std::deque<CommonMessage>& msg_list, size_t from);
+		/// <summary>
+		/// Get counted opcodes, ordered by bytes in descending order.
+		/// </summary>
+		std::vector<OpcodeUsage> Summarize(OpcodeDirection direction);
+
+		/// <summary>
+		/// Get the name of BMMO opcode. Return "unknown" for unknown one.
+		/// </summary>
+		static const char* GetOpcodeName(uint32_t opcode);
+	private:
+		OpcodeCounters* mParent;
+		std::atomic_uint64_t mMsg[2][OPCODE_SLOT_COUNT], mBytes[2][OPCODE_SLOT_COUNT];
+	};
+
+	/// <summary>
+	/// <para>The duration distribution of each setup phase, aggregated from all bridges.</para>
+	/// <para>The duration of a phase is measured from its previous phase (see SetupTimeline::GetPreviousPhase()).
+	/// Total is measured from Accepted to GnsConnected.</para>
+	/// </summary>
+	class SetupDurations {
+	public:
+		SetupDurations();
+		SetupDurations(const SetupDurations& rhs) = delete;
+		SetupDurations(SetupDurations&& rhs) = delete;
+		~SetupDurations();
+
+		void Record(SetupPhase phase, uint64_t duration);
+		void RecordTotal(uint64_t duration);
+		LatencySummary Summarize(SetupPhase phase);
+		LatencySummary SummarizeTotal();
+	private:
+		LatencyHistogram mPhases[SETUP_PHASE_COUNT];
+		LatencyHistogram mTotal;
+	};
+
+	/// <summary>
+	/// <para>The time of each setup phase of a bridge. Each phase only keep its first time.</para>
+	/// <para>Created by TcpInstance when accepted, then shared with the bridge and its first GnsInstance.
+	/// Mark() is lock-free and can be called by any thread.
+	/// If parent is provided, the duration of each phase is recorded into it once marked.</para>
+	/// </summary>
+	class SetupTimeline {
+	public:
+		SetupTimeline(SetupDurations* parent = nullptr);
+		SetupTimeline(const SetupTimeline& rhs) = delete;
+		SetupTimeline(SetupTimeline&& rhs) = delete;
+		~SetupTimeline();
+
+		void Mark(SetupPhase phase);
+		bool IsMarked(SetupPhase phase) const;
+		/// <summary>
+		/// Format the time of each phase as milliseconds since Accepted, like "ordered 1.23ms". Not reached phases are shown as "-".
+		/// </summary>
+		std::string Format() const;
+
+		static const char* GetPhaseName(SetupPhase phase);
+		/// <summary>
+		/// Get the phase which the duration of given phase is measured from.
+		/// Both first message phases are measured from GnsConnected because they can happen in any order.
+		/// Return Count for Accepted.
+		/// </summary>
+		static SetupPhase GetPreviousPhase(SetupPhase phase);
+	private:
+		SetupDurations* mParent;
+		std::atomic_uint64_t mTimes[SETUP_PHASE_COUNT];	// from CommonOpers::GetMonotonicTime(). 0 mean not reached.
+	};
+
+	/// <summary>
+	/// <para>Compute per second rates of monotonic counters in a sliding window.</para>
+	/// <para>Push() a sample periodically, then GetRate() return the rate between the oldest and the newest sample in window.
+	/// Not thread safe. Caller should protect it.</para>
+	/// </summary>
+	class RateSampler {
+	public:
+		RateSampler(std::chrono::milliseconds window = THROUGHPUT_WINDOW);
+		RateSampler(const RateSampler& rhs) = delete;
+		RateSampler(RateSampler&& rhs) = default;
+		~RateSampler();
+
+		void Push(std::chrono::steady_clock::time_point now, const ThroughputSample& sample);
+		ThroughputRate GetRate() const;
+	private:
+		std::chrono::milliseconds mWindow;
+		std::deque<std::pair<std::chrono::steady_clock::time_point, ThroughputSample>> mSamples;
+	};
+
+}
@@ -0,0 +1,135 @@
+#include "metrics_server.hpp"
+
+namespace WhispersAbyss {
+
+#pragma region MetricsServer
+
+	MetricsServer::MetricsServer(OutputHelper* output, uint16_t port) :
+		mOutput(output), mPort(port),
+		mIoContext(), mAcceptor(mIoContext), mRetryTimer(mIoContext), mTdIoCtx(),
+		mSnapshot(std::make_shared<const std::string>())
+	{}
+
+	MetricsServer::~MetricsServer() {
+		Stop();
+	}
+
+	bool MetricsServer::Start() {
+		// only listen on loopback. metrics are not intended to be exposed to network.
+		asio::error_code ec;
+		asio::ip::tcp::endpoint endpoint(asio::ip::address_v4::loopback(), mPort);
+		mAcceptor.open(endpoint.protocol(), ec);
+		if (!ec) mAcceptor.set_option(asio::ip::tcp::acceptor::reuse_address(true), ec);
+		if (!ec) mAcceptor.bind(endpoint, ec);
+		if (!ec) mAcceptor.listen(asio::socket_base::max_listen_connections, ec);
+		if (ec) {
+			mOutput->Printf(OutputHelper::Component::BridgeFactory, NO_INDEX, "Fail to start metrics server on port %" PRIu16 ": %s", mPort, ec.message().c_str());
+			return false;
+		}
+
+		RegisterAsyncWork();
+		mTdIoCtx = std::thread([this]() -> void {
+			ThreadInventory::Register("metrics", NO_INDEX);
+			this->mIoContext.run();
+		});
+
+		mOutput->Printf(OutputHelper::Component::BridgeFactory, NO_INDEX, "Metrics server is listening on 127.0.0.1:%" PRIu16 ".", mPort);
+		return true;
+	}
+
+	void MetricsServer::Stop() {
+		mIoContext.stop();
+		if (mTdIoCtx.joinable()) {
+			mTdIoCtx.join();
+		}
+	}
+
+	void MetricsServer::Publish(std::string&& text) {
+		mSnapshot.store(std::make_shared<const std::string>(std::move(text)));
+	}
+
+	void MetricsServer::RegisterAsyncWork() {
+		mAcceptor.async_accept([this](asio::error_code ec, asio::ip::tcp::socket socket) -> void {
+			// acceptor is closed
+			if (ec == asio::error::operation_aborted) return;
+
+			// accepting again immediately would spin on errors like EMFILE, so wait a while.
+			if (ec) {
+				mOutput->Printf(OutputHelper::Component::BridgeFactory, NO_INDEX, "Metrics server fail to accept: %s. Retry later.", ec.message().c_str());
+				mRetryTimer.expires_after(METRICS_ACCEPT_RETRY_INTERVAL);
+				mRetryTimer.async_wait([this](asio::error_code ec) -> void {
+					if (!ec) this->RegisterAsyncWork();
+				});
+				return;
+			}
+
+			std::make_shared<Session>(std::move(socket), mSnapshot.load())->Start();
+
+			// accept next one
+			this->RegisterAsyncWork();
+		});
+	}
+
+#pragma endregion
+
+#pragma region MetricsServer::Session
+
+	MetricsServer::Session::Session(asio::ip::tcp::socket socket, std::shared_ptr<const std::string> snapshot) :
+		mSocket(std::move(socket)), mDeadline(mSocket.get_executor()),
+		mRequest(METRICS_REQUEST_CAPACITY), mResponseHeader(),
+		mSnapshot(std::move(snapshot))
+	{}
+
+	void MetricsServer::Session::Start() {
+		// close slow client. all handlers run in the same thread so no race here.
+		auto self(shared_from_this());
+		mDeadline.expires_after(METRICS_REQUEST_TIMEOUT);
+		mDeadline.async_wait([self](asio::error_code ec) -> void {
+			if (!ec) self->Close();
+		});
+
+		// we only need request line. header end is read for being polite to client.
+		asio::async_read_until(mSocket, mRequest, "\r\n\r\n", [self](asio::error_code ec, std::size_t) -> void {
+			self->OnRequest(ec);
+		});
+	}
+
+	void MetricsServer::Session::OnRequest(asio::error_code ec) {
+		if (ec) {
+			Close();
+			return;
+		}
+
+		// parse request line
+		std::istream stream(&mRequest);
+		std::string method, path;
+		stream >> method >> path;
+
+		const std::string* body;
+		static const std::string not_found("Not Found. Try /metrics\n");
+		if (method == "GET" && path == "/metrics") {
+			body = mSnapshot.get();
+			mResponseHeader = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n";
+		} else {
+			body = &not_found;
+			mResponseHeader = "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain; charset=utf-8\r\n";
+		}
+		CommonOpers::AppendStrF(mResponseHeader, "Content-Length: %zu\r\nConnection: close\r\n\r\n", body->size());
+
+		auto self(shared_from_this());
+		std::array<asio::const_buffer, 2> buffers{ asio::buffer(mResponseHeader), asio::buffer(*body) };
+		asio::async_write(mSocket, buffers, [self](asio::error_code, std::size_t) -> void {
+			self->Close();
+		});
+	}
+
+	void MetricsServer::Session::Close() {
+		asio::error_code ec;
+		mDeadline.cancel();
+		mSocket.shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+		mSocket.close(ec);
+	}
+
+#pragma endregion
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#ifdef _WIN32
+#include <sdkddkver.h>	// need by asio
+#endif // _WIN32
+#include "asio.hpp"
+#include "others_helper.hpp"
+#include "tracer.hpp"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace WhispersAbyss {
+
+	/*
+	MetricsServer is a tiny HTTP server which serve the metrics in Prometheus text format.
+
+	It only listen on loopback address and only answer `GET /metrics`.
+	The content is a snapshot published by BridgeFactory periodically.
+	Scraping only read the latest snapshot atomically, so it never block any worker or lock.
+	*/
+
+	class MetricsServer {
+	public:
+		MetricsServer(OutputHelper* output, uint16_t port);
+		MetricsServer(const MetricsServer& rhs) = delete;
+		MetricsServer(MetricsServer&& rhs) = delete;
+		~MetricsServer();
+
+		/// <summary>
+		/// Start listening.
+		/// </summary>
+		/// <returns>True if success.</returns>
+		bool Start();
+		void Stop();
+		/// <summary>
+		/// Replace current snapshot. Thread safe.
+		/// </summary>
+		void Publish(std::string&& text);
+	private:
+		class Session : public std::enable_shared_from_this<Session> {
+		public:
+			Session(asio::ip::tcp::socket socket, std::shared_ptr<const std::string> snapshot);
+			void Start();
+		private:
+			void OnRequest(asio::error_code ec);
+			void Close();
+
+			asio::ip::tcp::socket mSocket;
+			asio::steady_timer mDeadline;
+			asio::streambuf mRequest;
+			std::string mResponseHeader;
+			std::shared_ptr<const std::string> mSnapshot;
+		};
+
+		OutputHelper* mOutput;
+		uint16_t mPort;
+
+		asio::io_context mIoContext;	// this 2 decleartion should keep this order. due to init list order.
+		asio::ip::tcp::acceptor mAcceptor;
+		asio::steady_timer mRetryTimer;
+		std::thread mTdIoCtx;
+
+		std::atomic<std::shared_ptr<const std::string>> mSnapshot;
+
+		void RegisterAsyncWork();
+	};
+
+}
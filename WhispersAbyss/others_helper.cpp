@@ -1,12 +1,17 @@
 #include "others_helper.hpp"
+#include "tracer.hpp"
 #include <cstdio>
 #include <cstdarg>
+#include <algorithm>
 
 // for got ms-based time
 #ifdef _WIN32
 #include <Windows.h>
 #else
 #include <time.h>
+#include <sys/time.h>
+#include <csignal>
+#include <unistd.h>
 #endif // _WIND32
 
 namespace WhispersAbyss {
@@ -40,95 +45,244 @@ namespace WhispersAbyss {
 		if (write_result < 0 || write_result > count) throw new std::length_error("Invalid write result in vsnprintf.");
 	}
 
+	uint64_t CommonOpers::GetMonotonicTime() {
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()
+		).count());
+	}
+
 #pragma region OutputHelper
 
-	OutputHelper::OutputHelper() {
-		g_logTimeZero = GetSysTimeMicros();
+	OutputHelper::OutputHelper() :
+		g_logTimeZero(GetSysTimeMicros()),
+		mFileMutex("log_file"), mFile(stdout),
+		mSlots(new LogSlot[LOG_QUEUE_CAPACITY]), mEnqueuePos(0u), mDequeuePos(0u),
+		mLoggedLines(0u), mDroppedLines(0u), mCallTimeTotal(0u), mCallTimeMax(0u),
+		mTdWriter()
+	{
+		static_assert((LOG_QUEUE_CAPACITY & (LOG_QUEUE_CAPACITY - 1u)) == 0u, "LOG_QUEUE_CAPACITY must be power of 2.");
+		for (size_t i = 0u; i < LOG_QUEUE_CAPACITY; ++i) {
+			mSlots[i].mSequence.store(i, std::memory_order_relaxed);
+			mSlots[i].mLength = 0u;
+		}
+
+		mTdWriter = std::jthread(std::bind(&OutputHelper::WriterWorker, this, std::placeholders::_1));
 	}
 
-	OutputHelper::~OutputHelper() {}
+	OutputHelper::~OutputHelper() {
+		// writer will write all remaining lines before exiting
+		if (mTdWriter.joinable()) {
+			mTdWriter.request_stop();
+			mTdWriter.join();
+		}
+
+		if (mFile != stdout) fclose(mFile);
+	}
+
+	bool OutputHelper::OpenLogFile(const char* path) {
+		FILE* fs = fopen(path, "a");
+		if (fs == nullptr) return false;
+
+		// let queued lines go into old file.
+		Flush();
+
+		std::lock_guard locker(mFileMutex);
+		if (mFile != stdout) fclose(mFile);
+		mFile = fs;
+		return true;
+	}
 
-#define CALL_FMT va_list ap; \
+#define CALL_PUSH(has_component, comp, index) va_list ap; \
 va_start(ap, fmt); \
-PrintMessage(fmt, ap); \
+PushLine(has_component, comp, index, fmt, ap); \
+va_end(ap);
+#define CALL_DIRECT(has_timestamp, has_component, comp, index) va_list ap; \
+va_start(ap, fmt); \
+WriteDirectly(has_timestamp, has_component, comp, index, fmt, ap); \
 va_end(ap);
 
 	void OutputHelper::FatalError(const char* fmt, ...) {
 		{
-			std::lock_guard locker(mMutex);
-			PrintTimestamp();
-			CALL_FMT;
+			CALL_DIRECT(true, false, Component::Core, NO_INDEX);
 		}
 		NukeProcess(1);
 	}
 	void OutputHelper::FatalError(Component comp, IndexDistributor::Index_t index, const char* fmt, ...) {
 		{
-			std::lock_guard locker(mMutex);
-			PrintTimestamp();
-			PrintComponent(comp, index);
-			CALL_FMT;
+			CALL_DIRECT(true, true, comp, index);
 		}
 		NukeProcess(1);
 	}
 	void OutputHelper::Printf(const char* fmt, ...) {
-		{
-			std::lock_guard locker(mMutex);
-			PrintTimestamp();
-			CALL_FMT;
-		}
+		CALL_PUSH(false, Component::Core, NO_INDEX);
 	}
 	void OutputHelper::Printf(Component comp, IndexDistributor::Index_t index, const char* fmt, ...) {
-		{
-			std::lock_guard locker(mMutex);
-			PrintTimestamp();
-			PrintComponent(comp, index);
-			CALL_FMT;
-		}
+		CALL_PUSH(true, comp, index);
 	}
 	void OutputHelper::RawPrintf(const char* fmt, ...) {
-		{
-			std::lock_guard locker(mMutex);
-			CALL_FMT;
+		CALL_DIRECT(false, false, Component::Core, NO_INDEX);
+	}
+
+#undef CALL_DIRECT
+#undef CALL_PUSH
+
+	void OutputHelper::Flush() {
+		// wait writer catching up. give up if writer has gone.
+		size_t target = mEnqueuePos.load(std::memory_order_acquire);
+		CountDownTimer waiting(MODULE_WAITING_INTERVAL);
+		while (mDequeuePos.load(std::memory_order_acquire) < target) {
+			if (waiting.HasRunOutOfTime()) return;
+			std::this_thread::sleep_for(LOG_FLUSH_INTERVAL);
+		}
+	}
+
+	OutputHelperProfile OutputHelper::ReportStatus() {
+		OutputHelperProfile profile;
+
+		profile.mLoggedLines = mLoggedLines.load();
+		profile.mDroppedLines = mDroppedLines.load();
+		profile.mCallTimeTotal = mCallTimeTotal.load();
+		profile.mCallTimeMax = mCallTimeMax.load();
+
+		return profile;
+	}
+
+	void OutputHelper::PushLine(bool has_component, Component comp, IndexDistributor::Index_t index, const char* fmt, va_list ap) {
+		auto time_start = std::chrono::steady_clock::now();
+
+		// claim a free slot
+		LogSlot* slot;
+		size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+		while (true) {
+			slot = &mSlots[pos & (LOG_QUEUE_CAPACITY - 1u)];
+			size_t seq = slot->mSequence.load(std::memory_order_acquire);
+			intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+			if (diff == 0) {
+				if (mEnqueuePos.compare_exchange_weak(pos, pos + 1u, std::memory_order_relaxed)) break;
+			} else if (diff < 0) {
+				// queue is full. drop it.
+				mDroppedLines.fetch_add(1u, std::memory_order_relaxed);
+				return;
+			} else {
+				pos = mEnqueuePos.load(std::memory_order_relaxed);
+			}
 		}
+
+		// format in slot. keep one char for line break.
+		size_t len = FormatPrefix(slot->mText, LOG_LINE_CAPACITY - 1u, true, has_component, comp, index);
+		int count = vsnprintf(slot->mText + len, LOG_LINE_CAPACITY - 1u - len, fmt, ap);
+		if (count > 0) len = std::min(len + static_cast<size_t>(count), LOG_LINE_CAPACITY - 2u);
+		slot->mText[len++] = '\n';
+		slot->mLength = len;
+
+		// publish it
+		slot->mSequence.store(pos + 1u, std::memory_order_release);
+
+		// record call time
+		mLoggedLines.fetch_add(1u, std::memory_order_relaxed);
+		uint64_t elapsed = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - time_start).count());
+		mCallTimeTotal.fetch_add(elapsed, std::memory_order_relaxed);
+		uint64_t prev_max = mCallTimeMax.load(std::memory_order_relaxed);
+		while (elapsed > prev_max && !mCallTimeMax.compare_exchange_weak(prev_max, elapsed, std::memory_order_relaxed)) {}
+	}
+
+	void OutputHelper::WriteDirectly(bool has_timestamp, bool has_component, Component comp, IndexDistributor::Index_t index, const char* fmt, va_list ap) {
+		char prefix[LOG_LINE_CAPACITY];
+		FormatPrefix(prefix, LOG_LINE_CAPACITY, has_timestamp, has_component, comp, index);
+
+		// keep order with queued lines
+		Flush();
+
+		std::lock_guard locker(mFileMutex);
+		fputs(prefix, mFile);
+		vfprintf(mFile, fmt, ap);
+		fputc('\n', mFile);
+		fflush(mFile);
 	}
 
-#undef CALL_FMT
-
-	void OutputHelper::PrintTimestamp() {
-		float time = (float)(GetSysTimeMicros() - g_logTimeZero);
-		fprintf(stdout, "%10.6f ", time * 1e-6);
-	}
-
-	void OutputHelper::PrintComponent(Component comp, IndexDistributor::Index_t index) {
-		switch (comp) {
-			case Component::TcpInstance:
-				fprintf(stdout, "[Tcp-#%" PRIu64 "] ", index);
-				break;
-			case Component::TcpFactory:
-				fputs("[Tcp Factory] ", stdout);
-				break;
-			case Component::GnsInstance:
-				fprintf(stdout, "[Gns-#%" PRIu64 "] ", index);
-				break;
-			case Component::GnsFactory:
-				fputs("[Gns Factory] ", stdout);
-				break;
-			case Component::BridgeInstance:
-				fprintf(stdout, "[Bridge-#%" PRIu64 "] ", index);
-				break;
-			case Component::BridgeFactory:
-				fputs("[Bridge Factory] ", stdout);
-				break;
-			case Component::Core:
-				fputs("[Core] ", stdout);
-				break;
+	size_t OutputHelper::FormatPrefix(char* buf, size_t size, bool has_timestamp, bool has_component, Component comp, IndexDistributor::Index_t index) {
+		int count = 0;
+		buf[0] = '\0';
+		if (has_timestamp) {
+			float time = (float)(GetSysTimeMicros() - g_logTimeZero);
+			count += snprintf(buf, size, "%10.6f ", time * 1e-6);
 		}
+		if (has_component) {
+			char* cur = buf + count;
+			size_t remain = size - count;
+			switch (comp) {
+				case Component::TcpInstance:
+					count += snprintf(cur, remain, "[Tcp-#%" PRIu64 "] ", index);
+					break;
+				case Component::TcpFactory:
+					count += snprintf(cur, remain, "[Tcp Factory] ");
+					break;
+				case Component::GnsInstance:
+					count += snprintf(cur, remain, "[Gns-#%" PRIu64 "] ", index);
+					break;
+				case Component::GnsFactory:
+					count += snprintf(cur, remain, "[Gns Factory] ");
+					break;
+				case Component::BridgeInstance:
+					count += snprintf(cur, remain, "[Bridge-#%" PRIu64 "] ", index);
+					break;
+				case Component::BridgeFactory:
+					count += snprintf(cur, remain, "[Bridge Factory] ");
+					break;
+				case Component::Core:
+					count += snprintf(cur, remain, "[Core] ");
+					break;
+			}
+		}
+		return static_cast<size_t>(count);
 	}
 
-	void OutputHelper::PrintMessage(const char* fmt, va_list ap) {
-		vfprintf(stdout, fmt, ap);
-		fputc('\n', stdout);
-		fflush(stdout);
+	void OutputHelper::WriterWorker(std::stop_token st) {
+		std::string batch;
+		batch.reserve(LOG_LINE_CAPACITY * 64u);
+		ThreadInventory::Register("logger", NO_INDEX);
+		// tracer may be enabled after this thread started, so name it again when recording.
+		bool is_trace_named = false;
+
+		while (true) {
+			bool is_stopping = st.stop_requested();
+
+			// pick up all filled slots. we are the only consumer.
+			size_t pos = mDequeuePos.load(std::memory_order_relaxed), start_pos = pos;
+			while (true) {
+				LogSlot& slot = mSlots[pos & (LOG_QUEUE_CAPACITY - 1u)];
+				if (slot.mSequence.load(std::memory_order_acquire) != pos + 1u) break;
+
+				batch.append(slot.mText, slot.mLength);
+				slot.mSequence.store(pos + LOG_QUEUE_CAPACITY, std::memory_order_release);
+				++pos;
+			}
+
+			// write them in one call
+			if (!batch.empty()) {
+				uint64_t flush_start = CommonOpers::GetMonotonicTime();
+				{
+					std::lock_guard locker(mFileMutex);
+					fwrite(batch.data(), sizeof(char), batch.size(), mFile);
+					fflush(mFile);
+				}
+				batch.clear();
+
+				if (Tracer::IsEnabled()) {
+					if (!is_trace_named) {
+						Tracer::SetThreadName("logger", NO_INDEX);
+						is_trace_named = true;
+					}
+					Tracer::Complete("log", "flush", NO_INDEX, flush_start, pos - start_pos);
+				}
+			}
+			// update position after writing, so Flush() can know lines have been written.
+			mDequeuePos.store(pos, std::memory_order_release);
+
+			// quit after the last round, or sleep.
+			if (is_stopping) return;
+			std::this_thread::sleep_for(LOG_FLUSH_INTERVAL);
+		}
 	}
 
 	void OutputHelper::NukeProcess(int rc) {
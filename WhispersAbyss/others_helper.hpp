@@ -1,10 +1,18 @@
 #pragma once
+#include "alloc_profiler.hpp"
+#include "lock_profiler.hpp"
+#include "thread_inventory.hpp"
 #include <cinttypes>
 #include <mutex>
 #include <chrono>
 #include <deque>
 #include <functional>
 #include <stdexcept>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
 
 namespace WhispersAbyss {
 
@@ -28,6 +36,94 @@ namespace WhispersAbyss {
 	/// The interval for waiting module starting to running.
 	/// </summary>
 	constexpr const double MODULE_WAITING_INTERVAL = 10000;	// 10 secs
+	/// <summary>
+	/// The count of threads running Initializing and Stopping transitions.
+	/// </summary>
+	constexpr const size_t LIFECYCLE_THREAD_COUNT = 4u;
+	/// <summary>
+	/// How long the resolved server address will be kept in cache.
+	/// </summary>
+	constexpr const std::chrono::seconds RESOLVE_CACHE_TTL(60);
+	/// <summary>
+	/// How many GNS connections can be raced at the same time when connecting server.
+	/// </summary>
+	constexpr const size_t GNS_RACING_COUNT = 3u;
+	/// <summary>
+	/// The delay between starting 2 racing GNS connections.
+	/// </summary>
+	constexpr const std::chrono::milliseconds GNS_RACING_DELAY(250);
+	/// <summary>
+	/// How many server messages can be buffered for a detached session waiting Tcp reattaching.
+	/// </summary>
+	constexpr const size_t RESUME_BUFFER_CAPACITY = 2048u;
+	/// <summary>
+	/// The max length of one log line, including timestamp and component. Longer line will be truncated.
+	/// </summary>
+	constexpr const size_t LOG_LINE_CAPACITY = 512u;
+	/// <summary>
+	/// How many log lines can be queued before writing. Must be power of 2. Log will be dropped if full.
+	/// </summary>
+	constexpr const size_t LOG_QUEUE_CAPACITY = 4096u;
+	/// <summary>
+	/// The interval for log writer checking new lines.
+	/// </summary>
+	constexpr const std::chrono::milliseconds LOG_FLUSH_INTERVAL(5);
+	/// <summary>
+	/// The sliding window used for computing throughput rates.
+	/// </summary>
+	constexpr const std::chrono::seconds THROUGHPUT_WINDOW(5);
+	/// <summary>
+	/// The interval for sampling GNS real-time connection status.
+	/// </summary>
+	constexpr const std::chrono::milliseconds GNS_STATUS_INTERVAL(1000);
+	/// <summary>
+	/// The max length of GNS detailed connection status text.
+	/// </summary>
+	constexpr const size_t GNS_DETAILED_STATUS_CAPACITY = 4096u;
+	/// <summary>
+	/// The interval for publishing metrics snapshot.
+	/// </summary>
+	constexpr const std::chrono::milliseconds METRICS_INTERVAL(1000);
+	/// <summary>
+	/// Metrics client should send its request in this time, otherwise it will be disconnected.
+	/// </summary>
+	constexpr const std::chrono::milliseconds METRICS_REQUEST_TIMEOUT(2000);
+	/// <summary>
+	/// The max size of HTTP request accepted by metrics server.
+	/// </summary>
+	constexpr const size_t METRICS_REQUEST_CAPACITY = 8192u;
+	/// <summary>
+	/// The wait before accepting again when metrics server fails to accept, like running out of file descriptors.
+	/// </summary>
+	constexpr const std::chrono::milliseconds METRICS_ACCEPT_RETRY_INTERVAL(1000);
+	/// <summary>
+	/// The count of opcodes counted separately. Opcodes out of this range are counted as unknown.
+	/// </summary>
+	constexpr const uint32_t OPCODE_SLOT_COUNT = 64u;
+	/// <summary>
+	/// How many opcodes are shown in each opcode table of profile.
+	/// </summary>
+	constexpr const size_t OPCODE_TOP_COUNT = 5u;
+	/// <summary>
+	/// How many trace events are kept for each thread. Older events are overwritten.
+	/// </summary>
+	constexpr const size_t TRACE_BUFFER_CAPACITY = 16384u;
+	/// <summary>
+	/// How many trace buffers of exited threads are kept. The oldest ones are dropped.
+	/// </summary>
+	constexpr const size_t TRACE_RETIRED_BUFFER_COUNT = 256u;
+	/// <summary>
+	/// The interval for capture writer writing buffered records into file.
+	/// </summary>
+	constexpr const std::chrono::milliseconds CAPTURE_FLUSH_INTERVAL(20);
+	/// <summary>
+	/// The max bytes of records waiting for writing. Records will be dropped if writer falls behind this much.
+	/// </summary>
+	constexpr const size_t CAPTURE_BUFFER_CAPACITY = 64u * 1024u * 1024u;
+	/// <summary>
+	/// How many busiest threads are listed under thread table of profile.
+	/// </summary>
+	constexpr const size_t THREAD_BUSIEST_COUNT = 5u;
 
 	namespace StateMachine {
 		using State_t = uint32_t;
@@ -42,6 +138,7 @@ namespace WhispersAbyss {
 		template<class T>
 		void MoveDeque(std::deque<T>& _from, std::deque<T>& _to) {
 			// https://stackoverflow.com/questions/49928501/better-way-to-move-objects-from-one-stddeque-to-another
+			ABYSS_ALLOC_SCOPE(DequeNode);
 			_to.insert(_to.end(),
 				std::make_move_iterator(_from.begin()),
 				std::make_move_iterator(_from.end())
@@ -52,6 +149,10 @@ namespace WhispersAbyss {
 
 		const char* State2String(StateMachine::State_t state);
 		void AppendStrF(std::string& strl, const char* fmt, ...);
+		/// <summary>
+		/// Get a cheap monotonic timestamp in nanoseconds. Only the difference of 2 timestamps is meaningful.
+		/// </summary>
+		uint64_t GetMonotonicTime();
 
 	}
 
@@ -113,15 +214,23 @@ namespace WhispersAbyss {
 		using DestroyFunc_t = std::function<void(_Ty)>;
 	private:
 		std::mutex mMutex;
+		/// <summary>
+		/// Set when disposal worker returns. Declared before thread, so it outlives the thread.
+		/// </summary>
+		std::atomic_bool mIsExited;
 		std::jthread mTdDisposal;
 		std::deque<_Ty> mDequeDisposal;
 		DestroyFunc_t mDestroyFunc;
+		/// <summary>
+		/// The count of moved items which are not destroyed yet, including the ones being destroyed.
+		/// </summary>
+		std::atomic_size_t mPendingCount;
 
 	public:
 		DisposalHelper() :
 			mMutex(),
-			mTdDisposal(), mDequeDisposal(),
-			mDestroyFunc(nullptr)
+			mIsExited(true), mTdDisposal(), mDequeDisposal(),
+			mDestroyFunc(nullptr), mPendingCount(0u)
 		{}
 		DisposalHelper(const DisposalHelper& rhs) = delete;
 		DisposalHelper(DisposalHelper&& rhs) = delete;
@@ -132,10 +241,13 @@ namespace WhispersAbyss {
 		Because this is a helper class. Caller must make sure Start(), Stop(), Move() can not be called at the same time.
 		*/
 
-		void Start(DestroyFunc_t pfDestroy) {
+		/// <param name="thread_role">The name of disposal thread in ThreadInventory. Must be a static string.</param>
+		void Start(DestroyFunc_t pfDestroy, const char* thread_role) {
 			if (pfDestroy == nullptr) throw std::logic_error("DestroyFunc_t should not be nullptr!");
+			ABYSS_ALLOC_SCOPE(Disposal);
 			mDestroyFunc = pfDestroy;
-			mTdDisposal = std::jthread(std::bind(&DisposalHelper::DisposalWorker, this, std::placeholders::_1));
+			mIsExited.store(false);
+			mTdDisposal = std::jthread(std::bind(&DisposalHelper::DisposalWorker, this, std::placeholders::_1, thread_role));
 		}
 		void Stop() {
 			if (this->mTdDisposal.joinable()) {
@@ -143,16 +255,33 @@ namespace WhispersAbyss {
 				this->mTdDisposal.join();
 			}
 		}
+		/// <summary>
+		/// <para>Order disposal worker to exit once all items are destroyed, without waiting it.</para>
+		/// <para>Poll IsExited(), then call Stop() to join it, like LifecycleExecutor::StopDisposal() does.</para>
+		/// </summary>
+		void RequestStop() {
+			this->mTdDisposal.request_stop();
+		}
+		bool IsExited() const { return mIsExited.load(std::memory_order_acquire); }
 		void Move(_Ty v) {
+			ABYSS_ALLOC_SCOPE(Disposal);
 			std::lock_guard locker(mMutex);
 			mDequeDisposal.emplace_back(v);
+			mPendingCount.fetch_add(1u, std::memory_order_relaxed);
 		}
 		void Move(std::deque<_Ty>& v) {
+			ABYSS_ALLOC_SCOPE(Disposal);
 			std::lock_guard locker(mMutex);
+			mPendingCount.fetch_add(v.size(), std::memory_order_relaxed);
 			CommonOpers::MoveDeque(v, mDequeDisposal);
 		}
+		/// <summary>
+		/// Get how many items are waiting for or under disposal. Can be called from any thread.
+		/// </summary>
+		size_t GetPendingCount() const { return mPendingCount.load(std::memory_order_relaxed); }
 	private:
-		void DisposalWorker(std::stop_token st) {
+		void DisposalWorker(std::stop_token st, const char* thread_role) {
+			ThreadInventory::Register(thread_role, NO_INDEX);
 			std::deque<_Ty> cache;
 			while (true) {
 				// copy first
@@ -164,7 +293,10 @@ namespace WhispersAbyss {
 				// no item
 				if (cache.empty()) {
 					// quit if ordered.
-					if (st.stop_requested()) return;
+					if (st.stop_requested()) {
+						mIsExited.store(true, std::memory_order_release);
+						return;
+					}
 					// otherwise sleep
 					std::this_thread::sleep_for(DISPOSAL_INTERVAL);
 					continue;
@@ -174,6 +306,7 @@ namespace WhispersAbyss {
 				// then return index and free them.
 				for (auto& ptr : cache) {
 					mDestroyFunc(ptr);
+					mPendingCount.fetch_sub(1u, std::memory_order_relaxed);
 				}
 				cache.clear();
 			}
@@ -181,6 +314,22 @@ namespace WhispersAbyss {
 
 	};
 
+	struct OutputHelperProfile {
+		uint64_t mLoggedLines, mDroppedLines;
+		uint64_t mCallTimeTotal, mCallTimeMax;	// in nanoseconds. the time spent in Printf by callers.
+	};
+
+	/*
+	OutputHelper is an asynchronous logger.
+
+	Printf() format the line into a slot of a bounded lock-free ring queue and return immediately.
+	A background writer thread pick up lines in batch and write them into stdout or log file.
+	If queue is full, the line will be dropped and counted, instead of blocking caller.
+
+	RawPrintf() and FatalError() are not in hot path. They wait until queued lines written,
+	then write directly, so that big text like profile can be shown completely and in order.
+	*/
+
 	class OutputHelper {
 	public:
 		enum class Component {
@@ -191,8 +340,16 @@ namespace WhispersAbyss {
 		};
 
 		OutputHelper();
+		OutputHelper(const OutputHelper& rhs) = delete;
+		OutputHelper(OutputHelper&& rhs) = delete;
 		~OutputHelper();
 
+		/// <summary>
+		/// Write log into given file instead of stdout.
+		/// </summary>
+		/// <returns>True if success.</returns>
+		bool OpenLogFile(const char* path);
+
 		/// <summary>
 		/// Print fatal error and try to nuke process.
 		/// </summary>
@@ -207,13 +364,40 @@ namespace WhispersAbyss {
 		/// Print log without timestamp.
 		/// </summary>
 		void RawPrintf(const char* fmt, ...);
+		/// <summary>
+		/// Wait until all queued lines have been written.
+		/// </summary>
+		void Flush();
+		OutputHelperProfile ReportStatus();
 	private:
+		struct LogSlot {
+			/// <summary>
+			/// The sequence number of bounded MPMC queue (Dmitry Vyukov).
+			/// Equal to position when slot is free. Equal to position + 1 when slot is filled.
+			/// </summary>
+			std::atomic_size_t mSequence;
+			size_t mLength;
+			char mText[LOG_LINE_CAPACITY];
+		};
+
 		int64_t g_logTimeZero;
-		std::mutex mMutex;
+		/// <summary>
+		/// Protect mFile. Only held by writer thread, RawPrintf and FatalError. Printf never touch it.
+		/// </summary>
+		AbyssMutex mFileMutex;
+		FILE* mFile;
+
+		std::unique_ptr<LogSlot[]> mSlots;
+		alignas(64) std::atomic_size_t mEnqueuePos;
+		alignas(64) std::atomic_size_t mDequeuePos;
+		std::atomic_uint64_t mLoggedLines, mDroppedLines, mCallTimeTotal, mCallTimeMax;
+
+		std::jthread mTdWriter;
 
-		void PrintTimestamp();
-		void PrintComponent(Component comp, IndexDistributor::Index_t index);
-		void PrintMessage(const char* fmt, va_list ap);
+		void PushLine(bool has_component, Component comp, IndexDistributor::Index_t index, const char* fmt, va_list ap);
+		void WriteDirectly(bool has_timestamp, bool has_component, Component comp, IndexDistributor::Index_t index, const char* fmt, va_list ap);
+		size_t FormatPrefix(char* buf, size_t size, bool has_timestamp, bool has_component, Component comp, IndexDistributor::Index_t index);
+		void WriterWorker(std::stop_token st);
 		void NukeProcess(int rc);
 		int64_t GetSysTimeMicros();
 	};
@@ -0,0 +1,55 @@
+#pragma once
+
+/*
+Static tracepoints (USDT) on the forwarding path, for attaching bpftrace or perf to a running process.
+
+They are only compiled by the Linux build with -DWHISPERS_ABYSS_USDT=ON, which needs dtrace and <sys/sdt.h>
+(install systemtap-sdt-dev or systemtap-sdt-devel). Probes are declared in probes.d too, see there.
+Otherwise every probe expands to nothing and its arguments are not evaluated, so do not put side effects in arguments.
+
+A compiled probe is a single nop guarded by its semaphore, which is only set while a tracer is attached,
+so its arguments are not evaluated either until then. Values only used by a probe, like a start timestamp,
+should be computed under ABYSS_PROBE_ENABLED(name) for the same reason.
+
+Provider is whispers_abyss. All probes and their arguments:
+
+tcp_frame(index, flag, size)
+	TcpInstance::RecvWorker parsed a frame. flag is TcpCommandType, size is body size.
+tcp_write(index, msg_count, cmd_count, start_ns, end_ns)
+	TcpInstance::SendWorker wrote a batch into socket.
+gns_recv(index, msg_count, queue_size)
+	GnsInstance::RecvGns fetched a batch from GNS. queue_size is the count of messages still pending in internal buffer before this batch.
+gns_send(index, msg_count, start_ns, end_ns)
+	GnsInstance::SendGns handed a batch to GNS.
+queue_warning(component, index, size, is_recv)
+queue_nuke(component, index, size, is_recv)
+	CheckSize found a message list reaching WARNING_CAPACITY or NUKE_CAPACITY. component is "tcp" or "gns".
+transition_begin(core, state, is_stopping)
+transition_end(core, from, to)
+	A StateMachineCore entered or finished a transition. core is its address, used to pair both probes.
+
+Timestamps are got from CommonOpers::GetMonotonicTime().
+See AbyssProbes/ for example scripts.
+*/
+
+#if defined(WHISPERS_ABYSS_USDT) && !defined(_WIN32)
+
+// generated from probes.d by dtrace -h. It declares whispers_abyss_[name]_semaphore and includes <sys/sdt.h>.
+#include "abyss_probes_generated.h"
+
+#define ABYSS_PROBE_ENABLED(name) (__builtin_expect(whispers_abyss_##name##_semaphore, 0) != 0)
+#define ABYSS_PROBE3(name, a1, a2, a3) \
+	do { if (ABYSS_PROBE_ENABLED(name)) DTRACE_PROBE3(whispers_abyss, name, a1, a2, a3); } while (0)
+#define ABYSS_PROBE4(name, a1, a2, a3, a4) \
+	do { if (ABYSS_PROBE_ENABLED(name)) DTRACE_PROBE4(whispers_abyss, name, a1, a2, a3, a4); } while (0)
+#define ABYSS_PROBE5(name, a1, a2, a3, a4, a5) \
+	do { if (ABYSS_PROBE_ENABLED(name)) DTRACE_PROBE5(whispers_abyss, name, a1, a2, a3, a4, a5); } while (0)
+
+#else
+
+#define ABYSS_PROBE_ENABLED(name) false
+#define ABYSS_PROBE3(name, a1, a2, a3) ((void)0)
+#define ABYSS_PROBE4(name, a1, a2, a3, a4) ((void)0)
+#define ABYSS_PROBE5(name, a1, a2, a3, a4, a5) ((void)0)
+
+#endif
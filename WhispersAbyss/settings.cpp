@@ -0,0 +1,103 @@
+#include "settings.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+
+namespace WhispersAbyss {
+
+	AbyssSettings::AbyssSettings() :
+		mAcceptPort(0u),
+		mResumeWindow(0),
+		mLogFile(),
+		mMetricsPort(0u),
+		mStatsName(),
+		mOpcodeStats(false),
+		mTraceFile(),
+		mCaptureFile(),
+		mImpairment{ 0, 0.0f, 0.0f, 0, 0.0f, 0 }
+	{}
+
+	bool GnsImpairment::IsEnabled() const {
+		return mLag != 0 || mLoss != 0.0f || mReorder != 0.0f || mDup != 0.0f;
+	}
+
+	static bool ParseUnsigned(const char* str, unsigned long max_value, unsigned long& result) {
+		char* end = nullptr;
+		result = strtoul(str, &end, 10);
+		if (end == str || *end != '\0') return false;
+		if (result == ULONG_MAX || result > max_value) return false;
+		return true;
+	}
+
+	bool AbyssSettings::Parse(int argc, char* argv[], std::string& error) {
+		if (argc < 2) {
+			error = "Wrong arguments.";
+			return false;
+		}
+
+		// accept port
+		unsigned long value;
+		if (!ParseUnsigned(argv[1], 65535u, value)) {
+			error = "Wrong arguments. Port value is illegal.";
+			return false;
+		}
+		mAcceptPort = static_cast<uint16_t>(value);
+
+		// options
+		for (int i = 2; i < argc; ++i) {
+			const char* opt = argv[i];
+			if (i + 1 >= argc) {
+				error = std::string("Wrong arguments. Missing value of option: ") + opt;
+				return false;
+			}
+			const char* opt_value = argv[++i];
+
+			if (strcmp(opt, "--resume-window") == 0) {
+				if (!ParseUnsigned(opt_value, 3600000u, value)) {
+					error = "Wrong arguments. Resumption window is illegal.";
+					return false;
+				}
+				mResumeWindow = std::chrono::milliseconds(value);
+			} else if (strcmp(opt, "--log-file") == 0) {
+				mLogFile = opt_value;
+			} else if (strcmp(opt, "--metrics-port") == 0) {
+				if (!ParseUnsigned(opt_value, 65535u, value)) {
+					error = "Wrong arguments. Metrics port is illegal.";
+					return false;
+				}
+				mMetricsPort = static_cast<uint16_t>(value);
+			} else if (strcmp(opt, "--stats-name") == 0) {
+				mStatsName = opt_value;
+			} else if (strcmp(opt, "--opcode-stats") == 0) {
+				if (!ParseUnsigned(opt_value, 1u, value)) {
+					error = "Wrong arguments. Opcode statistics switch should be 0 or 1.";
+					return false;
+				}
+				mOpcodeStats = value != 0u;
+			} else if (strcmp(opt, "--trace-file") == 0) {
+				mTraceFile = opt_value;
+			} else if (strcmp(opt, "--capture-file") == 0) {
+				mCaptureFile = opt_value;
+			} else {
+				error = std::string("Wrong arguments. Unknown option: ") + opt;
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	void AbyssSettings::PrintSyntax() {
+		puts("Syntax: WhispersAbyss [accept_port] [options...]");
+		puts("Options:");
+		puts("\t--resume-window [ms]\tKeep GNS session for given milliseconds after Tcp connection dropped. 0 to disable. Default is 0.");
+		puts("\t--stats-name [name]\tPublish statistics in the shared memory with given name. Read it by AbyssTop. Default is disabled.");
+		puts("\t--opcode-stats [0/1]\tCount traffic per BMMO opcode and show it in profile. Default is 0.");
+		puts("\t--trace-file [path]\tRecord trace events and write them into given file as Chrome trace JSON on exit or when t is pressed. Default is disabled.");
+		puts("\t--capture-file [path]\tRecord every forwarded message into given file for replaying by AbyssBench. Default is disabled.");
+		puts("\t--log-file [path]\tAppend log into given file instead of showing it in console.");
+		puts("\t--metrics-port [port]\tServe Prometheus metrics at http://127.0.0.1:[port]/metrics. 0 to disable. Default is 0.");
+	}
+
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cinttypes>
+#include <chrono>
+#include <string>
+
+namespace WhispersAbyss {
+
+	/// <summary>
+	/// <para>The fake network conditions applied by GNS. All zero mean no impairment.</para>
+	/// <para>GNS only accepts them as global options, so they apply to every packet sent by any GNS connection of this process.</para>
+	/// </summary>
+	struct GnsImpairment {
+		int32_t mLag;	// in milliseconds
+		float mLoss;	// in percent
+		float mReorder;	// the percent of packets delayed by extra mReorderTime
+		int32_t mReorderTime;	// in milliseconds
+		float mDup;	// the percent of packets sent twice, the copy delayed up to mDupTimeMax
+		int32_t mDupTimeMax;	// in milliseconds
+
+		bool IsEnabled() const;
+	};
+
+	/// <summary>
+	/// The settings provided by command line. Shared by all factories. Read only after parsing.
+	/// </summary>
+	struct AbyssSettings {
+		AbyssSettings();
+
+		/// <summary>
+		/// The port which will accept TCP connections.
+		/// </summary>
+		uint16_t mAcceptPort;
+		/// <summary>
+		/// How long a bridge keep its GNS session after its Tcp connection dropped. 0 mean disabled.
+		/// </summary>
+		std::chrono::milliseconds mResumeWindow;
+		/// <summary>
+		/// Write log into this file instead of stdout. Empty mean stdout.
+		/// </summary>
+		std::string mLogFile;
+		/// <summary>
+		/// The loopback port serving Prometheus metrics. 0 mean disabled.
+		/// </summary>
+		uint16_t mMetricsPort;
+		/// <summary>
+		/// The name of shared memory statistics page. Empty mean disabled.
+		/// </summary>
+		std::string mStatsName;
+		/// <summary>
+		/// Inspect the opcode of every payload and count traffic per opcode.
+		/// </summary>
+		bool mOpcodeStats;
+		/// <summary>
+		/// The file receiving Chrome trace JSON. Empty mean tracing is disabled.
+		/// </summary>
+		std::string mTraceFile;
+		/// <summary>
+		/// The file receiving every forwarded message. Empty mean capture is disabled.
+		/// </summary>
+		std::string mCaptureFile;
+		/// <summary>
+		/// Not provided by command line. Set by AbyssBench to impair the GNS side of benchmarks.
+		/// </summary>
+		GnsImpairment mImpairment;
+
+		/// <summary>
+		/// Parse command line arguments.
+		/// </summary>
+		/// <param name="error">The reason if parsing failed.</param>
+		/// <returns>True if success.</returns>
+		bool Parse(int argc, char* argv[], std::string& error);
+		/// <summary>
+		/// Print command line syntax.
+		/// </summary>
+		static void PrintSyntax();
+	};
+
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include "others_helper.hpp"
+#include "probes.hpp"
 #include <cinttypes>
 #include <mutex>
 #include <chrono>
@@ -66,7 +67,7 @@ namespace WhispersAbyss::StateMachine {
 		StateMachineCore(State_t init_state) :
 			mState(init_state), mIsInTransition(false),
 			mHasRunInitializing(false), mHasRunStopping(false),
-			mRefCounter(0u), mStateMutex() {}
+			mRefCounter(0u), mStateMutex("state") {}
 		~StateMachineCore() {
 			// Self spin until all reference has been released.
 			while (true) {
@@ -112,7 +113,7 @@ namespace WhispersAbyss::StateMachine {
 		/// <summary>
 		/// Core mutex
 		/// </summary>
-		std::mutex mStateMutex;
+		AbyssMutex mStateMutex;
 
 		void IncRefCounter() { ++mRefCounter; }
 		void DecRefCounter() { if (mRefCounter != 0u) --mRefCounter; }
@@ -175,34 +176,21 @@ namespace WhispersAbyss::StateMachine {
 	class TransitionInitializing {
 	public:
 		TransitionInitializing(StateMachineCore& sm) :
-			mStateMachine(&sm), mCanTransition(false), mHasProblem(false) {
-			while (true) {
-				std::lock_guard locker(mStateMachine->mStateMutex);
-				mStateMachine->IncRefCounter();
-				break;
-			}
-
+			TransitionInitializing(sm, std::defer_lock) {
 			// loop until no transition running
-			while (true) {
-				mStateMachine->mStateMutex.lock();
-
-				if (mStateMachine->mIsInTransition) {
-					mStateMachine->mStateMutex.unlock();
-					std::this_thread::sleep_for(SPIN_INTERVAL);
-					continue;
-				}
-
-				if (mStateMachine->mState == Ready && !mStateMachine->mHasRunInitializing) {
-					mCanTransition = true;
-					mStateMachine->mHasRunInitializing = true;
-					mStateMachine->mIsInTransition = true;
-				} else {
-					mCanTransition = false;
-				}
-				mStateMachine->mStateMutex.unlock();
-				break;
+			while (!TryEnter()) {
+				std::this_thread::sleep_for(SPIN_INTERVAL);
 			}
-
+		}
+		/// <summary>
+		/// <para>Deferred version. Only hold the reference of state machine and do not wait.</para>
+		/// <para>Caller should call TryEnter() until it return true, then check CanTransition().</para>
+		/// <para>Used by the transitions running in LifecycleExecutor which should not block its thread.</para>
+		/// </summary>
+		TransitionInitializing(StateMachineCore& sm, std::defer_lock_t) :
+			mStateMachine(&sm), mCanTransition(false), mHasProblem(false) {
+			std::lock_guard locker(mStateMachine->mStateMutex);
+			mStateMachine->IncRefCounter();
 		}
 		~TransitionInitializing() {
 			std::lock_guard locker(mStateMachine->mStateMutex);
@@ -211,11 +199,32 @@ namespace WhispersAbyss::StateMachine {
 			if (mCanTransition) {
 				mStateMachine->mState = mHasProblem ? Stopped : Running;
 				mStateMachine->mIsInTransition = false;
+				ABYSS_PROBE3(transition_end, mStateMachine, Ready, mStateMachine->mState);
 			}
 		}
 		TransitionInitializing(const TransitionInitializing& rhs) = delete;
 		TransitionInitializing(TransitionInitializing&& rhs) = delete;
 
+		/// <summary>
+		/// <para>Try to decide whether this transition can run.</para>
+		/// <para>Return false if other transition is running. Caller should try it later.</para>
+		/// </summary>
+		/// <returns></returns>
+		bool TryEnter() {
+			std::lock_guard locker(mStateMachine->mStateMutex);
+
+			if (mStateMachine->mIsInTransition) return false;
+
+			if (mStateMachine->mState == Ready && !mStateMachine->mHasRunInitializing) {
+				mCanTransition = true;
+				mStateMachine->mHasRunInitializing = true;
+				mStateMachine->mIsInTransition = true;
+				ABYSS_PROBE3(transition_begin, mStateMachine, mStateMachine->mState, false);
+			} else {
+				mCanTransition = false;
+			}
+			return true;
+		}
 		/// <summary>
 		/// Check whether caller can start transition work.
 		/// </summary>
@@ -235,38 +244,26 @@ namespace WhispersAbyss::StateMachine {
 	{
 	public:
 		TransitionStopping(StateMachineCore& sm) :
-			mStateMachine(&sm), mCanTransition(false) {
-			while (true) {
-				std::lock_guard locker(mStateMachine->mStateMutex);
-				mStateMachine->IncRefCounter();
-				break;
-			}
-
-			while (true) {
-				mStateMachine->mStateMutex.lock();
-
-				if (mStateMachine->mIsInTransition) {
-					mStateMachine->mStateMutex.unlock();
-					std::this_thread::sleep_for(SPIN_INTERVAL);
-					continue;
-				}
-
-				if ((mStateMachine->mState == Ready || mStateMachine->mState == Running) && !mStateMachine->mHasRunStopping) {
-					mCanTransition = true;
-					mStateMachine->mHasRunStopping = true;
-					mStateMachine->mIsInTransition = true;
-				} else {
-					mCanTransition = false;
-				}
-				mStateMachine->mStateMutex.unlock();
-				break;
+			TransitionStopping(sm, std::defer_lock) {
+			while (!TryEnter()) {
+				std::this_thread::sleep_for(SPIN_INTERVAL);
 			}
 		}
+		/// <summary>
+		/// <para>Deferred version. Only hold the reference of state machine and do not wait.</para>
+		/// <para>Same usage as the deferred version of TransitionInitializing.</para>
+		/// </summary>
+		TransitionStopping(StateMachineCore& sm, std::defer_lock_t) :
+			mStateMachine(&sm), mCanTransition(false) {
+			std::lock_guard locker(mStateMachine->mStateMutex);
+			mStateMachine->IncRefCounter();
+		}
 		~TransitionStopping() {
 			std::lock_guard locker(mStateMachine->mStateMutex);
 			mStateMachine->DecRefCounter();
 
 			if (mCanTransition) {
+				ABYSS_PROBE3(transition_end, mStateMachine, mStateMachine->mState, Stopped);
 				mStateMachine->mState = Stopped;
 				mStateMachine->mIsInTransition = false;
 			}
@@ -274,6 +271,26 @@ namespace WhispersAbyss::StateMachine {
 		TransitionStopping(const TransitionStopping& rhs) = delete;
 		TransitionStopping(TransitionStopping&& rhs) = delete;
 
+		/// <summary>
+		/// <para>Try to decide whether this transition can run.</para>
+		/// <para>Return false if other transition is running. Caller should try it later.</para>
+		/// </summary>
+		/// <returns></returns>
+		bool TryEnter() {
+			std::lock_guard locker(mStateMachine->mStateMutex);
+
+			if (mStateMachine->mIsInTransition) return false;
+
+			if ((mStateMachine->mState == Ready || mStateMachine->mState == Running) && !mStateMachine->mHasRunStopping) {
+				mCanTransition = true;
+				mStateMachine->mHasRunStopping = true;
+				mStateMachine->mIsInTransition = true;
+				ABYSS_PROBE3(transition_begin, mStateMachine, mStateMachine->mState, true);
+			} else {
+				mCanTransition = false;
+			}
+			return true;
+		}
 		/// <summary>
 		/// Check whether caller can start transition work.
 		/// </summary>
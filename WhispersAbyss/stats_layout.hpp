@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+/*
+The layout of the statistics page published by WhispersAbyss in a named shared memory.
+This header is shared by WhispersAbyss (writer) and AbyssTop (reader),
+so it only depends on standard library.
+
+The page is fixed size and never grows. It starts with a header,
+followed by a global section and STATS_SLOT_COUNT bridge slots.
+Every section is guarded by its own seqlock and only has one writer at any time:
+the global section is written by BridgeFactory context,
+a bridge slot is written by the context of the bridge owning it.
+Readers never block writers. They just retry if a section was changed during reading.
+
+Increase STATS_PAGE_VERSION if any layout changed.
+*/
+
+namespace WhispersAbyss {
+
+	constexpr const uint32_t STATS_PAGE_MAGIC = 0x53594241u;	// "ABYS" in little endian
+	constexpr const uint32_t STATS_PAGE_VERSION = 1u;
+	/// <summary>
+	/// The count of bridge slots. Bridges created when all slots are occupied are not published.
+	/// </summary>
+	constexpr const uint32_t STATS_SLOT_COUNT = 256u;
+
+	namespace StatsSlotFlags {
+		using Flags_t = uint32_t;
+		constexpr const Flags_t InUse = 0b1;
+		constexpr const Flags_t Running = 0b10;
+		constexpr const Flags_t Detached = 0b100;
+		constexpr const Flags_t Switching = 0b1000;
+	}
+
+	/// <summary>
+	/// <para>Single writer sequence lock living in shared memory.</para>
+	/// <para>All data guarded by it should be atomic and accessed with relaxed order,
+	/// so that a torn read is only a retry, never an undefined behavior.</para>
+	/// </summary>
+	struct StatsSeqlock {
+		std::atomic_uint32_t mSequence;
+
+		template<class _TFunc>
+		void Write(_TFunc&& func) {
+			uint32_t seq = mSequence.load(std::memory_order_relaxed);
+			mSequence.store(seq + 1u, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			func();
+			mSequence.store(seq + 2u, std::memory_order_release);
+		}
+		/// <summary>
+		/// Try reading once.
+		/// </summary>
+		/// <returns>True if what func read is consistent. Otherwise, caller should retry.</returns>
+		template<class _TFunc>
+		bool TryRead(_TFunc&& func) const {
+			uint32_t seq = mSequence.load(std::memory_order_acquire);
+			if (seq & 1u) return false;
+			func();
+			std::atomic_thread_fence(std::memory_order_acquire);
+			return mSequence.load(std::memory_order_relaxed) == seq;
+		}
+	};
+
+	struct StatsCounters {
+		std::atomic_uint64_t mRecvTcp, mSendTcp, mRecvGns, mSendGns;
+		std::atomic_uint64_t mRecvTcpBytes, mSendTcpBytes, mRecvGnsBytes, mSendGnsBytes;
+	};
+	/// <summary>
+	/// The plain copy of StatsCounters, used by writer and reader to move data in and out of page.
+	/// </summary>
+	struct StatsCountersValue {
+		uint64_t mRecvTcp, mSendTcp, mRecvGns, mSendGns;
+		uint64_t mRecvTcpBytes, mSendTcpBytes, mRecvGnsBytes, mSendGnsBytes;
+
+		StatsCountersValue& operator+=(const StatsCountersValue& rhs) {
+			mRecvTcp += rhs.mRecvTcp; mSendTcp += rhs.mSendTcp; mRecvGns += rhs.mRecvGns; mSendGns += rhs.mSendGns;
+			mRecvTcpBytes += rhs.mRecvTcpBytes; mSendTcpBytes += rhs.mSendTcpBytes; mRecvGnsBytes += rhs.mRecvGnsBytes; mSendGnsBytes += rhs.mSendGnsBytes;
+			return *this;
+		}
+		void StoreTo(StatsCounters& dst) const {
+			dst.mRecvTcp.store(mRecvTcp, std::memory_order_relaxed);
+			dst.mSendTcp.store(mSendTcp, std::memory_order_relaxed);
+			dst.mRecvGns.store(mRecvGns, std::memory_order_relaxed);
+			dst.mSendGns.store(mSendGns, std::memory_order_relaxed);
+			dst.mRecvTcpBytes.store(mRecvTcpBytes, std::memory_order_relaxed);
+			dst.mSendTcpBytes.store(mSendTcpBytes, std::memory_order_relaxed);
+			dst.mRecvGnsBytes.store(mRecvGnsBytes, std::memory_order_relaxed);
+			dst.mSendGnsBytes.store(mSendGnsBytes, std::memory_order_relaxed);
+		}
+		void LoadFrom(const StatsCounters& src) {
+			mRecvTcp = src.mRecvTcp.load(std::memory_order_relaxed);
+			mSendTcp = src.mSendTcp.load(std::memory_order_relaxed);
+			mRecvGns = src.mRecvGns.load(std::memory_order_relaxed);
+			mSendGns = src.mSendGns.load(std::memory_order_relaxed);
+			mRecvTcpBytes = src.mRecvTcpBytes.load(std::memory_order_relaxed);
+			mSendTcpBytes = src.mSendTcpBytes.load(std::memory_order_relaxed);
+			mRecvGnsBytes = src.mRecvGnsBytes.load(std::memory_order_relaxed);
+			mSendGnsBytes = src.mSendGnsBytes.load(std::memory_order_relaxed);
+		}
+	};
+
+	struct StatsPageHeader {
+		/// <summary>
+		/// Written at last when page is ready. Reader should check it before anything else.
+		/// </summary>
+		std::atomic_uint32_t mMagic;
+		uint32_t mVersion;
+		uint32_t mPageSize;
+		uint32_t mSlotCount;
+		uint64_t mProcessId;
+		/// <summary>
+		/// Unix time in milliseconds.
+		/// </summary>
+		int64_t mStartTime;
+	};
+
+	struct alignas(64) StatsGlobalSection {
+		StatsSeqlock mLock;
+		std::atomic_uint32_t mBridgeCount;
+		std::atomic_uint32_t mUnpublishedBridgeCount;
+		/// <summary>
+		/// Unix time in milliseconds of the last update. Reader can use it to detect a hung writer.
+		/// </summary>
+		std::atomic_int64_t mUpdateTime;
+		/// <summary>
+		/// Including disposed bridges. Monotonic.
+		/// </summary>
+		StatsCounters mTotal;
+	};
+
+	/// <summary>
+	/// Aligned to cache line, so that bridges do not share lines with each other.
+	/// </summary>
+	struct alignas(64) StatsBridgeSlot {
+		StatsSeqlock mLock;
+		std::atomic_uint32_t mFlags;
+		/// <summary>
+		/// The index of the bridge owning this slot. Index may be reused by later bridges.
+		/// </summary>
+		std::atomic_uint64_t mIndex;
+		StatsCounters mCounters;
+	};
+
+	struct StatsPageLayout {
+		StatsPageHeader mHeader;
+		StatsGlobalSection mGlobal;
+		StatsBridgeSlot mSlots[STATS_SLOT_COUNT];
+	};
+
+	static_assert(std::atomic_uint32_t::is_always_lock_free && std::atomic_uint64_t::is_always_lock_free && std::atomic_int64_t::is_always_lock_free,
+		"Statistics page needs address free atomics.");
+	static_assert(sizeof(StatsBridgeSlot) == 128u, "Bridge slot layout changed. Bump STATS_PAGE_VERSION.");
+
+}
@@ -0,0 +1,221 @@
+#include "stats_page.hpp"
+#include <chrono>
+#include <cstring>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#endif // _WIN32
+
+namespace WhispersAbyss {
+
+	static int64_t GetUnixTimeMillis() {
+		return static_cast<int64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::system_clock::now().time_since_epoch()
+		).count());
+	}
+
+#ifndef _WIN32
+	/// <summary>
+	/// Check whether an existing page is left by a process which has gone, like killed by SIGKILL.
+	/// On Windows, mapping is freed with its last handle, so a page never outlives its writer.
+	/// </summary>
+	/// <returns>
+	/// True if page is ready and its writer is not alive.
+	/// False if it is still used, or it can not be told, like a page being created right now.
+	/// </returns>
+	static bool IsStalePage(const std::string& shm_name) {
+		int fd = shm_open(shm_name.c_str(), O_RDONLY, 0);
+		if (fd < 0) return false;
+		struct stat st;
+		void* view = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(StatsPageHeader)) {
+			view = mmap(nullptr, sizeof(StatsPageHeader), PROT_READ, MAP_SHARED, fd, 0);
+		}
+		close(fd);
+		if (view == MAP_FAILED) return false;
+
+		const StatsPageHeader* header = static_cast<const StatsPageHeader*>(view);
+		bool is_stale = false;
+		if (header->mMagic.load(std::memory_order_acquire) == STATS_PAGE_MAGIC) {
+			pid_t pid = static_cast<pid_t>(header->mProcessId);
+			is_stale = pid > 0 && kill(pid, 0) != 0 && errno == ESRCH;
+		}
+		munmap(view, sizeof(StatsPageHeader));
+		return is_stale;
+	}
+#endif // _WIN32
+
+	StatsPage::StatsPage(OutputHelper* output) :
+		mOutput(output), mMapping(nullptr), mLayout(nullptr),
+		mSlotsMutex("stats_slots"), mFreeSlots(), mUnpublishedBridgeCount(0u)
+	{}
+
+	StatsPage::~StatsPage() {
+		Close();
+	}
+
+	bool StatsPage::Open(const std::string& name) {
+		if (mLayout != nullptr) return true;
+
+		// create named shared memory. system zero-fill it.
+		// refuse existing one, otherwise 2 processes will write the same page,
+		// unless it is left by a dead process.
+#ifdef _WIN32
+		HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(StatsPageLayout), name.c_str());
+		if (mapping == nullptr) {
+			mOutput->Printf(OutputHelper::Component::BridgeFactory, NO_INDEX, "Fail to create statistics page %s. Error: %lu", name.c_str(), GetLastError());
+			return false;
+		}
+		if (GetLastError() == ERROR_ALREADY_EXISTS) {
+			mOutput->Printf(OutputHelper::Component::BridgeFactory, NO_INDEX, "Statistics page %s has been created by other process.", name.c_str());
+			CloseHandle(mapping);
+			return false;
+		}
+		void* view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(StatsPageLayout));
+		if (view == nullptr) {
+			mOutput->Printf(OutputHelper::Component::BridgeFactory, NO_INDEX, "Fail to map statistics page %s. Error: %lu", name.c_str(), GetLastError());
+			CloseHandle(mapping);
+			return false;
+		}
+		mMapping = mapping;
+#else
+		std::string shm_name("/" + name);
+		int fd = shm_open(shm_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+		if (fd < 0 && errno == EEXIST) {
+			if (IsStalePage(shm_name)) {
+				mOutput->Printf(OutputHelper::Component::BridgeFactory, NO_INDEX, "Statistics page %s is left by an exited process. Recreate it.", name.c_str());
+				shm_unlink(shm_name.c_str());
+				fd = shm_open(shm_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+			} else {
+				mOutput->Printf(OutputHelper::Component::BridgeFactory, NO_INDEX, "Statistics page %s has been created by other process. If it is not running, remove /dev/shm%s.", name.c_str(), shm_name.c_str());
+				return false;
+			}
+		}
+		if (fd < 0) {
+			mOutput->Printf(OutputHelper::Component::BridgeFactory, NO_INDEX, "Fail to create statistics page %s. Error: %s", name.c_str(), strerror(errno));
+			return false;
+		}
+		void* view = MAP_FAILED;
+		if (ftruncate(fd, sizeof(StatsPageLayout)) == 0) {
+			view = mmap(nullptr, sizeof(StatsPageLayout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		}
+		close(fd);
+		if (view == MAP_FAILED) {
+			mOutput->Printf(OutputHelper::Component::BridgeFactory, NO_INDEX, "Fail to map statistics page %s. Error: %s", name.c_str(), strerror(errno));
+			shm_unlink(shm_name.c_str());
+			return false;
+		}
+		mMapping = new std::string(shm_name);
+#endif // _WIN32
+
+		// fill header. magic is the last one so that reader never see a half-filled header.
+		mLayout = static_cast<StatsPageLayout*>(view);
+		mLayout->mHeader.mVersion = STATS_PAGE_VERSION;
+		mLayout->mHeader.mPageSize = static_cast<uint32_t>(sizeof(StatsPageLayout));
+		mLayout->mHeader.mSlotCount = STATS_SLOT_COUNT;
+#ifdef _WIN32
+		mLayout->mHeader.mProcessId = static_cast<uint64_t>(GetCurrentProcessId());
+#else
+		mLayout->mHeader.mProcessId = static_cast<uint64_t>(getpid());
+#endif // _WIN32
+		mLayout->mHeader.mStartTime = GetUnixTimeMillis();
+		mLayout->mHeader.mMagic.store(STATS_PAGE_MAGIC, std::memory_order_release);
+
+		{
+			std::lock_guard locker(mSlotsMutex);
+			mFreeSlots.clear();
+			for (uint32_t i = 0u; i < STATS_SLOT_COUNT; ++i) {
+				mFreeSlots.emplace_back(i);
+			}
+		}
+
+		mOutput->Printf(OutputHelper::Component::BridgeFactory, NO_INDEX, "Statistics page %s created with %" PRIu32 " slots.", name.c_str(), STATS_SLOT_COUNT);
+		return true;
+	}
+
+	void StatsPage::Close() {
+		if (mLayout == nullptr) return;
+
+		// tell readers this page is dead
+		mLayout->mHeader.mMagic.store(0u, std::memory_order_release);
+
+#ifdef _WIN32
+		UnmapViewOfFile(mLayout);
+		CloseHandle(static_cast<HANDLE>(mMapping));
+#else
+		munmap(mLayout, sizeof(StatsPageLayout));
+		std::string* shm_name = static_cast<std::string*>(mMapping);
+		shm_unlink(shm_name->c_str());
+		delete shm_name;
+#endif // _WIN32
+
+		mLayout = nullptr;
+		mMapping = nullptr;
+	}
+
+	StatsBridgeSlot* StatsPage::AcquireSlot(IndexDistributor::Index_t index) {
+		if (mLayout == nullptr) return nullptr;
+
+		uint32_t slot_index;
+		{
+			std::lock_guard locker(mSlotsMutex);
+			if (mFreeSlots.empty()) {
+				mUnpublishedBridgeCount.fetch_add(1u, std::memory_order_relaxed);
+				return nullptr;
+			}
+			slot_index = mFreeSlots.front();
+			mFreeSlots.pop_front();
+		}
+
+		// the bridge is not created yet, so we are the only writer now.
+		StatsBridgeSlot* slot = &mLayout->mSlots[slot_index];
+		slot->mLock.Write([slot, index]() -> void {
+			slot->mFlags.store(StatsSlotFlags::InUse, std::memory_order_relaxed);
+			slot->mIndex.store(index, std::memory_order_relaxed);
+			StatsCountersValue{ 0u, 0u, 0u, 0u, 0u, 0u, 0u, 0u }.StoreTo(slot->mCounters);
+		});
+		return slot;
+	}
+
+	void StatsPage::ReleaseSlot(StatsBridgeSlot* slot) {
+		if (slot == nullptr || mLayout == nullptr) return;
+
+		slot->mLock.Write([slot]() -> void {
+			slot->mFlags.store(0u, std::memory_order_relaxed);
+		});
+
+		std::lock_guard locker(mSlotsMutex);
+		mFreeSlots.emplace_back(static_cast<uint32_t>(slot - mLayout->mSlots));
+	}
+
+	void StatsPage::PublishGlobal(uint32_t bridge_count, const StatsCountersValue& total) {
+		if (mLayout == nullptr) return;
+
+		StatsGlobalSection& global = mLayout->mGlobal;
+		uint32_t unpublished = mUnpublishedBridgeCount.load(std::memory_order_relaxed);
+		int64_t now = GetUnixTimeMillis();
+		global.mLock.Write([&]() -> void {
+			global.mBridgeCount.store(bridge_count, std::memory_order_relaxed);
+			global.mUnpublishedBridgeCount.store(unpublished, std::memory_order_relaxed);
+			global.mUpdateTime.store(now, std::memory_order_relaxed);
+			total.StoreTo(global.mTotal);
+		});
+	}
+
+	void StatsPage::PublishSlot(StatsBridgeSlot* slot, StatsSlotFlags::Flags_t flags, const StatsCountersValue& counters) {
+		if (slot == nullptr) return;
+
+		slot->mLock.Write([&]() -> void {
+			slot->mFlags.store(flags | StatsSlotFlags::InUse, std::memory_order_relaxed);
+			counters.StoreTo(slot->mCounters);
+		});
+	}
+
+}
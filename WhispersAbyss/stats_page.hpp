@@ -0,0 +1,59 @@
+#pragma once
+
+#include "others_helper.hpp"
+#include "stats_layout.hpp"
+#include <deque>
+#include <mutex>
+#include <string>
+
+namespace WhispersAbyss {
+
+	/// <summary>
+	/// <para>The writer side of statistics page. Owned by BridgeFactory.</para>
+	/// <para>It creates a named shared memory and hands out bridge slots.
+	/// Slot data is written by bridges themselves. See stats_layout.hpp for the protocol.</para>
+	/// </summary>
+	class StatsPage {
+	public:
+		StatsPage(OutputHelper* output);
+		StatsPage(const StatsPage& rhs) = delete;
+		StatsPage(StatsPage&& rhs) = delete;
+		~StatsPage();
+
+		/// <summary>
+		/// Create the shared memory with given name.
+		/// </summary>
+		/// <returns>True if success. Page is not usable if failed.</returns>
+		bool Open(const std::string& name);
+		void Close();
+		bool IsOpened() { return mLayout != nullptr; }
+
+		/// <summary>
+		/// Take a free slot and mark it in use by given bridge.
+		/// </summary>
+		/// <returns>nullptr if page is not opened or all slots are occupied.</returns>
+		StatsBridgeSlot* AcquireSlot(IndexDistributor::Index_t index);
+		/// <summary>
+		/// Clear and return a slot. Caller should make sure its bridge will not write it anymore.
+		/// </summary>
+		void ReleaseSlot(StatsBridgeSlot* slot);
+		/// <summary>
+		/// Update global section. Should only be called by one thread.
+		/// </summary>
+		void PublishGlobal(uint32_t bridge_count, const StatsCountersValue& total);
+
+		/// <summary>
+		/// Publish the state and counters of a bridge into its slot. Should only be called by the owner of slot.
+		/// </summary>
+		static void PublishSlot(StatsBridgeSlot* slot, StatsSlotFlags::Flags_t flags, const StatsCountersValue& counters);
+	private:
+		OutputHelper* mOutput;
+		void* mMapping;
+		StatsPageLayout* mLayout;
+
+		AbyssMutex mSlotsMutex;
+		std::deque<uint32_t> mFreeSlots;
+		std::atomic_uint32_t mUnpublishedBridgeCount;
+	};
+
+}
@@ -2,37 +2,15 @@
 
 namespace WhispersAbyss {
 
-	TcpFactory::TcpFactory(OutputHelper* output, uint16_t port) :
-		mOutput(output), mModuleStatus(StateMachine::Ready), mStatusReporter(mModuleStatus), mIndexDistributor(), mPort(port),
+	TcpFactory::TcpFactory(OutputHelper* output, LifecycleExecutor* executor, uint16_t port, SetupDurations* setup_durations) :
+		mOutput(output), mExecutor(executor), mStrand(executor->MakeStrand()),
+		mModuleStatus(StateMachine::Ready), mStatusReporter(mModuleStatus), mIndexDistributor(), mPort(port), mSetupDurations(setup_durations),
 		mIoContext(), mTcpAcceptor(mIoContext, asio::ip::tcp::endpoint(asio::ip::tcp::v4(), mPort)),
 		mTdIoCtx(),
-		mConnectionsMutex(), mConnections(),
+		mConnectionsMutex("tcp_connections"), mConnections(),
 		mDisposal()
 	{
-		std::thread([this]() -> void {
-			// start transition
-			StateMachine::TransitionInitializing transition(mModuleStatus);
-			if (!transition.CanTransition()) return;
-
-			// register worker
-			this->RegisterAsyncWork();
-
-			// preparing ctx worker
-			this->mTdIoCtx = std::thread([this]() -> void {
-				this->mIoContext.run();
-			});
-
-			// preparing disposal
-			this->mDisposal.Start([this](TcpInstance* instance) -> void {
-				if (!instance->mStatusReporter.IsInState(StateMachine::Stopped)) instance->Stop();
-				instance->mStatusReporter.SpinUntil(StateMachine::Stopped);
-				this->mIndexDistributor.Return(instance->mIndex);
-				delete instance;
-			});
-
-			// end transition
-			transition.SetTransitionError(false);
-		}).detach();
+		mExecutor->Spawn(mStrand, InitializingTask(), "TcpFactory::Initializing", NO_INDEX);
 
 		mOutput->Printf(OutputHelper::Component::TcpFactory, NO_INDEX, "Factory created.");
 	}
@@ -43,29 +21,59 @@ namespace WhispersAbyss {
 		mOutput->Printf(OutputHelper::Component::TcpFactory, NO_INDEX, "Factory disposed.");
 	}
 
+	LifecycleExecutor::Task_t TcpFactory::InitializingTask() {
+		// start transition
+		StateMachine::TransitionInitializing transition(mModuleStatus, std::defer_lock);
+		co_await LifecycleExecutor::EnterTransition(transition);
+		if (!transition.CanTransition()) co_return;
+
+		// register worker
+		this->RegisterAsyncWork();
+
+		// preparing ctx worker
+		this->mTdIoCtx = std::thread([this]() -> void {
+			ThreadInventory::Register("tcp-acceptor", NO_INDEX);
+			this->mIoContext.run();
+		});
+
+		// preparing disposal
+		this->mDisposal.Start([this](TcpInstance* instance) -> void {
+			if (!instance->mStatusReporter.IsInState(StateMachine::Stopped)) instance->Stop();
+			instance->mStatusReporter.SpinUntil(StateMachine::Stopped);
+			this->mIndexDistributor.Return(instance->mIndex);
+			delete instance;
+		}, "disposal-tcp");
+
+		// end transition
+		transition.SetTransitionError(false);
+	}
+
 	void TcpFactory::Stop() {
-		std::thread([this]() -> void {
-			// start transition
-			StateMachine::TransitionStopping transition(mModuleStatus);
-			if (!transition.CanTransition()) return;
-
-			// try stop worker
-			this->mIoContext.stop();
-
-			// waiting for thread over
-			if (this->mTdIoCtx.joinable()) {
-				this->mTdIoCtx.join();
-			}
-
-			// move all pending connections into disposal list
-			{
-				std::lock_guard locker(mConnectionsMutex);
-				mDisposal.Move(mConnections);
-			}
-
-			// wait disposal worker exit
-			mDisposal.Stop();
-		}).detach();
+		mExecutor->Spawn(mStrand, StoppingTask(), "TcpFactory::Stopping", NO_INDEX);
+	}
+
+	LifecycleExecutor::Task_t TcpFactory::StoppingTask() {
+		// start transition
+		StateMachine::TransitionStopping transition(mModuleStatus, std::defer_lock);
+		co_await LifecycleExecutor::EnterTransition(transition);
+		if (!transition.CanTransition()) co_return;
+
+		// try stop worker
+		this->mIoContext.stop();
+
+		// waiting for thread over
+		if (this->mTdIoCtx.joinable()) {
+			this->mTdIoCtx.join();
+		}
+
+		// move all pending connections into disposal list
+		{
+			std::lock_guard locker(mConnectionsMutex);
+			mDisposal.Move(mConnections);
+		}
+
+		// wait disposal worker exit
+		co_await LifecycleExecutor::StopDisposal(mDisposal);
 	}
 
 	void TcpFactory::GetConnections(std::deque<TcpInstance*>& conn_list) {
@@ -74,7 +82,7 @@ namespace WhispersAbyss {
 			return;
 		}
 
-		std::lock_guard<std::mutex> locker(mConnectionsMutex);
+		std::lock_guard locker(mConnectionsMutex);
 		CommonOpers::MoveDeque(mConnections, conn_list);
 	}
 
@@ -87,11 +95,16 @@ namespace WhispersAbyss {
 		mDisposal.Move(conn);
 	}
 
+	size_t TcpFactory::ReportDisposalBacklog() {
+		return mDisposal.GetPendingCount();
+	}
+
 	void TcpFactory::AcceptorWorker(std::error_code ec, asio::ip::tcp::socket socket) {
 		// accept socket
-		TcpInstance* new_connection = new TcpInstance(mOutput, mIndexDistributor.Get(), std::move(socket));
+		TcpInstance* new_connection = new TcpInstance(mOutput, mExecutor, mIndexDistributor.Get(), std::move(socket), mSetupDurations);
+		Tracer::Instant("tcp", "accept", new_connection->mIndex);
 		{
-			std::lock_guard<std::mutex> locker(mConnectionsMutex);
+			std::lock_guard locker(mConnectionsMutex);
 			mConnections.push_back(new_connection);
 		}
 
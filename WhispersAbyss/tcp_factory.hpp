@@ -1,10 +1,13 @@
 #pragma once
 
+#ifdef _WIN32
 #include <sdkddkver.h>	// need by asio
+#endif // _WIN32
 #include "asio.hpp"
 #include "others_helper.hpp"
 #include "state_machine.hpp"
 #include "tcp_instance.hpp"
+#include "lifecycle_executor.hpp"
 #include <deque>
 #include <atomic>
 
@@ -13,9 +16,15 @@ namespace WhispersAbyss {
 	class TcpFactory {
 	private:
 		OutputHelper* mOutput;
+		LifecycleExecutor* mExecutor;
+		LifecycleExecutor::Strand_t mStrand;
 		StateMachine::StateMachineCore mModuleStatus;
 		IndexDistributor mIndexDistributor;
 		uint16_t mPort;
+		/// <summary>
+		/// The parent of setup timelines of all accepted instances. Owned by BridgeFactory.
+		/// </summary>
+		SetupDurations* mSetupDurations;
 		
 		asio::io_context mIoContext;	// this 2 decleartion should keep this order. due to init list order.
 		asio::ip::tcp::acceptor mTcpAcceptor;
@@ -23,16 +32,18 @@ namespace WhispersAbyss {
 		std::thread mTdIoCtx;
 		DisposalHelper<TcpInstance*> mDisposal;
 
-		std::mutex mConnectionsMutex;
+		AbyssMutex mConnectionsMutex;
 		std::deque<TcpInstance*> mConnections;
 	public:
 		StateMachine::StateMachineReporter mStatusReporter;
 
 	private:
+		LifecycleExecutor::Task_t InitializingTask();
+		LifecycleExecutor::Task_t StoppingTask();
 		void AcceptorWorker(std::error_code ec, asio::ip::tcp::socket socket);
 		void RegisterAsyncWork();
 	public:
-		TcpFactory(OutputHelper* output, uint16_t port);
+		TcpFactory(OutputHelper* output, LifecycleExecutor* executor, uint16_t port, SetupDurations* setup_durations);
 		TcpFactory(const TcpFactory& rhs) = delete;
 		TcpFactory(TcpFactory&& rhs) = delete;
 		~TcpFactory();
@@ -41,6 +52,10 @@ namespace WhispersAbyss {
 
 		void GetConnections(std::deque<TcpInstance*>& conn_list);
 		void ReturnConnections(TcpInstance* conn);
+		/// <summary>
+		/// Get how many returned instances are still waiting for disposal.
+		/// </summary>
+		size_t ReportDisposalBacklog();
 	};
 
 }
@@ -1,30 +1,21 @@
 #include "tcp_instance.hpp"
+#include "probes.hpp"
 
 namespace WhispersAbyss {
 
 	constexpr const uint32_t MAX_MSG_BODY = 2048u;
 
-	TcpInstance::TcpInstance(OutputHelper* output, IndexDistributor::Index_t index, asio::ip::tcp::socket socket) :
-		mOutput(output), mModuleStatus(StateMachine::Ready), mStatusReporter(mModuleStatus), mIndex(index),
+	TcpInstance::TcpInstance(OutputHelper* output, LifecycleExecutor* executor, IndexDistributor::Index_t index, asio::ip::tcp::socket socket, SetupDurations* setup_durations) :
+		mOutput(output), mExecutor(executor), mStrand(executor->MakeStrand()),
+		mModuleStatus(StateMachine::Ready), mStatusReporter(mModuleStatus), mIndex(index),
 		mSocket(std::move(socket)),
-		mRecvMsgMutex(), mSendMsgMutex(), mOrderedUrlMutex(),
-		mRecvMsg(), mSendMsg(), mOrderedUrl(),
+		mRecvMsgMutex("tcp_recv_msg"), mSendMsgMutex("tcp_send_msg"), mOrderedUrlMutex("tcp_ordered_url"),
+		mRecvMsg(), mSendMsg(), mSendCmd(), mEgressLatency(), mSetupTimeline(std::make_shared<SetupTimeline>(setup_durations)),
+		mOrderedUrl(), mOrderedSwitchUrl(), mOrderedResumeToken(0u), mIsResumeRequested(false), mOrderedEvent(),
 		mTdSend(), mTdRecv()
 	{
-		std::thread([this]() -> void {
-			// start transition
-			StateMachine::TransitionInitializing transition(mModuleStatus);
-			if (!transition.CanTransition()) return;
-
-			// active sender, recver
-			this->mTdRecv = std::jthread(std::bind(&TcpInstance::RecvWorker, this, std::placeholders::_1));
-			this->mTdSend = std::jthread(std::bind(&TcpInstance::SendWorker, this, std::placeholders::_1));
-
-			mOutput->Printf(OutputHelper::Component::TcpInstance, mIndex, "Started.");
-
-			// end transition
-			transition.SetTransitionError(false);
-		}).detach();
+		mSetupTimeline->Mark(SetupPhase::Accepted);
+		mExecutor->Spawn(mStrand, InitializingTask(), "TcpInstance::Initializing", mIndex);
 
 		mOutput->Printf(OutputHelper::Component::TcpInstance, mIndex, "Instance created.");
 	}
@@ -37,30 +28,47 @@ namespace WhispersAbyss {
 		mOutput->Printf(OutputHelper::Component::TcpInstance, mIndex, "Instance disposed.");
 	}
 
+	LifecycleExecutor::Task_t TcpInstance::InitializingTask() {
+		// start transition
+		StateMachine::TransitionInitializing transition(mModuleStatus, std::defer_lock);
+		co_await LifecycleExecutor::EnterTransition(transition);
+		if (!transition.CanTransition()) co_return;
+
+		// active sender, recver
+		// mark it first, so that an order received at once is not earlier than it.
+		mSetupTimeline->Mark(SetupPhase::TcpStarted);
+		this->mTdRecv.Start(std::bind(&TcpInstance::RecvWorker, this, std::placeholders::_1));
+		this->mTdSend.Start(std::bind(&TcpInstance::SendWorker, this, std::placeholders::_1));
+
+		mOutput->Printf(OutputHelper::Component::TcpInstance, mIndex, "Started.");
+
+		// end transition
+		transition.SetTransitionError(false);
+	}
+
 	void TcpInstance::Stop() {
-		std::thread([this]() -> void {
-			// start transition
-			StateMachine::TransitionStopping transition(mModuleStatus);
-			if (!transition.CanTransition()) return;
-
-			// close socket if it still is opened
-			if (mSocket.is_open()) {
-				mSocket.close();
-			}
+		mExecutor->Spawn(mStrand, StoppingTask(), "TcpInstance::Stopping", mIndex);
+	}
 
-			// stop recver and sender
-			if (mTdRecv.joinable()) {
-				mTdRecv.request_stop();
-				mTdRecv.join();
-			}
-			if (mTdSend.joinable()) {
-				mTdSend.request_stop();
-				mTdSend.join();
-			}
+	LifecycleExecutor::Task_t TcpInstance::StoppingTask() {
+		// start transition
+		StateMachine::TransitionStopping transition(mModuleStatus, std::defer_lock);
+		co_await LifecycleExecutor::EnterTransition(transition);
+		if (!transition.CanTransition()) co_return;
+
+		// close socket if it still is opened
+		if (mSocket.is_open()) {
+			mSocket.close();
+		}
+
+		// stop recver and sender
+		co_await mTdRecv.Stop();
+		co_await mTdSend.Stop();
 
-			mOutput->Printf(OutputHelper::Component::TcpInstance, mIndex, "Stopped.");
+		// wake up the transition which is waiting ordered url.
+		mOrderedEvent.Set();
 
-		}).detach();
+		mOutput->Printf(OutputHelper::Component::TcpInstance, mIndex, "Stopped.");
 	}
 
 	void TcpInstance::Send(std::deque<CommonMessage>& msg_list) {
@@ -87,16 +95,94 @@ namespace WhispersAbyss {
 	std::string TcpInstance::GetOrderedUrl() {
 		if (!mStatusReporter.IsInState(StateMachine::Running)) return std::string();
 
+		std::lock_guard locker(mOrderedUrlMutex);
 		return mOrderedUrl;
 	}
 
+	uint64_t TcpInstance::GetOrderedResumeToken() {
+		if (!mStatusReporter.IsInState(StateMachine::Running)) return 0u;
+
+		std::lock_guard locker(mOrderedUrlMutex);
+		return mOrderedResumeToken;
+	}
+
+	bool TcpInstance::IsResumeRequested() {
+		return mIsResumeRequested.exchange(false);
+	}
+
+	void TcpInstance::SendResumeToken(uint64_t token) {
+		if (!mStatusReporter.IsInState(StateMachine::Running)) return;
+
+		// mFlagIsCommand, mResumeToken
+		std::string body(sizeof(uint8_t) + sizeof(uint64_t), '\0');
+		body[0] = static_cast<char>(TcpCommandType::Resume);
+		memcpy(body.data() + sizeof(uint8_t), &token, sizeof(uint64_t));
+
+		PushCommand(std::move(body));
+	}
+
+	std::string TcpInstance::PopSwitchUrl() {
+		if (!mStatusReporter.IsInState(StateMachine::Running)) return std::string();
+
+		std::lock_guard locker(mOrderedUrlMutex);
+		return std::exchange(mOrderedSwitchUrl, std::string());
+	}
+
+	void TcpInstance::SendSwitchResult(bool is_success) {
+		if (!mStatusReporter.IsInState(StateMachine::Running)) return;
+
+		// mFlagIsCommand, mIsSuccess
+		std::string body(sizeof(uint8_t) + sizeof(uint8_t), '\0');
+		body[0] = static_cast<char>(TcpCommandType::Switch);
+		body[1] = is_success ? 1 : 0;
+
+		PushCommand(std::move(body));
+	}
+
+	void TcpInstance::SetEgressLatency(std::shared_ptr<LatencyHistogram> latency) {
+		std::lock_guard locker(mSendMsgMutex);
+		mEgressLatency = std::move(latency);
+	}
+
+	void TcpInstance::ReportQueueDepth(size_t& send_depth, size_t& recv_depth) {
+		{
+			std::lock_guard locker(mSendMsgMutex);
+			send_depth = mSendMsg.size();
+		}
+		{
+			std::lock_guard locker(mRecvMsgMutex);
+			recv_depth = mRecvMsg.size();
+		}
+	}
+
+	void TcpInstance::PushCommand(std::string&& body) {
+		std::lock_guard locker(mSendMsgMutex);
+		mSendCmd.emplace_back(PendingCommand{ mSendMsg.size(), std::move(body) });
+	}
+
+	bool TcpInstance::WriteCommand(const std::string& body) {
+		// mMsgSize, (mFlagIsCommand + payload)
+		asio::error_code ec;
+		uint32_t msg_size = static_cast<uint32_t>(body.size());
+		asio::write(mSocket, asio::buffer(&msg_size, sizeof(uint32_t)), ec);
+		if (!ec) asio::write(mSocket, asio::buffer(body.data(), body.size()), ec);
+		if (ec) {
+			mOutput->Printf(OutputHelper::Component::TcpInstance, mIndex, "Fail to write command: %s", ec.message().c_str());
+			this->Stop();
+			return false;
+		}
+		return true;
+	}
+
 	void TcpInstance::CheckSize(size_t msg_size, bool is_recv) {
 		const char* side = is_recv ? "Recv" : "Send";
 
 		if (msg_size >= NUKE_CAPACITY) {
+			ABYSS_PROBE4(queue_nuke, "tcp", mIndex, msg_size, is_recv);
 			mOutput->Printf(OutputHelper::Component::TcpInstance, mIndex, "%s message list reach nuke level: %zu. Nuke instance!!!", side, msg_size);
 			Stop();
 		} else if (msg_size >= WARNING_CAPACITY) {
+			ABYSS_PROBE4(queue_warning, "tcp", mIndex, msg_size, is_recv);
 			mOutput->Printf(OutputHelper::Component::TcpInstance, mIndex, "%s message list reach warning level: %zu", side, msg_size);
 		}
 	}
@@ -104,6 +190,11 @@ namespace WhispersAbyss {
 	void TcpInstance::SendWorker(std::stop_token st) {
 		asio::error_code ec;
 		std::deque<CommonMessage> intermsg;
+		std::deque<PendingCommand> intercmd;
+		std::shared_ptr<LatencyHistogram> latency;
+		size_t position;
+		uint64_t write_start;
+		ThreadInventory::Register("tcp-send", mIndex);
 
 		while (!st.stop_requested()) {
 			// wait if socket is not worked
@@ -117,16 +208,28 @@ namespace WhispersAbyss {
 			{
 				std::lock_guard locker(mSendMsgMutex);
 				CommonOpers::MoveDeque(mSendMsg, intermsg);
+				CommonOpers::MoveDeque(mSendCmd, intercmd);
+				latency = mEgressLatency;
 			}
 
 			// if no message. sleep and continue
-			if (intermsg.empty()) {
+			if (intermsg.empty() && intercmd.empty()) {
 				std::this_thread::sleep_for(std::chrono::milliseconds(10));
 				continue;
 			}
 
 			// write message one by one
+			// and insert commands at their position.
+			// only read clock when someone records it.
+			write_start = (Tracer::IsEnabled() || ABYSS_PROBE_ENABLED(tcp_write)) ? CommonOpers::GetMonotonicTime() : 0u;
+			position = 0u;
 			for (auto& msg : intermsg) {
+				while (!intercmd.empty() && intercmd.front().mPosition <= position) {
+					if (!WriteCommand(intercmd.front().mBody)) return;
+					intercmd.pop_front();
+				}
+				++position;
+
 				// mMsgSize, mFlagIsCommand, mIsReliable, mRaw
 				uint32_t msg_size = msg.GetCommonDataLen() + sizeof(uint8_t) + sizeof(uint8_t);
 				static uint8_t flag_data = 0u;
@@ -158,10 +261,22 @@ namespace WhispersAbyss {
 					this->Stop();
 					return;
 				}
+
+				// record forwarding latency
+				if (latency != nullptr) latency->RecordSince(msg.GetIngressTime());
+			}
+
+			// write remaining commands
+			for (auto& cmd : intercmd) {
+				if (!WriteCommand(cmd.mBody)) return;
 			}
 
+			ABYSS_PROBE5(tcp_write, mIndex, intermsg.size(), intercmd.size(), write_start, CommonOpers::GetMonotonicTime());
+			Tracer::Complete("tcp", "write", mIndex, write_start, intermsg.size());
+
 			// clear internal buffer
 			intermsg.clear();
+			intercmd.clear();
 
 			// end of a loop of sender.
 		}
@@ -173,6 +288,7 @@ namespace WhispersAbyss {
 		std::string mMsgBuffer;
 		asio::error_code ec;
 		std::deque<CommonMessage> intermsg;
+		ThreadInventory::Register("tcp-recv", mIndex);
 
 		while (!st.stop_requested()) {
 			// wait if socket is not worked
@@ -195,7 +311,10 @@ namespace WhispersAbyss {
 			}
 
 			// recv msg body
-			mMsgBuffer.resize(mMsgSize);
+			{
+				ABYSS_ALLOC_SCOPE(RecvBuffer);
+				mMsgBuffer.resize(mMsgSize);
+			}
 			asio::read(mSocket, asio::buffer(mMsgBuffer.data(), mMsgSize), ec);
 			if (ec) {
 				mOutput->Printf(OutputHelper::Component::TcpInstance, mIndex, "Fail to read body: %s", ec.message().c_str());
@@ -210,8 +329,10 @@ namespace WhispersAbyss {
 				return;
 			}
 			mFlagIsCommand = *reinterpret_cast<const uint8_t*>(mMsgBuffer.c_str());
-			if (mFlagIsCommand) {
-				// command message
+			ABYSS_PROBE3(tcp_frame, mIndex, mFlagIsCommand, mMsgSize);
+			if (mFlagIsCommand == static_cast<uint8_t>(TcpCommandType::Connect) ||
+				mFlagIsCommand == static_cast<uint8_t>(TcpCommandType::Switch)) {
+				// connect or switch command. they have the same syntax
 				if (mMsgBuffer.size() < sizeof(uint8_t) + sizeof(uint32_t)) {
 					mOutput->Printf(OutputHelper::Component::TcpInstance, mIndex, "Too short command msg. No mUrlSize.");
 					this->Stop();
@@ -219,17 +340,53 @@ namespace WhispersAbyss {
 				}
 
 				mUrlSize = *reinterpret_cast<const uint32_t*>(mMsgBuffer.c_str() + sizeof(uint8_t));
+				if (mUrlSize > mMsgBuffer.size() - sizeof(uint8_t) - sizeof(uint32_t)) {
+					mOutput->Printf(OutputHelper::Component::TcpInstance, mIndex, "Too short command msg. Incomplete mUrl.");
+					this->Stop();
+					return;
+				}
 				{
+					bool is_switch = mFlagIsCommand == static_cast<uint8_t>(TcpCommandType::Switch);
 					std::lock_guard locker(mOrderedUrlMutex);
-					mOrderedUrl.resize(mUrlSize);
+					std::string& url = is_switch ? mOrderedSwitchUrl : mOrderedUrl;
+					url.resize(mUrlSize);
 					memcpy(
-						mOrderedUrl.data(),
+						url.data(),
 						mMsgBuffer.c_str() + sizeof(uint8_t) + sizeof(uint32_t),
 						mUrlSize
 					);
 
-					mOutput->Printf(OutputHelper::Component::TcpInstance, mIndex, "Request GNS connect to: %s", mOrderedUrl.c_str());
+					mOutput->Printf(OutputHelper::Component::TcpInstance, mIndex, "Request GNS %s to: %s", is_switch ? "switch" : "connect", url.c_str());
+					if (!is_switch) mSetupTimeline->Mark(SetupPhase::Ordered);
+					Tracer::Instant("tcp", is_switch ? "switch_ordered" : "url_ordered", mIndex);
+				}
+				mOrderedEvent.Set();
+			} else if (mFlagIsCommand == static_cast<uint8_t>(TcpCommandType::Resume)) {
+				// resume command
+				if (mMsgBuffer.size() < sizeof(uint8_t) + sizeof(uint64_t)) {
+					mOutput->Printf(OutputHelper::Component::TcpInstance, mIndex, "Too short command msg. No mResumeToken.");
+					this->Stop();
+					return;
+				}
+
+				uint64_t token;
+				memcpy(&token, mMsgBuffer.c_str() + sizeof(uint8_t), sizeof(uint64_t));
+				if (token == 0u) {
+					mIsResumeRequested.store(true);
+					mOutput->Printf(OutputHelper::Component::TcpInstance, mIndex, "Request session resumption.");
+				} else {
+					{
+						std::lock_guard locker(mOrderedUrlMutex);
+						mOrderedResumeToken = token;
+					}
+					mOutput->Printf(OutputHelper::Component::TcpInstance, mIndex, "Request resuming session %016" PRIx64 ".", token);
+					mSetupTimeline->Mark(SetupPhase::Ordered);
+					mOrderedEvent.Set();
 				}
+			} else if (mFlagIsCommand != static_cast<uint8_t>(TcpCommandType::Data)) {
+				mOutput->Printf(OutputHelper::Component::TcpInstance, mIndex, "Unknown command type: %" PRIu8, mFlagIsCommand);
+				this->Stop();
+				return;
 			} else {
 				// data message
 				if (mMsgBuffer.size() < sizeof(uint8_t) + sizeof(uint8_t)) {
@@ -246,17 +403,20 @@ namespace WhispersAbyss {
 					mIsReliable,
 					mMsgSize - sizeof(uint8_t) - sizeof(uint8_t)
 				);
+				ABYSS_ALLOC_SCOPE(DequeNode);
 				intermsg.push_back(std::move(msg));
 			}
 
 			// try move all intermsg to recv msg.
 			// if we cant, wait next time to move.
-			size_t msg_list_size = 0u;
+			size_t msg_list_size = 0u, handoff_count = intermsg.size();
 			if (mStatusReporter.IsInState(StateMachine::Running)) {
 				std::lock_guard locker(mRecvMsgMutex);
 				CommonOpers::MoveDeque(intermsg, mRecvMsg);
 				msg_list_size = mRecvMsg.size();
 			}
+			handoff_count -= intermsg.size();
+			if (handoff_count != 0u) Tracer::Instant("tcp", "recv_handoff", mIndex, handoff_count);
 			// check size at the same time
 			CheckSize(msg_list_size, true);
 
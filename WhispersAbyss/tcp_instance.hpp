@@ -1,14 +1,19 @@
 #pragma once
 
+#ifdef _WIN32
 #include <sdkddkver.h>	// need by asio
+#endif // _WIN32
 #include "asio.hpp"
 #include "others_helper.hpp"
 #include "state_machine.hpp"
 #include "messages.hpp"
+#include "lifecycle_executor.hpp"
+#include "metrics.hpp"
 #include <thread>
 #include <deque>
 #include <mutex>
 #include <string>
+#include <atomic>
 
 namespace WhispersAbyss {
 
@@ -39,6 +44,10 @@ namespace WhispersAbyss {
 
 	### Command Message
 
+	The value of mFlagIsCommand indicate the type of command.
+
+	#### Connect Command (mFlagIsCommand == 1)
+
 	uint32_t	mUrlSize;
 	...			mUrl;
 
@@ -47,29 +56,104 @@ namespace WhispersAbyss {
 	Then write the URL self without terminal null.
 	The encoding of URL is undefined. I don't know how ASIO process it.
 
+	#### Resume Command (mFlagIsCommand == 2)
+
+	uint64_t	mResumeToken;
+
+	Sent by endpoint with mResumeToken == 0: endpoint ask this app to keep this session
+	when its Tcp connection drops. This app will reply a Resume Command carrying the token of this session.
+	The replied token is 0 if session resumption is disabled.
+
+	Sent by endpoint with mResumeToken != 0: endpoint want to reattach to the session owning this token.
+	It should be sent instead of Connect Command as the first command of new Tcp connection.
+	If the session is not existed any more, the new connection will be closed.
+
+	During Tcp connection dropped, server messages are buffered and will be sent after reattaching.
+	If no connection reattach in the resumption window, or buffer is full, the session will be closed.
+
+	#### Switch Command (mFlagIsCommand == 3)
+
+	Sent by endpoint:
+
+	uint32_t	mUrlSize;
+	...			mUrl;
+
+	Same syntax as Connect Command. Endpoint want to move to another server without closing Tcp connection.
+	The new Gns connection will be established in background. Messages are still exchanged with current server during switching.
+
+	Replied by this app:
+
+	uint8_t		mIsSuccess;
+
+	If mIsSuccess != 0, new server is in use since this reply. All following messages belong to new server.
+	Otherwise new server can not be connected and current server is still in use.
+	If endpoint send another Switch Command during switching, the previous one will be abandoned without reply.
+
 	*/
 
+	enum class TcpCommandType : uint8_t {
+		Data = 0, Connect = 1, Resume = 2, Switch = 3
+	};
+
 	class TcpInstance {
 	private:
 		OutputHelper* mOutput;
+		LifecycleExecutor* mExecutor;
+		LifecycleExecutor::Strand_t mStrand;
 		StateMachine::StateMachineCore mModuleStatus;
 		asio::ip::tcp::socket mSocket;
 
-		std::mutex mRecvMsgMutex, mSendMsgMutex, mOrderedUrlMutex;
+		AbyssMutex mRecvMsgMutex, mSendMsgMutex;
+		AbyssMutex mOrderedUrlMutex;
 		std::deque<CommonMessage> mRecvMsg, mSendMsg;
-		std::string mOrderedUrl;
-
-		std::jthread mTdSend, mTdRecv;
+		struct PendingCommand {
+			/// <summary>
+			/// The count of data messages in mSendMsg queued before this command.
+			/// Keep the order between commands and data messages.
+			/// </summary>
+			size_t mPosition;
+			/// <summary>
+			/// The whole body (mFlagIsCommand and payload).
+			/// </summary>
+			std::string mBody;
+		};
+		/// <summary>
+		/// The command messages which will be sent to endpoint.
+		/// Protected by mSendMsgMutex.
+		/// </summary>
+		std::deque<PendingCommand> mSendCmd;
+		/// <summary>
+		/// Record the latency of messages written to endpoint. Protected by mSendMsgMutex.
+		/// It is shared because this instance may be disposed later than its bridge.
+		/// </summary>
+		std::shared_ptr<LatencyHistogram> mEgressLatency;
+		/// <summary>
+		/// Created when accepted. Shared with the bridge picking this instance up.
+		/// </summary>
+		std::shared_ptr<SetupTimeline> mSetupTimeline;
+		std::string mOrderedUrl, mOrderedSwitchUrl;
+		uint64_t mOrderedResumeToken;
+		std::atomic_bool mIsResumeRequested;
+
+		LifecycleThread mTdSend, mTdRecv;
 	public:
 		StateMachine::StateMachineReporter mStatusReporter;
 		IndexDistributor::Index_t mIndex;
+		/// <summary>
+		/// Set when URL or resume token has been ordered, or this instance has been stopped.
+		/// </summary>
+		LifecycleEvent mOrderedEvent;
 
 	private:
+		LifecycleExecutor::Task_t InitializingTask();
+		LifecycleExecutor::Task_t StoppingTask();
 		void SendWorker(std::stop_token st);
 		void RecvWorker(std::stop_token st);
 		void CheckSize(size_t msg_size, bool is_recv);
+		void PushCommand(std::string&& body);
+		bool WriteCommand(const std::string& body);
 	public:
-		TcpInstance(OutputHelper* output, IndexDistributor::Index_t index, asio::ip::tcp::socket socket);
+		TcpInstance(OutputHelper* output, LifecycleExecutor* executor, IndexDistributor::Index_t index, asio::ip::tcp::socket socket, SetupDurations* setup_durations);
 		TcpInstance(const TcpInstance& rhs) = delete;
 		TcpInstance(TcpInstance&& rhs) = delete;
 		~TcpInstance();
@@ -79,6 +163,14 @@ namespace WhispersAbyss {
 		void Send(std::deque<CommonMessage>& msg_list);
 		void Recv(std::deque<CommonMessage>& msg_list);
 		std::string GetOrderedUrl();		// return empty string mean no ordered url.
+		uint64_t GetOrderedResumeToken();	// return 0 mean no ordered token.
+		bool IsResumeRequested();			// the request will be cleared after reading.
+		void SendResumeToken(uint64_t token);
+		std::string PopSwitchUrl();			// return empty string mean no switching request. the request will be cleared after reading.
+		void SendSwitchResult(bool is_success);
+		void SetEgressLatency(std::shared_ptr<LatencyHistogram> latency);
+		std::shared_ptr<SetupTimeline> GetSetupTimeline() { return mSetupTimeline; }
+		void ReportQueueDepth(size_t& send_depth, size_t& recv_depth);
 	};
 
 
@@ -0,0 +1,417 @@
+#include "thread_inventory.hpp"
+#include "others_helper.hpp"
+#include "tracer.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <winternl.h>
+#include <unordered_map>
+#else
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif // _WIN32
+
+namespace WhispersAbyss {
+
+	/// <summary>
+	/// A registered thread. OS fields are fixed after registering, so they can be read without lock.
+	/// Other fields are protected by registry mutex.
+	/// </summary>
+	struct ThreadEntry {
+		~ThreadEntry() {
+#ifdef _WIN32
+			if (mHandle != nullptr) CloseHandle(mHandle);
+#endif // _WIN32
+		}
+
+		const char* mRole;
+		std::string mName;
+#ifdef _WIN32
+		HANDLE mHandle;	// duplicated, so it can be queried from other threads. nullptr if failed.
+		DWORD mTid;
+#else
+		clockid_t mClock;
+		bool mHasClock;
+		pid_t mTid;
+#endif // _WIN32
+		/// <summary>
+		/// CPU time and context switches when sampled last time, or when registered.
+		/// Switches start from 0 with thread.
+		/// </summary>
+		uint64_t mLastCpu, mLastSwitches;
+		/// <summary>
+		/// Set when thread exits. Its CPU time since last sample has been moved into retired totals.
+		/// </summary>
+		bool mIsExited;
+	};
+
+	struct ThreadRegistry {
+		std::mutex mMutex;
+		/// <summary>
+		/// Entries are shared with running Sample(), so an exiting thread can not free the one being read.
+		/// </summary>
+		std::deque<std::shared_ptr<ThreadEntry>> mEntries;
+		/// <summary>
+		/// CPU time of threads exited since last sample, by role.
+		/// </summary>
+		std::map<std::string, uint64_t> mRetiredCpu;
+
+		/// <summary>
+		/// Let only one Sample() run at a time. Fields below are protected by it instead of mMutex.
+		/// </summary>
+		std::mutex mSampleMutex;
+		uint64_t mLastSampleTime;
+		uint64_t mLastProcessCpu;
+	};
+
+	thread_local ThreadEntry* tEntry = nullptr;
+
+#pragma region OS Helpers
+
+	/// <summary>
+	/// Get CPU time of whole process in nanoseconds.
+	/// </summary>
+	static uint64_t ReadProcessCpu() {
+#ifdef _WIN32
+		FILETIME creation_time, exit_time, kernel_time, user_time;
+		if (!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time)) return 0u;
+		ULARGE_INTEGER kernel, user;
+		kernel.LowPart = kernel_time.dwLowDateTime;
+		kernel.HighPart = kernel_time.dwHighDateTime;
+		user.LowPart = user_time.dwLowDateTime;
+		user.HighPart = user_time.dwHighDateTime;
+		return (kernel.QuadPart + user.QuadPart) * 100u;	// in 100 nanoseconds
+#else
+		struct rusage ru;
+		if (getrusage(RUSAGE_SELF, &ru) != 0) return 0u;
+		return static_cast<uint64_t>(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000u +
+			static_cast<uint64_t>(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000u;
+#endif // _WIN32
+	}
+
+	/// <summary>
+	/// Get CPU time of given thread in nanoseconds. 0 if failed.
+	/// </summary>
+	static uint64_t ReadThreadCpu(const ThreadEntry& entry) {
+#ifdef _WIN32
+		if (entry.mHandle == nullptr) return 0u;
+		FILETIME creation_time, exit_time, kernel_time, user_time;
+		if (!GetThreadTimes(entry.mHandle, &creation_time, &exit_time, &kernel_time, &user_time)) return 0u;
+		ULARGE_INTEGER kernel, user;
+		kernel.LowPart = kernel_time.dwLowDateTime;
+		kernel.HighPart = kernel_time.dwHighDateTime;
+		user.LowPart = user_time.dwLowDateTime;
+		user.HighPart = user_time.dwHighDateTime;
+		return (kernel.QuadPart + user.QuadPart) * 100u;
+#else
+		if (!entry.mHasClock) return 0u;
+		struct timespec ts;
+		if (clock_gettime(entry.mClock, &ts) != 0) return 0u;
+		return static_cast<uint64_t>(ts.tv_sec) * 1000000000u + static_cast<uint64_t>(ts.tv_nsec);
+#endif // _WIN32
+	}
+
+#ifdef _WIN32
+	/// <summary>
+	/// Get context switches of every thread of this process by thread id, and the thread count of this process.
+	/// </summary>
+	static void ReadProcessSwitches(std::unordered_map<DWORD, uint64_t>& switches, size_t& thread_count) {
+		using NtQuerySystemInformation_t = NTSTATUS(NTAPI*)(SYSTEM_INFORMATION_CLASS, PVOID, ULONG, PULONG);
+		static NtQuerySystemInformation_t pfQuery = reinterpret_cast<NtQuerySystemInformation_t>(
+			GetProcAddress(GetModuleHandleW(L"ntdll.dll"), "NtQuerySystemInformation"));
+		constexpr const NTSTATUS STATUS_INFO_LENGTH_MISMATCH_CODE = static_cast<NTSTATUS>(0xC0000004L);
+		if (pfQuery == nullptr) return;
+
+		// the list covers all processes of system, and may grow between calls.
+		std::vector<uint8_t> buffer(512u * 1024u);
+		ULONG needed = 0u;
+		NTSTATUS status;
+		while ((status = pfQuery(SystemProcessInformation, buffer.data(), static_cast<ULONG>(buffer.size()), &needed)) == STATUS_INFO_LENGTH_MISMATCH_CODE) {
+			buffer.resize(static_cast<size_t>(needed) + 64u * 1024u);
+		}
+		if (status < 0) return;
+
+		// every process is followed by its threads.
+		DWORD pid = GetCurrentProcessId();
+		const uint8_t* p = buffer.data();
+		while (true) {
+			auto process = reinterpret_cast<const SYSTEM_PROCESS_INFORMATION*>(p);
+			if (HandleToULong(process->UniqueProcessId) == pid) {
+				auto threads = reinterpret_cast<const SYSTEM_THREAD_INFORMATION*>(process + 1);
+				thread_count = process->NumberOfThreads;
+				for (ULONG i = 0; i < process->NumberOfThreads; ++i) {
+					// Reserved3 is ContextSwitches.
+					switches[HandleToULong(threads[i].ClientId.UniqueThread)] = threads[i].Reserved3;
+				}
+				return;
+			}
+			if (process->NextEntryOffset == 0u) return;
+			p += process->NextEntryOffset;
+		}
+	}
+#else
+	/// <summary>
+	/// Get voluntary context switches of given thread. 0 if failed.
+	/// </summary>
+	static uint64_t ReadThreadSwitches(pid_t tid) {
+		char path[64];
+		snprintf(path, sizeof(path), "/proc/self/task/%d/status", static_cast<int>(tid));
+		FILE* fs = fopen(path, "r");
+		if (fs == nullptr) return 0u;
+		char line[256];
+		unsigned long long value = 0u;
+		while (fgets(line, sizeof(line), fs) != nullptr) {
+			if (sscanf(line, "voluntary_ctxt_switches: %llu", &value) == 1) break;
+		}
+		fclose(fs);
+		return value;
+	}
+
+	/// <summary>
+	/// Get the thread count of this process.
+	/// </summary>
+	static size_t ReadProcessThreadCount() {
+		FILE* fs = fopen("/proc/self/status", "r");
+		if (fs == nullptr) return 0u;
+		char line[256];
+		unsigned long long value = 0u;
+		while (fgets(line, sizeof(line), fs) != nullptr) {
+			if (sscanf(line, "Threads: %llu", &value) == 1) break;
+		}
+		fclose(fs);
+		return static_cast<size_t>(value);
+	}
+#endif // _WIN32
+
+	static void SetOsThreadName(const std::string& name) {
+#ifdef _WIN32
+		std::wstring wname(name.begin(), name.end());	// names are ASCII
+		SetThreadDescription(GetCurrentThread(), wname.c_str());
+#else
+		// name of main thread is the process name shown by ps and used by pidof, so keep it.
+		if (syscall(SYS_gettid) == getpid()) return;
+		// Linux limits it to 15 characters.
+		pthread_setname_np(pthread_self(), name.substr(0u, 15u).c_str());
+#endif // _WIN32
+	}
+
+#pragma endregion
+
+	/// <summary>
+	/// The registry is never destroyed, because threads may still exit after static destruction.
+	/// </summary>
+	static ThreadRegistry& GetRegistry() {
+		static ThreadRegistry* registry = []() -> ThreadRegistry* {
+			ThreadRegistry* ptr = new ThreadRegistry();
+			ptr->mLastSampleTime = CommonOpers::GetMonotonicTime();
+			ptr->mLastProcessCpu = ReadProcessCpu();
+			return ptr;
+		}();
+		return *registry;
+	}
+
+	/// <summary>
+	/// Move CPU time of current thread into retired totals and remove it from inventory.
+	/// </summary>
+	static void UnregisterCurrentThread() {
+		ThreadRegistry& registry = GetRegistry();
+		uint64_t cpu = ReadThreadCpu(*tEntry);
+		std::lock_guard locker(registry.mMutex);
+		registry.mRetiredCpu[tEntry->mRole] += cpu > tEntry->mLastCpu ? cpu - tEntry->mLastCpu : 0u;
+		tEntry->mIsExited = true;
+		auto it = std::find_if(registry.mEntries.begin(), registry.mEntries.end(),
+			[](const std::shared_ptr<ThreadEntry>& ptr) -> bool { return ptr.get() == tEntry; });
+		if (it != registry.mEntries.end()) registry.mEntries.erase(it);
+		tEntry = nullptr;
+	}
+
+	/// <summary>
+	/// Remove current thread from inventory when it exits.
+	/// It is constructed when thread registers, so unnamed threads do not get an exit hook.
+	/// </summary>
+	struct ThreadExitHook {
+		~ThreadExitHook() {
+			if (tEntry != nullptr) UnregisterCurrentThread();
+		}
+	};
+	thread_local ThreadExitHook tExitHook;
+
+	void ThreadInventory::Register(const char* role, uint64_t index) {
+		std::string name(role);
+		if (index != NO_INDEX) CommonOpers::AppendStrF(name, "#%" PRIu64, index);
+		ThreadRegistry& registry = GetRegistry();
+
+		// renaming, like a pool thread running another role.
+		if (tEntry != nullptr) {
+			if (tEntry->mName == name) return;
+			SetOsThreadName(name);
+			Tracer::SetThreadName(role, index);
+			std::lock_guard locker(registry.mMutex);
+			tEntry->mRole = role;
+			tEntry->mName = std::move(name);
+			return;
+		}
+
+		SetOsThreadName(name);
+		Tracer::SetThreadName(role, index);
+		auto entry = std::make_shared<ThreadEntry>();
+		entry->mRole = role;
+		entry->mName = std::move(name);
+#ifdef _WIN32
+		if (!DuplicateHandle(GetCurrentProcess(), GetCurrentThread(), GetCurrentProcess(), &entry->mHandle,
+			THREAD_QUERY_LIMITED_INFORMATION, FALSE, 0)) {
+			entry->mHandle = nullptr;
+		}
+		entry->mTid = GetCurrentThreadId();
+#else
+		entry->mHasClock = pthread_getcpuclockid(pthread_self(), &entry->mClock) == 0;
+		entry->mTid = static_cast<pid_t>(syscall(SYS_gettid));
+#endif // _WIN32
+		entry->mLastCpu = ReadThreadCpu(*entry);
+		entry->mLastSwitches = 0u;
+		entry->mIsExited = false;
+
+		// touch exit hook, so it is constructed and destroyed with this thread.
+		(void)&tExitHook;
+		tEntry = entry.get();
+		std::lock_guard locker(registry.mMutex);
+		registry.mEntries.emplace_back(std::move(entry));
+	}
+
+	ThreadCountProfile ThreadInventory::Count() {
+		ThreadCountProfile profile{ {}, 0u };
+		ThreadRegistry& registry = GetRegistry();
+		size_t process_threads = 0u;
+#ifdef _WIN32
+		std::unordered_map<DWORD, uint64_t> switches;
+		ReadProcessSwitches(switches, process_threads);
+#else
+		process_threads = ReadProcessThreadCount();
+#endif // _WIN32
+
+		std::map<std::string, size_t> roles;
+		size_t named_threads = 0u;
+		{
+			std::lock_guard locker(registry.mMutex);
+			for (auto& entry : registry.mEntries) ++roles[entry->mRole];
+			named_threads = registry.mEntries.size();
+		}
+		profile.mRoles.assign(roles.begin(), roles.end());
+		profile.mUnnamedThreads = process_threads > named_threads ? process_threads - named_threads : 0u;
+		return profile;
+	}
+
+	ThreadInventoryProfile ThreadInventory::Sample() {
+		ThreadInventoryProfile profile{ 0.0, {}, {}, 0u, 0u, 0.0 };
+		ThreadRegistry& registry = GetRegistry();
+		std::lock_guard sample_locker(registry.mSampleMutex);
+
+		// copy inventory under lock, then read clocks and /proc without it,
+		// so threads registering or exiting meanwhile are not blocked by file I/O.
+		struct ThreadSample {
+			std::shared_ptr<ThreadEntry> mEntry;
+			uint64_t mCpu, mSwitches;
+			bool mHasSwitches;
+		};
+		std::vector<ThreadSample> samples;
+		std::map<std::string, uint64_t> retired_cpu;
+		{
+			std::lock_guard locker(registry.mMutex);
+			samples.reserve(registry.mEntries.size());
+			for (auto& entry : registry.mEntries) samples.emplace_back(ThreadSample{ entry, 0u, 0u, false });
+			retired_cpu.swap(registry.mRetiredCpu);
+		}
+
+		size_t process_threads = 0u;
+#ifdef _WIN32
+		std::unordered_map<DWORD, uint64_t> switches;
+		ReadProcessSwitches(switches, process_threads);
+#else
+		process_threads = ReadProcessThreadCount();
+#endif // _WIN32
+		uint64_t now = CommonOpers::GetMonotonicTime();
+		uint64_t process_cpu = ReadProcessCpu();
+		for (auto& sample : samples) {
+			sample.mCpu = ReadThreadCpu(*sample.mEntry);
+#ifdef _WIN32
+			auto it = switches.find(sample.mEntry->mTid);
+			sample.mHasSwitches = it != switches.end();
+			if (sample.mHasSwitches) sample.mSwitches = it->second;
+#else
+			sample.mSwitches = ReadThreadSwitches(sample.mEntry->mTid);
+			sample.mHasSwitches = true;
+#endif // _WIN32
+		}
+
+		profile.mInterval = (now - registry.mLastSampleTime) / 1000000000.0;
+		double interval = std::max(profile.mInterval, 0.001);
+		auto to_percent = [interval](uint64_t cpu) -> double { return cpu / 1000000000.0 / interval * 100.0; };
+
+		std::map<std::string, ThreadRoleProfile> roles;
+		auto get_role = [&roles](const std::string& role) -> ThreadRoleProfile& {
+			auto [it, is_new] = roles.try_emplace(role, ThreadRoleProfile{ role, 0u, 0.0, 0.0, 0.0 });
+			return it->second;
+		};
+
+		// exited threads only have CPU time
+		uint64_t named_cpu = 0u;
+		for (auto& [role, cpu] : retired_cpu) {
+			get_role(role).mCpuPercent += to_percent(cpu);
+			named_cpu += cpu;
+		}
+
+		// store deltas back, unless thread exited meanwhile.
+		{
+			std::lock_guard locker(registry.mMutex);
+			for (auto& sample : samples) {
+				ThreadEntry& entry = *sample.mEntry;
+				// exited while reading. its CPU time is retired already, and reported next time.
+				if (entry.mIsExited) continue;
+
+				uint64_t cpu_delta = sample.mCpu > entry.mLastCpu ? sample.mCpu - entry.mLastCpu : 0u;
+				entry.mLastCpu = sample.mCpu;
+				named_cpu += cpu_delta;
+
+				uint64_t thread_switches = sample.mHasSwitches ? sample.mSwitches : entry.mLastSwitches;
+				uint64_t switch_delta = thread_switches > entry.mLastSwitches ? thread_switches - entry.mLastSwitches : 0u;
+				entry.mLastSwitches = thread_switches;
+
+				ThreadProfile thread{ entry.mName, to_percent(cpu_delta), switch_delta / interval };
+				ThreadRoleProfile& role = get_role(entry.mRole);
+				++role.mThreads;
+				role.mCpuPercent += thread.mCpuPercent;
+				role.mCpuPercentMax = std::max(role.mCpuPercentMax, thread.mCpuPercent);
+				role.mWakeupsPerSec += thread.mWakeupsPerSec;
+				profile.mBusiest.emplace_back(std::move(thread));
+				++profile.mNamedThreads;
+			}
+		}
+		profile.mUnnamedThreads = process_threads > profile.mNamedThreads ? process_threads - profile.mNamedThreads : 0u;
+		uint64_t process_delta = process_cpu > registry.mLastProcessCpu ? process_cpu - registry.mLastProcessCpu : 0u;
+		profile.mUnnamedCpuPercent = to_percent(process_delta > named_cpu ? process_delta - named_cpu : 0u);
+		registry.mLastSampleTime = now;
+		registry.mLastProcessCpu = process_cpu;
+
+		// sort roles and threads by CPU usage
+		for (auto& [name, role] : roles) profile.mRoles.emplace_back(std::move(role));
+		std::sort(profile.mRoles.begin(), profile.mRoles.end(), [](const ThreadRoleProfile& lhs, const ThreadRoleProfile& rhs) -> bool {
+			return lhs.mCpuPercent > rhs.mCpuPercent;
+		});
+		std::sort(profile.mBusiest.begin(), profile.mBusiest.end(), [](const ThreadProfile& lhs, const ThreadProfile& rhs) -> bool {
+			return lhs.mCpuPercent > rhs.mCpuPercent;
+		});
+		if (profile.mBusiest.size() > THREAD_BUSIEST_COUNT) profile.mBusiest.resize(THREAD_BUSIEST_COUNT);
+		return profile;
+	}
+
+}
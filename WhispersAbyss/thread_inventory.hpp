@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace WhispersAbyss {
+
+	/*
+	ThreadInventory names every thread created by WhispersAbyss and accounts its CPU time.
+
+	Each thread calls ThreadInventory::Register() once it starts. The name is role plus index, like "tcp-recv#12",
+	and it is also given to OS (shown by debuggers and top -H) and to Tracer.
+	Threads stay in inventory until they exit. CPU time of exited threads is still counted into their role.
+
+	Like Tracer, it is process-wide and only has static functions, because threads do not belong to any Factory or Instance.
+	Threads not created by us, such as GNS service thread and asio internal threads, are counted together as unnamed.
+
+	Wakeups are estimated by context switches: voluntary ones on Linux, all of them on Windows.
+	They are only counted for threads alive when sampling.
+	*/
+
+	struct ThreadRoleProfile {
+		std::string mRole;
+		size_t mThreads;	// alive threads
+		double mCpuPercent;	// of one core, including threads exited in this interval
+		double mCpuPercentMax;	// the busiest alive thread
+		double mWakeupsPerSec;
+	};
+	struct ThreadProfile {
+		std::string mName;
+		double mCpuPercent;
+		double mWakeupsPerSec;
+	};
+	struct ThreadInventoryProfile {
+		double mInterval;	// seconds since last sample
+		std::vector<ThreadRoleProfile> mRoles;	// the busiest role first
+		std::vector<ThreadProfile> mBusiest;	// the busiest threads first, at most THREAD_BUSIEST_COUNT
+		size_t mNamedThreads, mUnnamedThreads;
+		double mUnnamedCpuPercent;
+	};
+	struct ThreadCountProfile {
+		std::vector<std::pair<std::string, size_t>> mRoles;	// alive threads by role, ordered by role
+		size_t mUnnamedThreads;
+	};
+
+	class ThreadInventory {
+	public:
+		/// <summary>
+		/// Name current thread and account it until it exits. Calling it again renames current thread.
+		/// </summary>
+		/// <param name="role">Must be a string literal or other static string.</param>
+		/// <param name="index">Appended to name if it is not NO_INDEX.</param>
+		static void Register(const char* role, uint64_t index);
+		/// <summary>
+		/// Sample CPU time and wakeups of every thread since last sample,
+		/// or since thread registered or process started for the first sample.
+		/// </summary>
+		static ThreadInventoryProfile Sample();
+		/// <summary>
+		/// Count alive threads by role, and the threads of process not in inventory.
+		/// Unlike Sample(), it does not touch the baseline of next sample, so it can be called at any time.
+		/// </summary>
+		static ThreadCountProfile Count();
+	};
+
+}
@@ -0,0 +1,175 @@
+#include "tracer.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace WhispersAbyss {
+
+	struct TraceEvent {
+		uint64_t mTime;	// in nanoseconds. from CommonOpers::GetMonotonicTime()
+		uint64_t mDuration;	// in nanoseconds. only for complete event.
+		IndexDistributor::Index_t mIndex;
+		uint64_t mValue;
+		const char* mCategory;
+		const char* mName;
+		char mPhase;	// 'i' for instant, 'X' for complete.
+	};
+
+	/// <summary>
+	/// <para>The ring buffer of a thread. Only written by its thread.
+	/// It grows until TRACE_BUFFER_CAPACITY then overwrites the oldest events.</para>
+	/// <para>The mutex is only contended when dumping.</para>
+	/// </summary>
+	struct TraceThreadBuffer {
+		std::mutex mMutex;
+		uint32_t mTid;
+		std::string mName;
+		std::vector<TraceEvent> mEvents;
+		size_t mNext;
+		bool mIsWrapped;
+	};
+
+	std::atomic_bool Tracer::sIsEnabled(false);
+
+	/// <summary>
+	/// All buffers. Buffers of exited threads are kept so their events can still be dumped,
+	/// but only the newest TRACE_RETIRED_BUFFER_COUNT of them.
+	/// </summary>
+	static std::mutex gBuffersMutex;
+	static std::deque<std::shared_ptr<TraceThreadBuffer>> gBuffers;
+	static uint32_t gNextTid = 1u;
+	thread_local std::shared_ptr<TraceThreadBuffer> tBuffer;
+
+	static TraceThreadBuffer* GetThreadBuffer() {
+		if (tBuffer == nullptr) {
+			auto buffer = std::make_shared<TraceThreadBuffer>();
+			buffer->mName = "Thread";
+			buffer->mNext = 0u;
+			buffer->mIsWrapped = false;
+
+			std::lock_guard locker(gBuffersMutex);
+			buffer->mTid = gNextTid++;
+			gBuffers.emplace_back(buffer);
+			tBuffer = std::move(buffer);
+
+			// drop the oldest buffers of exited threads. only registry hold them.
+			size_t retired = static_cast<size_t>(std::count_if(gBuffers.begin(), gBuffers.end(),
+				[](const std::shared_ptr<TraceThreadBuffer>& ptr) -> bool { return ptr.use_count() == 1; }));
+			for (auto it = gBuffers.begin(); retired > TRACE_RETIRED_BUFFER_COUNT && it != gBuffers.end();) {
+				if (it->use_count() == 1) {
+					it = gBuffers.erase(it);
+					--retired;
+				} else ++it;
+			}
+		}
+		return tBuffer.get();
+	}
+
+	static void PushEvent(const TraceEvent& e) {
+		TraceThreadBuffer* buffer = GetThreadBuffer();
+		std::lock_guard locker(buffer->mMutex);
+		if (buffer->mIsWrapped) buffer->mEvents[buffer->mNext] = e;
+		else buffer->mEvents.emplace_back(e);
+		if (++buffer->mNext >= TRACE_BUFFER_CAPACITY) {
+			buffer->mNext = 0u;
+			buffer->mIsWrapped = true;
+		}
+	}
+
+	void Tracer::Enable() {
+		sIsEnabled.store(true, std::memory_order_relaxed);
+	}
+
+	void Tracer::SetThreadName(const char* name, IndexDistributor::Index_t index) {
+		if (!IsEnabled()) return;
+
+		TraceThreadBuffer* buffer = GetThreadBuffer();
+		std::lock_guard locker(buffer->mMutex);
+		buffer->mName = name;
+		if (index != NO_INDEX) CommonOpers::AppendStrF(buffer->mName, "#%" PRIu64, index);
+	}
+
+	void Tracer::Instant(const char* category, const char* name, IndexDistributor::Index_t index, uint64_t value) {
+		if (!IsEnabled()) return;
+		PushEvent(TraceEvent{ CommonOpers::GetMonotonicTime(), 0u, index, value, category, name, 'i' });
+	}
+
+	void Tracer::Complete(const char* category, const char* name, IndexDistributor::Index_t index, uint64_t start_time, uint64_t value) {
+		if (!IsEnabled()) return;
+		uint64_t now = CommonOpers::GetMonotonicTime();
+		PushEvent(TraceEvent{ start_time, now > start_time ? now - start_time : 0u, index, value, category, name, 'X' });
+	}
+
+	bool Tracer::Dump(const char* path) {
+		if (!IsEnabled()) return false;
+
+		// copy buffer list first, then copy events of each buffer.
+		// do not format under locks, so recording threads are only blocked by copying.
+		std::deque<std::shared_ptr<TraceThreadBuffer>> buffers;
+		{
+			std::lock_guard locker(gBuffersMutex);
+			buffers = gBuffers;
+		}
+
+		FILE* fs = fopen(path, "w");
+		if (fs == nullptr) return false;
+
+		std::string buf;
+		std::vector<TraceEvent> events;
+		std::string thread_name;
+		bool is_first = true;
+		auto append_separator = [&buf, &is_first]() -> void {
+			if (is_first) is_first = false;
+			else buf.append(",\n");
+		};
+
+		buf.append("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+		for (auto& buffer : buffers) {
+			// copy events in time order
+			uint32_t tid;
+			{
+				std::lock_guard locker(buffer->mMutex);
+				tid = buffer->mTid;
+				thread_name = buffer->mName;
+				events.clear();
+				if (buffer->mIsWrapped) {
+					events.insert(events.end(), buffer->mEvents.begin() + buffer->mNext, buffer->mEvents.end());
+				}
+				events.insert(events.end(), buffer->mEvents.begin(), buffer->mEvents.begin() + buffer->mNext);
+			}
+
+			append_separator();
+			CommonOpers::AppendStrF(buf, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%" PRIu32 ",\"args\":{\"name\":\"%s\"}}",
+				tid, thread_name.c_str());
+
+			for (auto& e : events) {
+				append_separator();
+				// timestamps are in microseconds
+				CommonOpers::AppendStrF(buf, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%" PRIu32 ",\"ts\":%" PRIu64 ".%03" PRIu64,
+					e.mName, e.mCategory, e.mPhase, tid, e.mTime / 1000u, e.mTime % 1000u);
+				if (e.mPhase == 'X') {
+					CommonOpers::AppendStrF(buf, ",\"dur\":%" PRIu64 ".%03" PRIu64, e.mDuration / 1000u, e.mDuration % 1000u);
+				} else {
+					buf.append(",\"s\":\"t\"");
+				}
+				CommonOpers::AppendStrF(buf, ",\"args\":{\"index\":%" PRIu64, e.mIndex);
+				if (e.mValue != 0u) CommonOpers::AppendStrF(buf, ",\"count\":%" PRIu64, e.mValue);
+				buf.append("}}");
+			}
+
+			// write in chunks to limit memory
+			fwrite(buf.data(), sizeof(char), buf.size(), fs);
+			buf.clear();
+		}
+		buf.append("\n]}\n");
+		fwrite(buf.data(), sizeof(char), buf.size(), fs);
+
+		bool is_success = ferror(fs) == 0;
+		fclose(fs);
+		return is_success;
+	}
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "others_helper.hpp"
+#include <atomic>
+#include <string>
+
+namespace WhispersAbyss {
+
+	/*
+	Tracer records compact events into per-thread ring buffers and dump them as Chrome trace JSON,
+	which can be loaded by Perfetto (ui.perfetto.dev) or chrome://tracing.
+
+	Unlike other modules, Tracer is process-wide and only has static functions,
+	because its buffers belong to threads, not to any Factory or Instance.
+	Every function is a no-op costing one relaxed load before Tracer::Enable() is called.
+
+	Category and name of events must be string literals (or other static strings),
+	because only their pointers are recorded.
+	*/
+
+	class Tracer {
+	public:
+		/// <summary>
+		/// Start recording. Can not be disabled once enabled.
+		/// </summary>
+		static void Enable();
+		static bool IsEnabled() { return sIsEnabled.load(std::memory_order_relaxed); }
+
+		/// <summary>
+		/// Name current thread in trace. Index is appended to name if it is not NO_INDEX.
+		/// </summary>
+		static void SetThreadName(const char* name, IndexDistributor::Index_t index);
+		/// <summary>
+		/// Record a point in time.
+		/// </summary>
+		/// <param name="value">Extra number shown as "count" in trace, such as message count of a handoff. 0 mean no value.</param>
+		static void Instant(const char* category, const char* name, IndexDistributor::Index_t index, uint64_t value = 0u);
+		/// <summary>
+		/// Record a span ending now.
+		/// </summary>
+		/// <param name="start_time">The start time got from CommonOpers::GetMonotonicTime().</param>
+		static void Complete(const char* category, const char* name, IndexDistributor::Index_t index, uint64_t start_time, uint64_t value = 0u);
+
+		/// <summary>
+		/// Write events of all threads into given file. Can be called at any time.
+		/// </summary>
+		/// <returns>True if success.</returns>
+		static bool Dump(const char* path);
+
+	private:
+		static std::atomic_bool sIsEnabled;
+	};
+
+}
@@ -0,0 +1,153 @@
+#include "traffic_capture.hpp"
+#include "tracer.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace WhispersAbyss {
+
+	TrafficCapture::TrafficCapture(OutputHelper* output) :
+		mOutput(output), mFile(nullptr), mStartTime(0u),
+		mBufferMutex("capture_buffer"), mBuffer(), mBufferRecords(0u),
+		mRecords(0u), mBytes(0u), mDroppedRecords(0u), mFailedRecords(0u), mFailedBytes(0u), mWriteTimeTotal(0u), mWriteTimeMax(0u),
+		mTdWriter()
+	{}
+
+	TrafficCapture::~TrafficCapture() {
+		Close();
+	}
+
+	bool TrafficCapture::Open(const std::string& path) {
+		if (mFile != nullptr) return true;
+
+		FILE* fs = fopen(path.c_str(), "wb");
+		if (fs == nullptr) {
+			mOutput->Printf("Fail to create capture file: %s", path.c_str());
+			return false;
+		}
+		CaptureFileHeader header{
+			CAPTURE_FILE_MAGIC,
+			CAPTURE_FILE_VERSION,
+			static_cast<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count())
+		};
+		if (fwrite(&header, sizeof(CaptureFileHeader), 1u, fs) != 1u) {
+			mOutput->Printf("Fail to write capture file header: %s", path.c_str());
+			fclose(fs);
+			return false;
+		}
+
+		mStartTime = CommonOpers::GetMonotonicTime();
+		mFile = fs;
+		mTdWriter = std::jthread(std::bind(&TrafficCapture::WriterWorker, this, std::placeholders::_1));
+		mOutput->Printf("Capturing traffic into %s.", path.c_str());
+		return true;
+	}
+
+	void TrafficCapture::Close() {
+		if (mFile == nullptr) return;
+
+		// writer will write all remaining records before exiting
+		if (mTdWriter.joinable()) {
+			mTdWriter.request_stop();
+			mTdWriter.join();
+		}
+		fclose(mFile);
+		mFile = nullptr;
+	}
+
+	void TrafficCapture::Record(IndexDistributor::Index_t index, CaptureDirection direction, const std::deque<CommonMessage>& msg_list, size_t from) {
+		if (from >= msg_list.size()) return;
+
+		// compute size first, so that a batch is appended or dropped as a whole.
+		size_t count = msg_list.size() - from, total = 0u;
+		for (size_t i = from; i < msg_list.size(); ++i) {
+			total += sizeof(CaptureRecordHeader) + msg_list[i].GetCommonDataLen();
+		}
+
+		CaptureRecordHeader header;
+		header.mBridgeIndex = index;
+		header.mDirection = static_cast<uint8_t>(direction);
+		header.mReserved = 0u;
+		{
+			std::lock_guard locker(mBufferMutex);
+			if (mBuffer.size() + total > CAPTURE_BUFFER_CAPACITY) {
+				mDroppedRecords.fetch_add(count, std::memory_order_relaxed);
+				return;
+			}
+
+			for (size_t i = from; i < msg_list.size(); ++i) {
+				const CommonMessage& msg = msg_list[i];
+				uint64_t ingress_time = msg.GetIngressTime();
+				header.mTimestamp = ingress_time > mStartTime ? ingress_time - mStartTime : 0u;
+				header.mLength = msg.GetCommonDataLen();
+				header.mIsReliable = msg.GetTcpIsReliable();
+				mBuffer.append(reinterpret_cast<const char*>(&header), sizeof(CaptureRecordHeader));
+				mBuffer.append(static_cast<const char*>(msg.GetCommonData()), msg.GetCommonDataLen());
+			}
+			mBufferRecords += count;
+		}
+
+		mRecords.fetch_add(count, std::memory_order_relaxed);
+		mBytes.fetch_add(total, std::memory_order_relaxed);
+	}
+
+	TrafficCaptureProfile TrafficCapture::ReportStatus() {
+		TrafficCaptureProfile profile;
+		profile.mRecords = mRecords.load();
+		profile.mBytes = mBytes.load();
+		profile.mDroppedRecords = mDroppedRecords.load();
+		profile.mFailedRecords = mFailedRecords.load();
+		profile.mFailedBytes = mFailedBytes.load();
+		profile.mWriteTimeTotal = mWriteTimeTotal.load();
+		profile.mWriteTimeMax = mWriteTimeMax.load();
+		return profile;
+	}
+
+	void TrafficCapture::WriterWorker(std::stop_token st) {
+		std::string batch;
+		size_t batch_records = 0u;
+		bool is_fail_logged = false;
+		ThreadInventory::Register("capture", NO_INDEX);
+
+		while (true) {
+			bool is_stopping = st.stop_requested();
+
+			// take all buffered records. the swapped-in string keep its capacity for next round.
+			{
+				std::lock_guard locker(mBufferMutex);
+				mBuffer.swap(batch);
+				batch_records = mBufferRecords;
+				mBufferRecords = 0u;
+			}
+
+			if (!batch.empty()) {
+				uint64_t write_start = CommonOpers::GetMonotonicTime();
+				size_t written = fwrite(batch.data(), sizeof(char), batch.size(), mFile);
+				bool is_failed = written != batch.size() || fflush(mFile) != 0;
+				uint64_t elapsed = CommonOpers::GetMonotonicTime() - write_start;
+				Tracer::Complete("capture", "write", NO_INDEX, write_start, batch.size());
+
+				// a partial record breaks the rest of file anyway, so the whole batch is counted as failed.
+				// only log the first failure, otherwise a full disk floods the log every round.
+				if (is_failed) {
+					mFailedRecords.fetch_add(batch_records, std::memory_order_relaxed);
+					mFailedBytes.fetch_add(batch.size(), std::memory_order_relaxed);
+					if (!is_fail_logged) {
+						mOutput->Printf("Fail to write capture file: %s. Later failures are only counted.", strerror(errno));
+						is_fail_logged = true;
+					}
+				}
+				batch.clear();
+
+				mWriteTimeTotal.fetch_add(elapsed, std::memory_order_relaxed);
+				uint64_t prev_max = mWriteTimeMax.load(std::memory_order_relaxed);
+				while (elapsed > prev_max && !mWriteTimeMax.compare_exchange_weak(prev_max, elapsed, std::memory_order_relaxed)) {}
+			}
+
+			// quit after the last round, or sleep.
+			if (is_stopping) return;
+			std::this_thread::sleep_for(CAPTURE_FLUSH_INTERVAL);
+		}
+	}
+
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "others_helper.hpp"
+#include "capture_layout.hpp"
+#include "messages.hpp"
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace WhispersAbyss {
+
+	struct TrafficCaptureProfile {
+		uint64_t mRecords, mBytes, mDroppedRecords;
+		/// <summary>
+		/// Records and bytes which were buffered but failed to be written into file, like disk full.
+		/// </summary>
+		uint64_t mFailedRecords, mFailedBytes;
+		/// <summary>
+		/// The time spent in writing file, in nanoseconds.
+		/// </summary>
+		uint64_t mWriteTimeTotal, mWriteTimeMax;
+	};
+
+	/// <summary>
+	/// <para>The writer of traffic capture file. Owned by BridgeFactory. See capture_layout.hpp for the file format.</para>
+	/// <para>Bridges only copy records into a memory buffer. A writer thread swaps the buffer out and writes it into file,
+	/// so bridges never wait for disk. If disk can not keep up, records are dropped rather than blocking bridges.</para>
+	/// </summary>
+	class TrafficCapture {
+	public:
+		TrafficCapture(OutputHelper* output);
+		TrafficCapture(const TrafficCapture& rhs) = delete;
+		TrafficCapture(TrafficCapture&& rhs) = delete;
+		~TrafficCapture();
+
+		/// <summary>
+		/// Create capture file and start writer.
+		/// </summary>
+		/// <returns>True if success. Capture is not usable if failed.</returns>
+		bool Open(const std::string& path);
+		/// <summary>
+		/// Write all buffered records and close file. Caller should make sure no bridge records anymore.
+		/// </summary>
+		void Close();
+		bool IsOpened() { return mFile != nullptr; }
+
+		/// <summary>
+		/// Append messages from given position of list as records of given bridge.
+		/// </summary>
+		void Record(IndexDistributor::Index_t index, CaptureDirection direction, const std::deque<CommonMessage>& msg_list, size_t from);
+		TrafficCaptureProfile ReportStatus();
+	private:
+		void WriterWorker(std::stop_token st);
+
+		OutputHelper* mOutput;
+		FILE* mFile;
+		/// <summary>
+		/// The monotonic time when capture started. Record timestamps are relative to it.
+		/// </summary>
+		uint64_t mStartTime;
+
+		/// <summary>
+		/// Records waiting for writer. Protected by mBufferMutex.
+		/// </summary>
+		AbyssMutex mBufferMutex;
+		std::string mBuffer;
+		size_t mBufferRecords;
+
+		std::atomic_uint64_t mRecords, mBytes, mDroppedRecords, mFailedRecords, mFailedBytes, mWriteTimeTotal, mWriteTimeMax;
+		std::jthread mTdWriter;
+	};
+
+}